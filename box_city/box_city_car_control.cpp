@@ -11,6 +11,7 @@
 CONTROL_VARIABLE_BOOL(c_car_ai_avoidance_enable, true, "Car AI", "Car AI avoidance enabled");
 CONTROL_VARIABLE_BOOL(c_car_ai_targeting_enable, true, "Car AI", "Car AI targeting enabled");
 CONTROL_VARIABLE_BOOL(c_car_collision_enable, true, "Car Collision", "Car collision enabled");
+CONTROL_VARIABLE_BOOL(c_car_collision_cars_enable, true, "Car Collision", "Collision between cars enabled, uses the cars grid");
 
 //Pitch input
 CONTROL_VARIABLE(float, c_car_Y_range, 0.f, 1.f, 1.0f, "Car Control", "Y Range");
@@ -296,6 +297,29 @@ namespace BoxCityCarControl
 						}
 					}
 				);
+
+				//The building hit in front of the car needs to be avoided even if it is not one of the closest ones
+				InstanceReference front_building;
+				float front_t;
+				if (glm::all(glm::isfinite(car_direction)) && tile_manager->CalculateClosestBuildingHit(helpers::Ray(car_position, car_direction, c_car_ai_visibility_distance), front_building, front_t))
+				{
+					OBBBox& avoid_box = front_building.Get<GameDatabase>().Get<OBBBox>();
+
+					bool cached = false;
+					for (auto& building : car_buildings_cache.buildings)
+					{
+						cached |= (building.size > 0.f && building.position == avoid_box.position);
+					}
+
+					if (!cached)
+					{
+						//Replace the furthest cached building
+						auto& building = car_buildings_cache.buildings[CarBuildingsCache::kNumCachedBuildings - 1];
+						building.position = avoid_box.position;
+						building.extent = glm::row(avoid_box.rotation, 2) * (avoid_box.extents.z);
+						building.size = glm::fastLength(glm::vec2(avoid_box.extents.x, avoid_box.extents.y));
+					}
+				}
 			}
 
 			//Calculate avoidance with the cached buildings
@@ -506,48 +530,36 @@ namespace BoxCityCarControl
 		assert(glm::all(glm::isfinite(linear_forces)));
 		assert(glm::all(glm::isfinite(angular_forces)));
 	}
-	void CalculateCollisionForces(BoxCityTileSystem::Manager* manager, const float elapsed_time, const glm::vec3& camera_pos, OBBBox& obb, glm::vec3& linear_forces, glm::vec3& angular_forces, CarMovement& car_movement, CarSettings& car_settings, glm::vec3& position_offset)
+	void CalculateCollisionForces(BoxCityTileSystem::Manager* manager, const BoxCityTrafficSystem::Manager* traffic_manager, uint32_t cars_grid_index, const float elapsed_time, const glm::vec3& camera_pos, OBBBox& obb, glm::vec3& linear_forces, glm::vec3& angular_forces, CarMovement& car_movement, CarSettings& car_settings, glm::vec3& position_offset)
 	{
 		if (c_car_collision_enable && glm::distance2(obb.position, camera_pos) < c_car_ai_avoidance_calculation_distance * c_car_ai_avoidance_calculation_distance)
 		{
 			helpers::AABB aabb;
 			helpers::CalculateAABBFromOBB(aabb, obb);
 
-			manager->VisitBuildings(aabb, [&](const InstanceReference& building)
+			//Contacts and response with a box that passed the separating axis test
+			//The car solves the part of the penetration given by depth_factor
+			auto collide_box = [&](const helpers::OBB& box, const glm::vec3& box_velocity, const float depth_factor)
 				{
-					assert(building.IsValid());
-					assert(building.Get<GameDatabase>().Is<BoxType>() || building.Get<GameDatabase>().Is<AnimatedBoxType>());
-
-					const OBBBox& building_box = building.Get<GameDatabase>().Get<OBBBox>();
-
 					helpers::CollisionReturn collision_return;
-					if (helpers::CollisionFeaturesOBBvsOBB(obb, building_box, collision_return))
-					{	
-						//Calculate the speed of the building, it is only linear
-						glm::vec3 building_velocity = glm::vec3(0.f, 0.f, 0.f);
-						if (building.Get<GameDatabase>().Is<AnimatedBoxType>())
-						{
-							platform::Interpolated<glm::vec3> position = building.Get<GameDatabase>().Get<InterpolatedPosition>().position;
-
-							building_velocity = (*position - position.Last()) * elapsed_time;
-						}
-			
-
+					if (helpers::CollisionFeaturesOBBvsOBB(obb, box, collision_return))
+					{
 						//Bounce
-						for (auto& contact : collision_return.contacts)
+						for (uint32_t contact_index = 0; contact_index < collision_return.num_contacts; ++contact_index)
 						{	
+							const helpers::CollisionContact& contact = collision_return.contacts[contact_index];
 							glm::vec3 contact_vector = contact.position - obb.position;
 
 							if (glm::length2(contact_vector) > 0.f)
 							{
 								//Calculate bounce back force in the contact point from velocity
-								glm::vec3 contact_force = -building_velocity + car_movement.linear_velocity + glm::cross(car_movement.rotation_velocity, contact_vector);
+								glm::vec3 contact_force = -box_velocity + car_movement.linear_velocity + glm::cross(car_movement.rotation_velocity, contact_vector);
 								if (glm::dot(contact_force, contact.normal) < 0.f)
 								{
 									glm::vec3 bounce_back_force = -(1.f + c_car_collision_lost) * glm::dot(contact_force, contact.normal) * contact.normal;
 									bounce_back_force /= (car_settings.inv_mass + glm::dot(contact.normal, glm::cross(glm::cross(contact_vector, contact.normal) * car_settings.inv_mass_inertia, contact_vector)));
 
-									bounce_back_force *= (1.f / static_cast<float>(collision_return.contacts.size()));
+									bounce_back_force *= (1.f / static_cast<float>(collision_return.num_contacts));
 
 									//Apply the bounce back force to the linear and angular velocity
 									car_movement.linear_velocity += bounce_back_force * car_settings.inv_mass;
@@ -558,7 +570,7 @@ namespace BoxCityCarControl
 									glm::vec3 contact_velocity_tangent = contact_force - glm::dot(contact_force, contact.normal) * contact.normal;
 									//float friction_factor = glm::dot(contact_velocity_tangent, contact_force);
 
-									//friction_factor *= (1.f / static_cast<float>(collision_return.contacts.size()));
+									//friction_factor *= (1.f / static_cast<float>(collision_return.num_contacts));
 
 									//Really simple friction
 									glm::vec3 friction_force = -contact_velocity_tangent * 0.25f; //sticky
@@ -572,11 +584,86 @@ namespace BoxCityCarControl
 						}
 						
 						//Readjust position
-						position_offset -= collision_return.normal * collision_return.depth;
+						position_offset -= collision_return.normal * (collision_return.depth * depth_factor);
 
 						COUNTER_INC(c_Car_Collisions);
 					}
+				};
+
+			auto collide_building = [&](const InstanceReference& building)
+				{
+					//Calculate the speed of the building, it is only linear
+					glm::vec3 building_velocity = glm::vec3(0.f, 0.f, 0.f);
+					if (building.Get<GameDatabase>().Is<AnimatedBoxType>())
+					{
+						platform::Interpolated<glm::vec3> position = building.Get<GameDatabase>().Get<InterpolatedPosition>().position;
+
+						building_velocity = (*position - position.Last()) * elapsed_time;
+					}
+
+					collide_box(building.Get<GameDatabase>().Get<OBBBox>(), building_velocity, 1.f);
+				};
+
+			//Collect the buildings around the car and test them in batches, most of them are rejected by the separating axis test
+			constexpr uint32_t kMaxBatchBuildings = 32;
+			InstanceReference batch_buildings[kMaxBatchBuildings];
+			float batch_center[3][kMaxBatchBuildings];
+			float batch_extents[3][kMaxBatchBuildings];
+			float batch_rotation[3][3][kMaxBatchBuildings];
+			uint32_t batch_count = 0;
+
+			auto flush_batch = [&]()
+				{
+					helpers::OBBSoA batch_boxes;
+					for (uint32_t i = 0; i < 3; ++i)
+					{
+						batch_boxes.center[i] = batch_center[i];
+						batch_boxes.extents[i] = batch_extents[i];
+						for (uint32_t j = 0; j < 3; ++j) batch_boxes.rotation[i][j] = batch_rotation[i][j];
+					}
+
+					uint32_t collision_mask[(kMaxBatchBuildings + 31) / 32];
+					helpers::CollisionOBBVsOBBs(obb, batch_boxes, batch_count, collision_mask);
+					for (uint32_t i = 0; i < batch_count; ++i)
+					{
+						if ((collision_mask[i / 32] >> (i % 32)) & 1)
+						{
+							collide_building(batch_buildings[i]);
+						}
+					}
+					batch_count = 0;
+				};
+
+			manager->VisitBuildings(aabb, [&](const InstanceReference& building)
+				{
+					assert(building.IsValid());
+					assert(building.Get<GameDatabase>().Is<BoxType>() || building.Get<GameDatabase>().Is<AnimatedBoxType>());
+
+					const OBBBox& building_box = building.Get<GameDatabase>().Get<OBBBox>();
+
+					batch_buildings[batch_count] = building;
+					for (glm::length_t i = 0; i < 3; ++i)
+					{
+						batch_center[i][batch_count] = building_box.position[i];
+						batch_extents[i][batch_count] = building_box.extents[i];
+						for (glm::length_t j = 0; j < 3; ++j) batch_rotation[i][j][batch_count] = glm::row(building_box.rotation, i)[j];
+					}
+					if (++batch_count == kMaxBatchBuildings) flush_batch();
 				});
+			if (batch_count > 0) flush_batch();
+
+			//Other cars, from the copies in the cars grid taken before any car moved in this update
+			//Both cars of a pair collide with each other, so each one solves half of the penetration
+			if (c_car_collision_cars_enable && traffic_manager && cars_grid_index != BoxCityTrafficSystem::Manager::kInvalidCarsGridIndex)
+			{
+				traffic_manager->VisitCars(aabb, [&](const uint32_t car_index, const BoxCityTrafficSystem::Manager::CarsGridCar& other_car)
+					{
+						if (car_index != cars_grid_index && helpers::CollisionOBBVsOBB(obb, other_car.obb))
+						{
+							collide_box(other_car.obb, other_car.linear_velocity, 0.5f);
+						}
+					});
+			}
 		}
 	}
 	void IntegrateCar(Car& car, CarMovement& car_movement, const CarSettings& car_settings, const glm::vec3& linear_forces, const glm::vec3& angular_forces, const glm::vec3& position_offset, float elapsed_time)
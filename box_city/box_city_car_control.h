@@ -42,8 +42,8 @@ namespace BoxCityCarControl
 	//Calculate car forces from the control system
 	void CalculateControlForces(Car& car, CarMovement& car_movement, CarSettings& car_settings, CarControl& car_control, float elapsed_time, glm::vec3& linear_forces, glm::vec3& angular_forces);
 
-	//Calculate car forces from collision
-	void CalculateCollisionForces(BoxCityTileSystem::Manager* manager, const float elapsed_time, const glm::vec3& camera_pos, OBBBox& obb, glm::vec3& linear_forces, glm::vec3& angular_forces, CarMovement& car_movement, CarSettings& car_settings, glm::vec3& position_offset);
+	//Calculate car forces from collision with the buildings and the other cars in the cars grid
+	void CalculateCollisionForces(BoxCityTileSystem::Manager* manager, const BoxCityTrafficSystem::Manager* traffic_manager, uint32_t cars_grid_index, const float elapsed_time, const glm::vec3& camera_pos, OBBBox& obb, glm::vec3& linear_forces, glm::vec3& angular_forces, CarMovement& car_movement, CarSettings& car_settings, glm::vec3& position_offset);
 	
 	//Integrate forces
 	void IntegrateCar(Car& car, CarMovement& car_movement, const CarSettings& car_settings, const glm::vec3& linear_forces, const glm::vec3& angular_forces, const glm::vec3& position_offset, float elapsed_time);
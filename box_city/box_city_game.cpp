@@ -1,6 +1,10 @@
 #include "box_city_game.h"
 #include <core/counters.h>
+#include <core/log.h>
 #include <render/render_debug_primitives.h>
+#include <helpers/bvh.h>
+#include <chrono>
+#include <numeric>
 
 PROFILE_DEFINE_MARKER(g_profile_marker_UpdatePosition, "Main", 0xFFFFAAAA, "BoxUpdate");
 PROFILE_DEFINE_MARKER(g_profile_marker_Culling, "Main", 0xFFFFAAAA, "BoxInterpolating");
@@ -10,6 +14,265 @@ COUNTER(c_InstancesLists_Summitted, "Box City", "InstancesLists summitted to GPU
 COUNTER(c_Car_Interpolated, "Box City", "Car interpolated for render", true);
 COUNTER(c_Building_Interpolated, "Box City", "Buildings interpolated for render", true);
 
+namespace
+{
+	constexpr size_t kBenchmarkBVHRepetitions = 16;
+
+	struct BenchmarkBVHSettings
+	{
+		const std::vector<helpers::AABB>& boxes;
+		using IndexType = uint32_t;
+		void SetLeafIndex(uint32_t, uint32_t) {}
+		helpers::AABB GetAABB(const uint32_t& index) { return boxes[index]; }
+
+		BenchmarkBVHSettings(const std::vector<helpers::AABB>& _boxes) : boxes(_boxes) {}
+	};
+
+	//Returns the average time in nanoseconds per query
+	template<typename FUNCTION>
+	double BenchmarkBVHQueries(size_t num_queries, FUNCTION&& function)
+	{
+		auto begin = std::chrono::high_resolution_clock::now();
+		for (size_t i = 0; i < kBenchmarkBVHRepetitions; ++i)
+		{
+			function();
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+
+		return std::chrono::duration<double, std::nano>(end - begin).count() / static_cast<double>(kBenchmarkBVHRepetitions * num_queries);
+	}
+
+	//Tiles with the size and the building distribution of box city, queried with car visibility boxes
+	void BenchmarkBVH(job::System* job_system)
+	{
+		using namespace BoxCityTileSystem;
+		constexpr uint32_t kNumQueries = 4096;
+
+		std::mt19937 random(1234);
+		std::uniform_real_distribution<float> position_range(0.f, kTileSize);
+		std::uniform_real_distribution<float> position_range_z(kTileHeightBottom, kTileHeightTop);
+		std::uniform_real_distribution<float> size_range(10.f, 35.f);
+		std::uniform_real_distribution<float> length_range(30.f, 200.f);
+
+		for (uint32_t num_boxes : {650, 2600, 20000})
+		{
+			std::vector<helpers::AABB> boxes(num_boxes);
+			helpers::AABB tile_bounds;
+			for (auto& box : boxes)
+			{
+				const glm::vec3 position(position_range(random), position_range(random), position_range_z(random));
+				const float size = size_range(random);
+				const glm::vec3 extents(size, size, length_range(random));
+				box.min = position - extents;
+				box.max = position + extents;
+				tile_bounds.Add(box);
+			}
+
+			//Car visibility boxes, as the car avoidance
+			std::vector<helpers::AABB> queries(kNumQueries);
+			for (auto& query : queries)
+			{
+				const glm::vec3 position(position_range(random), position_range(random), position_range_z(random));
+				query.min = position - glm::vec3(40.f, 20.f, 20.f);
+				query.max = position + glm::vec3(40.f, 20.f, 20.f);
+			}
+
+			std::vector<uint32_t> indexes(num_boxes);
+			std::iota(indexes.begin(), indexes.end(), 0);
+			BenchmarkBVHSettings settings(boxes);
+			helpers::LinearBVH<uint32_t, BenchmarkBVHSettings> bvh;
+
+			//Segments from random positions in random directions, sorted by the position as the cars
+			std::uniform_real_distribution<float> direction_range(-1.f, 1.f);
+			auto generate_probes = [&](float probe_length)
+			{
+				std::vector<helpers::Ray> probes(kNumQueries);
+				for (auto& probe : probes)
+				{
+					const glm::vec3 position(position_range(random), position_range(random), position_range_z(random));
+					const glm::vec3 direction = glm::normalize(glm::vec3(direction_range(random), direction_range(random), direction_range(random) * 0.2f));
+					probe = helpers::CalculateRayFromSegment(position, position + direction * probe_length);
+				}
+				std::sort(probes.begin(), probes.end(), [&](const helpers::Ray& a, const helpers::Ray& b)
+					{
+						return helpers::Morton((a.origin - tile_bounds.min) / (tile_bounds.max - tile_bounds.min)) <
+							helpers::Morton((b.origin - tile_bounds.min) / (tile_bounds.max - tile_bounds.min));
+					});
+				return probes;
+			};
+
+			//Build time in microseconds, in the calling thread and using the job system
+			auto benchmark_build = [&](job::System* build_job_system, helpers::BVHBuilder builder)
+			{
+				auto begin = std::chrono::high_resolution_clock::now();
+				for (size_t i = 0; i < kBenchmarkBVHRepetitions; ++i)
+				{
+					bvh.Build(&settings, indexes.data(), num_boxes, tile_bounds, build_job_system, builder);
+				}
+				auto end = std::chrono::high_resolution_clock::now();
+				return std::chrono::duration<double, std::micro>(end - begin).count() / static_cast<double>(kBenchmarkBVHRepetitions);
+			};
+
+			//Compare the builders, build time and nodes visited by the car visibility queries and the line of sight probes
+			const std::vector<helpers::Ray> line_of_sight_probes = generate_probes(400.f);
+			//Linear is the last one, the rest of the benchmark uses it
+			for (helpers::BVHBuilder builder : { helpers::BVHBuilder::BinnedSAH, helpers::BVHBuilder::Linear })
+			{
+				const double build_time = benchmark_build(nullptr, builder);
+				const double job_build_time = benchmark_build(job_system, builder);
+
+				size_t visited_nodes = 0;
+				const double query_time = BenchmarkBVHQueries(kNumQueries, [&]()
+					{
+						for (auto& query : queries) visited_nodes += bvh.Visit(query, [&](const uint32_t&) {});
+					});
+
+				size_t probe_visited_nodes = 0;
+				const double probe_time = BenchmarkBVHQueries(kNumQueries, [&]()
+					{
+						for (auto& probe : line_of_sight_probes)
+						{
+							float closest_t = probe.max_t;
+							probe_visited_nodes += bvh.VisitRay(probe, [&](const uint32_t& index, float) -> float
+								{
+									float t;
+									if (helpers::CollisionRayVsAABB(probe, boxes[index], t)) closest_t = std::min(closest_t, t);
+									return closest_t;
+								});
+						}
+					});
+
+				const double num_visits = static_cast<double>(kBenchmarkBVHRepetitions * kNumQueries);
+				core::LogInfo("BVH benchmark <%u> boxes, %s builder: build %.1fus, build with jobs %.1fus, %.1f nodes visited per query %.1fns, %.1f nodes visited per line of sight probe %.1fns",
+					num_boxes, (builder == helpers::BVHBuilder::Linear) ? "linear" : "binned SAH", build_time, job_build_time,
+					static_cast<double>(visited_nodes) / num_visits, query_time, static_cast<double>(probe_visited_nodes) / num_visits, probe_time);
+			}
+
+			//Refit after moving one of each ten boxes, as the animated buildings
+			auto benchmark_refit = [&](job::System* refit_job_system)
+			{
+				auto begin = std::chrono::high_resolution_clock::now();
+				for (size_t i = 0; i < kBenchmarkBVHRepetitions; ++i)
+				{
+					for (uint32_t leaf_index = 0; leaf_index < num_boxes; leaf_index += 10)
+					{
+						helpers::AABB moved_box = boxes[bvh.GetLeaf(leaf_index)];
+						moved_box.min.z += 1.f;
+						moved_box.max.z += 1.f;
+						bvh.UpdateLeaf(leaf_index, moved_box);
+					}
+					bvh.Refit(refit_job_system);
+				}
+				auto end = std::chrono::high_resolution_clock::now();
+				return std::chrono::duration<double, std::micro>(end - begin).count() / static_cast<double>(kBenchmarkBVHRepetitions);
+			};
+			const double refit_time = benchmark_refit(nullptr);
+			const double job_refit_time = benchmark_refit(job_system);
+			bvh.Build(&settings, indexes.data(), num_boxes, tile_bounds, job_system);
+
+			core::LogInfo("BVH benchmark <%u> boxes: refit 10%% %.1fus, refit 10%% with jobs %.1fus", num_boxes, refit_time, job_refit_time);
+
+			size_t binary_hits = 0;
+			const double binary_time = BenchmarkBVHQueries(kNumQueries, [&]()
+				{
+					for (auto& query : queries) bvh.VisitBinary(query, [&](const uint32_t&) { ++binary_hits; });
+				});
+
+			size_t wide_hits = 0;
+			const double wide_time = BenchmarkBVHQueries(kNumQueries, [&]()
+				{
+					for (auto& query : queries) bvh.Visit(query, [&](const uint32_t&) { ++wide_hits; });
+				});
+
+			size_t batch_hits = 0;
+			const double batch_time = BenchmarkBVHQueries(kNumQueries, [&]()
+				{
+					bvh.Visit(queries.data(), kNumQueries, [&](uint32_t, const uint32_t&) { ++batch_hits; });
+				});
+
+			//Batches only share nodes if the bounds are close, sort them as cars that are processed by zones
+			std::vector<helpers::AABB> sorted_queries = queries;
+			std::sort(sorted_queries.begin(), sorted_queries.end(), [&](const helpers::AABB& a, const helpers::AABB& b)
+				{
+					return helpers::Morton(((a.min + a.max) * 0.5f - tile_bounds.min) / (tile_bounds.max - tile_bounds.min)) <
+						helpers::Morton(((b.min + b.max) * 0.5f - tile_bounds.min) / (tile_bounds.max - tile_bounds.min));
+				});
+
+			size_t sorted_batch_hits = 0;
+			const double sorted_batch_time = BenchmarkBVHQueries(kNumQueries, [&]()
+				{
+					bvh.Visit(sorted_queries.data(), kNumQueries, [&](uint32_t, const uint32_t&) { ++sorted_batch_hits; });
+				});
+
+			if (binary_hits != wide_hits || binary_hits != batch_hits || binary_hits != sorted_batch_hits)
+			{
+				core::LogWarning("BVH benchmark <%u> boxes: traversals found different instances", num_boxes);
+			}
+
+			core::LogInfo("BVH benchmark <%u> boxes, %.1f hits per query: binary %.1fns, 4-wide SIMD %.1fns, 4-wide SIMD batched %.1fns, 4-wide SIMD batched sorted %.1fns per query",
+				num_boxes, static_cast<double>(wide_hits) / static_cast<double>(kBenchmarkBVHRepetitions * kNumQueries), binary_time, wide_time, batch_time, sorted_batch_time);
+
+			//Closest box hit by a segment, car look ahead and line of sight probes
+			for (float probe_length : {80.f, 400.f})
+			{
+				const std::vector<helpers::Ray> probes = generate_probes(probe_length);
+
+				//Previous approach, visit the boxes colliding with the bounds of the segment and test all of them
+				std::vector<float> box_closest_t(kNumQueries);
+				const double box_probe_time = BenchmarkBVHQueries(kNumQueries, [&]()
+					{
+						for (uint32_t i = 0; i < kNumQueries; ++i)
+						{
+							helpers::AABB probe_bounds;
+							probe_bounds.Add(probes[i].origin);
+							probe_bounds.Add(probes[i].origin + probes[i].direction);
+							box_closest_t[i] = FLT_MAX;
+							bvh.Visit(probe_bounds, [&](const uint32_t& index)
+								{
+									float t;
+									if (helpers::CollisionRayVsAABB(probes[i], boxes[index], t)) box_closest_t[i] = std::min(box_closest_t[i], t);
+								});
+						}
+					});
+
+				std::vector<float> closest_t(kNumQueries);
+				const double closest_probe_time = BenchmarkBVHQueries(kNumQueries, [&]()
+					{
+						for (uint32_t i = 0; i < kNumQueries; ++i)
+						{
+							uint32_t closest_index;
+							if (!bvh.ClosestHit(probes[i], [&](const uint32_t& index, float& t) { return helpers::CollisionRayVsAABB(probes[i], boxes[index], t); }, closest_index, closest_t[i]))
+							{
+								closest_t[i] = FLT_MAX;
+							}
+						}
+					});
+
+				std::vector<float> packet_closest_t(kNumQueries);
+				const double packet_probe_time = BenchmarkBVHQueries(kNumQueries, [&]()
+					{
+						std::fill(packet_closest_t.begin(), packet_closest_t.end(), FLT_MAX);
+						bvh.VisitRays(probes.data(), kNumQueries, [&](uint32_t ray_index, const uint32_t& index, float) -> float
+							{
+								float t;
+								if (helpers::CollisionRayVsAABB(probes[ray_index], boxes[index], t)) packet_closest_t[ray_index] = std::min(packet_closest_t[ray_index], t);
+								return std::min(packet_closest_t[ray_index], probes[ray_index].max_t);
+							});
+					});
+
+				if (box_closest_t != closest_t || box_closest_t != packet_closest_t)
+				{
+					core::LogWarning("BVH benchmark <%u> boxes: %.0fm probes found different closest hits", num_boxes, probe_length);
+				}
+
+				core::LogInfo("BVH benchmark <%u> boxes, %.0fm probes, %.2f hits per probe: visit segment bounds %.1fns, closest hit %.1fns, closest hit packets %.1fns per probe",
+					num_boxes, probe_length, static_cast<double>(std::count_if(closest_t.begin(), closest_t.end(), [](float t) { return t != FLT_MAX; })) / static_cast<double>(kNumQueries),
+					box_probe_time, closest_probe_time, packet_probe_time);
+			}
+		}
+	}
+}
+
 void BoxCityGame::OnInit()
 {
 	//Setup the tick to 60fps logic tick and render
@@ -107,6 +370,8 @@ void BoxCityGame::OnInit()
 	ecs::DatabaseDesc database_desc;
 	database_desc.num_max_entities_zone = 1024 * 1024;
 	database_desc.num_zones = m_tile_manager.GetNumTiles();
+	database_desc.large_pages = true;
+	database_desc.prefault_memory = true;
 	ecs::CreateDatabase<GameDatabase>(database_desc);
 
 	RegisterImguiDebugSystem("ECS stats"_sh32, [](bool* activated)
@@ -235,6 +500,9 @@ void BoxCityGame::OnLogic(double total_time, float elapsed_time)
 
 	job::Wait(m_job_system, update_fence);
 
+	//The animated buildings have moved, update the buildings BVH before the cars use it
+	m_tile_manager.RefitAnimatedBuildings();
+
 	//Update cars
 	job::Fence update_cars_fence;
 	m_traffic_system.UpdateCars(this, m_job_system, m_update_job_allocator.get(), *camera, update_cars_fence, &m_tile_manager, m_frame_index, elapsed_time);
@@ -451,6 +719,11 @@ void BoxCityGame::OnAddImguiMenu()
 		ImGui::SliderFloat("Fog Top Height", &m_fog_top_height, -1000.f, 1000.f);
 		ImGui::SliderFloat("Fog Bottom Height", &m_fog_bottom_height, -2000.f, 1000.f);
 
+		if (ImGui::MenuItem("Benchmark BVH"))
+		{
+			BenchmarkBVH(m_job_system);
+		}
+
 		ImGui::EndMenu();
 	}
 }
@@ -5,6 +5,7 @@
 #include <render/render.h>
 #include <render_module/render_module_gpu_memory.h>
 #include <core/counters.h>
+#include <core/control_variables.h>
 #include "box_city_descriptors.h"
 #include <numeric>
 
@@ -12,6 +13,9 @@ COUNTER(c_BuildingInstances_Count, "Box City", "Number of building instances", f
 COUNTER(c_Box_Count, "Box City", "Number of box between all the instances", false);
 COUNTER(c_Building_Summitted, "Box City", "Building summitted to the GPU", true);
 
+//The buildings BVH is built in the game thread when the tile changes to LOD 0, the SAH builder is around 10 times slower
+CONTROL_VARIABLE_BOOL(c_building_bvh_sah, false, "BoxCityTileManager", "Build the buildings BVH with the binned SAH builder");
+
 namespace
 {
 	bool CollisionPanelVsPanel(const glm::vec2& position_a, const glm::vec2& size_a, const glm::vec2& position_b, const glm::vec2& size_b)
@@ -308,7 +312,7 @@ namespace BoxCityTileSystem
 		std::vector<uint32_t> indexes(m_generated_boxes.size());
 		std::iota(indexes.begin(), indexes.end(), 0);
 		LinearBVHGeneratedBoxesSettings bvh_settings(m_generated_boxes);
-		m_generated_boxes_bvh.Build(&bvh_settings, indexes.data(), static_cast<uint32_t>(m_generated_boxes.size()), m_bounding_box);
+		m_generated_boxes_bvh.Build(&bvh_settings, indexes.data(), static_cast<uint32_t>(m_generated_boxes.size()), m_bounding_box, manager->GetJobSystem());
 
 		assert(m_state == State::Loaded || m_state == State::Unloaded || m_state == State::Loading);
 		SetState(State::Loaded);
@@ -513,14 +517,40 @@ namespace BoxCityTileSystem
 						}
 					}
 				}
-				m_building_bvh.Build(&settings, building_instances.data(), static_cast<uint32_t>(building_instances.size()), m_bounding_box);
+				m_building_bvh.Build(&settings, building_instances.data(), static_cast<uint32_t>(building_instances.size()), m_bounding_box, manager->GetJobSystem(),
+					c_building_bvh_sah ? helpers::BVHBuilder::BinnedSAH : helpers::BVHBuilder::Linear);
+
+				//The BVH is built with the range of the animation, the animated buildings are refitted each frame
+				m_animated_building_leafs.clear();
+				for (uint32_t leaf_index = 0; leaf_index < m_building_bvh.GetNumLeafs(); ++leaf_index)
+				{
+					if (m_building_bvh.GetLeaf(leaf_index).Get<GameDatabase>().Is<AnimatedBoxType>())
+					{
+						m_animated_building_leafs.push_back(leaf_index);
+					}
+				}
 			}
 			else
 			{
 				m_building_bvh.Clear();
+				m_animated_building_leafs.clear();
 			}
 		}
 	}
+
+	void Tile::RefitAnimatedBuildings(job::System* job_system)
+	{
+		if (!m_building_bvh.IsValid() || m_animated_building_leafs.empty()) return;
+
+		for (const uint32_t leaf_index : m_animated_building_leafs)
+		{
+			helpers::AABB aabb;
+			helpers::CalculateAABBFromOBB(aabb, m_building_bvh.GetLeaf(leaf_index).Get<GameDatabase>().Get<OBBBox>());
+			m_building_bvh.UpdateLeaf(leaf_index, aabb);
+		}
+
+		m_building_bvh.Refit(job_system);
+	}
 	void Tile::AppendVisibleInstanceLists(Manager* manager, std::vector<uint32_t>& instance_lists_offsets_array)
 	{
 		for (auto& lod_group : m_instances)
@@ -125,6 +125,9 @@ namespace BoxCityTileSystem
 		void DespawnTile(Manager* manager);
 		void LodTile(Manager* manager, uint32_t new_lod);
 
+		//Update the animated buildings in the buildings BVH, without rebuilding it
+		void RefitAnimatedBuildings(job::System* job_system);
+
 		void AppendVisibleInstanceLists(Manager* manager, std::vector<uint32_t>& instance_lists_offsets_array);
 
 		bool IsVisible() const { return m_state == State::Visible;}
@@ -202,6 +205,8 @@ namespace BoxCityTileSystem
 
 		//LBVH for building instances
 		helpers::LinearBVH<InstanceReference, LinearBVHBuildingSettings> m_building_bvh;
+		//Leafs of the animated buildings in the BVH
+		std::vector<uint32_t> m_animated_building_leafs;
 
 		//Each tile has 16 target positions
 		struct Target
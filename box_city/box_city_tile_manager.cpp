@@ -9,6 +9,7 @@
 #include <job/job.h>
 
 CONTROL_VARIABLE_BOOL(c_use_loading_thread, true, "BoxCityTileManager", "Use loading thread for loading");
+CONTROL_VARIABLE_BOOL(c_refit_animated_buildings, true, "BoxCityTileManager", "Refit the buildings BVH with the animated buildings");
 
 namespace
 {
@@ -69,16 +70,8 @@ namespace BoxCityTileSystem
 
 	void Manager::Shutdown()
 	{
-		//Quit the loading thread
-		{
-			std::unique_lock<core::Mutex> lock_guard(m_loading_access_mutex);
-
-			//Mark the loading thread for quit
-			m_loading_thread_quit = true;
-
-			//Notify the loading thread that has work
-			m_loading_queue_condition_variable.notify_one();
-		}
+		//Quit the loading thread, it wakes it if it is waiting for work
+		m_loading_queue.close();
 
 		//Join the thread
 		m_loading_thread->join();
@@ -102,6 +95,21 @@ namespace BoxCityTileSystem
 		}
 	}
 
+	void Manager::RefitAnimatedBuildings()
+	{
+		PROFILE_SCOPE("BoxCityTileManager", 0xFFFF77FF, "RefitAnimatedBuildings");
+
+		if (!c_refit_animated_buildings) return;
+
+		for (auto& tile : m_tiles)
+		{
+			if (tile.IsVisible())
+			{
+				tile.RefitAnimatedBuildings(m_job_system);
+			}
+		}
+	}
+
 	void Manager::Update(const glm::vec3& camera_position, bool first_logic_tick_after_render)
 	{
 		PROFILE_SCOPE("BoxCityTileManager", 0xFFFF77FF, "Update");
@@ -535,13 +543,8 @@ namespace BoxCityTileSystem
 		{
 			tile.AddedToLoadingQueue();
 
-			std::unique_lock<core::Mutex> lock_guard(m_loading_access_mutex);
-
-			//queue tile
+			//queue tile, it wakes the loading thread if it is waiting
 			m_loading_queue.push(LoadingJob{ &tile, local_tile_position, world_tile_position });
-
-			//Notify the loading thread that has work
-			m_loading_queue_condition_variable.notify_one();
 		}
 		else
 		{
@@ -559,33 +562,37 @@ namespace BoxCityTileSystem
 		//Register extra worker
 		job::RegisterExtraWorker(manager->m_job_system, 0);
 
-		std::unique_lock<core::Mutex> lock_guard(manager->m_loading_access_mutex);
-
-		while (!manager->m_loading_thread_quit)
+		//Waits for jobs until the queue is closed
+		LoadingJob job;
+		while (manager->m_loading_queue.pop(job))
 		{
-			manager->m_loading_queue_condition_variable.wait(lock_guard, [manager]()
-				{
-					return !manager->m_loading_queue.empty() || manager->m_loading_thread_quit;
-				});
+			//Pending tiles are not needed anymore
+			if (manager->m_loading_queue.closed())
+				break;
 
-			if (!manager->m_loading_queue.empty())
+			//Load the tile
 			{
-				LoadingJob job = manager->m_loading_queue.front();
-				manager->m_loading_queue.pop();
-
-				lock_guard.unlock();
+				assert(job.tile->IsLoading());
+				job.tile->BuildTileData(manager, job.local_tile_position, job.world_tile_position);
+			}
 
-				//Load the tile
+			//The tile is going to be spawned in this zone, commit and prefault the component storage here instead of during the spawn
+			{
+				size_t num_buildings = 0;
+				size_t num_animated_buildings = 0;
+				for (uint32_t i = 0; i < static_cast<uint32_t>(LODGroup::Count); ++i)
 				{
-					assert(job.tile->IsLoading());
-					job.tile->BuildTileData(manager, job.local_tile_position, job.world_tile_position);
+					auto& lod_group_data = job.tile->GetLodGroupData(static_cast<LODGroup>(i));
+					num_buildings += lod_group_data.building_data.size();
+					num_animated_buildings += lod_group_data.animated_building_data.size();
 				}
-
-				//Indicate to the tile manager that tiles have been loaded
-				manager->m_tiles_loaded.exchange(true);
-
-				lock_guard.lock();
+				const ecs::ZoneType zone_index = static_cast<ecs::ZoneType>(job.tile->GetZoneID());
+				ecs::PrefaultZoneMemory<GameDatabase, BoxType>(zone_index, num_buildings);
+				ecs::PrefaultZoneMemory<GameDatabase, AnimatedBoxType>(zone_index, num_animated_buildings);
 			}
+
+			//Indicate to the tile manager that tiles have been loaded
+			manager->m_tiles_loaded.exchange(true);
 		}
 	}
 }
@@ -4,9 +4,8 @@
 #include "box_city_components.h"
 #include "box_city_tile.h"
 #include <helpers/collision.h>
+#include <core/concurrent_ring_buffer.h>
 #include <bitset>
-#include <queue>
-#include <condition_variable>
 
 namespace render
 {
@@ -68,16 +67,35 @@ namespace BoxCityTileSystem
 
 		std::bitset<kLocalTileCount* kLocalTileCount> GetCameraBitSet(const helpers::Frustum& frustum) const
 		{
-			std::bitset<kLocalTileCount* kLocalTileCount> ret(false);
-
+			constexpr uint32_t kNumTiles = kLocalTileCount * kLocalTileCount;
+			std::bitset<kNumTiles> ret(false);
+
+			//Cull the visible tiles in one batch
+			float center[3][kNumTiles];
+			float extents[3][kNumTiles];
+			uint32_t zone_ids[kNumTiles];
+			uint32_t num_tiles = 0;
 			for (auto& tile : m_tiles)
 			{
 				if (tile.IsVisible())
 				{
-					ret[tile.GetZoneID()] = helpers::CollisionFrustumVsAABB(frustum, tile.GetBoundingBox());
+					const helpers::AABB& bounding_box = tile.GetBoundingBox();
+					for (glm::length_t i = 0; i < 3; ++i)
+					{
+						center[i][num_tiles] = (bounding_box.max[i] + bounding_box.min[i]) * 0.5f;
+						extents[i][num_tiles] = (bounding_box.max[i] - bounding_box.min[i]) * 0.5f;
+					}
+					zone_ids[num_tiles++] = tile.GetZoneID();
 				}
 			}
 
+			uint32_t visibility_mask[(kNumTiles + 31) / 32];
+			helpers::CollisionFrustumVsAABBs(frustum, helpers::AABBSoA{ { center[0], center[1], center[2] }, { extents[0], extents[1], extents[2] } }, num_tiles, visibility_mask);
+			for (uint32_t i = 0; i < num_tiles; ++i)
+			{
+				ret[zone_ids[i]] = (visibility_mask[i / 32] >> (i % 32)) & 1;
+			}
+
 			return ret;
 		}
 
@@ -92,12 +110,16 @@ namespace BoxCityTileSystem
 		//Update, it will check if new tiles need to be created/move because the camera has moved, as we send a to the GPU, we really only do it in the first logic tick after render
 		void Update(const glm::vec3& camera_position, bool first_logic_tick_after_render);
 
+		//Refit the buildings BVH of the visible tiles with the current position of the animated buildings
+		void RefitAnimatedBuildings();
+
 		//Get GPU alloc handle from zoneID
 		render::AllocHandle& GetGPUHandle(uint32_t zoneID, uint32_t lod_group);
 
 		display::Device* GetDevice() { return m_device; };
 		render::System* GetRenderSystem() { return m_render_system; };
 		render::GPUMemoryRenderModule* GetGPUMemoryRenderModule() { return m_GPU_memory_render_module; };
+		job::System* GetJobSystem() { return m_job_system; };
 
 		//Return a descriptor index for a position, if there is not a descriptor, it is just a gap
 		std::optional<uint32_t> GetZoneDescriptorIndex(const glm::vec3& position);
@@ -154,6 +176,39 @@ namespace BoxCityTileSystem
 				});
 		}
 
+		//Closest building hit by the ray (or segment), tested with the OBB of the building, the ray needs a finite max_t
+		bool CalculateClosestBuildingHit(const helpers::Ray& ray, InstanceReference& closest_building, float& closest_t)
+		{
+			assert(ray.max_t < FLT_MAX);
+
+			helpers::AABB ray_box;
+			ray_box.Add(ray.origin);
+			ray_box.Add(ray.origin + ray.direction * ray.max_t);
+
+			//Each hit clips the ray for the next tiles
+			helpers::Ray clipped_ray = ray;
+			bool hit = false;
+			VisitTiles(ray_box, [&](Tile& tile)
+				{
+					if (tile.GetBuildingsBVH().IsValid())
+					{
+						InstanceReference building;
+						float t;
+						if (tile.GetBuildingsBVH().ClosestHit(clipped_ray, [&](const InstanceReference& instance, float& instance_t)
+							{
+								return helpers::CollisionRayVsOBB(clipped_ray, instance.Get<GameDatabase>().Get<OBBBox>(), instance_t);
+							}, building, t))
+						{
+							closest_building = building;
+							closest_t = t;
+							clipped_ray.max_t = t;
+							hit = true;
+						}
+					}
+				});
+			return hit;
+		}
+
 		bool GetNextTrafficTarget(std::mt19937& random, const glm::vec3& position, glm::vec3& next_target) const;
 
 		//Building archetype, described by the extents and the GPU handle
@@ -229,11 +284,13 @@ namespace BoxCityTileSystem
 			WorldTilePosition world_tile_position;
 		};
 
+		//Only the game thread adds tiles and only the loading thread loads them
+		//A tile can not be added again until it is loaded, so the queue never can be full
+		static constexpr size_t kLoadingQueueSize = 256;
+		static_assert(kLoadingQueueSize >= kLocalTileCount * kLocalTileCount);
+
 		std::unique_ptr<core::Thread> m_loading_thread;
-		core::Mutex m_loading_access_mutex;
-		std::queue<LoadingJob> m_loading_queue;
-		std::condition_variable m_loading_queue_condition_variable;
-		bool m_loading_thread_quit = false;
+		core::BlockingRingBuffer<core::SPSCRingBuffer<LoadingJob, kLoadingQueueSize>> m_loading_queue;
 		std::atomic_bool m_tiles_loaded = false;
 
 		//Add Tile to Load
@@ -14,6 +14,7 @@
 
 PROFILE_DEFINE_MARKER(g_profile_marker_Car_Update, "Main", 0xFFFFAAAA, "CarUpdate");
 CONTROL_VARIABLE_BOOL(c_traffic_full_instance_list_upload, false, "TrafficSystem", "Upload all invalidated instance_list");
+CONTROL_VARIABLE_BOOL(c_traffic_cars_grid, true, "TrafficSystem", "Rebuild the cars grid each update, needed for the collisions between cars");
 COUNTER(c_Car_Summitted, "Box City", "Car summitted to the GPU", true);
 
 namespace BoxCityTrafficSystem
@@ -441,8 +442,49 @@ namespace BoxCityTrafficSystem
 	}
 
 
+	void Manager::BuildCarsGrid(job::System* job_system, job::JobAllocator<1024 * 1024>* job_allocator)
+	{
+		PROFILE_SCOPE("TrafficSystem", 0xFFFF77FF, "BuildCarsGrid");
+
+		//Each zone writes the cars in its own range
+		uint32_t num_cars = 0;
+		for (uint32_t zone_index = 0; zone_index < kLocalTileCount * kLocalTileCount; ++zone_index)
+		{
+			m_cars_grid_zone_offsets[zone_index] = num_cars;
+			m_cars_grid_zone_counts[zone_index] = static_cast<uint32_t>(ecs::GetNumInstances<GameDatabase, CarType>(zone_index));
+			num_cars += m_cars_grid_zone_counts[zone_index];
+		}
+		m_cars_grid_indices.resize(num_cars);
+		m_cars_grid_cars.resize(num_cars);
+		m_cars_grid_bounds.resize(num_cars);
+
+		std::bitset<BoxCityTileSystem::kLocalTileCount* BoxCityTileSystem::kLocalTileCount> full_bitset(0xFFFFFFFF >> (32 - kLocalTileCount * kLocalTileCount));
+		job::Fence gather_fence;
+		ecs::AddJobs<GameDatabase, const OBBBox, const CarMovement, const Car>(job_system, gather_fence, job_allocator, 256,
+			[zone_offsets = m_cars_grid_zone_offsets, indices = m_cars_grid_indices.data(), cars = m_cars_grid_cars.data(), bounds = m_cars_grid_bounds.data()](const auto& instance_iterator, const OBBBox& obb_box, const CarMovement& car_movement, const Car&)
+			{
+				const uint32_t index = zone_offsets[instance_iterator.m_zone_index] + instance_iterator.m_instance_index;
+				indices[index] = index;
+				cars[index] = CarsGridCar{ obb_box, car_movement.linear_velocity };
+				helpers::CalculateAABBFromOBB(bounds[index], obb_box);
+			}, full_bitset, &g_profile_marker_Car_Update);
+		job::Wait(job_system, gather_fence);
+
+		m_cars_grid.Build(m_cars_grid_indices.data(), m_cars_grid_bounds.data(), num_cars, kCarsGridCellSize, job_system);
+	}
+
 	void Manager::UpdateCars(platform::Game* game, job::System* job_system, job::JobAllocator<1024 * 1024>* job_allocator, const helpers::Camera& camera, job::Fence& update_fence, BoxCityTileSystem::Manager* tile_manager, uint32_t frame_index, float elapsed_time)
 	{
+		//Broad phase of the cars before they move, the car jobs can query the cars around them
+		if (c_traffic_cars_grid)
+		{
+			BuildCarsGrid(job_system, job_allocator);
+		}
+		else
+		{
+			m_cars_grid.Clear();
+		}
+
 		std::bitset<BoxCityTileSystem::kLocalTileCount* BoxCityTileSystem::kLocalTileCount> full_bitset(0xFFFFFFFF >> (32 - kLocalTileCount * kLocalTileCount));
 		//std::bitset<BoxCityTileSystem::kLocalTileCount* BoxCityTileSystem::kLocalTileCount> camera_bitset = GetCameraBitSet(camera);
 		//Update the cars in the direction of the target
@@ -468,7 +510,7 @@ namespace BoxCityTrafficSystem
 				glm::vec3 position_offset(0.f, 0.f, 0.f);
 
 				BoxCityCarControl::CalculateControlForces(car, car_movement, car_settings, car_control, elapsed_time, linear_forces, angular_forces);
-				BoxCityCarControl::CalculateCollisionForces(tile_manager, elapsed_time, camera_position, obb_box, linear_forces, angular_forces, car_movement, car_settings, position_offset);
+				BoxCityCarControl::CalculateCollisionForces(tile_manager, manager, manager->GetCarsGridIndex(instance_iterator.m_zone_index, instance_iterator.m_instance_index), elapsed_time, camera_position, obb_box, linear_forces, angular_forces, car_movement, car_settings, position_offset);
 
 				//Integrate
 				BoxCityCarControl::IntegrateCar(car, car_movement, car_settings, linear_forces, angular_forces, position_offset, elapsed_time);
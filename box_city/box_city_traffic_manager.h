@@ -7,6 +7,7 @@
 #include <job/job.h>
 #include <helpers/camera.h>
 #include <helpers/grid3D.h>
+#include <helpers/spatial_hash_grid.h>
 
 namespace render
 {
@@ -24,6 +25,9 @@ namespace BoxCityTrafficSystem
 	//World size
 	constexpr float kTileSize = 1000.f;
 
+	//Cell size of the cars grid, a few cars in each cell
+	constexpr float kCarsGridCellSize = 16.f;
+
 	//Traffic system
 	constexpr uint32_t kTrafficTargetCountXY = 32;
 	constexpr uint32_t kTrafficTargetCountZ = 4;
@@ -128,6 +132,38 @@ namespace BoxCityTrafficSystem
 		//The instance in the zone has change for some reason, the gpu offset needs to be reevaluated
 		void RegisterECSChange(uint32_t zone_index, uint32_t instance_index);
 
+		//Copy of a car when the cars grid was built, the car jobs can read it while the cars are moving
+		struct CarsGridCar
+		{
+			helpers::OBB obb;
+			glm::vec3 linear_velocity;
+		};
+
+		//The cars grid indexes the copies of the cars
+		using CarsGrid = helpers::SpatialHashGrid<uint32_t>;
+		constexpr static uint32_t kInvalidCarsGridIndex = static_cast<uint32_t>(-1);
+
+		//Index of a car in the cars grid, invalid if the car was created after the grid was built
+		uint32_t GetCarsGridIndex(uint32_t zone_index, uint32_t instance_index) const
+		{
+			if (!m_cars_grid.IsValid() || instance_index >= m_cars_grid_zone_counts[zone_index])
+			{
+				return kInvalidCarsGridIndex;
+			}
+			return m_cars_grid_zone_offsets[zone_index] + instance_index;
+		}
+
+		//Call the visitor with the index and the copy of each car that overlaps the bounds
+		//The cars grid is rebuilt at the start of UpdateCars with the positions of the last update, so it can be used from the car jobs
+		template<typename VISITOR>
+		void VisitCars(const helpers::AABB& bounds, VISITOR&& visitor) const
+		{
+			m_cars_grid.Visit(bounds, [&](const uint32_t car_index)
+				{
+					visitor(car_index, m_cars_grid_cars[car_index]);
+				});
+		}
+
 	private:
 		//Systems
 		display::Device* m_device = nullptr;
@@ -205,6 +241,16 @@ namespace BoxCityTrafficSystem
 		std::array<render::AllocHandle, 5> m_gpu_car_box_list;
 		//Car type dimensions
 		std::array<helpers::AABB, 5> m_car_type_dimensions;
+
+		//Broad phase of the cars, rebuilt each update from the OBBBox of the cars
+		CarsGrid m_cars_grid;
+		std::vector<uint32_t> m_cars_grid_indices;
+		std::vector<CarsGridCar> m_cars_grid_cars;
+		std::vector<helpers::AABB> m_cars_grid_bounds;
+		std::array<uint32_t, kLocalTileCount * kLocalTileCount> m_cars_grid_zone_offsets = {};
+		std::array<uint32_t, kLocalTileCount * kLocalTileCount> m_cars_grid_zone_counts = {};
+
+		void BuildCarsGrid(job::System* job_system, job::JobAllocator<1024 * 1024>* job_allocator);
 	};
 }
 
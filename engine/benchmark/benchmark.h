@@ -0,0 +1,46 @@
+//////////////////////////////////////////////////////////////////////////
+// Cute engine - Headless benchmarks of the engine primitives and helpers
+//////////////////////////////////////////////////////////////////////////
+#ifndef BENCHMARK_H_
+#define BENCHMARK_H_
+
+#include <chrono>
+#include <cstdint>
+
+namespace job
+{
+	struct System;
+}
+
+namespace benchmark
+{
+	struct Context
+	{
+		job::System* job_system = nullptr;
+		//Small sizes and few iterations, only to validate the results (ctest)
+		bool quick = false;
+	};
+
+	//Returns the average time in microseconds of each call to the function
+	template<typename FUNCTION>
+	double Measure(uint32_t num_iterations, FUNCTION&& function)
+	{
+		auto begin = std::chrono::high_resolution_clock::now();
+		for (uint32_t i = 0; i < num_iterations; ++i)
+		{
+			function();
+		}
+		return std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - begin).count() / static_cast<double>(num_iterations);
+	}
+
+	//Each benchmark validates its results against a brute force version, core::LogError if they are wrong
+	void BenchmarkHelpers(const Context& context);
+	void BenchmarkSortRenderItems(const Context& context);
+	void BenchmarkPersistentRenderItems(const Context& context);
+	void BenchmarkFastMaps(const Context& context);
+	void BenchmarkRingBuffers(const Context& context);
+	void BenchmarkMutexes(const Context& context);
+	void BenchmarkECSComponentsMutex(const Context& context);
+}
+
+#endif //BENCHMARK_H_
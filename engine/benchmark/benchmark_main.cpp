@@ -0,0 +1,76 @@
+//////////////////////////////////////////////////////////////////////////
+// Cute engine - Headless benchmarks of the engine primitives and helpers
+//////////////////////////////////////////////////////////////////////////
+//Usage: cute_engine_benchmark [--quick] [benchmark names...], runs all the benchmarks if there are not names
+
+#include <benchmark/benchmark.h>
+#include <core/log.h>
+#include <job/job.h>
+#include <cstring>
+#include <iterator>
+
+namespace
+{
+	struct Benchmark
+	{
+		const char* name;
+		void(*function)(const benchmark::Context& context);
+	};
+
+	constexpr Benchmark kBenchmarks[] =
+	{
+		{ "helpers", benchmark::BenchmarkHelpers },
+		{ "sort_render_items", benchmark::BenchmarkSortRenderItems },
+		{ "persistent_render_items", benchmark::BenchmarkPersistentRenderItems },
+		{ "fast_maps", benchmark::BenchmarkFastMaps },
+		{ "ring_buffers", benchmark::BenchmarkRingBuffers },
+		{ "mutexes", benchmark::BenchmarkMutexes },
+		{ "ecs_components_mutex", benchmark::BenchmarkECSComponentsMutex },
+	};
+}
+
+int main(int argc, char* argv[])
+{
+	benchmark::Context context;
+
+	bool selected[std::size(kBenchmarks)] = {};
+	bool any_selected = false;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--quick") == 0)
+		{
+			context.quick = true;
+			continue;
+		}
+
+		bool found = false;
+		for (size_t benchmark_index = 0; benchmark_index < std::size(kBenchmarks); ++benchmark_index)
+		{
+			if (strcmp(argv[i], kBenchmarks[benchmark_index].name) == 0)
+			{
+				selected[benchmark_index] = true;
+				any_selected = found = true;
+			}
+		}
+		if (!found)
+		{
+			core::LogWarning("Unknown benchmark <%s>", argv[i]);
+			return 1;
+		}
+	}
+
+	job::SystemDesc job_system_desc;
+	context.job_system = job::CreateSystem(job_system_desc);
+
+	for (size_t benchmark_index = 0; benchmark_index < std::size(kBenchmarks); ++benchmark_index)
+	{
+		if (!any_selected || selected[benchmark_index])
+		{
+			core::LogInfo("Benchmark <%s>", kBenchmarks[benchmark_index].name);
+			kBenchmarks[benchmark_index].function(context);
+		}
+	}
+
+	job::DestroySystem(context.job_system);
+	return 0;
+}
@@ -1,10 +1,16 @@
 //////////////////////////////////////////////////////////////////////////
 // Cute engine - Virtual command buffer that captures commands with data
+// Commands and data live in reserved virtual memory, so they never get reallocated or zeroed
 //////////////////////////////////////////////////////////////////////////
 #ifndef COMMAND_BUFFER_h
 #define COMMAND_BUFFER_h
 
-#include <vector>
+#include <core/virtual_buffer.h>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
 
 namespace core
 {
@@ -14,6 +20,17 @@ namespace core
 	public:
 		using Command = COMMAND_TYPE;
 
+		//Default reserved memory for commands and data
+		static constexpr size_t kDefaultReservedCommands = 16 * 1024 * 1024;
+		static constexpr size_t kDefaultReservedData = 128 * 1024 * 1024;
+
+		//Memory is only reserved, it gets commited in big steps as the buffer grows
+		explicit CommandBuffer(size_t reserved_commands = kDefaultReservedCommands, size_t reserved_data = kDefaultReservedData) :
+			m_commands(reserved_commands * sizeof(Command)), m_commands_reserved(reserved_commands * sizeof(Command)),
+			m_command_data(reserved_data), m_command_data_reserved(reserved_data)
+		{
+		}
+
 		//Clear the command buffer, it will not deallocate memory, just clear it
 		void Reset();
 
@@ -45,45 +62,92 @@ namespace core
 		//Get current offset of commands
 		size_t GetCurrentCommandPosition() const
 		{
-			return m_commands.size();
+			return m_commands_size;
 		}
 
 		//Get current offset of command data
 		size_t GetCurrentCommandDataPosition() const
 		{
-			return m_command_data.size();
+			return m_command_data_size;
 		}
 
 	private:
+		//Memory gets commited in steps of this size, it avoids calling the OS for each command
+		static constexpr size_t kCommitGranularity = 64 * 1024;
 
 		//Returns the offset needed for alignment for ptr
 		inline size_t CalculateAlignment(size_t alignment, size_t offset);
 
+		//Makes sure that the buffer has at least size bytes commited
+		inline void Commit(VirtualBuffer& buffer, size_t reserved, size_t size);
+
+		//Bump allocation in the data buffer, returns the offset to the allocated data
+		inline size_t AllocData(size_t alignment, size_t size);
+
 		//List of commands in the command buffer
-		std::vector<Command> m_commands;
+		VirtualBuffer m_commands;
+		size_t m_commands_reserved;
+		size_t m_commands_size = 0;
 		//Data associated to each command
-		std::vector<std::byte> m_command_data;
+		VirtualBuffer m_command_data;
+		size_t m_command_data_reserved;
+		size_t m_command_data_size = 0;
 	};
 
 	template<typename COMMAND_TYPE>
 	inline void CommandBuffer<COMMAND_TYPE>::Reset()
 	{
-		m_commands.clear();
-		m_command_data.clear();
+		//Commited memory is kept for the next frame
+		m_commands_size = 0;
+		m_command_data_size = 0;
+	}
+
+	template<typename COMMAND_TYPE>
+	inline void CommandBuffer<COMMAND_TYPE>::Commit(VirtualBuffer& buffer, size_t reserved, size_t size)
+	{
+		if (size > buffer.GetCommitedSize())
+		{
+			if (size > reserved)
+			{
+				//Commiting past the reservation would write out of the buffer
+				throw std::runtime_error("Command buffer reserved memory is full");
+			}
+
+			//Commit the double of the current size in big steps, limited by the reserved memory
+			size_t new_commited_size = (size > buffer.GetCommitedSize() * 2) ? size : buffer.GetCommitedSize() * 2;
+			new_commited_size = ((new_commited_size + kCommitGranularity - 1) / kCommitGranularity) * kCommitGranularity;
+			if (new_commited_size > reserved)
+			{
+				new_commited_size = reserved;
+			}
+			buffer.SetCommitedSize(new_commited_size, false);
+		}
+	}
+
+	template<typename COMMAND_TYPE>
+	inline size_t CommandBuffer<COMMAND_TYPE>::AllocData(size_t alignment, size_t size)
+	{
+		const size_t begin_offset = m_command_data_size + CalculateAlignment(alignment, m_command_data_size);
+		m_command_data_size = begin_offset + size;
+		Commit(m_command_data, m_command_data_reserved, m_command_data_size);
+
+		return begin_offset;
 	}
 
 	//Push command
 	template<typename COMMAND_TYPE>
 	inline void CommandBuffer<COMMAND_TYPE>::PushCommand(const Command & command)
 	{
-		m_commands.push_back(command);
+		Commit(m_commands, m_commands_reserved, (m_commands_size + 1) * sizeof(Command));
+		reinterpret_cast<Command*>(m_commands.GetPtr())[m_commands_size++] = command;
 	}
 
 	//Get command
 	template<typename COMMAND_TYPE>
 	inline typename CommandBuffer<COMMAND_TYPE>::Command CommandBuffer<COMMAND_TYPE>::GetCommand(size_t & offset)
 	{
-		return m_commands[offset++];
+		assert(offset < m_commands_size);
+		return reinterpret_cast<const Command*>(m_commands.GetPtr())[offset++];
 	}
 
 	//Returns the offset needed for alignment for ptr
@@ -99,17 +163,20 @@ namespace core
 	template<typename DATA>
 	inline void CommandBuffer<COMMAND_TYPE>::PushData(const DATA& data)
 	{
-		size_t alignment_offset = CalculateAlignment(alignof(DATA), m_command_data.size());
-
 		//Reserve memory as needed
-		const size_t begin_offset = m_command_data.size() + alignment_offset;
-		m_command_data.resize(m_command_data.size() + alignment_offset + sizeof(DATA));
+		const size_t begin_offset = AllocData(alignof(DATA), sizeof(DATA));
 
-		std::byte* byte_ptr = m_command_data.data() + begin_offset;
-		DATA* data_ptr = reinterpret_cast<DATA*>(byte_ptr);
+		std::byte* byte_ptr = reinterpret_cast<std::byte*>(m_command_data.GetPtr()) + begin_offset;
 		
-		//Construct a new DATA in the memory
-		new (data_ptr) DATA (data);
+		if constexpr (std::is_trivially_copyable<DATA>::value)
+		{
+			memcpy(byte_ptr, &data, sizeof(DATA));
+		}
+		else
+		{
+			//Construct a new DATA in the memory
+			new (byte_ptr) DATA(data);
+		}
 	}
 
 	//Push command data array
@@ -117,38 +184,40 @@ namespace core
 	template<typename DATA>
 	inline void* CommandBuffer<COMMAND_TYPE>::PushDataArray(const DATA * data, size_t num)
 	{
-		size_t alignment_offset = CalculateAlignment(alignof(DATA), m_command_data.size());
+		//Reserve memory as needed, without data the memory is left uninitialised for the caller
+		const size_t begin_offset = AllocData(alignof(DATA), sizeof(DATA) * num);
 
-		//Reserve memory as needed
-		const size_t begin_offset = m_command_data.size() + alignment_offset;
-		m_command_data.resize(m_command_data.size() + alignment_offset + sizeof(DATA) * num);
+		std::byte* byte_ptr = reinterpret_cast<std::byte*>(m_command_data.GetPtr()) + begin_offset;
 
 		if (data)
 		{
-			//Copy data
-			for (size_t i = 0; i < num; ++i)
+			if constexpr (std::is_trivially_copyable<DATA>::value)
+			{
+				memcpy(byte_ptr, data, sizeof(DATA) * num);
+			}
+			else
 			{
-				std::byte* byte_ptr = m_command_data.data() + begin_offset + i * sizeof(DATA);
-				DATA* data_ptr = reinterpret_cast<DATA*>(byte_ptr);
-
 				//Construct a new DATA in the memory
-				new (data_ptr) DATA(data[i]);
+				for (size_t i = 0; i < num; ++i)
+				{
+					new (byte_ptr + i * sizeof(DATA)) DATA(data[i]);
+				}
 			}
 		}
 
-		return &m_command_data[begin_offset];
+		return byte_ptr;
 	}
 	//Push Buffer
 	template<typename COMMAND_TYPE>
 	inline std::byte* CommandBuffer<COMMAND_TYPE>::PushBuffer(const std::byte* buffer, size_t size)
 	{
 		//Reserve memory as needed
-		const size_t begin_offset = m_command_data.size();
-		m_command_data.resize(m_command_data.size() + size);
+		const size_t begin_offset = AllocData(1, size);
 
-		memcpy(&m_command_data[begin_offset], buffer, size);
+		std::byte* byte_ptr = reinterpret_cast<std::byte*>(m_command_data.GetPtr()) + begin_offset;
+		memcpy(byte_ptr, buffer, size);
 
-		return &m_command_data[begin_offset];
+		return byte_ptr;
 	}
 
 
@@ -162,8 +231,9 @@ namespace core
 
 		//Move offset
 		offset += alignment_offset + sizeof(DATA);
+		assert(offset <= m_command_data_size);
 		//Return data
-		return *reinterpret_cast<DATA*>(&m_command_data[begin_offset]);
+		return *reinterpret_cast<DATA*>(reinterpret_cast<std::byte*>(m_command_data.GetPtr()) + begin_offset);
 	}
 
 	//Get buffer
@@ -175,8 +245,9 @@ namespace core
 		//Move offset
 		offset += size;
 
+		assert(offset <= m_command_data_size);
 		//Return data
-		return &m_command_data[begin_offset];
+		return reinterpret_cast<const std::byte*>(m_command_data.GetPtr()) + begin_offset;
 	}
 }
 
@@ -0,0 +1,490 @@
+//////////////////////////////////////////////////////////////////////////
+// Cute engine - Pool of generic handles that can be allocated and freed from any thread
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef CONCURRENT_HANDLE_POOL_H_
+#define CONCURRENT_HANDLE_POOL_H_
+
+#include <core/handle_pool.h>
+#include <core/virtual_buffer.h>
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+
+namespace core
+{
+	namespace internal
+	{
+		//Cache indices are shared by all the concurrent pools, a thread owns its index until it exits
+		//The caches of an index without owners can be given back to the global stack of each pool
+		constexpr size_t kNumThreadCaches = 64;
+
+		inline std::atomic<uint32_t>* GetThreadCacheOwners()
+		{
+			static std::atomic<uint32_t> s_owners[kNumThreadCaches] = {};
+			return s_owners;
+		}
+
+		struct ThreadCacheIndex
+		{
+			size_t index;
+
+			ThreadCacheIndex()
+			{
+				//Use a free index, if all of them are used share one
+				std::atomic<uint32_t>* owners = GetThreadCacheOwners();
+				for (size_t i = 0; i < kNumThreadCaches; ++i)
+				{
+					uint32_t expected = 0;
+					if (owners[i].compare_exchange_strong(expected, 1, std::memory_order_acq_rel))
+					{
+						index = i;
+						return;
+					}
+				}
+				static std::atomic<size_t> s_next_shared_index = 0;
+				index = s_next_shared_index.fetch_add(1, std::memory_order_relaxed) % kNumThreadCaches;
+				owners[index].fetch_add(1, std::memory_order_acq_rel);
+			}
+
+			~ThreadCacheIndex()
+			{
+				GetThreadCacheOwners()[index].fetch_sub(1, std::memory_order_acq_rel);
+			}
+		};
+	}
+
+	//Pool of handles with the same interface as HandlePool, but Alloc and Free are thread safe
+	//Each thread has a cache of free slots, it gets refilled or flushed in batches from a global lock free stack
+	//The caches of the threads that exited are given back to the global stack before growing the pool
+	//Stale handles get detected with the generation of the slot, same as HandlePool
+	//The data never moves, it can be accessed while other threads are allocating
+	template<typename HANDLE>
+	class ConcurrentHandlePool
+	{
+		using DATA = typename HANDLE::data_param;
+		using TYPE = typename HANDLE::type_param;
+
+		static_assert(std::is_default_constructible<DATA>::value);
+		static_assert(std::is_unsigned<TYPE>::value);
+
+	protected:
+		using Accessor = HandleAccessor<DATA, TYPE>;
+
+	public:
+		using HandleType = HANDLE;
+
+		ConcurrentHandlePool() = default;
+		ConcurrentHandlePool(const ConcurrentHandlePool&) = delete;
+		ConcurrentHandlePool& operator=(const ConcurrentHandlePool&) = delete;
+
+		~ConcurrentHandlePool();
+
+		//Init pool with a list of free slots avaliable
+		void Init(size_t max_size, size_t init_size);
+
+		//Allocate a handle
+		template<typename ...Args>
+		HANDLE Alloc(Args&&... args);
+
+		//Free unused handle
+		void Free(HANDLE& handle);
+
+		//Accessors
+		DATA& operator[](const Accessor& handle)
+		{
+			return GetData()[CheckedSlot(handle)];
+		}
+
+		const DATA& operator[](const Accessor& handle) const
+		{
+			return GetData()[CheckedSlot(handle)];
+		}
+
+		//Returns if the handle points to a slot that has not been freed
+		bool IsAlive(const Accessor& handle) const
+		{
+			if (!handle.IsValid())
+				return false;
+
+			const size_t slot = handle.GetSlot();
+			return slot < m_capacity.load(std::memory_order_acquire) && handle.GetGeneration() == GetGenerations()[slot].load(std::memory_order_acquire);
+		}
+
+		//Number of allocated handles, only exact if there are not allocations in flight
+		size_t Size() const
+		{
+			int64_t size = 0;
+			for (size_t i = 0; i < kNumCaches; ++i)
+			{
+				size += m_caches[i].live.load(std::memory_order_relaxed);
+			}
+			return static_cast<size_t>(size);
+		}
+
+		size_t MaxSize() const
+		{
+			return m_max_size;
+		}
+
+	protected:
+		TYPE GetInternalIndex(const Accessor& handle) const
+		{
+			return handle.GetSlot();
+		}
+
+	private:
+		//Last slot index is never used by the handles, it is the end of the free lists
+		static constexpr uint32_t kEndSlot = static_cast<uint32_t>(Accessor::kMaxSlots);
+
+		//Thread caches
+		static constexpr size_t kNumCaches = internal::kNumThreadCaches;
+		static constexpr size_t kCacheSize = 64;
+		static constexpr size_t kBatchSize = kCacheSize / 2;
+
+		struct alignas(64) Cache
+		{
+			//Only one thread can access the cache, if it is busy the global stack is used
+			std::atomic_flag busy = ATOMIC_FLAG_INIT;
+			//Number of free slots in the cache
+			size_t count = 0;
+			//Free slots
+			uint32_t slots[kCacheSize];
+			//Allocations minus frees done from this cache
+			std::atomic<int64_t> live = 0;
+		};
+
+		//Max size the pool can grow
+		size_t m_max_size = 0;
+
+		//Current capacity, the memory is reserved for max size and commited as it grows
+		std::atomic<size_t> m_capacity = 0;
+
+		//Storage of the data, the generation and the next free slot of each slot
+		std::unique_ptr<VirtualBuffer> m_data;
+		std::unique_ptr<VirtualBuffer> m_generations;
+		std::unique_ptr<VirtualBuffer> m_next_free_slots;
+
+		//Head of the global free stack, the slot index in the low bits and a tag in the high bits to avoid ABA
+		std::atomic<uint64_t> m_global_free_head = kEndSlot;
+
+		//Caches
+		std::unique_ptr<Cache[]> m_caches;
+
+		//Only used when the pool needs to grow
+		core::Mutex m_grow_mutex;
+
+		DATA* GetData() const
+		{
+			return reinterpret_cast<DATA*>(m_data->GetPtr());
+		}
+
+		//Generations are read by IsAlive while other threads free the slots
+		std::atomic<uint32_t>* GetGenerations() const
+		{
+			return reinterpret_cast<std::atomic<uint32_t>*>(m_generations->GetPtr());
+		}
+
+		std::atomic<uint32_t>* GetNextFreeSlots() const
+		{
+			return reinterpret_cast<std::atomic<uint32_t>*>(m_next_free_slots->GetPtr());
+		}
+
+		size_t CheckedSlot(const Accessor& handle) const
+		{
+			if (!IsAlive(handle))
+			{
+				//Log error breaks the execution
+				core::LogError("Access to a stale handle <%i>", static_cast<int>(handle.GetSlot()));
+			}
+			return handle.GetSlot();
+		}
+
+		//Each thread uses always the same cache
+		static size_t GetThreadCacheIndex()
+		{
+			thread_local internal::ThreadCacheIndex thread_cache_index;
+			return thread_cache_index.index;
+		}
+
+		//Flush the caches of the threads that exited to the global stack, returns if any slot was recovered
+		bool ReclaimOrphanCaches();
+
+		//Push a list of slots already linked with the next free slots
+		void PushGlobal(uint32_t first_slot, uint32_t last_slot);
+
+		//Pop a free slot from the global stack, kEndSlot if it is empty
+		uint32_t PopGlobal();
+
+		//Pop a free slot from the global stack, it grows the pool if it is empty
+		uint32_t PopGlobalOrGrow();
+	};
+
+	template<typename HANDLE>
+	inline ConcurrentHandlePool<HANDLE>::~ConcurrentHandlePool()
+	{
+		const size_t capacity = m_capacity.load();
+		if (capacity == 0)
+			return;
+
+		//Mark all the free slots, the rest are leaks
+		std::vector<uint8_t> allocated(capacity, true);
+		uint32_t free_slot = static_cast<uint32_t>(m_global_free_head.load() & 0xFFFFFFFF);
+		while (free_slot != kEndSlot)
+		{
+			allocated[free_slot] = false;
+			free_slot = GetNextFreeSlots()[free_slot].load();
+		}
+		for (size_t i = 0; i < kNumCaches; ++i)
+		{
+			for (size_t j = 0; j < m_caches[i].count; ++j)
+			{
+				allocated[m_caches[i].slots[j]] = false;
+			}
+		}
+
+		size_t num_allocated_handles = 0;
+		for (size_t i = 0; i < capacity; ++i)
+		{
+			if (allocated[i])
+			{
+				//Destroy DATA
+				GetData()[i].~DATA();
+
+				num_allocated_handles++;
+			}
+		}
+		if (num_allocated_handles > 0)
+		{
+			core::LogWarning("Concurrent pool still has some allocated handles <%zu>, force deleted all handles", num_allocated_handles);
+		}
+	}
+
+	template<typename HANDLE>
+	inline void ConcurrentHandlePool<HANDLE>::Init(size_t max_size, size_t init_size)
+	{
+		assert(max_size <= kEndSlot);
+		assert(init_size <= max_size);
+		m_max_size = max_size;
+
+		m_data = std::make_unique<VirtualBuffer>(max_size * sizeof(DATA));
+		m_generations = std::make_unique<VirtualBuffer>(max_size * sizeof(uint32_t));
+		m_next_free_slots = std::make_unique<VirtualBuffer>(max_size * sizeof(uint32_t));
+		m_caches = std::make_unique<Cache[]>(kNumCaches);
+		m_capacity = 0;
+		m_global_free_head = kEndSlot;
+
+		if (init_size > 0)
+		{
+			//Commit the first slots and add them to the global stack
+			core::MutexGuard guard(m_grow_mutex);
+			m_data->SetCommitedSize(init_size * sizeof(DATA));
+			m_generations->SetCommitedSize(init_size * sizeof(uint32_t));
+			m_next_free_slots->SetCommitedSize(init_size * sizeof(uint32_t));
+			for (size_t i = 0; i < init_size; ++i)
+			{
+				new (&GetGenerations()[i]) std::atomic<uint32_t>(0);
+				new (&GetNextFreeSlots()[i]) std::atomic<uint32_t>(static_cast<uint32_t>(i + 1));
+			}
+			m_capacity = init_size;
+			PushGlobal(0, static_cast<uint32_t>(init_size - 1));
+		}
+	}
+
+	template<typename HANDLE>
+	inline void ConcurrentHandlePool<HANDLE>::PushGlobal(uint32_t first_slot, uint32_t last_slot)
+	{
+		uint64_t head = m_global_free_head.load(std::memory_order_relaxed);
+		uint64_t new_head;
+		do
+		{
+			GetNextFreeSlots()[last_slot].store(static_cast<uint32_t>(head & 0xFFFFFFFF), std::memory_order_relaxed);
+			new_head = (((head >> 32) + 1) << 32) | first_slot;
+		} while (!m_global_free_head.compare_exchange_weak(head, new_head, std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	template<typename HANDLE>
+	inline uint32_t ConcurrentHandlePool<HANDLE>::PopGlobal()
+	{
+		uint64_t head = m_global_free_head.load(std::memory_order_acquire);
+		uint64_t new_head;
+		do
+		{
+			const uint32_t slot = static_cast<uint32_t>(head & 0xFFFFFFFF);
+			if (slot == kEndSlot)
+			{
+				return kEndSlot;
+			}
+			//The next can be stale if other thread popped the slot, then the tag makes the exchange fail
+			new_head = (((head >> 32) + 1) << 32) | GetNextFreeSlots()[slot].load(std::memory_order_relaxed);
+		} while (!m_global_free_head.compare_exchange_weak(head, new_head, std::memory_order_acquire, std::memory_order_acquire));
+
+		return static_cast<uint32_t>(head & 0xFFFFFFFF);
+	}
+
+	template<typename HANDLE>
+	inline uint32_t ConcurrentHandlePool<HANDLE>::PopGlobalOrGrow()
+	{
+		uint32_t slot = PopGlobal();
+		while (slot == kEndSlot)
+		{
+			core::MutexGuard guard(m_grow_mutex);
+
+			//Other thread could have grown the pool already
+			slot = PopGlobal();
+			if (slot != kEndSlot)
+				break;
+
+			//Recover the slots cached by threads that exited before growing
+			if (ReclaimOrphanCaches())
+			{
+				slot = PopGlobal();
+				if (slot != kEndSlot)
+					break;
+			}
+
+			const size_t old_capacity = m_capacity.load(std::memory_order_relaxed);
+			const size_t new_capacity = std::min(m_max_size, std::max<size_t>(old_capacity * 2, kCacheSize));
+			if (old_capacity >= new_capacity)
+			{
+				//No more free handles, error
+				core::LogError("Concurrent pool is out of handles, max size <%zu>", m_max_size);
+				throw std::runtime_error("Out of handles");
+			}
+
+			m_data->SetCommitedSize(new_capacity * sizeof(DATA));
+			m_generations->SetCommitedSize(new_capacity * sizeof(uint32_t));
+			m_next_free_slots->SetCommitedSize(new_capacity * sizeof(uint32_t));
+			for (size_t i = old_capacity; i < new_capacity; ++i)
+			{
+				new (&GetGenerations()[i]) std::atomic<uint32_t>(0);
+				new (&GetNextFreeSlots()[i]) std::atomic<uint32_t>(static_cast<uint32_t>(i + 1));
+			}
+			m_capacity.store(new_capacity, std::memory_order_release);
+
+			//Keep the first new slot and share the rest
+			slot = static_cast<uint32_t>(old_capacity);
+			if (old_capacity + 1 < new_capacity)
+			{
+				PushGlobal(static_cast<uint32_t>(old_capacity + 1), static_cast<uint32_t>(new_capacity - 1));
+			}
+		}
+		return slot;
+	}
+
+	template<typename HANDLE>
+	inline bool ConcurrentHandlePool<HANDLE>::ReclaimOrphanCaches()
+	{
+		bool reclaimed = false;
+		std::atomic<uint32_t>* owners = internal::GetThreadCacheOwners();
+		for (size_t i = 0; i < kNumCaches; ++i)
+		{
+			Cache& cache = m_caches[i];
+			if (owners[i].load(std::memory_order_acquire) == 0 && !cache.busy.test_and_set(std::memory_order_acquire))
+			{
+				if (cache.count > 0)
+				{
+					//Link all the cached slots and push them with only one exchange
+					for (size_t j = 0; j + 1 < cache.count; ++j)
+					{
+						GetNextFreeSlots()[cache.slots[j]].store(cache.slots[j + 1], std::memory_order_relaxed);
+					}
+					PushGlobal(cache.slots[0], cache.slots[cache.count - 1]);
+					cache.count = 0;
+					reclaimed = true;
+				}
+				cache.busy.clear(std::memory_order_release);
+			}
+		}
+		return reclaimed;
+	}
+
+	template<typename HANDLE>
+	template<typename ...Args>
+	inline HANDLE ConcurrentHandlePool<HANDLE>::Alloc(Args&& ...args)
+	{
+		uint32_t slot = kEndSlot;
+		Cache& cache = m_caches[GetThreadCacheIndex()];
+
+		if (!cache.busy.test_and_set(std::memory_order_acquire))
+		{
+			if (cache.count == 0)
+			{
+				//Refill the cache with a batch from the global stack
+				cache.slots[cache.count++] = PopGlobalOrGrow();
+				while (cache.count < kBatchSize)
+				{
+					const uint32_t free_slot = PopGlobal();
+					if (free_slot == kEndSlot)
+						break;
+					cache.slots[cache.count++] = free_slot;
+				}
+			}
+			slot = cache.slots[--cache.count];
+			cache.busy.clear(std::memory_order_release);
+		}
+		else
+		{
+			//Other thread is using the same cache, go directly to the global stack
+			slot = PopGlobalOrGrow();
+		}
+		cache.live.fetch_add(1, std::memory_order_relaxed);
+
+		//Create DATA
+		new(&GetData()[slot]) DATA(std::forward<Args>(args)...);
+
+		return HANDLE(Accessor::MakeIndex(slot, static_cast<TYPE>(GetGenerations()[slot].load(std::memory_order_relaxed))));
+	}
+
+	template<typename HANDLE>
+	inline void ConcurrentHandlePool<HANDLE>::Free(HANDLE& handle)
+	{
+		if (handle.IsValid())
+		{
+			if (!IsAlive(handle))
+			{
+				//The slot has been already freed, freeing it again will corrupt the free lists
+				core::LogError("Handle <%i> has been already freed", static_cast<int>(handle.GetSlot()));
+				handle.m_index = HANDLE::kInvalid;
+				return;
+			}
+
+			const uint32_t slot = handle.GetSlot();
+
+			//Destroy DATA
+			GetData()[slot].~DATA();
+
+			//Next generation, all the handles to the old one are stale
+			const uint32_t generation = GetGenerations()[slot].load(std::memory_order_relaxed);
+			GetGenerations()[slot].store((generation + 1) & Accessor::kGenerationMask, std::memory_order_release);
+
+			Cache& cache = m_caches[GetThreadCacheIndex()];
+			if (!cache.busy.test_and_set(std::memory_order_acquire))
+			{
+				if (cache.count == kCacheSize)
+				{
+					//Flush a batch to the global stack, linked before pushing it with only one exchange
+					const size_t first_index = kCacheSize - kBatchSize;
+					for (size_t i = first_index; i < kCacheSize - 1; ++i)
+					{
+						GetNextFreeSlots()[cache.slots[i]].store(cache.slots[i + 1], std::memory_order_relaxed);
+					}
+					PushGlobal(cache.slots[first_index], cache.slots[kCacheSize - 1]);
+					cache.count = first_index;
+				}
+				cache.slots[cache.count++] = slot;
+				cache.busy.clear(std::memory_order_release);
+			}
+			else
+			{
+				PushGlobal(slot, slot);
+			}
+			cache.live.fetch_sub(1, std::memory_order_relaxed);
+
+			//Reset handle to an invalid, it will avoid it keep the index
+			handle.m_index = HANDLE::kInvalid;
+		}
+	}
+}
+
+#endif //CONCURRENT_HANDLE_POOL_H_
@@ -0,0 +1,408 @@
+//////////////////////////////////////////////////////////////////////////
+// Cute engine - Lock free ring buffers for sending data between threads
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef CONCURRENT_RING_BUFFER_H_
+#define CONCURRENT_RING_BUFFER_H_
+
+#include <core/sync.h>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+
+namespace core
+{
+	//Bounded multiple producers and multiple consumers ring buffer
+	//Each slot has a sequence number, it tells if the slot is ready to be written or read for the current lap
+	//Producers and consumers only share the slot they are accessing, they reserve it with a CAS in the tail or head
+	template <typename DATA, size_t SIZE>
+	class MPMCRingBuffer
+	{
+	public:
+		using DataType = DATA;
+
+		MPMCRingBuffer();
+		~MPMCRingBuffer();
+
+		MPMCRingBuffer(const MPMCRingBuffer&) = delete;
+		MPMCRingBuffer& operator=(const MPMCRingBuffer&) = delete;
+
+		//Emplace to the tail, returns false if it is full
+		template<typename ...Args>
+		bool try_emplace(Args&&... args);
+
+		//Pop the head, returns false if it is empty
+		bool try_pop(DATA& data);
+
+		//Approximated, other threads can be pushing or popping
+		bool empty() const
+		{
+			return m_head_index.load(std::memory_order_relaxed) >= m_tail_index.load(std::memory_order_relaxed);
+		}
+
+	private:
+		static_assert(SIZE >= 2 && (SIZE & (SIZE - 1)) == 0, "Size needs to be a power of two");
+		static constexpr size_t kMask = SIZE - 1;
+
+		struct Slot
+		{
+			std::atomic<size_t> sequence;
+			typename std::aligned_storage<sizeof(DATA), alignof(DATA)>::type data;
+		};
+
+		//Indexes, each one in a different cache line
+		alignas(64) std::atomic<size_t> m_tail_index;
+		alignas(64) std::atomic<size_t> m_head_index;
+
+		//Slots
+		alignas(64) std::array<Slot, SIZE> m_buffer;
+	};
+
+	//Bounded single producer and single consumer ring buffer
+	//Same interface as MPMCRingBuffer, only one thread can push and only one thread can pop
+	template <typename DATA, size_t SIZE>
+	class SPSCRingBuffer
+	{
+	public:
+		using DataType = DATA;
+
+		SPSCRingBuffer();
+		~SPSCRingBuffer();
+
+		SPSCRingBuffer(const SPSCRingBuffer&) = delete;
+		SPSCRingBuffer& operator=(const SPSCRingBuffer&) = delete;
+
+		//Emplace to the tail, returns false if it is full
+		template<typename ...Args>
+		bool try_emplace(Args&&... args);
+
+		//Pop the head, returns false if it is empty
+		bool try_pop(DATA& data);
+
+		//Approximated, other threads can be pushing or popping
+		bool empty() const
+		{
+			return m_head_index.load(std::memory_order_relaxed) == m_tail_index.load(std::memory_order_relaxed);
+		}
+
+	private:
+		static_assert(SIZE >= 2 && (SIZE & (SIZE - 1)) == 0, "Size needs to be a power of two");
+		static constexpr size_t kMask = SIZE - 1;
+
+		//Producer side, it keeps a copy of the head so it doesn't need to read the consumer cache line each push
+		alignas(64) std::atomic<size_t> m_tail_index;
+		size_t m_cached_head_index;
+
+		//Consumer side, it keeps a copy of the tail
+		alignas(64) std::atomic<size_t> m_head_index;
+		size_t m_cached_tail_index;
+
+		//Data
+		alignas(64) std::array<typename std::aligned_storage<sizeof(DATA), alignof(DATA)>::type, SIZE> m_buffer;
+	};
+
+	//Adds blocking push and pop to a MPMCRingBuffer or SPSCRingBuffer
+	//It only parks the thread when the ring buffer is empty or full, the fast path is lock free
+	template <typename RING_BUFFER>
+	class BlockingRingBuffer
+	{
+	public:
+		//Push to the tail, waits if the ring buffer is full
+		template<typename ...Args>
+		void push(Args&&... args);
+
+		//Pop the head, waits if the ring buffer is empty
+		//Returns false if the ring buffer has been closed and it is empty
+		bool pop(typename RING_BUFFER::DataType& data);
+
+		//Wake all waiting threads, pops will fail when the ring buffer is empty
+		void close();
+
+		bool closed() const
+		{
+			return m_closed.load(std::memory_order_acquire);
+		}
+
+		//Access to the non blocking interface
+		RING_BUFFER& GetRingBuffer()
+		{
+			return m_ring_buffer;
+		}
+
+	private:
+		//Number of tries before parking the thread
+		static constexpr size_t kSpinCount = 64;
+
+		struct Parking
+		{
+			core::Mutex mutex;
+			std::condition_variable condition_variable;
+			std::atomic<size_t> num_waiting = 0;
+
+			//Spin a little and park until try_function returns true
+			template<typename FUNCTION>
+			void Wait(FUNCTION&& try_function);
+
+			//Wake one parked thread or all of them, cheap if nobody is waiting
+			void Wake(bool all = false);
+		};
+
+		RING_BUFFER m_ring_buffer;
+		std::atomic_bool m_closed = false;
+
+		//Consumers waiting for data and producers waiting for space
+		Parking m_not_empty;
+		Parking m_not_full;
+	};
+
+	template<typename DATA, size_t SIZE>
+	inline MPMCRingBuffer<DATA, SIZE>::MPMCRingBuffer()
+	{
+		for (size_t i = 0; i < SIZE; ++i)
+		{
+			m_buffer[i].sequence.store(i, std::memory_order_relaxed);
+		}
+		m_tail_index.store(0, std::memory_order_relaxed);
+		m_head_index.store(0, std::memory_order_relaxed);
+	}
+
+	template<typename DATA, size_t SIZE>
+	inline MPMCRingBuffer<DATA, SIZE>::~MPMCRingBuffer()
+	{
+		//Destroy the data still in the ring buffer
+		const size_t tail = m_tail_index.load(std::memory_order_acquire);
+		for (size_t head = m_head_index.load(std::memory_order_acquire); head != tail; ++head)
+		{
+			reinterpret_cast<DATA*>(&m_buffer[head & kMask].data)->~DATA();
+		}
+	}
+
+	template<typename DATA, size_t SIZE>
+	template<typename ...Args>
+	inline bool MPMCRingBuffer<DATA, SIZE>::try_emplace(Args&& ...args)
+	{
+		size_t tail = m_tail_index.load(std::memory_order_relaxed);
+		while (true)
+		{
+			Slot& slot = m_buffer[tail & kMask];
+			const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+			const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(tail);
+			if (diff == 0)
+			{
+				//The slot is free for this lap, try to reserve it
+				if (m_tail_index.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed))
+				{
+					new(&slot.data) DATA(std::forward<Args>(args)...);
+
+					//Ready to be read
+					slot.sequence.store(tail + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0)
+			{
+				//The slot still has data from the last lap, full
+				return false;
+			}
+			else
+			{
+				//Other producer got it
+				tail = m_tail_index.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	template<typename DATA, size_t SIZE>
+	inline bool MPMCRingBuffer<DATA, SIZE>::try_pop(DATA& data)
+	{
+		size_t head = m_head_index.load(std::memory_order_relaxed);
+		while (true)
+		{
+			Slot& slot = m_buffer[head & kMask];
+			const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+			const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(head + 1);
+			if (diff == 0)
+			{
+				//The slot has data for this lap, try to reserve it
+				if (m_head_index.compare_exchange_weak(head, head + 1, std::memory_order_relaxed))
+				{
+					DATA* slot_data = reinterpret_cast<DATA*>(&slot.data);
+					data = std::move(*slot_data);
+					slot_data->~DATA();
+
+					//Ready to be written in the next lap
+					slot.sequence.store(head + SIZE, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0)
+			{
+				//The slot has not been written yet, empty
+				return false;
+			}
+			else
+			{
+				//Other consumer got it
+				head = m_head_index.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	template<typename DATA, size_t SIZE>
+	inline SPSCRingBuffer<DATA, SIZE>::SPSCRingBuffer()
+	{
+		m_tail_index.store(0, std::memory_order_relaxed);
+		m_cached_head_index = 0;
+		m_head_index.store(0, std::memory_order_relaxed);
+		m_cached_tail_index = 0;
+	}
+
+	template<typename DATA, size_t SIZE>
+	inline SPSCRingBuffer<DATA, SIZE>::~SPSCRingBuffer()
+	{
+		//Destroy the data still in the ring buffer
+		const size_t tail = m_tail_index.load(std::memory_order_acquire);
+		for (size_t head = m_head_index.load(std::memory_order_acquire); head != tail; ++head)
+		{
+			reinterpret_cast<DATA*>(&m_buffer[head & kMask])->~DATA();
+		}
+	}
+
+	template<typename DATA, size_t SIZE>
+	template<typename ...Args>
+	inline bool SPSCRingBuffer<DATA, SIZE>::try_emplace(Args&& ...args)
+	{
+		const size_t tail = m_tail_index.load(std::memory_order_relaxed);
+		if (tail - m_cached_head_index == SIZE)
+		{
+			//Looks full, check the real head
+			m_cached_head_index = m_head_index.load(std::memory_order_acquire);
+			if (tail - m_cached_head_index == SIZE)
+			{
+				return false;
+			}
+		}
+
+		new(&m_buffer[tail & kMask]) DATA(std::forward<Args>(args)...);
+
+		m_tail_index.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	template<typename DATA, size_t SIZE>
+	inline bool SPSCRingBuffer<DATA, SIZE>::try_pop(DATA& data)
+	{
+		const size_t head = m_head_index.load(std::memory_order_relaxed);
+		if (head == m_cached_tail_index)
+		{
+			//Looks empty, check the real tail
+			m_cached_tail_index = m_tail_index.load(std::memory_order_acquire);
+			if (head == m_cached_tail_index)
+			{
+				return false;
+			}
+		}
+
+		DATA* slot_data = reinterpret_cast<DATA*>(&m_buffer[head & kMask]);
+		data = std::move(*slot_data);
+		slot_data->~DATA();
+
+		m_head_index.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	template<typename RING_BUFFER>
+	template<typename FUNCTION>
+	inline void BlockingRingBuffer<RING_BUFFER>::Parking::Wait(FUNCTION&& try_function)
+	{
+		for (size_t spin_count = 0; spin_count < kSpinCount; ++spin_count)
+		{
+			if (try_function())
+				return;
+
+			//Same as the spin lock, pause first and later give the core to the other side
+			if (spin_count < 16)
+				_mm_pause();
+			else
+				std::this_thread::yield();
+		}
+
+		std::unique_lock<core::Mutex> lock(mutex);
+		while (true)
+		{
+			//Register as waiting before checking again, a wake from now will need the mutex
+			num_waiting.fetch_add(1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+
+			if (try_function())
+			{
+				num_waiting.fetch_sub(1, std::memory_order_relaxed);
+				return;
+			}
+
+			condition_variable.wait(lock);
+			num_waiting.fetch_sub(1, std::memory_order_relaxed);
+		}
+	}
+
+	template<typename RING_BUFFER>
+	inline void BlockingRingBuffer<RING_BUFFER>::Parking::Wake(bool all)
+	{
+		//Pairs with the fence in Wait, or the waiting thread sees the change or we see the waiting thread
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (num_waiting.load(std::memory_order_relaxed) > 0)
+		{
+			{
+				//The waiting thread is inside the wait or it has not checked yet
+				core::MutexGuard guard(mutex);
+			}
+			(all) ? condition_variable.notify_all() : condition_variable.notify_one();
+		}
+	}
+
+	template<typename RING_BUFFER>
+	template<typename ...Args>
+	inline void BlockingRingBuffer<RING_BUFFER>::push(Args&& ...args)
+	{
+		if (!m_ring_buffer.try_emplace(std::forward<Args>(args)...))
+		{
+			m_not_full.Wait([&]()
+				{
+					return m_ring_buffer.try_emplace(std::forward<Args>(args)...);
+				});
+		}
+		m_not_empty.Wake();
+	}
+
+	template<typename RING_BUFFER>
+	inline bool BlockingRingBuffer<RING_BUFFER>::pop(typename RING_BUFFER::DataType& data)
+	{
+		bool popped = false;
+		m_not_empty.Wait([&]()
+			{
+				popped = m_ring_buffer.try_pop(data);
+				return popped || closed();
+			});
+
+		if (!popped)
+		{
+			//Closed, but it could have been closed after a push
+			popped = m_ring_buffer.try_pop(data);
+		}
+		if (popped)
+		{
+			m_not_full.Wake();
+		}
+		return popped;
+	}
+
+	template<typename RING_BUFFER>
+	inline void BlockingRingBuffer<RING_BUFFER>::close()
+	{
+		m_closed.store(true, std::memory_order_release);
+		m_not_empty.Wake(true);
+	}
+}
+
+#endif //CONCURRENT_RING_BUFFER_H_
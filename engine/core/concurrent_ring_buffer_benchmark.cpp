@@ -0,0 +1,128 @@
+//////////////////////////////////////////////////////////////////////////
+// Cute engine - Benchmark of the concurrent ring buffers against a mutex queue
+//////////////////////////////////////////////////////////////////////////
+
+#include <benchmark/benchmark.h>
+#include <core/concurrent_ring_buffer.h>
+#include <core/log.h>
+#include <core/sync.h>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	//Mutex and condition variable queue, used as reference in the ring buffer benchmark
+	class MutexQueue
+	{
+	public:
+		void push(uint64_t value)
+		{
+			{
+				core::MutexGuard guard(m_mutex);
+				m_queue.push(value);
+			}
+			m_condition_variable.notify_one();
+		}
+
+		bool pop(uint64_t& value)
+		{
+			std::unique_lock<core::Mutex> lock(m_mutex);
+			m_condition_variable.wait(lock, [this]() { return !m_queue.empty() || m_closed; });
+			if (m_queue.empty())
+				return false;
+			value = m_queue.front();
+			m_queue.pop();
+			return true;
+		}
+
+		void close()
+		{
+			{
+				core::MutexGuard guard(m_mutex);
+				m_closed = true;
+			}
+			m_condition_variable.notify_all();
+		}
+	private:
+		core::Mutex m_mutex;
+		std::condition_variable m_condition_variable;
+		std::queue<uint64_t> m_queue;
+		bool m_closed = false;
+	};
+
+	//Returns millions of items per second sent from the producers to one consumer
+	template<typename QUEUE>
+	double BenchmarkQueue(size_t num_producers, size_t num_items_per_producer)
+	{
+		auto queue = std::make_unique<QUEUE>();
+		uint64_t checksum = 0;
+
+		auto begin = std::chrono::high_resolution_clock::now();
+
+		std::thread consumer([&]()
+			{
+				uint64_t value;
+				while (queue->pop(value))
+				{
+					checksum += value;
+				}
+			});
+
+		std::vector<std::thread> producers;
+		for (size_t i = 0; i < num_producers; ++i)
+		{
+			producers.emplace_back([&]()
+				{
+					for (uint64_t value = 0; value < num_items_per_producer; ++value)
+					{
+						queue->push(value);
+					}
+				});
+		}
+
+		for (auto& producer : producers)
+		{
+			producer.join();
+		}
+		queue->close();
+		consumer.join();
+
+		const double elapsed_s = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - begin).count();
+
+		if (checksum != num_producers * (num_items_per_producer * (num_items_per_producer - 1) / 2))
+		{
+			core::LogError("Queue benchmark with <%zu> producers returned wrong results", num_producers);
+		}
+
+		return static_cast<double>(num_producers * num_items_per_producer) / (elapsed_s * 1000000.0);
+	}
+}
+
+namespace benchmark
+{
+	void BenchmarkRingBuffers(const Context& context)
+	{
+		const size_t num_items_per_producer = context.quick ? 10000 : 1000000;
+		constexpr size_t kRingBufferSize = 1024;
+
+		for (size_t num_producers : {1, 2, 4, 8})
+		{
+			const double mutex_queue = BenchmarkQueue<MutexQueue>(num_producers, num_items_per_producer);
+			const double mpmc_ring_buffer = BenchmarkQueue<core::BlockingRingBuffer<core::MPMCRingBuffer<uint64_t, kRingBufferSize>>>(num_producers, num_items_per_producer);
+
+			if (num_producers == 1)
+			{
+				const double spsc_ring_buffer = BenchmarkQueue<core::BlockingRingBuffer<core::SPSCRingBuffer<uint64_t, kRingBufferSize>>>(num_producers, num_items_per_producer);
+				core::LogInfo("Queue benchmark <%zu> producers: mutex queue %.2fM items/s, MPMC ring buffer %.2fM items/s, SPSC ring buffer %.2fM items/s", num_producers, mutex_queue, mpmc_ring_buffer, spsc_ring_buffer);
+			}
+			else
+			{
+				core::LogInfo("Queue benchmark <%zu> producers: mutex queue %.2fM items/s, MPMC ring buffer %.2fM items/s", num_producers, mutex_queue, mpmc_ring_buffer);
+			}
+		}
+	}
+}
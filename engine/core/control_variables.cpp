@@ -66,7 +66,7 @@ namespace
 		}
 
 		//Look for the group
-		auto& group_it = g_control_variables->Find(group_name);
+		auto group_it = g_control_variables->Find(group_name);
 
 		if (!group_it)
 		{
@@ -238,12 +238,12 @@ namespace core
 		if (ImGui::Begin("Control Variables", &activated))
 		{
 			//Add tree node for each group
-			for (auto& control_variable_group : *g_control_variables)
+			for (auto control_variable_group : *g_control_variables)
 			{
 				if (ImGui::TreeNode(control_variable_group.first.GetValue()))
 				{
 					//Add a slot for each variable
-					for (auto& control_variable : control_variable_group.second.control_variables)
+					for (auto control_variable : control_variable_group.second.control_variables)
 					{
 						std::visit(
 							overloaded
@@ -82,7 +82,7 @@ namespace core
 
 		//Look for the group
 		auto& group_map = (type == CounterType::Main) ? g_counter_manager->main_groups : g_counter_manager->render_groups;
-		auto& group_it = group_map.Find(group);
+		auto group_it = group_map.Find(group);
 
 		if (!group_it)
 		{
@@ -90,7 +90,7 @@ namespace core
 			group_it = group_map.Insert(group);
 		}
 
-		auto& counter_it = group_it->counters.Find(name);
+		auto counter_it = group_it->counters.Find(name);
 		if (counter_it)
 		{
 			core::LogError("Counter <%s> is already defined in the group <%s>", name.GetValue(), group.GetValue());
@@ -127,16 +127,16 @@ namespace core
 		g_counter_manager->GetAtomic(atomic_index).fetch_add(value);
 	}
 
-	void core::UpdateCountersMain()
+	void UpdateCountersMain()
 	{
 		if (g_counter_manager)
 		{
 			g_counter_manager->main_index = (g_counter_manager->main_index + 1) % 2;
 
 			//Reset counters if needed
-			for (auto& group : g_counter_manager->main_groups)
+			for (auto group : g_counter_manager->main_groups)
 			{
-				for (auto& counter : group.second.counters_reset)
+				for (auto counter : group.second.counters_reset)
 				{
 					counter.second.atomics[g_counter_manager->main_index]->exchange(0);
 				}
@@ -144,16 +144,16 @@ namespace core
 		}
 	}
 
-	void core::UpdateCountersRender()
+	void UpdateCountersRender()
 	{
 		if (g_counter_manager)
 		{
 			g_counter_manager->render_index = (g_counter_manager->render_index + 1) % 2;
 
 			//Reset counters if needed
-			for (auto& group : g_counter_manager->render_groups)
+			for (auto group : g_counter_manager->render_groups)
 			{
-				for (auto& counter : group.second.counters_reset)
+				for (auto counter : group.second.counters_reset)
 				{
 					counter.second.atomics[g_counter_manager->render_index]->exchange(0);
 				}
@@ -161,7 +161,7 @@ namespace core
 		}
 	}
 
-	bool core::RenderCounters()
+	bool RenderCounters()
 	{
 		if (!g_counter_manager)
 			return false;
@@ -175,17 +175,17 @@ namespace core
 			size_t render_frame = (g_counter_manager->render_index + 1) % 2;
 
 			//Add tree node for each group
-			for (auto& counter_group : g_counter_manager->main_groups)
+			for (auto counter_group : g_counter_manager->main_groups)
 			{
 				if (ImGui::TreeNode(counter_group.first.GetValue()))
 				{
 					//Add a slot for each variable
-					for (auto& counter : counter_group.second.counters)
+					for (auto counter : counter_group.second.counters)
 					{
 						uint32_t value = counter.second.atomic->load();
 						ImGui::Text("%s = %u", counter.first.GetValue(), value);
 					}
-					for (auto& counter : counter_group.second.counters_reset)
+					for (auto counter : counter_group.second.counters_reset)
 					{
 						uint32_t value = counter.second.atomics[main_frame]->load();
 						ImGui::Text("%s = %u", counter.first.GetValue(), value);
@@ -193,17 +193,17 @@ namespace core
 					ImGui::TreePop();
 				}
 			}
-			for (auto& counter_group : g_counter_manager->render_groups)
+			for (auto counter_group : g_counter_manager->render_groups)
 			{
 				if (ImGui::TreeNode(counter_group.first.GetValue()))
 				{
 					//Add a slot for each variable
-					for (auto& counter : counter_group.second.counters)
+					for (auto counter : counter_group.second.counters)
 					{
 						uint32_t value = counter.second.atomic->load();
 						ImGui::Text("%s = %u", counter.first.GetValue(), value);
 					}
-					for (auto& counter : counter_group.second.counters_reset)
+					for (auto counter : counter_group.second.counters_reset)
 					{
 						uint32_t value = counter.second.atomics[render_frame]->load();
 						ImGui::Text("%s = %u", counter.first.GetValue(), value);
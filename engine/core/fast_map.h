@@ -17,23 +17,23 @@ namespace core
 	public:
 
 		//Accesor helper
-		template<typename DATA>
+		template<typename ACCESOR_DATA>
 		class Accesor
 		{
 		public:
-			DATA* operator->()
+			ACCESOR_DATA* operator->()
 			{
 				assert(m_data);
 				return m_data;
 			}
 
-			DATA& operator*()&
+			ACCESOR_DATA& operator*()&
 			{
 				assert(m_data);
 				return *m_data;
 			}
 
-			DATA&& operator*()&&
+			ACCESOR_DATA&& operator*()&&
 			{
 				assert(m_data);
 				return *m_data;
@@ -44,23 +44,23 @@ namespace core
 				return m_data != nullptr;
 			}
 
-			Accesor(DATA* data) : m_data(data)
+			Accesor(ACCESOR_DATA* data) : m_data(data)
 			{
 			}
 
-			Accesor<DATA> operator=(DATA& data)
+			Accesor<ACCESOR_DATA> operator=(ACCESOR_DATA& data)
 			{
 				assert(m_data);
-				m_data = data;
+				m_data = &data;
 				return *this;
 			}
 
 		private:
-			DATA* m_data;
+			ACCESOR_DATA* m_data;
 		};
 
 
-		template<typename KEY, typename DATA>
+		template<typename ITERATOR_KEY, typename ITERATOR_DATA>
 		class Iterator
 		{
 		public:
@@ -69,9 +69,9 @@ namespace core
 			{
 			}
 
-			std::pair<KEY&, DATA&> operator*()
+			std::pair<ITERATOR_KEY&, ITERATOR_DATA&> operator*()
 			{
-				return std::pair<KEY&, DATA&>(m_fast_map->m_key[m_index], *reinterpret_cast<DATA*>(&m_fast_map->m_data[m_index]));
+				return std::pair<ITERATOR_KEY&, ITERATOR_DATA&>(m_fast_map->m_key[m_index], *reinterpret_cast<ITERATOR_DATA*>(&m_fast_map->m_data[m_index]));
 			}
 
 			bool operator!= (const Iterator & other) const
@@ -350,7 +350,7 @@ namespace core
 
 	template<typename KEY, typename DATA>
 	template< class... ARGS >
-	inline FastMap<KEY, DATA>::Accesor<DATA> FastMap<KEY, DATA>::Insert(const KEY& key, ARGS&&... args)
+	inline typename FastMap<KEY, DATA>::template Accesor<DATA> FastMap<KEY, DATA>::Insert(const KEY& key, ARGS&&... args)
 	{
 		auto index = GetIndex(key);
 
@@ -387,7 +387,7 @@ namespace core
 
 
 	template<typename KEY, typename DATA>
-	inline FastMap<KEY, DATA>::Accesor<const DATA> FastMap<KEY, DATA>::Find(const KEY& key) const
+	inline typename FastMap<KEY, DATA>::template Accesor<const DATA> FastMap<KEY, DATA>::Find(const KEY& key) const
 	{
 		auto index = GetIndex(key);
 
@@ -403,7 +403,7 @@ namespace core
 	}
 
 	template<typename KEY, typename DATA>
-	inline FastMap<KEY, DATA>::Accesor<DATA> FastMap<KEY, DATA>::Find(const KEY& key)
+	inline typename FastMap<KEY, DATA>::template Accesor<DATA> FastMap<KEY, DATA>::Find(const KEY& key)
 	{
 		auto index = GetIndex(key);
 
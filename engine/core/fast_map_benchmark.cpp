@@ -0,0 +1,96 @@
+//////////////////////////////////////////////////////////////////////////
+// Cute engine - Benchmark of the fast map against the SIMD fast map
+//////////////////////////////////////////////////////////////////////////
+
+#include <benchmark/benchmark.h>
+#include <core/fast_map.h>
+#include <core/simd_fast_map.h>
+#include <core/string_hash.h>
+#include <core/log.h>
+#include <cstdio>
+#include <vector>
+
+namespace
+{
+	//Same key type as the render resource names, the render maps are the main users of the fast maps
+	using BenchmarkResourceName = StringHash32<"BenchmarkResourceName"_namespace>;
+
+	constexpr size_t kNumFindIterations = 16;
+
+	//Measure insert and find, the times are accumulated in microseconds
+	template<typename MAP>
+	void BenchmarkFastMap(const std::vector<BenchmarkResourceName>& keys, size_t num_keys, double& insert_time, double& find_time, double& miss_time)
+	{
+		MAP map;
+		insert_time += benchmark::Measure(1, [&]()
+			{
+				for (size_t i = 0; i < num_keys; ++i)
+				{
+					map.Insert(keys[i], static_cast<uint32_t>(i));
+				}
+			});
+
+		uint32_t checksum = 0;
+		find_time += benchmark::Measure(1, [&]()
+			{
+				for (size_t iteration = 0; iteration < kNumFindIterations; ++iteration)
+				{
+					for (size_t i = 0; i < num_keys; ++i)
+					{
+						auto data = map.Find(keys[i]);
+						checksum += *data;
+					}
+				}
+			});
+
+		//The second half of the keys is never inserted
+		size_t num_misses = 0;
+		miss_time += benchmark::Measure(1, [&]()
+			{
+				for (size_t iteration = 0; iteration < kNumFindIterations; ++iteration)
+				{
+					for (size_t i = num_keys; i < 2 * num_keys; ++i)
+					{
+						num_misses += map.Find(keys[i]) ? 0 : 1;
+					}
+				}
+			});
+
+		if (checksum != kNumFindIterations * (num_keys * (num_keys - 1) / 2) || num_misses != kNumFindIterations * num_keys)
+		{
+			core::LogError("Fast map benchmark with <%zu> keys returned wrong results", num_keys);
+		}
+	}
+}
+
+namespace benchmark
+{
+	void BenchmarkFastMaps(const Context& context)
+	{
+		const size_t num_iterations = context.quick ? 1 : 8;
+
+		for (size_t num_keys : {64, 1024, 16384})
+		{
+			std::vector<BenchmarkResourceName> keys;
+			keys.reserve(2 * num_keys);
+			for (size_t i = 0; i < 2 * num_keys; ++i)
+			{
+				char buffer[64];
+				snprintf(buffer, sizeof(buffer), "BenchmarkResource_%zu", i);
+				keys.emplace_back(buffer);
+			}
+
+			double fast_map_times[3] = {};
+			double simd_fast_map_times[3] = {};
+			for (size_t iteration = 0; iteration < num_iterations; ++iteration)
+			{
+				BenchmarkFastMap<core::FastMap<BenchmarkResourceName, uint32_t>>(keys, num_keys, fast_map_times[0], fast_map_times[1], fast_map_times[2]);
+				BenchmarkFastMap<core::SIMDFastMap<BenchmarkResourceName, uint32_t>>(keys, num_keys, simd_fast_map_times[0], simd_fast_map_times[1], simd_fast_map_times[2]);
+			}
+
+			const double to_ms = 1.0 / (1000.0 * static_cast<double>(num_iterations));
+			core::LogInfo("Fast map benchmark <%zu> keys: insert %.3fms, find %.3fms, miss %.3fms", num_keys, fast_map_times[0] * to_ms, fast_map_times[1] * to_ms, fast_map_times[2] * to_ms);
+			core::LogInfo("SIMD fast map benchmark <%zu> keys: insert %.3fms, find %.3fms, miss %.3fms", num_keys, simd_fast_map_times[0] * to_ms, simd_fast_map_times[1] * to_ms, simd_fast_map_times[2] * to_ms);
+		}
+	}
+}
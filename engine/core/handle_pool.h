@@ -10,13 +10,10 @@
 #include <vector>
 #include <algorithm>
 #include <cassert>
+#include <stdexcept>
 #include <core/sync.h>
 #include <set>
 
-#ifdef _DEBUG
-#define WEAKHANDLE_TRACKING
-#endif
-
 namespace core
 {
 	template <typename DATA, typename TYPE>
@@ -25,27 +22,8 @@ namespace core
 	template<typename HANDLE>
 	class HandlePool;
 
-#ifdef WEAKHANDLE_TRACKING
-	struct WeakHandleTracking
-	{
-		void AddWeakReference(size_t index)
-		{
-			core::MutexGuard guard(m_spin_lock_mutex);
-			m_weak_handle_tracking[index]++;
-		}
-
-		void RemoveWeakReference(size_t index)
-		{
-			core::MutexGuard guard(m_spin_lock_mutex);
-			m_weak_handle_tracking[index]--;
-		}
-
-		//Number of weak handles for each index
-		std::vector<size_t> m_weak_handle_tracking;
-		//Spin lock
-		core::Mutex m_spin_lock_mutex;
-	};
-#endif
+	template<typename HANDLE>
+	class ConcurrentHandlePool;
 
 	template <typename DATA, typename TYPE>
 	class HandleAccessor
@@ -55,13 +33,43 @@ namespace core
 		using data_param = DATA;
 
 		//Index inside the handlepool to access the data associated to this handle 
+		//The low bits are the slot and the high bits the generation of the slot when it was allocated
 		TYPE m_index;
 
 		//Invalid handle
 		static const TYPE kInvalid = -1;
 
+		//Small handles keep less bits for the generation, so they still can address enough slots
+		//The generation wraps, a stale handle aliases a live one again after 2^kGenerationBits reuses of its slot
+		//(16 for 16 bits handles, 256 for 32 bits handles), CheckAlive only detects the stale handles before the wrap
+		static constexpr size_t kGenerationBits = (sizeof(TYPE) >= 4) ? 8 : 4;
+		static constexpr size_t kSlotBits = sizeof(TYPE) * 8 - kGenerationBits;
+		static constexpr TYPE kSlotMask = static_cast<TYPE>((static_cast<uint64_t>(1) << kSlotBits) - 1);
+		static constexpr TYPE kGenerationMask = static_cast<TYPE>((static_cast<uint64_t>(1) << kGenerationBits) - 1);
+
+		//Last slot is never used, so a valid handle never is equal to kInvalid
+		static constexpr size_t kMaxSlots = kSlotMask;
+
+		static TYPE MakeIndex(size_t slot, TYPE generation)
+		{
+			assert(slot < kMaxSlots);
+			return static_cast<TYPE>((static_cast<TYPE>(generation & kGenerationMask) << kSlotBits) | slot);
+		}
+
+		TYPE GetSlot() const
+		{
+			return static_cast<TYPE>(m_index & kSlotMask);
+		}
+
+		TYPE GetGeneration() const
+		{
+			return static_cast<TYPE>((m_index >> kSlotBits) & kGenerationMask);
+		}
+
 		template<typename HANDLE>
 		friend class HandlePool;
+		template<typename HANDLE>
+		friend class ConcurrentHandlePool;
 
 		HandleAccessor() : m_index(kInvalid)
 		{
@@ -92,11 +100,6 @@ namespace core
 	{
 		using Accessor = HandleAccessor<DATA, TYPE>;
 
-#ifdef WEAKHANDLE_TRACKING
-		//Access to the pool associated to this handle
-		inline static WeakHandleTracking* s_tracking_pool = nullptr;
-#endif
-
 		//Private, just for the handlepool
 		WeakHandle(TYPE index)
 		{
@@ -106,70 +109,14 @@ namespace core
 		}
 		template<typename HANDLE>
 		friend class HandlePool;
+		template<typename HANDLE>
+		friend class ConcurrentHandlePool;
 
 	public:
 		//Default constructor
 		WeakHandle()
 		{
 		}
-
-#ifdef WEAKHANDLE_TRACKING
-		WeakHandle(const Handle<DATA, TYPE>& a);
-
-		WeakHandle(const WeakHandle & a)
-		{
-			if (Accessor::m_index != Accessor::kInvalid)
-			{
-				s_tracking_pool->RemoveWeakReference(Accessor::m_index);
-			}
-
-			Accessor::m_index = a.m_index;
-
-			if (Accessor::m_index != Accessor::kInvalid)
-			{
-				s_tracking_pool->AddWeakReference(Accessor::m_index);
-			}
-		}
-
-		WeakHandle& operator=(const WeakHandle& a)
-		{
-			if (Accessor::m_index != Accessor::kInvalid)
-			{
-				s_tracking_pool->RemoveWeakReference(Accessor::m_index);
-			}
-
-			Accessor::m_index = a.m_index;
-
-			if (Accessor::m_index != Accessor::kInvalid)
-			{
-				s_tracking_pool->AddWeakReference(Accessor::m_index);
-			}
-
-			return *this;
-		}
-
-		WeakHandle(WeakHandle&& a)
-		{
-			Accessor::m_index = a.m_index;
-			a.m_index = Accessor::kInvalid;
-		}
-
-		WeakHandle& operator=(WeakHandle&& a)
-		{
-			Accessor::m_index = a.m_index;
-			a.m_index = Accessor::kInvalid;
-
-			return *this;
-		}
-
-		~WeakHandle()
-		{
-			if (Accessor::m_index != Accessor::kInvalid)
-			{
-				s_tracking_pool->RemoveWeakReference(Accessor::m_index);
-			}
-		}
-#endif
 	};
 
 	//Handles can only be created from a pool and they can not be copied, only moved
@@ -188,8 +135,10 @@ namespace core
 
 		template<typename HANDLE>
 		friend class HandlePool;
+		template<typename HANDLE>
+		friend class ConcurrentHandlePool;
 
-		template<typename DATA, typename TYPE>
+		template<typename FRIEND_DATA, typename FRIEND_TYPE>
 		friend class WeakHandle;
 
 	public:
@@ -240,9 +189,6 @@ namespace core
 	//Pool of resources
 	template<typename HANDLE>
 	class HandlePool
-#ifdef WEAKHANDLE_TRACKING
-		: public WeakHandleTracking
-#endif
 	{
 		using DATA = typename HANDLE::data_param;
 
@@ -253,13 +199,6 @@ namespace core
 	public:
 		using HandleType = HANDLE;
 
-#ifdef WEAKHANDLE_TRACKING
-		HandlePool()
-		{
-			//Init tracking pool
-			WeakHandle<typename HANDLE::data_param, typename HANDLE::type_param>::s_tracking_pool = this;
-		}
-#endif
 		~HandlePool();
 
 		//Init pool with a list of free slots avaliable
@@ -275,16 +214,20 @@ namespace core
 		//Accessors
 		DATA& operator[](const Accessor& handle)
 		{
-			assert(handle.IsValid());
-			assert(handle.m_index < m_capacity);
-			return m_data[handle.m_index];
+			CheckAlive(handle);
+			return m_data[handle.GetSlot()];
 		}
 
 		const DATA& operator[](const Accessor& handle) const
 		{
-			assert(handle.IsValid());
-			assert(handle.m_index < m_capacity);
-			return m_data[handle.m_index];
+			CheckAlive(handle);
+			return m_data[handle.GetSlot()];
+		}
+
+		//Returns if the handle points to a slot that has not been freed, a stale handle has an old generation
+		bool IsAlive(const Accessor& handle) const
+		{
+			return handle.IsValid() && handle.GetSlot() < m_capacity && handle.GetGeneration() == m_generations[handle.GetSlot()];
 		}
 
 		size_t Size() const
@@ -301,10 +244,20 @@ namespace core
 		void VisitSlow(FUNCTION&& visitor);
 
 	private:
+		//A stale handle would access the data of the object that reuses the slot
+		void CheckAlive(const Accessor& handle) const
+		{
+			if (!IsAlive(handle))
+			{
+				//Log error breaks the execution
+				core::LogError("Access to a stale handle <%i>", static_cast<int>(handle.GetSlot()));
+			}
+		}
+
 		typename HANDLE::type_param& GetNextFreeSlot(const typename HANDLE::type_param& index)
 		{
 			assert(index < m_capacity);
-			return *reinterpret_cast<HANDLE::type_param*>(&m_data[index]);
+			return *reinterpret_cast<typename HANDLE::type_param*>(&m_data[index]);
 		}
 
 		void GrowDataStorage(size_t new_size, bool init = false);
@@ -318,19 +271,24 @@ namespace core
 		//Current capacity
 		size_t m_capacity = 0;
 
-		//List of free slots
+		//List of free slots, the freed slots are added at the end so they are reused as late as possible
+		//It spreads the reuses over all the free slots and the generations wrap slower
 		typename HANDLE::type_param m_first_free_allocated;
+		typename HANDLE::type_param m_last_free_allocated;
 
 		//Allocated data
 		DATA* m_data = nullptr;
 
+		//Current generation of each slot, it changes each time the slot is freed
+		std::vector<typename HANDLE::type_param> m_generations;
+
 		//Allocator
 		std::allocator<DATA> m_data_allocator;
 
 	protected:
 		typename HANDLE::type_param GetInternalIndex(const Accessor& handle) const
 		{
-			return handle.m_index;
+			return handle.GetSlot();
 		}
 	};
 
@@ -376,10 +334,11 @@ namespace core
 	template<typename HANDLE>
 	inline void HandlePool<HANDLE>::Init(size_t max_size, size_t init_size)
 	{
-		assert(max_size <= std::numeric_limits<typename HANDLE::type_param>::max() - 1);
+		assert(max_size <= Accessor::kMaxSlots);
 		assert(init_size <= max_size);
 		m_max_size = max_size;
 		m_first_free_allocated = HANDLE::kInvalid;
+		m_last_free_allocated = HANDLE::kInvalid;
 		m_size = 0;
 		m_capacity = 0;
 
@@ -406,7 +365,7 @@ namespace core
 			else
 			{
 				//No more free handles, error
-				throw std::runtime_error::exception("Out of handles");
+				throw std::runtime_error("Out of handles");
 				return HANDLE(HANDLE::kInvalid);
 			}
 		}
@@ -421,12 +380,7 @@ namespace core
 
 		m_size++;
 
-#ifdef WEAKHANDLE_TRACKING
-		//Init tracking of weak handles
-		m_weak_handle_tracking[handle_slot] = 0;
-#endif
-		
-		return HANDLE(handle_slot);
+		return HANDLE(Accessor::MakeIndex(handle_slot, m_generations[handle_slot]));
 	}
 
 	template<typename HANDLE>
@@ -446,7 +400,7 @@ namespace core
 		{
 			if (free_slots.find(i) == free_slots.end())
 			{
-				visitor(HANDLE::WeakHandle(i));
+				visitor(typename HANDLE::WeakHandleVersion(Accessor::MakeIndex(i, m_generations[i])));
 			}
 		}
 	}
@@ -457,31 +411,36 @@ namespace core
 	{
 		if (handle.IsValid())
 		{
+			if (!IsAlive(handle))
+			{
+				//The slot has been already freed, freeing it again will corrupt the free list
+				core::LogError("Handle <%i> has been already freed", static_cast<int>(handle.GetSlot()));
+				handle.m_index = HANDLE::kInvalid;
+				return;
+			}
+
+			const typename HANDLE::type_param slot = handle.GetSlot();
+
 			//Destroy DATA
-			assert(handle.m_index < m_capacity);
-			m_data[handle.m_index].~DATA();
+			m_data[slot].~DATA();
+
+			//Next generation, all the weak handles to this slot are stale
+			m_generations[slot] = (m_generations[slot] + 1) & Accessor::kGenerationMask;
 
-			//Add it in the free list
+			//Add it at the end of the free list
+			GetNextFreeSlot(slot) = HANDLE::kInvalid;
 			if (m_first_free_allocated == HANDLE::kInvalid)
 			{
-				m_first_free_allocated = handle.m_index;
+				m_first_free_allocated = slot;
 			}
 			else
 			{
-				GetNextFreeSlot(handle.m_index) = m_first_free_allocated;
-				m_first_free_allocated = handle.m_index;
+				GetNextFreeSlot(m_last_free_allocated) = slot;
 			}
+			m_last_free_allocated = slot;
 
 			m_size--;
 
-#ifdef WEAKHANDLE_TRACKING
-			//Add log if there is still a weak handle
-			if (m_weak_handle_tracking[handle.m_index] > 0)
-			{
-				core::LogWarning("Handle <%i> has been deleted, but still there weakhandles from it", handle.m_index);
-			}
-#endif
-
 			//Reset handle to an invalid, it will avoid it keep the index
 			handle.m_index = HANDLE::kInvalid;
 		}
@@ -534,27 +493,10 @@ namespace core
 		}
 
 		m_first_free_allocated = static_cast<typename HANDLE::type_param>(old_size);
+		m_last_free_allocated = static_cast<typename HANDLE::type_param>(new_size - 1);
 		m_capacity = new_size;
-#ifdef WEAKHANDLE_TRACKING
-		{
-			core::MutexGuard guard(m_spin_lock_mutex);
-			m_weak_handle_tracking.resize(new_size);
-		}
-#endif
-	}
-
-#ifdef WEAKHANDLE_TRACKING
-	template<typename DATA, typename TYPE>
-	inline WeakHandle<DATA, TYPE>::WeakHandle(const Handle<DATA, TYPE>& a)
-	{
-		Accessor::m_index = a.m_index;
-
-		if (Accessor::m_index != Accessor::kInvalid)
-		{
-			s_tracking_pool->AddWeakReference(Accessor::m_index);
-		}
+		m_generations.resize(new_size, 0);
 	}
-#endif
 }
 
 #endif //HANDLE_POOL_H_
\ No newline at end of file
@@ -0,0 +1,55 @@
+#include <core/log.h>
+#include <core/sync.h>
+#include <cstdio>
+#include <cstdarg>
+#include <cstdlib>
+
+namespace
+{
+	//Size used for the format intermediated buffer
+	constexpr size_t kLogFormatBufferSize = 1024;
+
+	//Access mutex, so lines from different threads don't mix
+	core::Mutex g_log_mutex;
+
+	//Headless log, it goes to the standard output and errors to the standard error
+	void Log(FILE* output, const char* prefix, const char* message, va_list args)
+	{
+		char buffer[kLogFormatBufferSize];
+		vsnprintf(buffer, kLogFormatBufferSize, message, args);
+
+		core::MutexGuard log_access_guard(g_log_mutex);
+		fprintf(output, "%s%s\n", prefix, buffer);
+		fflush(output);
+	}
+}
+
+namespace core
+{
+	void LogInfo(const char* message, ...)
+	{
+		va_list args;
+		va_start(args, message);
+		Log(stdout, "INFO: ", message, args);
+		va_end(args);
+	}
+
+	void LogWarning(const char* message, ...)
+	{
+		va_list args;
+		va_start(args, message);
+		Log(stderr, "WARNING: ", message, args);
+		va_end(args);
+	}
+
+	void LogError(const char* message, ...)
+	{
+		va_list args;
+		va_start(args, message);
+		Log(stderr, "ERROR: ", message, args);
+		va_end(args);
+
+		//It needs to break or crash
+		abort();
+	}
+}
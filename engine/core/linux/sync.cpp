@@ -0,0 +1,41 @@
+#include <core/sync.h>
+#include <pthread.h>
+#include <sched.h>
+#include <cwchar>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <climits>
+
+void core::Thread::Init(const wchar_t* name, ThreadPriority thread_priority)
+{
+	//Set name, linux limits it to 15 characters
+	char name_buffer[16];
+	std::mbstate_t state = {};
+	const size_t length = std::wcsrtombs(name_buffer, &name, sizeof(name_buffer) - 1, &state);
+	name_buffer[(length == static_cast<size_t>(-1)) ? 0 : length] = 0;
+	pthread_setname_np(native_handle(), name_buffer);
+
+	if (thread_priority == ThreadPriority::Background)
+	{
+		//Set priority, normal threads can not go below the default static priority, so it moves to the idle policy
+		sched_param param = {};
+		pthread_setschedparam(native_handle(), SCHED_IDLE, &param);
+	}
+}
+
+void core::FutexWait(std::atomic<uint32_t>& value, uint32_t expected_value)
+{
+	//Process private futex, it returns straight away if the value is not the expected one
+	syscall(SYS_futex, reinterpret_cast<uint32_t*>(&value), FUTEX_WAIT_PRIVATE, expected_value, nullptr, nullptr, 0);
+}
+
+void core::FutexWakeOne(std::atomic<uint32_t>& value)
+{
+	syscall(SYS_futex, reinterpret_cast<uint32_t*>(&value), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+}
+
+void core::FutexWakeAll(std::atomic<uint32_t>& value)
+{
+	syscall(SYS_futex, reinterpret_cast<uint32_t*>(&value), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+}
@@ -0,0 +1,170 @@
+#include <core/virtual_alloc.h>
+#include <core/log.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <stdexcept>
+#include <fstream>
+#include <string>
+#include <atomic>
+#include <cassert>
+
+namespace
+{
+	size_t g_cached_page_size = 0;
+	size_t g_cached_large_page_size = 0;
+
+	//Reserve a range aligned to the large page size, so the transparent huge pages can back all of it
+	void* ReserveAligned(size_t size, size_t alignment)
+	{
+		const size_t reserved_size = size + alignment;
+		char* reserved_ptr = static_cast<char*>(mmap(nullptr, reserved_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0));
+		if (reserved_ptr == MAP_FAILED)
+		{
+			return MAP_FAILED;
+		}
+
+		//Unmap the head and tail that are not needed
+		char* aligned_ptr = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(reserved_ptr) + alignment - 1) & ~(alignment - 1));
+		const size_t head_size = aligned_ptr - reserved_ptr;
+		const size_t tail_size = reserved_size - head_size - size;
+		if (head_size > 0)
+		{
+			munmap(reserved_ptr, head_size);
+		}
+		if (tail_size > 0)
+		{
+			munmap(aligned_ptr + size, tail_size);
+		}
+		return aligned_ptr;
+	}
+}
+
+namespace core
+{
+	void * VirtualAlloc(void * ptr, size_t size, AllocFlags flags)
+	{
+		const int protection = check_flag(flags, AllocFlags::Commit) ? (PROT_READ | PROT_WRITE) : PROT_NONE;
+
+		void* return_ptr = ptr;
+		if (check_flag(flags, AllocFlags::Reserve))
+		{
+			if (check_flag(flags, AllocFlags::LargePages) && GetLargePageSize() > GetPageSize())
+			{
+				return_ptr = ReserveAligned(size, GetLargePageSize());
+				if (return_ptr != MAP_FAILED)
+				{
+					//Only a hint, transparent huge pages can be disabled in the system
+					madvise(return_ptr, size, MADV_HUGEPAGE);
+					if (protection != PROT_NONE && mprotect(return_ptr, size, protection) != 0)
+					{
+						return_ptr = MAP_FAILED;
+					}
+				}
+			}
+			else
+			{
+				//Reserved memory doesn't count for the commit limit until it is commited
+				return_ptr = mmap(ptr, size, protection, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+			}
+		}
+		else if (check_flag(flags, AllocFlags::Commit))
+		{
+			//Pages get physical memory in the first access
+			if (mprotect(ptr, size, protection) != 0)
+			{
+				return_ptr = MAP_FAILED;
+			}
+		}
+
+		if (return_ptr == MAP_FAILED || return_ptr == nullptr)
+		{
+			core::LogError("Error allocating virtual memory");
+			throw std::runtime_error("Invalid virtual allocation");
+		}
+
+		return return_ptr;
+	}
+
+	void VirtualFree(void * ptr, size_t size, FreeFlags flags)
+	{
+		if (check_flag(flags, FreeFlags::Release))
+		{
+			//munmap needs the size of the reservation, windows ignores it
+			if (munmap(ptr, size) != 0)
+			{
+				throw std::runtime_error("Invalid virtual free");
+			}
+		}
+		else if (check_flag(flags, FreeFlags::Decommit))
+		{
+			//Return the physical pages to the system and protect the range again, the huge page hint is kept
+			if (madvise(ptr, size, MADV_DONTNEED) != 0 || mprotect(ptr, size, PROT_NONE) != 0)
+			{
+				throw std::runtime_error("Invalid virtual free");
+			}
+		}
+	}
+
+	size_t GetPageSize()
+	{
+		if (g_cached_page_size == 0)
+		{
+			g_cached_page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+		}
+
+		return g_cached_page_size;
+	}
+
+	size_t GetLargePageSize()
+	{
+		if (g_cached_large_page_size == 0)
+		{
+			//Size of the transparent huge pages, only if they can be enabled with madvise
+			std::ifstream enabled_file("/sys/kernel/mm/transparent_hugepage/enabled");
+			std::string enabled;
+			std::getline(enabled_file, enabled);
+
+			size_t large_page_size = 0;
+			if (enabled.find("[never]") == std::string::npos)
+			{
+				std::ifstream size_file("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size");
+				size_file >> large_page_size;
+			}
+
+			if (large_page_size == 0)
+			{
+				//Not supported
+				large_page_size = GetPageSize();
+			}
+			g_cached_large_page_size = large_page_size;
+		}
+
+		return g_cached_large_page_size;
+	}
+
+	bool CanCommitLargePages()
+	{
+		//Transparent huge pages back the aligned 2MB ranges of the reservation as they get commited
+		return GetLargePageSize() > GetPageSize();
+	}
+
+	void PrefaultMemory(void* ptr, size_t size)
+	{
+		const size_t page_size = GetPageSize();
+		assert(reinterpret_cast<uintptr_t>(ptr) % page_size == 0);
+
+#ifdef MADV_POPULATE_WRITE
+		//Faults all the pages in one call, it keeps the content (Linux 5.14)
+		if (madvise(ptr, size, MADV_POPULATE_WRITE) == 0)
+		{
+			return;
+		}
+#endif
+		//The owner can be writing in the page at the same time, an atomic or with zero is a write that keeps the value
+		char* memory = reinterpret_cast<char*>(ptr);
+		for (size_t offset = 0; offset < size; offset += page_size)
+		{
+			reinterpret_cast<std::atomic<uint32_t>*>(memory + offset)->fetch_or(0, std::memory_order_relaxed);
+		}
+	}
+}
@@ -12,4 +12,22 @@ void core::Thread::Init(const wchar_t* name, ThreadPriority thread_priority)
 		//Set priority
 		SetThreadPriority(static_cast<HANDLE>(native_handle()), THREAD_PRIORITY_BELOW_NORMAL);
 	}
-}
\ No newline at end of file
+}
+
+//WaitOnAddress and WakeByAddress are in the synchronization library
+#pragma comment(lib, "Synchronization.lib")
+
+void core::FutexWait(std::atomic<uint32_t>& value, uint32_t expected_value)
+{
+	WaitOnAddress(&value, &expected_value, sizeof(uint32_t), INFINITE);
+}
+
+void core::FutexWakeOne(std::atomic<uint32_t>& value)
+{
+	WakeByAddressSingle(&value);
+}
+
+void core::FutexWakeAll(std::atomic<uint32_t>& value)
+{
+	WakeByAddressAll(&value);
+}
@@ -2,10 +2,13 @@
 #include <core/log.h>
 #include <Windows.h>
 #include <stdexcept>
+#include <atomic>
+#include <cassert>
 
 namespace
 {
 	size_t g_cached_page_size = 0;
+	size_t g_cached_large_page_size = 0;
 }
 
 namespace core
@@ -24,6 +27,8 @@ namespace core
 			allocation_type |= MEM_COMMIT;
 			protection = PAGE_READWRITE;
 		}
+		//Windows only can use large pages if all the memory is reserved and commited at the same time, with lock memory privileges
+		//Reserved memory commited incrementally always uses normal pages, so the large pages hint is ignored
 		void* return_ptr = ::VirtualAlloc(ptr, size, allocation_type, protection);
 
 		if (return_ptr == nullptr)
@@ -47,7 +52,8 @@ namespace core
 			free_type |= MEM_RELEASE;
 		}
 
-		if (!::VirtualFree(ptr, size, free_type))
+		//Release needs a zero size, it always frees the full reservation
+		if (!::VirtualFree(ptr, check_flag(flags, FreeFlags::Release) ? 0 : size, free_type))
 		{
 			throw std::runtime_error("Invalid virtual free");
 		}
@@ -65,4 +71,38 @@ namespace core
 
 		return g_cached_page_size;
 	}
+
+	size_t GetLargePageSize()
+	{
+		if (g_cached_large_page_size == 0)
+		{
+			g_cached_large_page_size = GetLargePageMinimum();
+			if (g_cached_large_page_size == 0)
+			{
+				//Not supported
+				g_cached_large_page_size = GetPageSize();
+			}
+		}
+
+		return g_cached_large_page_size;
+	}
+
+	bool CanCommitLargePages()
+	{
+		//Large pages need to be reserved and commited at the same time, VirtualAlloc ignores the hint
+		return false;
+	}
+
+	void PrefaultMemory(void* ptr, size_t size)
+	{
+		const size_t page_size = GetPageSize();
+		assert(reinterpret_cast<uintptr_t>(ptr) % page_size == 0);
+
+		//The owner can be writing in the page at the same time, an atomic or with zero is a write that keeps the value
+		char* memory = reinterpret_cast<char*>(ptr);
+		for (size_t offset = 0; offset < size; offset += page_size)
+		{
+			reinterpret_cast<std::atomic<uint32_t>*>(memory + offset)->fetch_or(0, std::memory_order_relaxed);
+		}
+	}
 }
\ No newline at end of file
@@ -227,4 +227,4 @@ namespace platform
 	void RegisterModule(Module* module);
 }
 
-#endif PLATFORM_H_
\ No newline at end of file
+#endif //PLATFORM_H_
\ No newline at end of file
@@ -0,0 +1,503 @@
+//////////////////////////////////////////////////////////////////////////
+// Cute engine - SIMD fast map, open addressing map with control bytes probed in groups of 16 with SSE2
+// Same interface as FastMap, it keeps constant time lookups with high load factors
+//////////////////////////////////////////////////////////////////////////
+#ifndef SIMD_FAST_MAP_h
+#define SIMD_FAST_MAP_h
+
+#include <emmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include <memory>
+#include <functional>
+#include <utility>
+#include <cassert>
+#include <stdint.h>
+
+namespace core
+{
+	//Mixing hash, the hash of the key is finalized so keys with identity hashes (like string hashes) spread over all the bits
+	template<typename KEY>
+	struct MixHash
+	{
+		size_t operator()(const KEY& key) const
+		{
+			uint64_t hash = static_cast<uint64_t>(std::hash<KEY>{}(key));
+			hash ^= hash >> 33;
+			hash *= 0xff51afd7ed558ccdULL;
+			hash ^= hash >> 33;
+			hash *= 0xc4ceb9fe1a85ec53ULL;
+			hash ^= hash >> 33;
+			return static_cast<size_t>(hash);
+		}
+	};
+
+	//Open addressing map with linear probing
+	//Each slot has a control byte, empty or the low 7 bits of the hash, the control bytes are compared 16 at the time
+	//Erase shifts back the following items, so there are not tombstones
+	template <typename KEY, typename DATA, typename HASH = MixHash<KEY>>
+	class SIMDFastMap
+	{
+	public:
+
+		//Accesor helper
+		template<typename ACCESOR_DATA>
+		class Accesor
+		{
+		public:
+			ACCESOR_DATA* operator->()
+			{
+				assert(m_data);
+				return m_data;
+			}
+
+			ACCESOR_DATA& operator*()&
+			{
+				assert(m_data);
+				return *m_data;
+			}
+
+			ACCESOR_DATA&& operator*()&&
+			{
+				assert(m_data);
+				return std::move(*m_data);
+			}
+
+			explicit operator bool() const
+			{
+				return m_data != nullptr;
+			}
+
+			Accesor(ACCESOR_DATA* data) : m_data(data)
+			{
+			}
+
+		private:
+			ACCESOR_DATA* m_data;
+		};
+
+		class Iterator
+		{
+		public:
+			Iterator(SIMDFastMap* fast_map, size_t index) :
+				m_fast_map(fast_map), m_index(index)
+			{
+			}
+
+			std::pair<KEY&, DATA&> operator*()
+			{
+				return std::pair<KEY&, DATA&>(m_fast_map->m_keys[m_index], m_fast_map->m_data[m_index]);
+			}
+
+			bool operator!= (const Iterator & other) const
+			{
+				return m_fast_map != other.m_fast_map || m_index != other.m_index;
+			}
+
+			const Iterator& operator++ ()
+			{
+				assert(m_index != kInvalid);
+
+				m_index = m_fast_map->NextFullSlot(m_index + 1);
+				return *this;
+			}
+
+		private:
+			SIMDFastMap* m_fast_map;
+			size_t m_index;
+		};
+
+		//Insert data
+		template< class... ARGS>
+		Accesor<DATA> Insert(const KEY& key, ARGS&&... args);
+
+		//Erase data, returns false if the key was not in the map
+		bool Erase(const KEY& key);
+
+		//Access data
+		Accesor<DATA> Find(const KEY& key);
+		Accesor<const DATA> Find(const KEY& key) const;
+
+		Accesor<const DATA> operator[](const KEY& key) const
+		{
+			return Find(key);
+		}
+
+		Accesor<DATA> operator[](const KEY& key)
+		{
+			return Find(key);
+		}
+
+		Iterator begin()
+		{
+			return Iterator(this, NextFullSlot(0));
+		}
+
+		Iterator end()
+		{
+			return Iterator(this, kInvalid);
+		}
+
+		//Visit
+		template<typename VISITOR>
+		void Visit(VISITOR&& visitor)
+		{
+			for (auto& it : *this)
+			{
+				visitor(it.second);
+			}
+		}
+
+		template<typename VISITOR>
+		void VisitNamed(VISITOR&& visitor)
+		{
+			for (auto& it : *this)
+			{
+				visitor(it.first, it.second);
+			}
+		}
+
+		//Clear (keeping the capacity)
+		void clear()
+		{
+			for (size_t i = 0; i < m_capacity; ++i)
+			{
+				if (IsFull(m_control[i]))
+				{
+					m_keys[i].~KEY();
+					m_data[i].~DATA();
+				}
+			}
+			for (size_t i = 0; i < m_capacity + kGroupWidth - 1; ++i)
+			{
+				m_control[i] = kEmpty;
+			}
+			m_size = 0;
+		}
+
+		//Size
+		size_t size() const
+		{
+			return m_size;
+		}
+
+		SIMDFastMap()
+		{
+		}
+		SIMDFastMap(SIMDFastMap&& a)
+		{
+			*this = std::move(a);
+		}
+		SIMDFastMap& operator=(SIMDFastMap&& a)
+		{
+			if (this != &a)
+			{
+				Release();
+
+				m_control = std::move(a.m_control);
+				m_keys = a.m_keys;
+				m_data = a.m_data;
+				m_capacity = a.m_capacity;
+				m_size = a.m_size;
+
+				a.m_keys = nullptr;
+				a.m_data = nullptr;
+				a.m_capacity = 0;
+				a.m_size = 0;
+			}
+			return *this;
+		}
+		~SIMDFastMap()
+		{
+			Release();
+		}
+
+	private:
+		//Number of control bytes checked at the same time
+		constexpr static size_t kGroupWidth = 16;
+		//Control byte of an empty slot, full slots have the high bit clear
+		constexpr static int8_t kEmpty = -128;
+
+		constexpr static size_t kInvalid = static_cast<size_t>(-1);
+
+		//Control bytes, the first kGroupWidth - 1 bytes are replicated at the end so a group can be loaded from any slot
+		std::unique_ptr<int8_t[]> m_control;
+		//Keys and data storage, only constructed for full slots
+		KEY* m_keys = nullptr;
+		DATA* m_data = nullptr;
+
+		//Capacity (needs to be power of 2)
+		size_t m_capacity = 0;
+
+		//Size
+		size_t m_size = 0;
+
+		static bool IsFull(int8_t control)
+		{
+			return control >= 0;
+		}
+
+		static uint32_t CountTrailingZeros(uint32_t mask)
+		{
+#if defined(_MSC_VER)
+			unsigned long index;
+			_BitScanForward(&index, mask);
+			return static_cast<uint32_t>(index);
+#else
+			return static_cast<uint32_t>(__builtin_ctz(mask));
+#endif
+		}
+
+		//Mask with a bit for each control byte in the group that is equal to the value
+		uint32_t MatchGroup(size_t slot, int8_t value) const
+		{
+			const __m128i group = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&m_control[slot]));
+			return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(value))));
+		}
+
+		//Mask with a bit for each empty control byte in the group
+		uint32_t MatchEmptyGroup(size_t slot) const
+		{
+			//Empty is the only control value with the high bit set
+			const __m128i group = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&m_control[slot]));
+			return static_cast<uint32_t>(_mm_movemask_epi8(group));
+		}
+
+		void SetControl(size_t slot, int8_t value)
+		{
+			m_control[slot] = value;
+			if (slot < kGroupWidth - 1)
+			{
+				m_control[m_capacity + slot] = value;
+			}
+		}
+
+		static size_t GetHomeSlot(size_t hash, size_t capacity)
+		{
+			return (hash >> 7) & (capacity - 1);
+		}
+
+		static int8_t GetControlHash(size_t hash)
+		{
+			return static_cast<int8_t>(hash & 0x7F);
+		}
+
+		//Look for the slot of the key, kInvalid if it is not in the map
+		size_t FindSlot(const KEY& key) const;
+
+		//Look for the first empty slot from the home slot of the hash, the map can not be full
+		size_t FindEmptySlot(size_t hash) const;
+
+		//Next full slot from the slot (included), kInvalid if there are no more
+		size_t NextFullSlot(size_t slot) const
+		{
+			while (slot < m_capacity && !IsFull(m_control[slot]))
+			{
+				slot++;
+			}
+			return (slot < m_capacity) ? slot : kInvalid;
+		}
+
+		//Grow by new capacity
+		void Grow(size_t new_capacity);
+
+		//Destroy all items and deallocate the memory
+		void Release()
+		{
+			if (m_capacity > 0)
+			{
+				clear();
+				std::allocator<KEY>().deallocate(m_keys, m_capacity);
+				std::allocator<DATA>().deallocate(m_data, m_capacity);
+				m_control.reset();
+				m_keys = nullptr;
+				m_data = nullptr;
+				m_capacity = 0;
+			}
+		}
+	};
+
+	template<typename KEY, typename DATA, typename HASH>
+	inline size_t SIMDFastMap<KEY, DATA, HASH>::FindSlot(const KEY& key) const
+	{
+		if (m_capacity == 0)
+		{
+			return kInvalid;
+		}
+
+		const size_t hash = HASH{}(key);
+		const int8_t control_hash = GetControlHash(hash);
+		size_t slot = GetHomeSlot(hash, m_capacity);
+
+		while (true)
+		{
+			//Check all the candidates in the group
+			uint32_t match = MatchGroup(slot, control_hash);
+			while (match)
+			{
+				const size_t candidate_slot = (slot + CountTrailingZeros(match)) & (m_capacity - 1);
+				if (m_keys[candidate_slot] == key)
+				{
+					return candidate_slot;
+				}
+				match &= match - 1;
+			}
+
+			//Linear probing never leaves empty slots between the home slot and the key
+			if (MatchEmptyGroup(slot))
+			{
+				return kInvalid;
+			}
+
+			slot = (slot + kGroupWidth) & (m_capacity - 1);
+		}
+	}
+
+	template<typename KEY, typename DATA, typename HASH>
+	inline size_t SIMDFastMap<KEY, DATA, HASH>::FindEmptySlot(size_t hash) const
+	{
+		size_t slot = GetHomeSlot(hash, m_capacity);
+
+		while (true)
+		{
+			const uint32_t empty = MatchEmptyGroup(slot);
+			if (empty)
+			{
+				return (slot + CountTrailingZeros(empty)) & (m_capacity - 1);
+			}
+			slot = (slot + kGroupWidth) & (m_capacity - 1);
+		}
+	}
+
+	template<typename KEY, typename DATA, typename HASH>
+	inline void SIMDFastMap<KEY, DATA, HASH>::Grow(size_t new_capacity)
+	{
+		std::unique_ptr<int8_t[]> source_control = std::move(m_control);
+		KEY* source_keys = m_keys;
+		DATA* source_data = m_data;
+		const size_t source_capacity = m_capacity;
+
+		m_control = std::make_unique<int8_t[]>(new_capacity + kGroupWidth - 1);
+		for (size_t i = 0; i < new_capacity + kGroupWidth - 1; ++i)
+		{
+			m_control[i] = kEmpty;
+		}
+		m_keys = std::allocator<KEY>().allocate(new_capacity);
+		m_data = std::allocator<DATA>().allocate(new_capacity);
+		m_capacity = new_capacity;
+
+		//Move old key/data into the new map, all keys are unique
+		for (size_t i = 0; i < source_capacity; ++i)
+		{
+			if (IsFull(source_control[i]))
+			{
+				const size_t hash = HASH{}(source_keys[i]);
+				const size_t slot = FindEmptySlot(hash);
+				SetControl(slot, GetControlHash(hash));
+				new (&m_keys[slot]) KEY(std::move(source_keys[i]));
+				new (&m_data[slot]) DATA(std::move(source_data[i]));
+				source_keys[i].~KEY();
+				source_data[i].~DATA();
+			}
+		}
+
+		if (source_capacity > 0)
+		{
+			std::allocator<KEY>().deallocate(source_keys, source_capacity);
+			std::allocator<DATA>().deallocate(source_data, source_capacity);
+		}
+	}
+
+	template<typename KEY, typename DATA, typename HASH>
+	template< class... ARGS >
+	inline typename SIMDFastMap<KEY, DATA, HASH>::template Accesor<DATA> SIMDFastMap<KEY, DATA, HASH>::Insert(const KEY& key, ARGS&&... args)
+	{
+		const size_t slot = FindSlot(key);
+
+		if (slot == kInvalid)
+		{
+			//Add
+
+			//Check if we need to grow, max load factor is 7/8
+			if ((m_size + 1) * 8 > m_capacity * 7)
+			{
+				Grow((m_capacity == 0) ? kGroupWidth : m_capacity * 2);
+			}
+
+			const size_t hash = HASH{}(key);
+			const size_t new_slot = FindEmptySlot(hash);
+			SetControl(new_slot, GetControlHash(hash));
+			new (&m_keys[new_slot]) KEY(key);
+			new (&m_data[new_slot]) DATA(std::forward<ARGS>(args)...);
+			m_size++;
+
+			return Accesor<DATA>(&m_data[new_slot]);
+		}
+		else
+		{
+			//It was already added, just update
+			m_data[slot] = DATA(std::forward<ARGS>(args)...);
+
+			return Accesor<DATA>(&m_data[slot]);
+		}
+	}
+
+	template<typename KEY, typename DATA, typename HASH>
+	inline bool SIMDFastMap<KEY, DATA, HASH>::Erase(const KEY& key)
+	{
+		size_t slot = FindSlot(key);
+
+		if (slot == kInvalid)
+		{
+			return false;
+		}
+
+		m_keys[slot].~KEY();
+		m_data[slot].~DATA();
+		SetControl(slot, kEmpty);
+		m_size--;
+
+		//Backward shift, move back the next items that can not be found anymore after the new empty slot
+		const size_t mask = m_capacity - 1;
+		size_t empty_slot = slot;
+		size_t next_slot = (slot + 1) & mask;
+		while (IsFull(m_control[next_slot]))
+		{
+			const size_t home_slot = GetHomeSlot(HASH{}(m_keys[next_slot]), m_capacity);
+
+			//The item can move if its home slot is not in the cyclic range (empty_slot, next_slot]
+			if (((next_slot - home_slot) & mask) >= ((next_slot - empty_slot) & mask))
+			{
+				SetControl(empty_slot, m_control[next_slot]);
+				new (&m_keys[empty_slot]) KEY(std::move(m_keys[next_slot]));
+				new (&m_data[empty_slot]) DATA(std::move(m_data[next_slot]));
+				m_keys[next_slot].~KEY();
+				m_data[next_slot].~DATA();
+				SetControl(next_slot, kEmpty);
+				empty_slot = next_slot;
+			}
+			next_slot = (next_slot + 1) & mask;
+		}
+
+		return true;
+	}
+
+	template<typename KEY, typename DATA, typename HASH>
+	inline typename SIMDFastMap<KEY, DATA, HASH>::template Accesor<const DATA> SIMDFastMap<KEY, DATA, HASH>::Find(const KEY& key) const
+	{
+		const size_t slot = FindSlot(key);
+
+		return Accesor<const DATA>((slot != kInvalid) ? &m_data[slot] : nullptr);
+	}
+
+	template<typename KEY, typename DATA, typename HASH>
+	inline typename SIMDFastMap<KEY, DATA, HASH>::template Accesor<DATA> SIMDFastMap<KEY, DATA, HASH>::Find(const KEY& key)
+	{
+		const size_t slot = FindSlot(key);
+
+		return Accesor<DATA>((slot != kInvalid) ? &m_data[slot] : nullptr);
+	}
+}
+
+#endif //SIMD_FAST_MAP_h
@@ -7,6 +7,7 @@
 
 #include <array>
 #include <cassert>
+#include <stdexcept>
 
 namespace core
 {
@@ -19,7 +20,7 @@ namespace core
 		using DataStorage = union
 		{
 			typename std::aligned_storage<sizeof(DATA), alignof(DATA)>::type data;
-			typename size_t next_free_slot;
+			size_t next_free_slot;
 		};
 
 		//List of free slots
@@ -100,7 +101,7 @@ namespace core
 			if (m_first_free_allocated == kInvalidIndex)
 			{
 				//Error
-				throw std::runtime_error::exception("Simple pool is full");
+				throw std::runtime_error("Simple pool is full");
 			}
 
 			//Get next free slot
@@ -7,6 +7,7 @@
 
 #include <array>
 #include <cassert>
+#include <stdexcept>
 #include <vector>
 
 namespace core
@@ -22,7 +23,7 @@ namespace core
 		{
 			m_index = index;
 		}
-		template <typename TYPE, TYPE MAX_SIZE, size_t MAX_FRAMES>
+		template <typename FRIEND_TYPE, FRIEND_TYPE MAX_SIZE, size_t MAX_FRAMES>
 		friend class SlotPool;
 
 		void Invalidate()
@@ -126,7 +127,7 @@ namespace core
 			}
 
 			//Error, no more slots
-			throw std::runtime_error::exception("Slot pool is full");
+			throw std::runtime_error("Slot pool is full");
 
 			return Slot<TYPE>();
 		}
@@ -2,6 +2,8 @@
 #include <unordered_map>
 #include <string>
 #include <stdexcept>
+#include <cstring>
+#include <type_traits>
 #include "log.h"
 #include "fast_map.h"
 #include "virtual_buffer.h"
@@ -17,16 +19,12 @@ namespace core
 		core::FastMap<uint64_t, const char*> string_hash_map_64;
 
 		template<typename TYPE>
-		auto& GetStringHashMap();
-
-		template<>
-		auto& GetStringHashMap<uint16_t>(){ return string_hash_map_16;};
-
-		template<>
-		auto& GetStringHashMap<uint32_t>(){ return string_hash_map_32; };
-
-		template<>
-		auto& GetStringHashMap<uint64_t>(){ return string_hash_map_64; };
+		auto& GetStringHashMap()
+		{
+			if constexpr (std::is_same_v<TYPE, uint16_t>) return string_hash_map_16;
+			else if constexpr (std::is_same_v<TYPE, uint32_t>) return string_hash_map_32;
+			else return string_hash_map_64;
+		}
 	};
 
 	//Global map for each namespace
@@ -46,7 +44,7 @@ namespace core
 		g_string_buffer->SetCommitedSize(g_string_buffer->GetCommitedSize() + string_size + 1);
 
 		//Copy the string
-		strcpy_s(buffer, string_size + 1, string);
+		memcpy(buffer, string, string_size + 1);
 
 		return buffer;
 	}
@@ -66,7 +64,7 @@ namespace core
 	{
 		if (g_namespaces_string_hash_table)
 		{
-			auto& namespace_find = g_namespaces_string_hash_table->Find(namespace_hash);
+			auto namespace_find = g_namespaces_string_hash_table->Find(namespace_hash);
 			if (namespace_find)
 			{
 				auto string_hash_find = namespace_find->GetStringHashMap<TYPE>().Find(string_hash);
@@ -13,42 +13,159 @@
 namespace core
 {
 	//Keep a specific mutex class for testing differences between different mutex implementations
-
+	//std::mutex is the default, it is needed with std::condition_variable
 	using Mutex = std::mutex;
-	/*class Mutex
+
+	//Platform dependent wait on address (futex), it parks the thread while the value is equal to the expected value
+	void FutexWait(std::atomic<uint32_t>& value, uint32_t expected_value);
+
+	//Platform dependent wake of the threads waiting in the address
+	void FutexWakeOne(std::atomic<uint32_t>& value);
+	void FutexWakeAll(std::atomic<uint32_t>& value);
+
+	//Mutex that spins a little before parking the thread in the kernel
+	//Useful for short critical sections, the common case never calls the kernel
+	class AdaptiveMutex
+	{
+	public:
+		void lock()
+		{
+			//Spin
+			for (uint32_t spin_count = 0; spin_count < kSpinCount; ++spin_count)
+			{
+				if (try_lock())
+					return;
+				_mm_pause();
+			}
+
+			//Mark that there are waiting threads and park until it gets unlocked
+			uint32_t state = m_state.exchange(kLockedWithWaiters, std::memory_order_acquire);
+			while (state != kUnlocked)
+			{
+				FutexWait(m_state, kLockedWithWaiters);
+				state = m_state.exchange(kLockedWithWaiters, std::memory_order_acquire);
+			}
+		}
+
+		bool try_lock()
+		{
+			uint32_t state = kUnlocked;
+			return m_state.load(std::memory_order_relaxed) == kUnlocked && m_state.compare_exchange_strong(state, kLocked, std::memory_order_acquire, std::memory_order_relaxed);
+		}
+
+		void unlock()
+		{
+			//Only wake if there was someone waiting
+			if (m_state.exchange(kUnlocked, std::memory_order_release) == kLockedWithWaiters)
+			{
+				FutexWakeOne(m_state);
+			}
+		}
+	private:
+		static constexpr uint32_t kSpinCount = 64;
+		static constexpr uint32_t kUnlocked = 0;
+		static constexpr uint32_t kLocked = 1;
+		static constexpr uint32_t kLockedWithWaiters = 2;
+
+		std::atomic<uint32_t> m_state{ kUnlocked };
+	};
+
+	//Reader-writer version of the adaptive mutex, same interface as std::shared_mutex
+	//Writers have preference, new readers wait if there is a writer waiting
+	class AdaptiveSharedMutex
 	{
 	public:
 		void lock()
 		{
-			for (int spin_count = 0; !try_lock(); ++spin_count)
+			for (uint32_t spin_count = 0; ; ++spin_count)
 			{
-				if (spin_count < 16)
+				uint32_t state = m_state.load(std::memory_order_relaxed);
+				if ((state & (kWriter | kReaderMask)) == 0)
+				{
+					//Keep the waiting flags, other threads could be waiting
+					if (m_state.compare_exchange_weak(state, state | kWriter, std::memory_order_acquire, std::memory_order_relaxed))
+						return;
+				}
+				else if (spin_count < kSpinCount)
+				{
 					_mm_pause();
-				else
+				}
+				else if (state & kWriterWaiting || m_state.compare_exchange_weak(state, state | kWriterWaiting, std::memory_order_relaxed))
 				{
-					std::this_thread::yield();
-					spin_count = 0;
+					FutexWait(m_state, state | kWriterWaiting);
 				}
 			}
 		}
 
 		bool try_lock()
 		{
-			return !locked.load(std::memory_order_relaxed) && !locked.exchange(true, std::memory_order_acquire);
-		}	
+			uint32_t state = m_state.load(std::memory_order_relaxed);
+			return (state & (kWriter | kReaderMask)) == 0 && m_state.compare_exchange_strong(state, state | kWriter, std::memory_order_acquire, std::memory_order_relaxed);
+		}
 
 		void unlock()
 		{
-			locked.store(false, std::memory_order_release);
+			//There are not readers, so only the waiting flags can be set
+			if (m_state.exchange(0, std::memory_order_release) & (kWriterWaiting | kReadersWaiting))
+			{
+				FutexWakeAll(m_state);
+			}
+		}
+
+		void lock_shared()
+		{
+			for (uint32_t spin_count = 0; ; ++spin_count)
+			{
+				uint32_t state = m_state.load(std::memory_order_relaxed);
+				if ((state & (kWriter | kWriterWaiting)) == 0)
+				{
+					if (m_state.compare_exchange_weak(state, state + 1, std::memory_order_acquire, std::memory_order_relaxed))
+						return;
+				}
+				else if (spin_count < kSpinCount)
+				{
+					_mm_pause();
+				}
+				else if (state & kReadersWaiting || m_state.compare_exchange_weak(state, state | kReadersWaiting, std::memory_order_relaxed))
+				{
+					FutexWait(m_state, state | kReadersWaiting);
+				}
+			}
+		}
+
+		bool try_lock_shared()
+		{
+			uint32_t state = m_state.load(std::memory_order_relaxed);
+			return (state & (kWriter | kWriterWaiting)) == 0 && m_state.compare_exchange_strong(state, state + 1, std::memory_order_acquire, std::memory_order_relaxed);
+		}
+
+		void unlock_shared()
+		{
+			const uint32_t state = m_state.fetch_sub(1, std::memory_order_release) - 1;
+
+			//Last reader with a writer waiting, clear the flags and let all of them try again
+			if ((state & kReaderMask) == 0 && (state & kWriterWaiting))
+			{
+				m_state.fetch_and(~(kWriterWaiting | kReadersWaiting), std::memory_order_relaxed);
+				FutexWakeAll(m_state);
+			}
 		}
 	private:
-		std::atomic<bool> locked{ false };
-	};*/
+		static constexpr uint32_t kSpinCount = 64;
+		static constexpr uint32_t kWriter = 1u << 31;
+		static constexpr uint32_t kWriterWaiting = 1u << 30;
+		static constexpr uint32_t kReadersWaiting = 1u << 29;
+		static constexpr uint32_t kReaderMask = kReadersWaiting - 1;
 
+		std::atomic<uint32_t> m_state{ 0 };
+	};
+
+	//Guard for any of the mutex classes, the use site selects the mutex
+	template<typename MUTEX = Mutex>
 	class MutexGuard
 	{
 	public:
-		MutexGuard(Mutex& spin_lock) : m_spin_lock(spin_lock)
+		MutexGuard(MUTEX& spin_lock) : m_spin_lock(spin_lock)
 		{
 			m_spin_lock.lock();
 		}
@@ -58,7 +175,25 @@ namespace core
 		}
 
 	private:
-		Mutex& m_spin_lock;
+		MUTEX& m_spin_lock;
+	};
+
+	//Guard for reading with a shared mutex
+	template<typename MUTEX = AdaptiveSharedMutex>
+	class SharedMutexGuard
+	{
+	public:
+		SharedMutexGuard(MUTEX& mutex) : m_mutex(mutex)
+		{
+			m_mutex.lock_shared();
+		}
+		~SharedMutexGuard()
+		{
+			m_mutex.unlock_shared();
+		}
+
+	private:
+		MUTEX& m_mutex;
 	};
 
 	enum class ThreadPriority
@@ -0,0 +1,114 @@
+//////////////////////////////////////////////////////////////////////////
+// Cute engine - Benchmark of the adaptive mutexes against the standard mutexes
+//////////////////////////////////////////////////////////////////////////
+
+#include <benchmark/benchmark.h>
+#include <core/sync.h>
+#include <core/log.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace
+{
+	//Returns the average time in nanoseconds per lock
+	//Each thread locks a random mutex from the list, a short critical section as the ECS zone and type locks
+	//With one mutex it is a hot lock, as the log or the handle pool locks
+	//Shared mutexes are locked for reading except one of each write_period locks
+	template<typename MUTEX>
+	double BenchmarkMutex(size_t num_threads, size_t num_mutexes, size_t write_period, size_t num_locks_per_thread)
+	{
+		constexpr bool kSharedMutex = std::is_same<MUTEX, std::shared_mutex>::value || std::is_same<MUTEX, core::AdaptiveSharedMutex>::value;
+
+		struct alignas(64) ProtectedData
+		{
+			MUTEX mutex;
+			uint64_t value = 0;
+		};
+		std::unique_ptr<ProtectedData[]> data = std::make_unique<ProtectedData[]>(num_mutexes);
+		std::atomic<uint64_t> read_checksum = 0;
+
+		auto begin = std::chrono::high_resolution_clock::now();
+
+		std::vector<std::thread> threads;
+		for (size_t i = 0; i < num_threads; ++i)
+		{
+			threads.emplace_back([&, i]()
+				{
+					uint32_t random = static_cast<uint32_t>(i * 7919 + 1);
+					uint64_t read_value = 0;
+					for (size_t lock_index = 0; lock_index < num_locks_per_thread; ++lock_index)
+					{
+						//Xorshift
+						random ^= random << 13;
+						random ^= random >> 17;
+						random ^= random << 5;
+
+						ProtectedData& protected_data = data[random % num_mutexes];
+						if constexpr (kSharedMutex)
+						{
+							if (lock_index % write_period != 0)
+							{
+								protected_data.mutex.lock_shared();
+								read_value += protected_data.value;
+								protected_data.mutex.unlock_shared();
+								continue;
+							}
+						}
+						core::MutexGuard guard(protected_data.mutex);
+						protected_data.value++;
+					}
+					//Avoid the reads to be removed
+					read_checksum += read_value;
+				});
+		}
+		for (auto& thread : threads)
+		{
+			thread.join();
+		}
+
+		const double elapsed_ns = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - begin).count();
+
+		//Lost increments mean that the mutex didn't exclude the writers
+		uint64_t num_writes = 0;
+		for (size_t i = 0; i < num_mutexes; ++i)
+		{
+			num_writes += data[i].value;
+		}
+		const size_t num_writes_per_thread = kSharedMutex ? (num_locks_per_thread + write_period - 1) / write_period : num_locks_per_thread;
+		if (num_writes != num_threads * num_writes_per_thread)
+		{
+			core::LogError("Mutex benchmark with <%zu> threads lost writes", num_threads);
+		}
+
+		return elapsed_ns / static_cast<double>(num_threads * num_locks_per_thread);
+	}
+}
+
+namespace benchmark
+{
+	//Synthetic locks, the ECS benchmark measures the real component locks
+	void BenchmarkMutexes(const Context& context)
+	{
+		const size_t num_locks_per_thread = context.quick ? 2000 : 200000;
+
+		for (size_t num_threads : {1, 2, 4, 8})
+		{
+			for (size_t num_mutexes : {1, 64})
+			{
+				const double std_mutex = BenchmarkMutex<std::mutex>(num_threads, num_mutexes, 1, num_locks_per_thread);
+				const double adaptive_mutex = BenchmarkMutex<core::AdaptiveMutex>(num_threads, num_mutexes, 1, num_locks_per_thread);
+				const double std_shared_mutex = BenchmarkMutex<std::shared_mutex>(num_threads, num_mutexes, 16, num_locks_per_thread);
+				const double adaptive_shared_mutex = BenchmarkMutex<core::AdaptiveSharedMutex>(num_threads, num_mutexes, 16, num_locks_per_thread);
+
+				core::LogInfo("Mutex benchmark <%zu> threads <%zu> mutexes: std::mutex %.1fns, AdaptiveMutex %.1fns, std::shared_mutex %.1fns, AdaptiveSharedMutex %.1fns",
+					num_threads, num_mutexes, std_mutex, adaptive_mutex, std_shared_mutex, adaptive_shared_mutex);
+			}
+		}
+	}
+}
@@ -6,6 +6,7 @@
 #define TYPE_LIST_H_
 
 #include <tuple>
+#include <stddef.h>
 
 namespace core
 {
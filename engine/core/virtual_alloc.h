@@ -6,6 +6,7 @@
 #define VIRTUAL_ALLOC_H_
 
 #include <stdint.h>
+#include <stddef.h>
 #include <type_traits>
 
 template <typename Enum, typename std::enable_if_t<std::is_enum<Enum>::value, int> = 0>
@@ -25,7 +26,9 @@ namespace core
 	enum class AllocFlags
 	{
 		Reserve = 1 << 0,
-		Commit = 1 << 1
+		Commit = 1 << 1,
+		//Hint to back the reserved range with large pages, platforms without support ignore it
+		LargePages = 1 << 2
 	};
 
 	enum class FreeFlags
@@ -35,8 +38,19 @@ namespace core
 	};
 
 	void* VirtualAlloc(void* ptr, size_t size, AllocFlags flags);
+	//Release needs the same ptr and size used for reserving the memory
 	void VirtualFree(void* ptr, size_t size, FreeFlags flags);
 	size_t GetPageSize();
+
+	//Size of a large page, page size if the platform doesn't support them
+	size_t GetLargePageSize();
+
+	//Large pages are used for reserved memory that is commited incrementally, only then it makes sense to commit in large pages
+	bool CanCommitLargePages();
+
+	//Touch all the pages in the range, so the first access doesn't page fault
+	//The memory needs to be commited, the content doesn't change
+	void PrefaultMemory(void* ptr, size_t size);
 }
 
 #endif //VIRTUAL_ALLOC_H_
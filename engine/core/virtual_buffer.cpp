@@ -20,8 +20,11 @@ namespace
 
 namespace core
 {
-	VirtualBuffer::VirtualBuffer(size_t reserved_memory)
+	VirtualBuffer::VirtualBuffer(size_t reserved_memory, VirtualBufferFlags flags) : m_flags(flags)
 	{
+		//Large pages are commited in large page chunks, only if the platform really uses them for this buffer
+		m_page_size = (check_flag(flags, VirtualBufferFlags::LargePages) && CanCommitLargePages()) ? GetLargePageSize() : GetPageSize();
+
 		if (reserved_memory == 0)
 		{
 			m_memory_base = nullptr;
@@ -29,13 +32,19 @@ namespace core
 		else
 		{
 			//Need to round the memory to page size
-			size_t page_size = GetPageSize();
-			reserved_memory = ((reserved_memory / page_size) + 1) * page_size;
+			reserved_memory = ((reserved_memory / m_page_size) + 1) * m_page_size;
 
 			//Reserve memory
-			m_memory_base = static_cast<char*>(VirtualAlloc(nullptr, reserved_memory, AllocFlags::Reserve));
+			AllocFlags alloc_flags = AllocFlags::Reserve;
+			if (check_flag(flags, VirtualBufferFlags::LargePages))
+			{
+				alloc_flags = alloc_flags | AllocFlags::LargePages;
+			}
+			m_memory_base = static_cast<char*>(VirtualAlloc(nullptr, reserved_memory, alloc_flags));
 		}
 
+		m_memory_reserved = reserved_memory;
+
 		//Non commited memory
 		m_memory_commited = 0;
 	}
@@ -45,52 +54,69 @@ namespace core
 		if (m_memory_base)
 		{
 			//Deallocate all commited/reserved memory
-			VirtualFree(m_memory_base, 0, FreeFlags::Release);
+			VirtualFree(m_memory_base, m_memory_reserved, FreeFlags::Release);
 		}
 	}
 
 	void VirtualBuffer::SetCommitedSize(size_t new_size, bool free_memory)
 	{
-		size_t page_size = GetPageSize();
-
 		if (!free_memory)
 		{
 			new_size = std::max(new_size, m_memory_commited);
 		}
 
-		//Check if the new size means new pages to be commited or released
-		size_t page_index = calculate_page(m_memory_commited, page_size);
-		size_t new_page_index = calculate_page(new_size, page_size);
+		//Memory that needs to be commited in pages
+		const size_t pages_commited_size = m_pages_commited_size.load(std::memory_order_relaxed);
+		size_t new_pages_commited_size = calculate_page(new_size, m_page_size) * m_page_size;
 
-		if (new_size == 0)
-		{
-			//Decommit all the memory
-			VirtualFree(m_memory_base, m_memory_commited, FreeFlags::Decommit);
-		}
-		else if (m_memory_commited == 0 && page_index == new_page_index)
-		{
-			//We need to commit the first one
-			VirtualAlloc(m_memory_base, page_size, AllocFlags::Commit);
-		}
-		else if (page_index == new_page_index)
-		{
-			//We don't need to update the commited pages
-		}
-		else if (new_page_index > page_index)
+		if (new_pages_commited_size > pages_commited_size)
 		{
-			//We need to commit new pages (from page_index to new_page_index)
+			if (check_flag(m_flags, VirtualBufferFlags::Prefault))
+			{
+				//Commit ahead, so there are pages to prefault before they are used
+				new_pages_commited_size = std::min(m_memory_reserved, std::max(new_pages_commited_size, pages_commited_size * 2));
+			}
+
+			//We need to commit new pages
 			//If there is not sufficient reserved memory, it will fail
-			size_t num_pages_to_commit = new_page_index - page_index;
-			VirtualAlloc(m_memory_base + page_index * page_size, num_pages_to_commit * page_size, AllocFlags::Commit);
+			VirtualAlloc(m_memory_base + pages_commited_size, new_pages_commited_size - pages_commited_size, AllocFlags::Commit);
+			m_pages_commited_size.store(new_pages_commited_size, std::memory_order_release);
 		}
-		else
+		else if (new_pages_commited_size < pages_commited_size && !check_flag(m_flags, VirtualBufferFlags::Prefault))
 		{
-			//We need to decommit the memory from (new_page_index + 1) to page_index (included page_index)
-			size_t num_pages_to_decommit = page_index - new_page_index;
-			VirtualFree(m_memory_base + (new_page_index + 1) * page_size, num_pages_to_decommit * page_size, FreeFlags::Decommit);
+			//We need to decommit the pages that are not used anymore
+			//Buffers that can be prefaulted never decommit, other thread could be touching the pages
+			VirtualFree(m_memory_base + new_pages_commited_size, pages_commited_size - new_pages_commited_size, FreeFlags::Decommit);
+			m_pages_commited_size.store(new_pages_commited_size, std::memory_order_release);
 		}
 
 		//Update commited memory value
 		m_memory_commited = new_size;
 	}
+
+	void VirtualBuffer::CommitAhead(size_t size)
+	{
+		assert(check_flag(m_flags, VirtualBufferFlags::Prefault));
+
+		const size_t pages_commited_size = m_pages_commited_size.load(std::memory_order_relaxed);
+		const size_t new_pages_commited_size = std::min(m_memory_reserved, calculate_page(size, m_page_size) * m_page_size);
+
+		if (new_pages_commited_size > pages_commited_size)
+		{
+			VirtualAlloc(m_memory_base + pages_commited_size, new_pages_commited_size - pages_commited_size, AllocFlags::Commit);
+			m_pages_commited_size.store(new_pages_commited_size, std::memory_order_release);
+		}
+	}
+
+	void VirtualBuffer::Prefault()
+	{
+		assert(check_flag(m_flags, VirtualBufferFlags::Prefault));
+
+		const size_t pages_commited_size = m_pages_commited_size.load(std::memory_order_acquire);
+		if (pages_commited_size > m_pages_prefaulted_size)
+		{
+			PrefaultMemory(m_memory_base + m_pages_prefaulted_size, pages_commited_size - m_pages_prefaulted_size);
+			m_pages_prefaulted_size = pages_commited_size;
+		}
+	}
 }
\ No newline at end of file
@@ -6,15 +6,27 @@
 #ifndef VIRTUAL_BUFFER_H_
 #define VIRTUAL_BUFFER_H_
 
+#include <core/virtual_alloc.h>
 #include <cassert>
+#include <atomic>
 
 namespace core
 {
+	enum class VirtualBufferFlags
+	{
+		None = 0,
+		//Back the buffer with large pages if the platform supports it, memory is commited in large pages only when they are used
+		LargePages = 1 << 0,
+		//Memory is commited ahead and never decommited until the buffer is destroyed
+		//The commited pages can be prefaulted from other thread with Prefault
+		Prefault = 1 << 1
+	};
+
 	class VirtualBuffer
 	{
 	public:
 		//Reserved memory is defined during construction
-		explicit VirtualBuffer(size_t reserved_memory);
+		explicit VirtualBuffer(size_t reserved_memory, VirtualBufferFlags flags = VirtualBufferFlags::None);
 		~VirtualBuffer();
 
 		VirtualBuffer(const VirtualBuffer&) = delete;
@@ -35,18 +47,37 @@ namespace core
 			return m_memory_base;
 		}
 
+		//Commit the pages needed for size without changing the commited size, only for buffers created with the Prefault flag
+		//Calls to CommitAhead and SetCommitedSize need to be synchronized by the caller
+		void CommitAhead(size_t size);
+
+		//Touch the commited pages that have not been prefaulted yet, only for buffers created with the Prefault flag
+		//It can be called from other thread while the buffer is used, only one thread can prefault at the same time
+		void Prefault();
+
 	private:
 		//Virtual memory address of the buffer
 		char* m_memory_base;
 		//Memory commited for this buffer
 		size_t m_memory_commited;
+
+		//Reserved memory
+		size_t m_memory_reserved;
+		//Granularity used for commiting memory
+		size_t m_page_size;
+		//Flags
+		VirtualBufferFlags m_flags;
+		//Memory commited in pages, with the Prefault flag it can be bigger than the commited memory
+		std::atomic<size_t> m_pages_commited_size = 0;
+		//Memory already prefaulted
+		size_t m_pages_prefaulted_size = 0;
 	};
 
-	template <size_t RESERVED_MEMORY>
+	template <size_t RESERVED_MEMORY, VirtualBufferFlags FLAGS = VirtualBufferFlags::None>
 	class VirtualBufferInitied : public VirtualBuffer
 	{
 	public:
-		VirtualBufferInitied() : VirtualBuffer(RESERVED_MEMORY)
+		VirtualBufferInitied() : VirtualBuffer(RESERVED_MEMORY, FLAGS)
 		{
 		}
 	};
@@ -55,7 +86,7 @@ namespace core
 	class VirtualBufferTyped : VirtualBuffer
 	{
 	public:
-		explicit VirtualBufferTyped(size_t reserved_memory) : VirtualBuffer(reserved_memory)
+		explicit VirtualBufferTyped(size_t reserved_memory, VirtualBufferFlags flags = VirtualBufferFlags::None) : VirtualBuffer(reserved_memory, flags)
 		{
 		}
 		void SetSize(const size_t size, bool free_memory = true)
@@ -91,11 +122,11 @@ namespace core
 		}
 	};
 
-	template <typename TYPE, size_t RESERVED_SIZE>
+	template <typename TYPE, size_t RESERVED_SIZE, VirtualBufferFlags FLAGS = VirtualBufferFlags::None>
 	class VirtualBufferTypedInitied : public VirtualBufferTyped<TYPE>
 	{
 	public:
-		VirtualBufferTypedInitied() : VirtualBufferTyped(RESERVED_SIZE)
+		VirtualBufferTypedInitied() : VirtualBufferTyped<TYPE>(RESERVED_SIZE, FLAGS)
 		{
 		}
 	};
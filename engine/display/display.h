@@ -296,4 +296,4 @@ namespace display
 	}
 
 }
-#endif DISPLAY_H_
\ No newline at end of file
+#endif //DISPLAY_H_
\ No newline at end of file
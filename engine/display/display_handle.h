@@ -8,26 +8,27 @@
 
 namespace display
 {
-	using CommandListHandle = core::Handle<struct CommandList, uint16_t>;
-	using WeakCommandListHandle = core::WeakHandle<struct CommandList, uint16_t>;
+	//32 bits handles, so a stale handle needs 256 reuses of its slot to alias a live one again (16 with 16 bits handles)
+	using CommandListHandle = core::Handle<struct CommandList, uint32_t>;
+	using WeakCommandListHandle = core::WeakHandle<struct CommandList, uint32_t>;
 
-	using RootSignatureHandle = core::Handle<struct RootSignature, uint16_t>;
-	using WeakRootSignatureHandle = core::WeakHandle<struct RootSignature, uint16_t>;
+	using RootSignatureHandle = core::Handle<struct RootSignature, uint32_t>;
+	using WeakRootSignatureHandle = core::WeakHandle<struct RootSignature, uint32_t>;
 
-	using PipelineStateHandle = core::Handle<struct PipelineState, uint16_t>;
-	using WeakPipelineStateHandle = core::WeakHandle<struct PipelineState, uint16_t>;
+	using PipelineStateHandle = core::Handle<struct PipelineState, uint32_t>;
+	using WeakPipelineStateHandle = core::WeakHandle<struct PipelineState, uint32_t>;
 
-	using DescriptorTableHandle = core::Handle<struct DescriptorTable, uint16_t>;
-	using WeakDescriptorTableHandle = core::WeakHandle<struct DescriptorTable, uint16_t>;
+	using DescriptorTableHandle = core::Handle<struct DescriptorTable, uint32_t>;
+	using WeakDescriptorTableHandle = core::WeakHandle<struct DescriptorTable, uint32_t>;
 
-	using SamplerDescriptorTableHandle = core::Handle<struct SamplerDescriptorTable, uint16_t>;
-	using WeakSamplerDescriptorTableHandle = core::WeakHandle<struct SamplerDescriptorTable, uint16_t>;
+	using SamplerDescriptorTableHandle = core::Handle<struct SamplerDescriptorTable, uint32_t>;
+	using WeakSamplerDescriptorTableHandle = core::WeakHandle<struct SamplerDescriptorTable, uint32_t>;
 
-	using BufferHandle = core::Handle<struct Buffer, uint16_t>;
-	using WeakBufferHandle = core::WeakHandle<struct Buffer, uint16_t>;
+	using BufferHandle = core::Handle<struct Buffer, uint32_t>;
+	using WeakBufferHandle = core::WeakHandle<struct Buffer, uint32_t>;
 
-	using Texture2DHandle = core::Handle<struct Texture2D, uint16_t>;
-	using WeakTexture2DHandle = core::WeakHandle<struct Texture2D, uint16_t>;
+	using Texture2DHandle = core::Handle<struct Texture2D, uint32_t>;
+	using WeakTexture2DHandle = core::WeakHandle<struct Texture2D, uint32_t>;
 }
 
 #endif //DISPLAY_HANDLE_H_
@@ -4,6 +4,9 @@
 #ifndef ENTITY_COMPONENT_SYSTEM_COMMON_H_
 #define ENTITY_COMPONENT_SYSTEM_COMMON_H_
 
+#include <stdint.h>
+#include <stddef.h>
+
 namespace ecs
 {
 	struct Database;
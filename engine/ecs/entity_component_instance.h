@@ -42,18 +42,18 @@ namespace ecs
 	private:
 		InstanceIndirectionIndexType m_indirection_index;
 
-		template<typename DATABASE_DECLARATION, typename ENTITY_TYPE>
-		friend Instance<DATABASE_DECLARATION> AllocInstance(ZoneType zone_index);
+		template<typename FRIEND_DATABASE_DECLARATION, typename ENTITY_TYPE>
+		friend Instance<FRIEND_DATABASE_DECLARATION> AllocInstance(ZoneType zone_index);
 
-		template<typename DATABASE_DECLARATION>
-		friend void DeallocInstance(Instance<DATABASE_DECLARATION>& instance);
+		template<typename FRIEND_DATABASE_DECLARATION>
+		friend void DeallocInstance(Instance<FRIEND_DATABASE_DECLARATION>& instance);
 
 		Instance(const InstanceIndirectionIndexType& indirection_index) : m_indirection_index(indirection_index)
 		{
 		}
 
 		friend class InstanceReference;
-		template<typename DATABASE_DECLARATION>
+		template<typename FRIEND_DATABASE_DECLARATION>
 		friend class InstanceIterator;
 	};
 
@@ -105,7 +105,7 @@ namespace ecs
 		//Calls the default contructor for all components of the instance
 		EntityTypeMask entity_type_mask = internal::GetInstanceTypeMask(DATABASE_DECLARATION::s_database, m_indirection_index);
 
-		core::visit<DATABASE_DECLARATION::Components::template Size()>([&](auto component_index)
+		core::visit<DATABASE_DECLARATION::Components::Size()>([&](auto component_index)
 		{
 			if (((1ULL << component_index.value) & entity_type_mask) != 0)
 			{
@@ -63,14 +63,14 @@ namespace ecs
 		FUNCTION&& kernel, JOB_DATA* job_data, BITSET&& zone_bitset, core::ProfileMarker* profile_token = nullptr)
 	{
 		//Calculate component mask
-		const EntityTypeMask component_mask = EntityType<std::remove_const<COMPONENTS>::template type...>::template EntityTypeMask<DATABASE_DECLARATION>();
+		const EntityTypeMask component_mask = EntityType<typename std::remove_const<COMPONENTS>::type...>::template EntityTypeMask<DATABASE_DECLARATION>();
 
 		const ZoneType num_zones = internal::GetNumZones(DATABASE_DECLARATION::s_database);
 
 		InstanceIterator<DATABASE_DECLARATION> instance_iterator;
 
 		//Loop for all entity type that match the component mask
-		core::visit<DATABASE_DECLARATION::EntityTypes::template Size()>([&](auto entity_type_index)
+		core::visit<DATABASE_DECLARATION::EntityTypes::Size()>([&](auto entity_type_index)
 		{
 			const EntityTypeType entity_type = static_cast<EntityTypeType>(entity_type_index.value);
 
@@ -99,7 +99,7 @@ namespace ecs
 								//Create job data
 								using JobBucketDataT = JobBucketData<DATABASE_DECLARATION, FUNCTION, JOB_DATA, COMPONENTS...>;
 								
-								JobBucketDataT* job_bucket_data = job_allocator->Alloc<JobBucketDataT>();
+								JobBucketDataT* job_bucket_data = job_allocator->template Alloc<JobBucketDataT>();
 
 								job_bucket_data->components = argument_component_buffers;
 								job_bucket_data->begin_instance = bucket_index * static_cast<InstanceIndexType>(num_instances_per_job);
@@ -124,7 +124,7 @@ namespace ecs
 	struct JobBucketDataWithCapture
 	{
 		//Caller helper
-		template<typename DATABASE_DECLARATION, size_t ...indices, typename ...Args>
+		template<size_t ...indices, typename ...Args>
 		static constexpr inline void caller_helper(FUNCTION* kernel, const InstanceIterator<DATABASE_DECLARATION>& instance_it, InstanceIndexType instance_index, std::integer_sequence<size_t, indices...>, std::tuple<Args...>& arguments)
 		{
 			(*kernel)(instance_it, std::get<indices>(arguments)[instance_index]...);
@@ -161,7 +161,7 @@ namespace ecs
 				this_bucket_job_data->instance_iterator.m_instance_index = instance_index;
 
 				//Call kernel
-				caller_helper<DATABASE_DECLARATION>(this_bucket_job_data->kernel, this_bucket_job_data->instance_iterator, instance_index, std::make_index_sequence<sizeof...(COMPONENTS)>(), this_bucket_job_data->components);
+				caller_helper(this_bucket_job_data->kernel, this_bucket_job_data->instance_iterator, instance_index, std::make_index_sequence<sizeof...(COMPONENTS)>(), this_bucket_job_data->components);
 			}
 		}
 	};
@@ -174,7 +174,7 @@ namespace ecs
 		FUNCTION&& kernel, BITSET&& zone_bitset, core::ProfileMarker* profile_token = nullptr)
 	{
 		//Calculate component mask
-		const EntityTypeMask component_mask = EntityType<std::remove_const<COMPONENTS>::template type...>::template EntityTypeMask<DATABASE_DECLARATION>();
+		const EntityTypeMask component_mask = EntityType<typename std::remove_const<COMPONENTS>::type...>::template EntityTypeMask<DATABASE_DECLARATION>();
 
 		const ZoneType num_zones = internal::GetNumZones(DATABASE_DECLARATION::s_database);
 
@@ -182,10 +182,10 @@ namespace ecs
 
 		using JobBucketDataT = JobBucketDataWithCapture<DATABASE_DECLARATION, FUNCTION, COMPONENTS...>;
 		//Capture the kernel function into the job allocator
-		FUNCTION* kernel_captured = new (job_allocator->Alloc<FUNCTION>()) FUNCTION(kernel);
+		FUNCTION* kernel_captured = new (job_allocator->template Alloc<FUNCTION>()) FUNCTION(kernel);
 
 		//Loop for all entity type that match the component mask
-		core::visit<DATABASE_DECLARATION::EntityTypes::template Size()>([&](auto entity_type_index)
+		core::visit<DATABASE_DECLARATION::EntityTypes::Size()>([&](auto entity_type_index)
 			{
 				const EntityTypeType entity_type = static_cast<EntityTypeType>(entity_type_index.value);
 
@@ -213,7 +213,7 @@ namespace ecs
 								{
 									//Create job data
 
-									JobBucketDataT* job_bucket_data = job_allocator->Alloc<JobBucketDataT>();
+									JobBucketDataT* job_bucket_data = job_allocator->template Alloc<JobBucketDataT>();
 
 									job_bucket_data->components = argument_component_buffers;
 									job_bucket_data->begin_instance = bucket_index * static_cast<InstanceIndexType>(num_instances_per_job);
@@ -35,6 +35,37 @@ namespace ecs
 		size_t count_created = 0;
 	};
 
+	//Lock of the components of a zone and entity type
+	//The core::Mutex version (std::mutex) can be selected in the database description to compare the contention
+	class ComponentsMutex
+	{
+	public:
+		void lock()
+		{
+			if (m_adaptive)
+				m_adaptive_mutex.lock();
+			else
+				m_mutex.lock();
+		}
+
+		void unlock()
+		{
+			if (m_adaptive)
+				m_adaptive_mutex.unlock();
+			else
+				m_mutex.unlock();
+		}
+
+		void SetAdaptive(bool adaptive)
+		{
+			m_adaptive = adaptive;
+		}
+	private:
+		bool m_adaptive = true;
+		core::AdaptiveMutex m_adaptive_mutex;
+		core::Mutex m_mutex;
+	};
+
 	//Database
 	//Our Database will have a list of instance types
 	//Instance types depends of the combination of components added to a instance
@@ -49,6 +80,9 @@ namespace ecs
 		//Index of the component with the indirection index
 		uint8_t m_indirection_index_component_index;
 
+		//Component storage can be prefaulted
+		bool m_prefault_memory = false;
+
 		//List of components
 		std::vector<Component> m_components;
 
@@ -62,7 +96,7 @@ namespace ecs
 
 		//Flat list of spin locks to control access to the components
 		//Dimensions are <Zone, EntityType>
-		std::unique_ptr<core::Mutex[]> m_components_spinlock_mutex;
+		std::unique_ptr<ComponentsMutex[]> m_components_spinlock_mutex;
 
 		//Flat list with the number of instances for each Zone/EntityType
 		//Dimensions are <Zone, EntityType>
@@ -71,7 +105,7 @@ namespace ecs
 		struct IndirectionInstanceTable
 		{
 			//Using virtual memory here will avoid the sync needed in case the table gets reallocated
-			core::VirtualBufferTypedInitied<InternalInstanceIndex, 20 * 1024 * 1024> table;
+			core::VirtualBufferTypedInitied<InternalInstanceIndex, 20 * 1024 * 1024, core::VirtualBufferFlags::LargePages> table;
 			InstanceIndexType first_free_slot_indirection_instance; //We use the same type that the instance index, as we create the chain with it
 		};
 
@@ -306,7 +340,7 @@ namespace ecs
 			auto& first_free_slot_indirection_instance_table = m_indirection_instance_table.Get().first_free_slot_indirection_instance;
 			auto& indirection_instance_table = m_indirection_instance_table.Get().table;
 
-			if (first_free_slot_indirection_instance_table == -1)
+			if (first_free_slot_indirection_instance_table == static_cast<InstanceIndexType>(-1))
 			{
 				//The pool is full, just push and index and return
 				assert(indirection_instance_table.GetSize() <= (1 << 24));
@@ -354,7 +388,7 @@ namespace ecs
 			//Get indirection index
 			auto& indirection_index = *reinterpret_cast<InstanceIndirectionIndexType*>(GetComponentData(internal_index, m_indirection_index_component_index));
 
-			auto& internal_instance_index = AccessInternalInstanceIndex(indirection_index);
+			[[maybe_unused]] auto& internal_instance_index = AccessInternalInstanceIndex(indirection_index);
 
 			assert(internal_instance_index.zone_index == internal_index.zone_index);
 			assert(internal_instance_index.entity_type_index == internal_index.entity_type_index);
@@ -400,6 +434,18 @@ namespace ecs
 				entity_type |= (1ULL << database->m_indirection_index_component_index);
 			}
 
+			//Flags for the component storage
+			core::VirtualBufferFlags component_buffer_flags = core::VirtualBufferFlags::None;
+			if (database_desc.large_pages)
+			{
+				component_buffer_flags = component_buffer_flags | core::VirtualBufferFlags::LargePages;
+			}
+			if (database_desc.prefault_memory)
+			{
+				component_buffer_flags = component_buffer_flags | core::VirtualBufferFlags::Prefault;
+			}
+			database->m_prefault_memory = database_desc.prefault_memory;
+
 			//Create all the components
 			const size_t num_components = database->m_num_zones * database->m_num_entity_types * database->m_num_components;
 			database->m_component_containers = std::make_unique<std::unique_ptr<core::VirtualBuffer>[]>(num_components);
@@ -417,7 +463,7 @@ namespace ecs
 					for (size_t component_index = 0; component_index < database->m_num_components; ++component_index)
 					{
 						const size_t compoment_buffer_size = database_desc.num_max_entities_zone * database->m_components[component_index].size;
-						database->m_component_containers[component_array_index++] = std::make_unique<core::VirtualBuffer>((((1ULL << component_index) & entity_type_mask) != 0 ) ? compoment_buffer_size : 0);
+						database->m_component_containers[component_array_index++] = std::make_unique<core::VirtualBuffer>((((1ULL << component_index) & entity_type_mask) != 0 ) ? compoment_buffer_size : 0, component_buffer_flags);
 					}
 				}
 			}
@@ -426,7 +472,11 @@ namespace ecs
 			database->m_num_instances.resize(database->m_num_zones * database->m_num_entity_types);
 		
 			//Init mutex for access to each instance components
-			database->m_components_spinlock_mutex = std::make_unique<core::Mutex[]>(database->m_num_zones * database->m_num_entity_types);
+			database->m_components_spinlock_mutex = std::make_unique<ComponentsMutex[]>(database->m_num_zones * database->m_num_entity_types);
+			for (size_t i = 0; i < database->m_num_zones * database->m_num_entity_types; ++i)
+			{
+				database->m_components_spinlock_mutex[i].SetAdaptive(database_desc.adaptive_components_mutex);
+			}
 
 			//Reserve memory for the indirection indexes
 			database->m_indirection_instance_table.Visit([](auto& data)
@@ -530,6 +580,38 @@ namespace ecs
 			return database->AccessInternalInstanceIndex(index).zone_index;
 		}
 
+		void PrefaultZoneMemory(Database* database, ZoneType zone_index, EntityTypeType entity_type_index, size_t num_instances)
+		{
+			if (!database->m_prefault_memory)
+				return;
+
+			{
+				//The storage only grows when the instances are allocated, commit the space for the expected instances
+				//Same lock than AllocInstance, the game thread can be allocating in this zone
+				core::MutexGuard component_access(database->m_components_spinlock_mutex[entity_type_index + zone_index * database->m_num_entity_types]);
+
+				const size_t expected_num_instances = database->m_num_instances[entity_type_index + zone_index * database->m_num_entity_types].count_created + num_instances;
+				for (ComponentType component_index = 0; component_index < database->m_num_components; ++component_index)
+				{
+					core::VirtualBuffer& storage = database->GetStorage(zone_index, entity_type_index, component_index);
+					if (storage.GetPtr())
+					{
+						storage.CommitAhead(expected_num_instances * database->m_components[component_index].size);
+					}
+				}
+			}
+
+			//Touching the pages doesn't need the lock
+			for (ComponentType component_index = 0; component_index < database->m_num_components; ++component_index)
+			{
+				core::VirtualBuffer& storage = database->GetStorage(zone_index, entity_type_index, component_index);
+				if (storage.GetPtr())
+				{
+					storage.Prefault();
+				}
+			}
+		}
+
 		void TickDatabase(Database* database)
 		{
 			//Lock database
@@ -149,6 +149,15 @@ namespace ecs
 
 		//Number max of entities per zone
 		size_t num_max_entities_zone = 1024;
+
+		//Back the component storage with large pages, less TLB misses when processing big zones
+		bool large_pages = false;
+
+		//Component storage is commited ahead and never decommited, PrefaultZoneMemory can commit and prefault it before the instances are allocated
+		bool prefault_memory = false;
+
+		//The locks of the components spin before parking the thread, false uses core::Mutex (only to compare the contention)
+		bool adaptive_components_mutex = true;
 	};
 
 	namespace internal
@@ -178,6 +187,9 @@ namespace ecs
 		//Tick database
 		void TickDatabase(Database* database);
 
+		//Commit and prefault the component storage of a zone and entity type for the expected new instances
+		void PrefaultZoneMemory(Database* database, ZoneType zone_index, EntityTypeType entity_type_index, size_t num_instances);
+
 		//Set the callback transation function if needed
 		void SetCallbackTransaction(Database* database, CallbackInternalFunction&& callback);
 
@@ -194,7 +206,7 @@ namespace ecs
 			return reinterpret_cast<COMPONENT*>(GetStorageComponent(DATABASE_DECLARATION::s_database,
 				zone_index,
 				entity_type,
-				DATABASE_DECLARATION::template ComponentIndex<std::remove_const<COMPONENT>::template type>()));
+				DATABASE_DECLARATION::template ComponentIndex<typename std::remove_const<COMPONENT>::type>()));
 		}
 
 		//Get num instances
@@ -217,11 +229,11 @@ namespace ecs
 		//List of components using type_list visit
 		std::vector<Component> components;
 
-		core::visit<DATABASE_DECLARATION::Components::template Size()>([&](auto component_index)
+		core::visit<DATABASE_DECLARATION::Components::Size()>([&](auto component_index)
 		{
 			Component component;
 			//Capture the information needed
-			component.Capture<DATABASE_DECLARATION::Components::template ElementType<component_index.value>>();
+			component.Capture<typename DATABASE_DECLARATION::Components::template ElementType<component_index.value>>();
 			//Added to the component list
 			components.push_back(component);
 		});
@@ -229,7 +241,7 @@ namespace ecs
 		//List of register entity types using type_list visit
 		std::vector<EntityTypeMask> entity_types;
 		std::vector<const char*> entity_names;
-		core::visit<DATABASE_DECLARATION::EntityTypes::template Size()>([&](auto entity_type_index)
+		core::visit<DATABASE_DECLARATION::EntityTypes::Size()>([&](auto entity_type_index)
 		{
 			using EntityTypeIt = typename DATABASE_DECLARATION::EntityTypes::template ElementType<entity_type_index.value>;
 			entity_types.push_back(EntityTypeIt::template EntityTypeMask<DATABASE_DECLARATION>());
@@ -246,7 +258,7 @@ namespace ecs
 	template<typename DATABASE_DECLARATION>
 	void DestroyDatabase()
 	{
-		internal::DestroyDatabase(DatabaseDeclaration<DATABASE_DECLARATION>::s_database);
+		internal::DestroyDatabase(DATABASE_DECLARATION::s_database);
 	}
 
 	//Alloc instance
@@ -261,7 +273,7 @@ namespace ecs
 	void DeallocInstance(Instance<DATABASE_DECLARATION>& instance)
 	{
 		internal::DeallocInstance(DATABASE_DECLARATION::s_database, instance.m_indirection_index);
-		instance.m_indirection_index.index = static_cast<uint32_t>(- 1);
+		instance.m_indirection_index.index = InstanceIndirectionIndexType::kInvalidIndex;
 	}
 
 	//Move instance
@@ -317,6 +329,15 @@ namespace ecs
 		internal::TickDatabase(DATABASE_DECLARATION::s_database);
 	}
 
+	//Commit and prefault the component storage for num_instances new instances of the entity type in the zone,
+	//so allocating them doesn't page fault
+	//Only if the database was created with prefault_memory, it can be called from a background thread
+	template<typename DATABASE_DECLARATION, typename ENTITY_TYPE>
+	void PrefaultZoneMemory(ZoneType zone_index, size_t num_instances)
+	{
+		internal::PrefaultZoneMemory(DATABASE_DECLARATION::s_database, zone_index, DATABASE_DECLARATION::template EntityTypeIndex<ENTITY_TYPE>(), num_instances);
+	}
+
 	//Iterator class, helper for access to data of the instance during the process calls
 	template<typename DATABASE_DECLARATION>
 	class InstanceIterator
@@ -403,14 +424,14 @@ namespace ecs
 	void Process(FUNCTION&& kernel, BITSET&& zone_bitset)
 	{
 		//Calculate component mask
-		const EntityTypeMask component_mask = EntityType<std::remove_const<COMPONENTS>::template type...>::template EntityTypeMask<DATABASE_DECLARATION>();
+		const EntityTypeMask component_mask = EntityType<typename std::remove_const<COMPONENTS>::type...>::template EntityTypeMask<DATABASE_DECLARATION>();
 		
 		const ZoneType num_zones = internal::GetNumZones(DATABASE_DECLARATION::s_database);
 
 		InstanceIterator<DATABASE_DECLARATION> instance_iterator;
 
 		//Loop for all entity type that match the component mask
-		core::visit<DATABASE_DECLARATION::EntityTypes::template Size()>([&](auto entity_type_index)
+		core::visit<DATABASE_DECLARATION::EntityTypes::Size()>([&](auto entity_type_index)
 		{
 			const EntityTypeType entity_type = static_cast<EntityTypeType>(entity_type_index.value);
 
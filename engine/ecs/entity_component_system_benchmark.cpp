@@ -0,0 +1,139 @@
+//////////////////////////////////////////////////////////////////////////
+// Cute engine - Benchmark of the contention in the ECS component locks
+//////////////////////////////////////////////////////////////////////////
+
+#include <benchmark/benchmark.h>
+#include <ecs/entity_component_system.h>
+#include <job/job_helper.h>
+#include <core/log.h>
+#include <ext/glm/vec3.hpp>
+#include <vector>
+
+namespace
+{
+	//Components and entity types similar to the box city boxes and cars
+	struct BenchmarkPosition
+	{
+		glm::vec3 position;
+	};
+
+	struct BenchmarkVelocity
+	{
+		glm::vec3 velocity;
+	};
+
+	struct BenchmarkFlags
+	{
+		uint32_t flags;
+	};
+
+	using BenchmarkBoxType = ecs::EntityType<BenchmarkPosition, BenchmarkFlags>;
+	using BenchmarkCarType = ecs::EntityType<BenchmarkPosition, BenchmarkVelocity, BenchmarkFlags>;
+
+	using BenchmarkComponents = ecs::ComponentList<BenchmarkPosition, BenchmarkVelocity, BenchmarkFlags>;
+	using BenchmarkEntityTypes = ecs::EntityTypeList<BenchmarkBoxType, BenchmarkCarType>;
+	using BenchmarkDatabase = ecs::DatabaseDeclaration<BenchmarkComponents, BenchmarkEntityTypes>;
+
+	struct ECSBenchmarkTimes
+	{
+		double alloc_time;
+		double tick_time;
+	};
+
+	//Each job allocates its instances in one zone, as the box city tiles loaded in jobs
+	//With one zone all the jobs contend for the same component locks
+	ECSBenchmarkTimes BenchmarkECSAllocInstances(const benchmark::Context& context, bool adaptive_components_mutex, uint32_t num_zones, uint32_t num_jobs, uint32_t num_instances_per_job)
+	{
+		ecs::DatabaseDesc database_desc;
+		database_desc.num_zones = num_zones;
+		database_desc.num_max_entities_zone = (num_jobs / num_zones + 1) * num_instances_per_job;
+		database_desc.adaptive_components_mutex = adaptive_components_mutex;
+		ecs::CreateDatabase<BenchmarkDatabase>(database_desc);
+
+		std::vector<std::vector<ecs::Instance<BenchmarkDatabase>>> job_instances(num_jobs);
+
+		ECSBenchmarkTimes times;
+		times.alloc_time = benchmark::Measure(1, [&]()
+			{
+				job::RunJobs(context.job_system, num_jobs, [&](uint32_t job_index)
+					{
+						const ecs::ZoneType zone_index = static_cast<ecs::ZoneType>(job_index % num_zones);
+						auto& instances = job_instances[job_index];
+						instances.reserve(num_instances_per_job);
+						for (uint32_t i = 0; i < num_instances_per_job; ++i)
+						{
+							if (i % 4 == 0)
+							{
+								instances.push_back(ecs::AllocInstance<BenchmarkDatabase, BenchmarkCarType>(zone_index).Init<BenchmarkPosition>().Init<BenchmarkVelocity>().Init<BenchmarkFlags>(i));
+							}
+							else
+							{
+								instances.push_back(ecs::AllocInstance<BenchmarkDatabase, BenchmarkBoxType>(zone_index).Init<BenchmarkPosition>().Init<BenchmarkFlags>(i));
+							}
+						}
+					});
+			});
+
+		//The tick makes the created instances visible
+		ecs::Tick<BenchmarkDatabase>();
+		const size_t num_instances = ecs::GetNumInstances<BenchmarkDatabase, BenchmarkBoxType>() + ecs::GetNumInstances<BenchmarkDatabase, BenchmarkCarType>();
+		if (num_instances != static_cast<size_t>(num_jobs) * num_instances_per_job)
+		{
+			core::LogError("ECS benchmark allocated <%zu> instances, expected <%u>", num_instances, num_jobs * num_instances_per_job);
+		}
+
+		//Deallocate half of the instances from the jobs, the tick destroys them and moves the last instances to the gaps
+		job::RunJobs(context.job_system, num_jobs, [&](uint32_t job_index)
+			{
+				auto& instances = job_instances[job_index];
+				for (size_t i = 0; i < instances.size(); i += 2)
+				{
+					ecs::DeallocInstance(instances[i]);
+				}
+			});
+		times.tick_time = benchmark::Measure(1, []()
+			{
+				ecs::Tick<BenchmarkDatabase>();
+			});
+
+		const size_t num_remaining_instances = ecs::GetNumInstances<BenchmarkDatabase, BenchmarkBoxType>() + ecs::GetNumInstances<BenchmarkDatabase, BenchmarkCarType>();
+		if (num_remaining_instances != num_instances / 2)
+		{
+			core::LogError("ECS benchmark has <%zu> instances after the tick, expected <%zu>", num_remaining_instances, num_instances / 2);
+		}
+
+		//The instances moved to the gaps keep their components
+		for (auto& instances : job_instances)
+		{
+			for (size_t i = 1; i < instances.size(); i += 2)
+			{
+				if (instances[i].Get<BenchmarkFlags>().flags != i)
+				{
+					core::LogError("ECS benchmark instance lost its components after the tick");
+				}
+			}
+		}
+
+		ecs::DestroyDatabase<BenchmarkDatabase>();
+		return times;
+	}
+}
+
+namespace benchmark
+{
+	//Component locks with core::Mutex (before) and with core::AdaptiveMutex (after)
+	void BenchmarkECSComponentsMutex(const Context& context)
+	{
+		const uint32_t num_jobs = static_cast<uint32_t>(job::GetNumWorkers()) * 4;
+		const uint32_t num_instances_per_job = context.quick ? 256 : 16384;
+
+		for (uint32_t num_zones : { 1u, 16u })
+		{
+			const ECSBenchmarkTimes mutex = BenchmarkECSAllocInstances(context, false, num_zones, num_jobs, num_instances_per_job);
+			const ECSBenchmarkTimes adaptive_mutex = BenchmarkECSAllocInstances(context, true, num_zones, num_jobs, num_instances_per_job);
+
+			core::LogInfo("ECS benchmark <%u> jobs <%u> zones <%u> instances: AllocInstance Mutex %.1fus, AdaptiveMutex %.1fus; TickDatabase Mutex %.1fus, AdaptiveMutex %.1fus",
+				num_jobs, num_zones, num_jobs * num_instances_per_job, mutex.alloc_time, adaptive_mutex.alloc_time, mutex.tick_time, adaptive_mutex.tick_time);
+		}
+	}
+}
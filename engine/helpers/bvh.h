@@ -4,9 +4,19 @@
 #include <ext/glm/vec3.hpp>
 #include "collision.h"
 #include <algorithm>
+#include <functional>
 #include <vector>
+#include <cassert>
+#include <xmmintrin.h>
+#include <job/job_helper.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__AVX2__) || defined(__BMI2__)
+#include <immintrin.h>
+#endif
 
 //Base to https://developer.nvidia.com/blog/thinking-parallel-part-iii-tree-construction-gpu/
+//Karras, Maximizing Parallelism in the Construction of BVHs, Octrees, and k-d Trees (2012)
 
 namespace helpers
 {
@@ -33,26 +43,221 @@ namespace helpers
 		return xx * 4 + yy * 2 + zz;
 	}
 
+	//Same for 21bits, two zero bits between each bit
+	inline uint64_t ExpandBits64(uint32_t value)
+	{
+#if defined(__BMI2__) || (defined(_MSC_VER) && defined(__AVX2__))
+		//pdep deposits the bits in the mask positions (slow in AMD before Zen 3, but still correct)
+		return _pdep_u64(value, 0x1249249249249249ull);
+#else
+		uint64_t x = value & 0x1FFFFFu;
+		x = (x | x << 32) & 0x001F00000000FFFFull;
+		x = (x | x << 16) & 0x001F0000FF0000FFull;
+		x = (x | x << 8) & 0x100F00F00F00F00Full;
+		x = (x | x << 4) & 0x10C30C30C30C30C3ull;
+		x = (x | x << 2) & 0x1249249249249249ull;
+		return x;
+#endif
+	}
+
+	//Morton codes, [0,1] cube to 63bits, 21bits for each axis
+	inline uint64_t Morton64(glm::vec3 position)
+	{
+		position.x = glm::clamp(position.x * 2097152.f, 0.f, 2097151.f);
+		position.y = glm::clamp(position.y * 2097152.f, 0.f, 2097151.f);
+		position.z = glm::clamp(position.z * 2097152.f, 0.f, 2097151.f);
+
+		const uint64_t xx = ExpandBits64(static_cast<uint32_t>(position.x));
+		const uint64_t yy = ExpandBits64(static_cast<uint32_t>(position.y));
+		const uint64_t zz = ExpandBits64(static_cast<uint32_t>(position.z));
+
+		return xx * 4 + yy * 2 + zz;
+	}
+
+	//63bits morton codes of a batch of positions inside the bounds, the positions are in structure of arrays
+	//Encodes 8 positions at the same time with AVX2
+	inline void CalculateMorton64(const float* x, const float* y, const float* z, const uint32_t count, const AABB& bounds, uint64_t* codes)
+	{
+		const glm::vec3 scale = 2097152.f / (bounds.max - bounds.min);
+
+		uint32_t i = 0;
+#if defined(__AVX2__)
+		const __m256 min_x = _mm256_set1_ps(bounds.min.x);
+		const __m256 min_y = _mm256_set1_ps(bounds.min.y);
+		const __m256 min_z = _mm256_set1_ps(bounds.min.z);
+		const __m256 scale_x = _mm256_set1_ps(scale.x);
+		const __m256 scale_y = _mm256_set1_ps(scale.y);
+		const __m256 scale_z = _mm256_set1_ps(scale.z);
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 max_value = _mm256_set1_ps(2097151.f);
+
+		//Max before min, so NaN ends as zero
+		auto quantize = [&](const float* values, const __m256 min, const __m256 scale)
+		{
+			const __m256 value = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(values), min), scale);
+			return _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(value, zero), max_value));
+		};
+
+		//Same steps than ExpandBits64 in four 64bits lanes
+		auto expand = [](__m128i value)
+		{
+			__m256i x = _mm256_cvtepu32_epi64(value);
+			x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi64(x, 32)), _mm256_set1_epi64x(0x001F00000000FFFFll));
+			x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi64(x, 16)), _mm256_set1_epi64x(0x001F0000FF0000FFll));
+			x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi64(x, 8)), _mm256_set1_epi64x(0x100F00F00F00F00Fll));
+			x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi64(x, 4)), _mm256_set1_epi64x(0x10C30C30C30C30C3ll));
+			x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi64(x, 2)), _mm256_set1_epi64x(0x1249249249249249ll));
+			return x;
+		};
+
+		auto interleave = [&](const __m256i xx, const __m256i yy, const __m256i zz, const int half)
+		{
+			const __m128i x_half = half ? _mm256_extracti128_si256(xx, 1) : _mm256_castsi256_si128(xx);
+			const __m128i y_half = half ? _mm256_extracti128_si256(yy, 1) : _mm256_castsi256_si128(yy);
+			const __m128i z_half = half ? _mm256_extracti128_si256(zz, 1) : _mm256_castsi256_si128(zz);
+			return _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi64(expand(x_half), 2), _mm256_slli_epi64(expand(y_half), 1)), expand(z_half));
+		};
+
+		for (; i + 8 <= count; i += 8)
+		{
+			const __m256i xx = quantize(x + i, min_x, scale_x);
+			const __m256i yy = quantize(y + i, min_y, scale_y);
+			const __m256i zz = quantize(z + i, min_z, scale_z);
+
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(codes + i), interleave(xx, yy, zz, 0));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(codes + i + 4), interleave(xx, yy, zz, 1));
+		}
+#endif
+		//Same operations than the vector path, so both give the same codes
+		auto quantize_scalar = [](const float value, const float min, const float scale)
+		{
+			const float quantized = (value - min) * scale;
+			return static_cast<uint32_t>(quantized > 0.f ? glm::min(quantized, 2097151.f) : 0.f);
+		};
+		for (; i < count; ++i)
+		{
+			codes[i] = ExpandBits64(quantize_scalar(x[i], bounds.min.x, scale.x)) * 4 +
+				ExpandBits64(quantize_scalar(y[i], bounds.min.y, scale.y)) * 2 +
+				ExpandBits64(quantize_scalar(z[i], bounds.min.z, scale.z));
+		}
+	}
+
+	//Number of upper bits shared by both codes, the split in the sorted morton codes happens in the first different bit
 	inline uint32_t CommonUpperBits(const uint32_t a, const uint32_t b)
 	{
-		//x86 intrisic
-		return _tzcnt_u32(a ^ b);
+		const uint32_t value = a ^ b;
+		if (value == 0) return 32;
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanReverse(&index, value);
+		return 31 - static_cast<uint32_t>(index);
+#else
+		return static_cast<uint32_t>(__builtin_clz(value));
+#endif
 	}
 
+	//Same for 64bits keys, the morton code in the upper bits and the instance index in the lower bits
+	inline uint32_t CommonUpperBits(const uint64_t a, const uint64_t b)
+	{
+		const uint64_t value = a ^ b;
+		if (value == 0) return 64;
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanReverse64(&index, value);
+		return 63 - static_cast<uint32_t>(index);
+#else
+		return static_cast<uint32_t>(__builtin_clzll(value));
+#endif
+	}
+
+	//Index of the lowest bit set, mask can not be zero
+	inline uint32_t LowestBitIndex(const uint32_t mask)
+	{
+		assert(mask != 0);
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return static_cast<uint32_t>(index);
+#else
+		return static_cast<uint32_t>(__builtin_ctz(mask));
+#endif
+	}
+
+	//Algorithm used for building the BVH, both produce different trees with the same node layout
+	enum class BVHBuilder
+	{
+		Linear, //Morton codes radix tree, fast to build
+		BinnedSAH //Surface area heuristic, slower to build but less nodes visited in the queries, for static data
+	};
+
 	//Basic linear BVH
 	//Fast to build and to update (without rebuilding the structure), not the best BVH
+	//The linear builder calculates the nodes from the sorted morton codes as a radix tree, each internal node can be calculated in parallel
+	//The binned SAH builder produces a different tree with the same node layout and tighter bounds, for static data that is queried a lot
+	//The binary tree is collapsed in a 4-wide tree for the queries, the four child bounds are tested with one SSE compare
 	template<typename INSTANCE, typename SETTINGS>
 	class LinearBVH
 	{
 	public:
-		using IndexType = SETTINGS::template IndexType;
+		using IndexType = typename SETTINGS::IndexType;
 
 		//Build the BVH from an instances array and a bounds
-		void Build(SETTINGS* settings, INSTANCE* const instances, uint32_t num_instances, const AABB& bounds);
+		//If a job system is provided, the build is split in jobs and GetAABB/SetLeafIndex are called from the workers
+		void Build(SETTINGS* settings, INSTANCE* const instances, uint32_t num_instances, const AABB& bounds, job::System* job_system = nullptr, BVHBuilder builder = BVHBuilder::Linear);
 
 		//Navigate the BVH and call the visitor with each instance that are inside the bounds
+		//Returns the number of wide nodes visited
+		template <typename VISITOR>
+		uint32_t Visit(const AABB& bounds, VISITOR&& visitor) const;
+
+		//Navigate the BVH with a batch of bounds, each node is fetched once for all the bounds that reach it
+		//Only faster if the bounds are close to each other (sorted by morton code or zone)
+		//Visitor is called with the index of the bounds and the instance, instances are not sorted by bounds
+		template <typename VISITOR>
+		void Visit(const AABB* bounds, uint32_t num_bounds, VISITOR&& visitor) const;
+
+		//Navigate the BVH with a ray (or a segment), near children are visited first
+		//Visitor is called with the instance and the entry t in the instance bounds, it returns the new max t of the ray,
+		//nodes further than it are skipped, return a negative value to stop
+		//Returns the number of wide nodes visited
+		template <typename VISITOR>
+		uint32_t VisitRay(const Ray& ray, VISITOR&& visitor) const;
+
+		//Closest instance hit by the ray, hit_test(instance, t) returns true and the t of the hit if the instance is hit
+		template <typename HIT_TEST>
+		bool ClosestHit(const Ray& ray, HIT_TEST&& hit_test, INSTANCE& closest_instance, float& closest_t) const;
+
+		//Returns true if any instance is hit by the ray, stops with the first hit, used for line of sight
+		template <typename HIT_TEST>
+		bool AnyHit(const Ray& ray, HIT_TEST&& hit_test) const;
+
+		//Navigate the BVH with a packet of rays, each node is fetched once for all the rays that reach it
+		//Visitor is called with the index of the ray, the instance and the entry t, it returns the new max t of that ray
+		//Only faster if the rays are coherent (same origin or direction)
+		template <typename VISITOR>
+		void VisitRays(const Ray* rays, uint32_t num_rays, VISITOR&& visitor) const;
+
+		//Navigate the binary tree, one node for each test, used as reference for validation and benchmarks
 		template <typename VISITOR>
-		void Visit(const AABB& bounds, VISITOR&& visitor) const;
+		void VisitBinary(const AABB& bounds, VISITOR&& visitor) const;
+
+		//Update the bounds of a leaf, the parents are marked as dirty and updated in the next Refit
+		//Queries will not see the change in the parents until Refit, it is not thread safe
+		void UpdateLeaf(IndexType leaf_index, const AABB& bounds);
+
+		//Recalculate the bounds of the dirty parents, bottom up, without rebuilding the structure
+		//If a job system is provided, each subtree is refitted in a job and the top of the tree after them
+		void Refit(job::System* job_system = nullptr);
+
+		//Access to the leafs, the leaf index is the order in the BVH
+		uint32_t GetNumLeafs() const
+		{
+			return static_cast<uint32_t>(m_leafs.size());
+		}
+		const INSTANCE& GetLeaf(IndexType leaf_index) const
+		{
+			return m_leafs[leaf_index];
+		}
 
 		//Clear
 		void Clear()
@@ -61,6 +266,10 @@ namespace helpers
 			m_leafs_parents.clear();
 			m_nodes.clear();
 			m_node_parents.clear();
+			m_node_wide_slots.clear();
+			m_dirty_node_flags.clear();
+			m_dirty_nodes.clear();
+			m_wide_nodes.clear();
 			m_max_depth = 0;
 		}
 
@@ -95,55 +304,302 @@ namespace helpers
 		//Parent for each node, used to update the parent bounds
 		std::vector<IndexType> m_node_parents;
 
-		//Max depth
-		uint32_t m_max_depth;
+		//Child of a wide node, leafs are marked with the top bit
+		constexpr static uint32_t kWideLeafFlag = 0x80000000u;
+		constexpr static uint32_t kWideInvalidChild = static_cast<uint32_t>(-1);
+
+		//Node in the 4-wide tree, bounds are in SoA so all the children are tested at the same time
+		//Empty children have inverted infinite bounds, so they never collide
+		struct alignas(64) WideNode
+		{
+			float min_x[4];
+			float min_y[4];
+			float min_z[4];
+			float max_x[4];
+			float max_y[4];
+			float max_z[4];
+			uint32_t children[4];
+		}; //128 bytes
+
+		//List of wide nodes, node zero is the root
+		std::vector<WideNode> m_wide_nodes;
+
+		//Wide node and lane (wide_node * 4 + lane) where the bounds of each binary node are stored, used for the refit
+		//The root and the children collapsed in the wide tree are not stored
+		std::vector<uint32_t> m_node_wide_slots;
+
+		//Nodes with children updated since the last refit
+		std::vector<uint8_t> m_dirty_node_flags;
+		std::vector<IndexType> m_dirty_nodes;
 
-		//Struct used for building the BVH
-		struct InstanceInfo
+		//Number of dirty nodes needed for using jobs in the refit and binary depth of the subtrees refitted in each job
+		constexpr static uint32_t kRefitJobMinDirtyNodes = 1024;
+		constexpr static uint32_t kRefitSubtreeDepth = 4;
+
+		//Copy the bounds of a binary node in the wide node that stores it
+		void UpdateWideBounds(const IndexType node_index)
+		{
+			const uint32_t wide_slot = m_node_wide_slots[node_index];
+			if (wide_slot != kWideInvalidChild)
+			{
+				const AABB& bounds = m_nodes[node_index].bounds;
+				WideNode& wide_node = m_wide_nodes[wide_slot / 4];
+				const uint32_t lane = wide_slot % 4;
+				wide_node.min_x[lane] = bounds.min.x;
+				wide_node.min_y[lane] = bounds.min.y;
+				wide_node.min_z[lane] = bounds.min.z;
+				wide_node.max_x[lane] = bounds.max.x;
+				wide_node.max_y[lane] = bounds.max.y;
+				wide_node.max_z[lane] = bounds.max.z;
+			}
+		}
+
+		//Recalculate the bounds of an internal node from the children
+		void RefitNode(const IndexType node_index)
+		{
+			Node& node = m_nodes[node_index];
+			node.bounds = m_nodes[LeftNode(node_index)].bounds;
+			node.bounds.Add(m_nodes[node.right_node].bounds);
+			UpdateWideBounds(node_index);
+			m_dirty_node_flags[node_index] = 0;
+		}
+
+		//Max depth of the wide tree
+		uint32_t m_max_depth = 0;
+
+		//Each visited wide node can push 4 children and the wide depth is half of the binary depth,
+		//the binary tree is never deeper than the 64 bits of the keys (morton code and instance index) in the linear builder
+		//or the max SAH depth plus the median splits (32 bits of the instance index) in the SAH builder
+		constexpr static uint32_t kMaxStackSize = 128;
+		constexpr static uint32_t kMaxBatchBounds = 32;
+
+		//Bounds replicated in the four lanes
+		struct QueryBounds
 		{
-			INSTANCE instance;
-			AABB aabb;
-			uint32_t morton_codes;
+			__m128 min_x, min_y, min_z;
+			__m128 max_x, max_y, max_z;
 
-			InstanceInfo(const INSTANCE& _instance, const AABB& _aabb, const uint32_t _morton_codes) :
-				instance(_instance), aabb(_aabb), morton_codes(_morton_codes)
+			QueryBounds() = default;
+			QueryBounds(const AABB& bounds)
 			{
+				min_x = _mm_set1_ps(bounds.min.x);
+				min_y = _mm_set1_ps(bounds.min.y);
+				min_z = _mm_set1_ps(bounds.min.z);
+				max_x = _mm_set1_ps(bounds.max.x);
+				max_y = _mm_set1_ps(bounds.max.y);
+				max_z = _mm_set1_ps(bounds.max.z);
 			}
 		};
 
-		//Recursive node building
-		AABB NodeBuild(SETTINGS* settings, const IndexType parent_index, std::vector<InstanceInfo>& instances_info, IndexType& next_node_index, IndexType& next_leaf_index, const IndexType instance_first, const IndexType instance_last);
+		//Returns a 4 bits mask with the children that collide with the bounds
+		static uint32_t CollisionMask(const WideNode& node, const QueryBounds& query)
+		{
+			__m128 result = _mm_and_ps(_mm_cmple_ps(query.min_x, _mm_load_ps(node.max_x)), _mm_cmpge_ps(query.max_x, _mm_load_ps(node.min_x)));
+			result = _mm_and_ps(result, _mm_and_ps(_mm_cmple_ps(query.min_y, _mm_load_ps(node.max_y)), _mm_cmpge_ps(query.max_y, _mm_load_ps(node.min_y))));
+			result = _mm_and_ps(result, _mm_and_ps(_mm_cmple_ps(query.min_z, _mm_load_ps(node.max_z)), _mm_cmpge_ps(query.max_z, _mm_load_ps(node.min_z))));
+			return static_cast<uint32_t>(_mm_movemask_ps(result));
+		}
+
+		//Ray with the inverse direction replicated in the four lanes
+		//The near and far planes of each axis are selected by the sign of the direction, as offsets from the start of the wide node bounds
+		struct QueryRay
+		{
+			__m128 origin_x, origin_y, origin_z;
+			__m128 inv_direction_x, inv_direction_y, inv_direction_z;
+			uint32_t near_x, near_y, near_z;
+			uint32_t far_x, far_y, far_z;
 
+			QueryRay() = default;
+			QueryRay(const Ray& ray)
+			{
+				//Zero directions are replaced by a tiny one, so the slabs never produce NaNs
+				auto inverse = [](const float direction)
+				{
+					return 1.f / ((direction == 0.f) ? 1e-30f : direction);
+				};
+				const glm::vec3 inv_direction(inverse(ray.direction.x), inverse(ray.direction.y), inverse(ray.direction.z));
+
+				origin_x = _mm_set1_ps(ray.origin.x);
+				origin_y = _mm_set1_ps(ray.origin.y);
+				origin_z = _mm_set1_ps(ray.origin.z);
+				inv_direction_x = _mm_set1_ps(inv_direction.x);
+				inv_direction_y = _mm_set1_ps(inv_direction.y);
+				inv_direction_z = _mm_set1_ps(inv_direction.z);
+
+				//min_x, min_y, min_z, max_x, max_y, max_z are consecutive arrays of 4 floats
+				near_x = (inv_direction.x < 0.f) ? 12 : 0;
+				near_y = (inv_direction.y < 0.f) ? 16 : 4;
+				near_z = (inv_direction.z < 0.f) ? 20 : 8;
+				far_x = (inv_direction.x < 0.f) ? 0 : 12;
+				far_y = (inv_direction.y < 0.f) ? 4 : 16;
+				far_z = (inv_direction.z < 0.f) ? 8 : 20;
+			}
+		};
+
+		//Returns the lanes of the children hit by the ray before max_t and the entry t for each child
+		//Empty children have the near plane at infinite and the far plane at -infinite, so they are never hit
+		static __m128 RayCollision(const WideNode& node, const QueryRay& ray, const __m128 max_t, __m128& t_entry)
+		{
+			const float* bounds = node.min_x;
+			const __m128 near_x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bounds + ray.near_x), ray.origin_x), ray.inv_direction_x);
+			const __m128 near_y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bounds + ray.near_y), ray.origin_y), ray.inv_direction_y);
+			const __m128 near_z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bounds + ray.near_z), ray.origin_z), ray.inv_direction_z);
+			const __m128 far_x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bounds + ray.far_x), ray.origin_x), ray.inv_direction_x);
+			const __m128 far_y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bounds + ray.far_y), ray.origin_y), ray.inv_direction_y);
+			const __m128 far_z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bounds + ray.far_z), ray.origin_z), ray.inv_direction_z);
+
+			t_entry = _mm_max_ps(_mm_max_ps(near_x, near_y), _mm_max_ps(near_z, _mm_setzero_ps()));
+			const __m128 t_exit = _mm_min_ps(_mm_min_ps(far_x, far_y), _mm_min_ps(far_z, max_t));
+			return _mm_cmple_ps(t_entry, t_exit);
+		}
+
+		//Sort the children in the mask by the entry t, returns the number of children
+		static uint32_t SortChildren(uint32_t mask, const float* t_entry, uint32_t* sorted_children)
+		{
+			uint32_t num_children = 0;
+			while (mask)
+			{
+				const uint32_t child = LowestBitIndex(mask);
+				mask &= mask - 1;
+
+				//Insertion sort, there are only four
+				uint32_t position = num_children++;
+				while (position > 0 && t_entry[sorted_children[position - 1]] > t_entry[child])
+				{
+					sorted_children[position] = sorted_children[position - 1];
+					--position;
+				}
+				sorted_children[position] = child;
+			}
+			return num_children;
+		}
+
+		//Collapse the binary node in a wide node, returns the wide node index
+		uint32_t WideNodeBuild(const IndexType node_index, const uint32_t depth);
+
+		//Left child of a binary node
+		static IndexType LeftNode(const IndexType node_index)
+		{
+			//Fake node for cache aligment in the root node
+			return (node_index == 0) ? 2 : node_index + 1;
+		}
+
+		//Instances processed by each build job
+		constexpr static uint32_t kBuildJobSize = 1024;
+
+		//Radix sort of the morton codes, passes of 10 bits
+		constexpr static uint32_t kRadixBits = 10;
+		constexpr static uint32_t kRadixSize = 1 << kRadixBits;
+
+		//Calls function(job_index, begin, end) for each job of kBuildJobSize items, in the job system if there is one
+		template<typename FUNCTION>
+		static void BuildParallel(job::System* job_system, const uint32_t count, FUNCTION&& function)
+		{
+			job::RunJobs(job_system, (count + kBuildJobSize - 1) / kBuildJobSize, [&](uint32_t job_index)
+				{
+					function(job_index, job_index * kBuildJobSize, std::min(count, (job_index + 1) * kBuildJobSize));
+				});
+		}
+
+		//Internal node of the binary radix tree, covers the sorted leafs [first, last] and splits after split
+		struct RadixNode
+		{
+			uint32_t first;
+			uint32_t last;
+			uint32_t split;
+		};
+
+		//Calculates the range and the split of an internal node, only needs the sorted keys (Karras 2012)
+		static RadixNode CalculateRadixNode(const uint64_t* keys, const uint32_t num_keys, const uint32_t node);
+
+		//Builders, they place the nodes and calculate the instance of each leaf, the bounds are calculated after
+		void BuildLinear(const std::vector<AABB>& instances_bounds, const AABB& bounds, std::vector<uint32_t>& leaf_instances, job::System* job_system);
+		void BuildBinnedSAH(const std::vector<AABB>& instances_bounds, std::vector<uint32_t>& leaf_instances, job::System* job_system);
+
+		//Binned SAH, number of bins and max depth before splitting by the median, so the depth is bounded for the traversal stacks
+		constexpr static uint32_t kSAHBins = 16;
+		constexpr static uint32_t kSAHMaxDepth = 32;
+
+		//Subtrees smaller than that are built in jobs
+		constexpr static uint32_t kSAHJobSubtrees = 16;
+
+		//Sort the leaf instances in the range by the best split, returns the last of the left side
+		static uint32_t CalculateSAHSplit(const std::vector<AABB>& instances_bounds, const std::vector<glm::vec3>& centroids, uint32_t* leaf_instances, const uint32_t first, const uint32_t last, const uint32_t depth);
+
+		static float SurfaceArea(const AABB& bounds)
+		{
+			const glm::vec3 size = bounds.max - bounds.min;
+			return 2.f * (size.x * size.y + size.y * size.z + size.z * size.x);
+		}
 	};
 
 	template<typename INSTANCE, typename SETTINGS>
-	inline void LinearBVH<INSTANCE, SETTINGS>::Build(SETTINGS* settings, INSTANCE * const instances, const uint32_t num_instances, const AABB& bounds)
+	inline typename LinearBVH<INSTANCE, SETTINGS>::RadixNode LinearBVH<INSTANCE, SETTINGS>::CalculateRadixNode(const uint64_t* keys, const uint32_t num_keys, const uint32_t node)
 	{
-		m_leafs.clear();
-		m_leafs_parents.clear();
-		m_nodes.clear();
-		m_node_parents.clear();
-
-		//Collect all the bbox and calculate the morton codes
-		std::vector<InstanceInfo> instances_info;
-		instances_info.reserve(num_instances);
-		for (uint32_t i = 0; i < num_instances; ++i)
+		//Common upper bits with other key, -1 outside of the range
+		auto delta = [&](const int64_t other) -> int32_t
 		{
-			const INSTANCE& instance = instances[i];
-			//Get AABB
-			AABB aabb = settings->GetAABB(instance);
-			glm::vec3 center = (aabb.min + aabb.max) / 2.f;
+			if (other < 0 || other >= static_cast<int64_t>(num_keys)) return -1;
+			return static_cast<int32_t>(CommonUpperBits(keys[node], keys[other]));
+		};
 
-			//Move it to 0-1 range
-			glm::vec3 cube_center = (center - bounds.min) / (bounds.max - bounds.min);
+		//The keys are unique (instance index in the lower bits), so the direction is never ambiguous
+		const int64_t i = node;
+		const int64_t direction = (delta(i + 1) - delta(i - 1)) >= 0 ? 1 : -1;
 
-			instances_info.emplace_back(instance, aabb, Morton(cube_center));
+		//Upper bound for the length of the range
+		const int32_t delta_min = delta(i - direction);
+		int64_t max_length = 2;
+		while (delta(i + max_length * direction) > delta_min)
+		{
+			max_length *= 2;
 		}
 
-		//Sort leaf infos
-		std::sort(instances_info.begin(), instances_info.end(), [](const InstanceInfo& a, const InstanceInfo& b)
+		//Binary search of the other end
+		int64_t length = 0;
+		for (int64_t step = max_length / 2; step >= 1; step /= 2)
+		{
+			if (delta(i + (length + step) * direction) > delta_min)
 			{
-				return a.morton_codes < b.morton_codes;
+				length += step;
+			}
+		}
+		const int64_t j = i + length * direction;
+
+		//Binary search of the split, the last key that shares more upper bits with node than j
+		const int32_t delta_node = delta(j);
+		int64_t split = 0;
+		int64_t step = length;
+		do
+		{
+			step = (step + 1) >> 1;
+			if (delta(i + (split + step) * direction) > delta_node)
+			{
+				split += step;
+			}
+		} while (step > 1);
+
+		RadixNode radix_node;
+		radix_node.first = static_cast<uint32_t>(std::min(i, j));
+		radix_node.last = static_cast<uint32_t>(std::max(i, j));
+		radix_node.split = static_cast<uint32_t>(i + split * direction + std::min<int64_t>(direction, 0));
+		return radix_node;
+	}
+
+	template<typename INSTANCE, typename SETTINGS>
+	inline void LinearBVH<INSTANCE, SETTINGS>::Build(SETTINGS* settings, INSTANCE * const instances, const uint32_t num_instances, const AABB& bounds, job::System* job_system, BVHBuilder builder)
+	{
+		Clear();
+		if (num_instances == 0) return;
+
+		//Calculate the bounds
+		std::vector<AABB> instances_bounds(num_instances);
+		BuildParallel(job_system, num_instances, [&](uint32_t, uint32_t begin, uint32_t end)
+			{
+				for (uint32_t i = begin; i < end; ++i)
+				{
+					instances_bounds[i] = settings->GetAABB(instances[i]);
+				}
 			});
 
 		//Resize space for leafs
@@ -155,129 +611,908 @@ namespace helpers
 		m_nodes.resize(num_instances * 2);
 		m_node_parents.resize(num_instances * 2);
 
-		IndexType next_node_index = 0;
-		IndexType next_leaf_index = 0;
+		//Instance index for each leaf
+		std::vector<uint32_t> leaf_instances(num_instances);
 
-		//Build BVH, the first is the root
-		NodeBuild(settings, kInvalidIndex, instances_info, next_node_index, next_leaf_index, 0, num_instances - 1);
+		if (num_instances == 1)
+		{
+			//The root is a leaf
+			m_nodes[0].leaf = true;
+			m_nodes[0].leaf_offset = 0;
+			m_node_parents[0] = kInvalidIndex;
+			m_leafs_parents[0] = 0;
+			leaf_instances[0] = 0;
+		}
+		else if (builder == BVHBuilder::BinnedSAH)
+		{
+			BuildBinnedSAH(instances_bounds, leaf_instances, job_system);
+		}
+		else
+		{
+			BuildLinear(instances_bounds, bounds, leaf_instances, job_system);
+		}
 
-		assert(next_leaf_index == num_instances);
-		assert(next_node_index == num_instances * 2);
+		//Sorted leafs
+		BuildParallel(job_system, num_instances, [&](uint32_t, uint32_t begin, uint32_t end)
+			{
+				for (uint32_t i = begin; i < end; ++i)
+				{
+					m_leafs[i] = instances[leaf_instances[i]];
 
-		m_max_depth = static_cast<uint32_t>(log2f(static_cast<float>(num_instances)));
+					//Set the leaf index
+					settings->SetLeafIndex(m_leafs[i], static_cast<IndexType>(i));
+				}
+			});
+
+		//Children are always after the parents, so the bounds can be calculated backwards
+		for (size_t i = m_nodes.size(); i > 0; --i)
+		{
+			const IndexType node_index = static_cast<IndexType>(i - 1);
+			if (node_index == 1) continue; //Fake node
+
+			Node& node = m_nodes[node_index];
+			if (node.leaf)
+			{
+				node.bounds = instances_bounds[leaf_instances[node.leaf_offset]];
+			}
+			else
+			{
+				node.bounds = m_nodes[LeftNode(node_index)].bounds;
+				node.bounds.Add(m_nodes[node.right_node].bounds);
+			}
+		}
+
+		//Collapse the binary tree in the wide tree used by the queries
+		m_node_wide_slots.assign(m_nodes.size(), kWideInvalidChild);
+		m_dirty_node_flags.assign(m_nodes.size(), 0);
+		m_wide_nodes.reserve(num_instances);
+		WideNodeBuild(0, 1);
+
+		assert(3 * m_max_depth + 1 <= kMaxStackSize);
 	}
 
 	template<typename INSTANCE, typename SETTINGS>
-	inline AABB LinearBVH<INSTANCE, SETTINGS>::NodeBuild(SETTINGS* settings, const IndexType parent_index, std::vector<InstanceInfo>& instances_info, IndexType& next_node_index, IndexType& next_leaf_index, const IndexType instance_first, const IndexType instance_last)
+	inline void LinearBVH<INSTANCE, SETTINGS>::BuildLinear(const std::vector<AABB>& instances_bounds, const AABB& bounds, std::vector<uint32_t>& leaf_instances, job::System* job_system)
 	{
-		//Reserve a node
-		IndexType node_index = next_node_index++;
-		
-		m_node_parents[node_index] = parent_index;
+		const uint32_t num_instances = static_cast<uint32_t>(instances_bounds.size());
+
+		//The keys have the morton code in the upper bits and the instance index in the lower bits, equal morton codes are split by the index
+		//The index only uses the bits needed for the number of instances, the morton code keeps as many full levels (3 bits) as fit in the rest
+		const uint32_t index_bits = 32 - CommonUpperBits(num_instances - 1, 0u);
+		const uint32_t morton_bits = std::min(63u, ((64 - index_bits) / 3) * 3);
+		const uint64_t index_mask = (1ull << index_bits) - 1;
+
+		std::vector<uint64_t> keys(num_instances);
+		BuildParallel(job_system, num_instances, [&](uint32_t, uint32_t begin, uint32_t end)
+			{
+				//Centers in structure of arrays for the batch encoder, only the first count are used
+				float centers[3][kBuildJobSize] = {};
+				const uint32_t count = end - begin;
+				for (uint32_t i = 0; i < count; ++i)
+				{
+					const AABB& aabb = instances_bounds[begin + i];
+					const glm::vec3 center = (aabb.min + aabb.max) / 2.f;
+					centers[0][i] = center.x;
+					centers[1][i] = center.y;
+					centers[2][i] = center.z;
+				}
+
+				uint64_t* job_keys = &keys[begin];
+				CalculateMorton64(centers[0], centers[1], centers[2], count, bounds, job_keys);
+				for (uint32_t i = 0; i < count; ++i)
+				{
+					job_keys[i] = ((job_keys[i] >> (63 - morton_bits)) << index_bits) | (begin + i);
+				}
+			});
+
+		//Radix sort of the morton codes, each job counts its digits and scatters its keys in order, so it is stable
+		{
+			const uint32_t num_jobs = (num_instances + kBuildJobSize - 1) / kBuildJobSize;
+			std::vector<uint64_t> sorted_keys(num_instances);
+			std::vector<uint32_t> offsets(num_jobs * kRadixSize);
+
+			for (uint32_t shift = index_bits; shift < index_bits + morton_bits; shift += kRadixBits)
+			{
+				std::fill(offsets.begin(), offsets.end(), 0);
+				BuildParallel(job_system, num_instances, [&](uint32_t job_index, uint32_t begin, uint32_t end)
+					{
+						uint32_t* job_offsets = &offsets[job_index * kRadixSize];
+						for (uint32_t i = begin; i < end; ++i)
+						{
+							job_offsets[(keys[i] >> shift) & (kRadixSize - 1)]++;
+						}
+					});
+
+				//Offset of each digit for each job, skip the pass if all the keys have the same digit
+				bool same_digit = false;
+				uint32_t offset = 0;
+				for (uint32_t digit = 0; digit < kRadixSize; ++digit)
+				{
+					const uint32_t digit_begin = offset;
+					for (uint32_t job_index = 0; job_index < num_jobs; ++job_index)
+					{
+						const uint32_t count = offsets[job_index * kRadixSize + digit];
+						offsets[job_index * kRadixSize + digit] = offset;
+						offset += count;
+					}
+					same_digit = same_digit || (offset - digit_begin == num_instances);
+				}
+				if (same_digit) continue;
+
+				BuildParallel(job_system, num_instances, [&](uint32_t job_index, uint32_t begin, uint32_t end)
+					{
+						uint32_t* job_offsets = &offsets[job_index * kRadixSize];
+						for (uint32_t i = begin; i < end; ++i)
+						{
+							sorted_keys[job_offsets[(keys[i] >> shift) & (kRadixSize - 1)]++] = keys[i];
+						}
+					});
+				keys.swap(sorted_keys);
+			}
+		}
+
+		BuildParallel(job_system, num_instances, [&](uint32_t, uint32_t begin, uint32_t end)
+			{
+				for (uint32_t i = begin; i < end; ++i)
+				{
+					leaf_instances[i] = static_cast<uint32_t>(keys[i] & index_mask);
+				}
+			});
+
+		//Internal nodes of the radix tree, each one is calculated independently
+		const uint32_t num_internal_nodes = num_instances - 1;
+		std::vector<RadixNode> radix_nodes(num_internal_nodes);
+		BuildParallel(job_system, num_internal_nodes, [&](uint32_t, uint32_t begin, uint32_t end)
+			{
+				for (uint32_t i = begin; i < end; ++i)
+				{
+					radix_nodes[i] = CalculateRadixNode(keys.data(), num_instances, i);
+				}
+			});
+
+		//Place the nodes in depth first order, the left child is the next node and the right child goes after all the left nodes
+		struct PlaceEntry
+		{
+			uint32_t radix_node;
+			IndexType node_index;
+			IndexType parent_index;
+		};
+		PlaceEntry place_stack[kMaxStackSize];
+		uint32_t place_stack_size = 0;
+		place_stack[place_stack_size++] = { 0, 0, kInvalidIndex };
+
+		while (place_stack_size > 0)
+		{
+			const PlaceEntry entry = place_stack[--place_stack_size];
+			const RadixNode& radix_node = radix_nodes[entry.radix_node];
+
+			m_node_parents[entry.node_index] = entry.parent_index;
+			Node& node = m_nodes[entry.node_index];
+			node.leaf = false;
+
+			//The left subtree has 2 * leafs - 1 nodes
+			const IndexType left_index = LeftNode(entry.node_index);
+			const IndexType right_index = left_index + 2 * static_cast<IndexType>(radix_node.split - radix_node.first + 1) - 1;
+			node.right_node = right_index;
+
+			const uint32_t children[2] = { radix_node.split, radix_node.split + 1 };
+			const IndexType children_index[2] = { left_index, right_index };
+			const bool children_leaf[2] = { radix_node.split == radix_node.first, radix_node.split + 1 == radix_node.last };
+			for (uint32_t i = 0; i < 2; ++i)
+			{
+				if (children_leaf[i])
+				{
+					Node& leaf_node = m_nodes[children_index[i]];
+					leaf_node.leaf = true;
+					leaf_node.leaf_offset = static_cast<IndexType>(children[i]);
+					m_node_parents[children_index[i]] = entry.node_index;
+					m_leafs_parents[children[i]] = children_index[i];
+				}
+				else
+				{
+					assert(place_stack_size < kMaxStackSize);
+					place_stack[place_stack_size++] = { children[i], children_index[i], entry.node_index };
+				}
+			}
+		}
+	}
+
+	template<typename INSTANCE, typename SETTINGS>
+	inline uint32_t LinearBVH<INSTANCE, SETTINGS>::CalculateSAHSplit(const std::vector<AABB>& instances_bounds, const std::vector<glm::vec3>& centroids, uint32_t* leaf_instances, const uint32_t first, const uint32_t last, const uint32_t depth)
+	{
+		AABB centroid_bounds;
+		for (uint32_t i = first; i <= last; ++i)
+		{
+			centroid_bounds.Add(centroids[leaf_instances[i]]);
+		}
+		const glm::vec3 extent = centroid_bounds.max - centroid_bounds.min;
+
+		//Bins in each axis
+		struct Bin
+		{
+			AABB bounds;
+			uint32_t count = 0;
+		};
+		Bin bins[3][kSAHBins];
+		glm::vec3 bin_scale;
+		for (glm::length_t axis = 0; axis < 3; ++axis)
+		{
+			bin_scale[axis] = (extent[axis] > 0.f) ? static_cast<float>(kSAHBins) * 0.9999f / extent[axis] : 0.f;
+		}
+		auto calculate_bin = [&](uint32_t instance, glm::length_t axis)
+		{
+			return std::min(kSAHBins - 1, static_cast<uint32_t>((centroids[instance][axis] - centroid_bounds.min[axis]) * bin_scale[axis]));
+		};
+
+		//Best split, the left side has the bins [0, best_bin] of the best axis
+		float best_cost = FLT_MAX;
+		glm::length_t best_axis = 0;
+		uint32_t best_bin = 0;
+		uint32_t best_left_count = 0;
+
+		if (depth < kSAHMaxDepth)
+		{
+			for (uint32_t i = first; i <= last; ++i)
+			{
+				const uint32_t instance = leaf_instances[i];
+				for (glm::length_t axis = 0; axis < 3; ++axis)
+				{
+					Bin& bin = bins[axis][calculate_bin(instance, axis)];
+					bin.bounds.Add(instances_bounds[instance]);
+					bin.count++;
+				}
+			}
+
+			for (glm::length_t axis = 0; axis < 3; ++axis)
+			{
+				if (extent[axis] <= 0.f) continue;
+
+				//Cost of the right side of each split, sweeping from the right
+				float right_cost[kSAHBins];
+				AABB right_bounds;
+				uint32_t right_count = 0;
+				for (uint32_t i = kSAHBins - 1; i > 0; --i)
+				{
+					if (bins[axis][i].count > 0)
+					{
+						right_bounds.Add(bins[axis][i].bounds);
+						right_count += bins[axis][i].count;
+					}
+					right_cost[i] = (right_count > 0) ? SurfaceArea(right_bounds) * static_cast<float>(right_count) : 0.f;
+				}
+
+				AABB left_bounds;
+				uint32_t left_count = 0;
+				for (uint32_t i = 0; i < kSAHBins - 1; ++i)
+				{
+					if (bins[axis][i].count > 0)
+					{
+						left_bounds.Add(bins[axis][i].bounds);
+						left_count += bins[axis][i].count;
+					}
+					const float cost = ((left_count > 0) ? SurfaceArea(left_bounds) * static_cast<float>(left_count) : 0.f) + right_cost[i + 1];
+					if (left_count > 0 && left_count <= last - first && cost < best_cost)
+					{
+						best_cost = cost;
+						best_axis = axis;
+						best_bin = i;
+						best_left_count = left_count;
+					}
+				}
+			}
+		}
 
-		//Fake node for better cache after the root node
-		if (node_index == 0)
+		if (best_left_count == 0)
 		{
-			next_node_index++; 
+			//All the centroids are in the same bin or the tree is too deep, split by the median of the largest axis
+			const glm::length_t axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : ((extent.y >= extent.z) ? 1 : 2);
+			const uint32_t split = (first + last) / 2;
+			std::nth_element(leaf_instances + first, leaf_instances + split, leaf_instances + last + 1, [&](uint32_t a, uint32_t b)
+				{
+					return centroids[a][axis] < centroids[b][axis];
+				});
+			return split;
 		}
 
-		//local copy of the node
-		Node& node = m_nodes[node_index];
+		std::partition(leaf_instances + first, leaf_instances + last + 1, [&](uint32_t instance)
+			{
+				return calculate_bin(instance, best_axis) <= best_bin;
+			});
+		return first + best_left_count - 1;
+	}
 
-		assert(instance_first <= instance_last);
+	template<typename INSTANCE, typename SETTINGS>
+	inline void LinearBVH<INSTANCE, SETTINGS>::BuildBinnedSAH(const std::vector<AABB>& instances_bounds, std::vector<uint32_t>& leaf_instances, job::System* job_system)
+	{
+		const uint32_t num_instances = static_cast<uint32_t>(instances_bounds.size());
 
-		if (instance_first == instance_last)
+		std::vector<glm::vec3> centroids(num_instances);
+		BuildParallel(job_system, num_instances, [&](uint32_t, uint32_t begin, uint32_t end)
+			{
+				for (uint32_t i = begin; i < end; ++i)
+				{
+					centroids[i] = (instances_bounds[i].min + instances_bounds[i].max) / 2.f;
+					leaf_instances[i] = i;
+				}
+			});
+
+		//Each task builds a node with the leafs [first, last], in depth first order as the linear builder
+		struct SAHTask
+		{
+			uint32_t first;
+			uint32_t last;
+			IndexType node_index;
+			IndexType parent_index;
+			uint32_t depth;
+		};
+
+		//With a job system, the top of the tree is built first and the small subtrees are built in jobs
+		const uint32_t job_subtree_size = (job_system) ? std::max(kBuildJobSize, num_instances / kSAHJobSubtrees) : num_instances + 1;
+		std::vector<SAHTask> job_tasks;
+
+		auto build_tasks = [&](const SAHTask& root_task, const bool defer_subtrees)
 		{
-			//It is a LEAF
-			node.leaf = true;
+			SAHTask task_stack[kMaxStackSize];
+			uint32_t task_stack_size = 0;
+			task_stack[task_stack_size++] = root_task;
+
+			while (task_stack_size > 0)
+			{
+				const SAHTask task = task_stack[--task_stack_size];
+
+				if (defer_subtrees && task.last - task.first < job_subtree_size && task.node_index != 0)
+				{
+					job_tasks.push_back(task);
+					continue;
+				}
+
+				m_node_parents[task.node_index] = task.parent_index;
+				Node& node = m_nodes[task.node_index];
+
+				if (task.first == task.last)
+				{
+					//It is a LEAF
+					node.leaf = true;
+					node.leaf_offset = static_cast<IndexType>(task.first);
+					m_leafs_parents[task.first] = task.node_index;
+					continue;
+				}
+
+				const uint32_t split = CalculateSAHSplit(instances_bounds, centroids, leaf_instances.data(), task.first, task.last, task.depth);
+
+				//The left subtree has 2 * leafs - 1 nodes
+				node.leaf = false;
+				const IndexType left_index = LeftNode(task.node_index);
+				const IndexType right_index = left_index + 2 * static_cast<IndexType>(split - task.first + 1) - 1;
+				node.right_node = right_index;
+
+				assert(task_stack_size + 2 <= kMaxStackSize);
+				task_stack[task_stack_size++] = { split + 1, task.last, right_index, task.node_index, task.depth + 1 };
+				task_stack[task_stack_size++] = { task.first, split, left_index, task.node_index, task.depth + 1 };
+			}
+		};
+
+		build_tasks({ 0, num_instances - 1, 0, kInvalidIndex, 0 }, job_system != nullptr);
+
+		//Each subtree has its own range of nodes and leafs
+		job::RunJobs(job_system, static_cast<uint32_t>(job_tasks.size()), [&](uint32_t job_index)
+			{
+				build_tasks(job_tasks[job_index], false);
+			});
+	}
+
+	template<typename INSTANCE, typename SETTINGS>
+	inline void LinearBVH<INSTANCE, SETTINGS>::UpdateLeaf(IndexType leaf_index, const AABB& bounds)
+	{
+		const IndexType node_index = m_leafs_parents[leaf_index];
+		m_nodes[node_index].bounds = bounds;
+		UpdateWideBounds(node_index);
+
+		//Mark the parents until one is already dirty, the rest of the chain was marked by other leaf
+		IndexType parent_index = m_node_parents[node_index];
+		while (parent_index != kInvalidIndex && m_dirty_node_flags[parent_index] == 0)
+		{
+			m_dirty_node_flags[parent_index] = 1;
+			m_dirty_nodes.push_back(parent_index);
+			parent_index = m_node_parents[parent_index];
+		}
+	}
+
+	template<typename INSTANCE, typename SETTINGS>
+	inline void LinearBVH<INSTANCE, SETTINGS>::Refit(job::System* job_system)
+	{
+		if (m_dirty_nodes.empty()) return;
+
+		//Children are always after the parents, refit from the last node to the first
+		std::sort(m_dirty_nodes.begin(), m_dirty_nodes.end(), std::greater<IndexType>());
+
+		if (job_system && m_dirty_nodes.size() >= kRefitJobMinDirtyNodes)
+		{
+			//Collect the subtrees at kRefitSubtreeDepth, each subtree is a range of consecutive nodes
+			struct Subtree
+			{
+				IndexType begin;
+				IndexType end;
+			};
+			Subtree subtrees[1 << kRefitSubtreeDepth];
+			uint32_t num_subtrees = 0;
+
+			struct SubtreeEntry
+			{
+				Subtree subtree;
+				uint32_t depth;
+			};
+			SubtreeEntry subtree_stack[kRefitSubtreeDepth + 2];
+			uint32_t subtree_stack_size = 0;
+			subtree_stack[subtree_stack_size++] = { { 0, static_cast<IndexType>(m_nodes.size()) }, 0 };
+			while (subtree_stack_size > 0)
+			{
+				const SubtreeEntry entry = subtree_stack[--subtree_stack_size];
+				const Node& node = m_nodes[entry.subtree.begin];
+				if (node.leaf) continue;
+
+				if (entry.depth == kRefitSubtreeDepth)
+				{
+					subtrees[num_subtrees++] = entry.subtree;
+				}
+				else
+				{
+					subtree_stack[subtree_stack_size++] = { { node.right_node, entry.subtree.end }, entry.depth + 1 };
+					subtree_stack[subtree_stack_size++] = { { LeftNode(entry.subtree.begin), node.right_node }, entry.depth + 1 };
+				}
+			}
 
-			InstanceInfo& instance_info = instances_info[instance_first];
+			//The dirty nodes of each subtree are consecutive in the sorted list
+			job::RunJobs(job_system, num_subtrees, [&](uint32_t subtree_index)
+				{
+					const Subtree& subtree = subtrees[subtree_index];
+					auto it = std::lower_bound(m_dirty_nodes.begin(), m_dirty_nodes.end(), subtree.end - 1, std::greater<IndexType>());
+					for (; it != m_dirty_nodes.end() && *it >= subtree.begin; ++it)
+					{
+						RefitNode(*it);
+					}
+				});
 
-			//Allocate a leaf
-			IndexType leaf_index = next_leaf_index++;
+			//Top of the tree
+			for (const IndexType node_index : m_dirty_nodes)
+			{
+				if (m_dirty_node_flags[node_index]) RefitNode(node_index);
+			}
+		}
+		else
+		{
+			for (const IndexType node_index : m_dirty_nodes)
+			{
+				RefitNode(node_index);
+			}
+		}
 
-			node.bounds = instance_info.aabb;
-			node.leaf_offset = leaf_index;
+		m_dirty_nodes.clear();
+	}
 
-			//Set the leaf index
-			settings->SetLeafIndex(instance_info.instance, leaf_index);
+	template<typename INSTANCE, typename SETTINGS>
+	inline uint32_t LinearBVH<INSTANCE, SETTINGS>::WideNodeBuild(const IndexType node_index, const uint32_t depth)
+	{
+		m_max_depth = std::max(m_max_depth, depth);
 
-			//Push the leaf
-			m_leafs[leaf_index] = instance_info.instance;
-			m_leafs_parents[leaf_index] = node_index;
+		//The children are the grand children of the binary node, leafs are kept as they are
+		IndexType children[4];
+		uint32_t num_children = 0;
+		if (m_nodes[node_index].leaf)
+		{
+			//Only happens with a root that is a leaf
+			children[num_children++] = node_index;
 		}
 		else
 		{
-			//It is a node
+			for (const IndexType child_index : { LeftNode(node_index), m_nodes[node_index].right_node })
+			{
+				const Node& child = m_nodes[child_index];
+				if (child.leaf)
+				{
+					children[num_children++] = child_index;
+				}
+				else
+				{
+					children[num_children++] = LeftNode(child_index);
+					children[num_children++] = child.right_node;
+				}
+			}
+		}
 
-			//Calculate the bbox for the node
-			//Calculate the split instance
+		//Reserve the node before the children, so the first child is next to it
+		const uint32_t wide_node_index = static_cast<uint32_t>(m_wide_nodes.size());
+		m_wide_nodes.emplace_back();
 
-			uint32_t first_morton_code = instances_info[instance_first].morton_codes;
-			uint32_t last_morton_code = instances_info[instance_last].morton_codes;
-			IndexType split_index = instance_first;
+		for (uint32_t i = 0; i < 4; ++i)
+		{
+			uint32_t wide_child = kWideInvalidChild;
+			AABB bounds;
+			bounds.min = glm::vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+			bounds.max = glm::vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
 
-			if (first_morton_code == last_morton_code)
+			if (i < num_children)
 			{
-				//Same morton code, split in half
-				split_index = (instance_first + instance_last) / 2;
+				m_node_wide_slots[children[i]] = wide_node_index * 4 + i;
+
+				const Node& child = m_nodes[children[i]];
+				bounds = child.bounds;
+				if (child.leaf)
+				{
+					wide_child = static_cast<uint32_t>(child.leaf_offset) | kWideLeafFlag;
+				}
+				else
+				{
+					wide_child = WideNodeBuild(children[i], depth + 1);
+				}
 			}
-			else
+
+			//The vector can be reallocated by the children
+			WideNode& wide_node = m_wide_nodes[wide_node_index];
+			wide_node.min_x[i] = bounds.min.x;
+			wide_node.min_y[i] = bounds.min.y;
+			wide_node.min_z[i] = bounds.min.z;
+			wide_node.max_x[i] = bounds.max.x;
+			wide_node.max_y[i] = bounds.max.y;
+			wide_node.max_z[i] = bounds.max.z;
+			wide_node.children[i] = wide_child;
+		}
+
+		return wide_node_index;
+	}
+
+	template<typename INSTANCE, typename SETTINGS>
+	template<typename VISITOR>
+	inline uint32_t LinearBVH<INSTANCE, SETTINGS>::Visit(const AABB& bounds, VISITOR&& visitor) const
+	{
+		assert(!m_leafs.empty());
+		assert(!m_wide_nodes.empty());
+
+		const QueryBounds query(bounds);
+
+		//Start with the root
+		uint32_t node_stack[kMaxStackSize];
+		uint32_t stack_size = 0;
+		node_stack[stack_size++] = 0;
+		uint32_t visited_nodes = 0;
+
+		while (stack_size > 0)
+		{
+			const WideNode& node = m_wide_nodes[node_stack[--stack_size]];
+			visited_nodes++;
+
+			uint32_t mask = CollisionMask(node, query);
+			while (mask)
 			{
-				uint32_t step = instance_last - instance_first;
-				//Start with the first one
-				uint32_t max_prefix = CommonUpperBits(first_morton_code, last_morton_code);
+				const uint32_t child = node.children[LowestBitIndex(mask)];
+				mask &= mask - 1;
 
-				//Look for the max common upper bits that shares with the first one
-				//Binary search
-				do
+				if (child & kWideLeafFlag)
 				{
-					step = (step + 1) >> 1;
-					uint32_t new_split = split_index + step;
+					//visit
+					visitor(m_leafs[child & ~kWideLeafFlag]);
+				}
+				else
+				{
+					assert(stack_size < kMaxStackSize);
+					node_stack[stack_size++] = child;
+				}
+			}
+		}
+
+		return visited_nodes;
+	}
 
-					if (new_split < instance_last)
+	template<typename INSTANCE, typename SETTINGS>
+	template<typename VISITOR>
+	inline void LinearBVH<INSTANCE, SETTINGS>::Visit(const AABB* bounds, uint32_t num_bounds, VISITOR&& visitor) const
+	{
+		assert(!m_leafs.empty());
+		assert(!m_wide_nodes.empty());
+
+		//Groups of 32 bounds, each node in the stack has the mask of the bounds that still collide
+		for (uint32_t batch_begin = 0; batch_begin < num_bounds; batch_begin += kMaxBatchBounds)
+		{
+			const uint32_t batch_size = std::min(kMaxBatchBounds, num_bounds - batch_begin);
+
+			QueryBounds queries[kMaxBatchBounds];
+			for (uint32_t i = 0; i < batch_size; ++i)
+			{
+				queries[i] = QueryBounds(bounds[batch_begin + i]);
+			}
+
+			struct StackEntry
+			{
+				uint32_t node;
+				uint32_t bounds_mask;
+			};
+			StackEntry node_stack[kMaxStackSize];
+			uint32_t stack_size = 0;
+			node_stack[stack_size++] = { 0, (batch_size == 32) ? 0xFFFFFFFFu : ((1u << batch_size) - 1) };
+
+			while (stack_size > 0)
+			{
+				const StackEntry entry = node_stack[--stack_size];
+				const WideNode& node = m_wide_nodes[entry.node];
+
+				//Bounds mask for each child
+				uint32_t children_bounds_mask[4] = { 0, 0, 0, 0 };
+				uint32_t bounds_mask = entry.bounds_mask;
+				while (bounds_mask)
+				{
+					const uint32_t bounds_index = LowestBitIndex(bounds_mask);
+					bounds_mask &= bounds_mask - 1;
+
+					uint32_t mask = CollisionMask(node, queries[bounds_index]);
+					while (mask)
+					{
+						children_bounds_mask[LowestBitIndex(mask)] |= 1u << bounds_index;
+						mask &= mask - 1;
+					}
+				}
+
+				for (uint32_t i = 0; i < 4; ++i)
+				{
+					uint32_t child_bounds_mask = children_bounds_mask[i];
+					if (child_bounds_mask == 0) continue;
+
+					const uint32_t child = node.children[i];
+					if (child & kWideLeafFlag)
 					{
-						uint32_t split_prefix = CommonUpperBits(first_morton_code, instances_info[new_split].morton_codes);
-						if (split_prefix > max_prefix)
+						//visit for each bounds
+						const INSTANCE& instance = m_leafs[child & ~kWideLeafFlag];
+						while (child_bounds_mask)
 						{
-							//New split
-							split_index = new_split;
+							visitor(batch_begin + LowestBitIndex(child_bounds_mask), instance);
+							child_bounds_mask &= child_bounds_mask - 1;
 						}
 					}
-				} while (step > 1);
+					else
+					{
+						assert(stack_size < kMaxStackSize);
+						node_stack[stack_size++] = { child, child_bounds_mask };
+					}
+				}
 			}
+		}
+	}
 
-			//Create the two child nodes
-			node.leaf = false;
+	template<typename INSTANCE, typename SETTINGS>
+	template<typename VISITOR>
+	inline uint32_t LinearBVH<INSTANCE, SETTINGS>::VisitRay(const Ray& ray, VISITOR&& visitor) const
+	{
+		assert(!m_leafs.empty());
+		assert(!m_wide_nodes.empty());
+
+		const QueryRay query(ray);
+		float max_t = ray.max_t;
+
+		struct StackEntry
+		{
+			uint32_t node;
+			float t_entry;
+		};
+		StackEntry node_stack[kMaxStackSize];
+		uint32_t stack_size = 0;
+		node_stack[stack_size++] = { 0, 0.f };
+		uint32_t visited_nodes = 0;
+
+		while (stack_size > 0)
+		{
+			const StackEntry entry = node_stack[--stack_size];
 
-			//Create first node and get the aabb
-			node.bounds = NodeBuild(settings, node_index, instances_info, next_node_index, next_leaf_index, instance_first, split_index);
+			//Early out, the ray has been clipped by a closer hit
+			if (entry.t_entry > max_t) continue;
 
-			//Create second node and add the aabb
-			node.right_node = next_node_index;
-			node.bounds.Add(NodeBuild(settings, node_index, instances_info, next_node_index, next_leaf_index, split_index + 1, instance_last));
+			const WideNode& node = m_wide_nodes[entry.node];
+			visited_nodes++;
+
+			__m128 t_entry_lanes;
+			const uint32_t mask = static_cast<uint32_t>(_mm_movemask_ps(RayCollision(node, query, _mm_set1_ps(max_t), t_entry_lanes)));
+			if (mask == 0) continue;
+
+			alignas(16) float t_entry[4];
+			_mm_store_ps(t_entry, t_entry_lanes);
+
+			uint32_t sorted_children[4];
+			const uint32_t num_children = SortChildren(mask, t_entry, sorted_children);
+
+			//Leafs are visited near to far, so they can clip the ray before the nodes are tested
+			for (uint32_t i = 0; i < num_children; ++i)
+			{
+				const uint32_t child_index = sorted_children[i];
+				const uint32_t child = node.children[child_index];
+				if ((child & kWideLeafFlag) && t_entry[child_index] <= max_t)
+				{
+					//visit
+					max_t = visitor(m_leafs[child & ~kWideLeafFlag], t_entry[child_index]);
+				}
+			}
 
+			//Push far to near, so the nearest is the next one
+			for (uint32_t i = num_children; i > 0; --i)
+			{
+				const uint32_t child_index = sorted_children[i - 1];
+				const uint32_t child = node.children[child_index];
+				if ((child & kWideLeafFlag) == 0)
+				{
+					assert(stack_size < kMaxStackSize);
+					node_stack[stack_size++] = { child, t_entry[child_index] };
+				}
+			}
 		}
-		return node.bounds;
+
+		return visited_nodes;
 	}
+
+	template<typename INSTANCE, typename SETTINGS>
+	template<typename HIT_TEST>
+	inline bool LinearBVH<INSTANCE, SETTINGS>::ClosestHit(const Ray& ray, HIT_TEST&& hit_test, INSTANCE& closest_instance, float& closest_t) const
+	{
+		bool hit = false;
+		closest_t = ray.max_t;
+
+		VisitRay(ray, [&](const INSTANCE& instance, float) -> float
+			{
+				float t;
+				if (hit_test(instance, t) && t <= closest_t)
+				{
+					//Clip the ray, only closer instances can be hit now
+					closest_t = t;
+					closest_instance = instance;
+					hit = true;
+				}
+				return closest_t;
+			});
+
+		return hit;
+	}
+
+	template<typename INSTANCE, typename SETTINGS>
+	template<typename HIT_TEST>
+	inline bool LinearBVH<INSTANCE, SETTINGS>::AnyHit(const Ray& ray, HIT_TEST&& hit_test) const
+	{
+		bool hit = false;
+
+		VisitRay(ray, [&](const INSTANCE& instance, float) -> float
+			{
+				float t;
+				if (hit_test(instance, t) && t <= ray.max_t)
+				{
+					hit = true;
+					return -1.f;
+				}
+				return ray.max_t;
+			});
+
+		return hit;
+	}
+
+	template<typename INSTANCE, typename SETTINGS>
+	template<typename VISITOR>
+	inline void LinearBVH<INSTANCE, SETTINGS>::VisitRays(const Ray* rays, uint32_t num_rays, VISITOR&& visitor) const
+	{
+		assert(!m_leafs.empty());
+		assert(!m_wide_nodes.empty());
+
+		//Groups of 32 rays, each node in the stack has the mask of the rays that still hit it
+		for (uint32_t batch_begin = 0; batch_begin < num_rays; batch_begin += kMaxBatchBounds)
+		{
+			const uint32_t batch_size = std::min(kMaxBatchBounds, num_rays - batch_begin);
+
+			QueryRay queries[kMaxBatchBounds];
+			float max_t[kMaxBatchBounds];
+			for (uint32_t i = 0; i < batch_size; ++i)
+			{
+				queries[i] = QueryRay(rays[batch_begin + i]);
+				max_t[i] = rays[batch_begin + i].max_t;
+			}
+
+			struct StackEntry
+			{
+				uint32_t node;
+				uint32_t rays_mask;
+			};
+			StackEntry node_stack[kMaxStackSize];
+			uint32_t stack_size = 0;
+			node_stack[stack_size++] = { 0, (batch_size == 32) ? 0xFFFFFFFFu : ((1u << batch_size) - 1) };
+
+			while (stack_size > 0)
+			{
+				const StackEntry entry = node_stack[--stack_size];
+				const WideNode& node = m_wide_nodes[entry.node];
+
+				//Rays mask for each child and the entry t of each ray, the children are ordered by the closest ray
+				uint32_t children_rays_mask[4] = { 0, 0, 0, 0 };
+				alignas(16) float rays_t_entry[kMaxBatchBounds][4];
+				__m128 children_t_entry = _mm_set1_ps(FLT_MAX);
+
+				uint32_t rays_mask = entry.rays_mask;
+				while (rays_mask)
+				{
+					const uint32_t ray_index = LowestBitIndex(rays_mask);
+					rays_mask &= rays_mask - 1;
+
+					__m128 t_entry;
+					const __m128 hit = RayCollision(node, queries[ray_index], _mm_set1_ps(max_t[ray_index]), t_entry);
+					_mm_store_ps(rays_t_entry[ray_index], t_entry);
+					children_t_entry = _mm_min_ps(children_t_entry, _mm_or_ps(_mm_and_ps(hit, t_entry), _mm_andnot_ps(hit, _mm_set1_ps(FLT_MAX))));
+
+					uint32_t mask = static_cast<uint32_t>(_mm_movemask_ps(hit));
+					while (mask)
+					{
+						children_rays_mask[LowestBitIndex(mask)] |= 1u << ray_index;
+						mask &= mask - 1;
+					}
+				}
+
+				uint32_t children_mask = 0;
+				for (uint32_t i = 0; i < 4; ++i)
+				{
+					if (children_rays_mask[i]) children_mask |= 1u << i;
+				}
+				if (children_mask == 0) continue;
+
+				alignas(16) float t_entry[4];
+				_mm_store_ps(t_entry, children_t_entry);
+				uint32_t sorted_children[4];
+				const uint32_t num_children = SortChildren(children_mask, t_entry, sorted_children);
+
+				//Leafs are visited near to far, so they can clip the rays before the nodes are tested
+				for (uint32_t i = 0; i < num_children; ++i)
+				{
+					const uint32_t child_index = sorted_children[i];
+					const uint32_t child = node.children[child_index];
+					if (child & kWideLeafFlag)
+					{
+						//visit for each ray
+						const INSTANCE& instance = m_leafs[child & ~kWideLeafFlag];
+						uint32_t child_rays_mask = children_rays_mask[child_index];
+						while (child_rays_mask)
+						{
+							const uint32_t ray_index = LowestBitIndex(child_rays_mask);
+							child_rays_mask &= child_rays_mask - 1;
+
+							//Skip the rays clipped by a leaf of this node
+							if (rays_t_entry[ray_index][child_index] <= max_t[ray_index])
+							{
+								max_t[ray_index] = visitor(batch_begin + ray_index, instance, rays_t_entry[ray_index][child_index]);
+							}
+						}
+					}
+				}
+
+				//Push far to near, so the nearest is the next one
+				for (uint32_t i = num_children; i > 0; --i)
+				{
+					const uint32_t child_index = sorted_children[i - 1];
+					const uint32_t child = node.children[child_index];
+					if ((child & kWideLeafFlag) == 0)
+					{
+						assert(stack_size < kMaxStackSize);
+						node_stack[stack_size++] = { child, children_rays_mask[child_index] };
+					}
+				}
+			}
+		}
+	}
+
 	template<typename INSTANCE, typename SETTINGS>
 	template<typename VISITOR>
-	inline void LinearBVH<INSTANCE, SETTINGS>::Visit(const AABB& bounds, VISITOR&& visitor) const
+	inline void LinearBVH<INSTANCE, SETTINGS>::VisitBinary(const AABB& bounds, VISITOR&& visitor) const
 	{
 		assert(!m_leafs.empty());
 		assert(!m_nodes.empty());
 
-		//Start with the root
-		std::vector<IndexType> node_stack = {0};
-		node_stack.reserve(m_max_depth);
+		//Start with the root, the binary tree is twice deeper than the wide tree
+		IndexType node_stack[kMaxStackSize];
+		uint32_t stack_size = 0;
+		node_stack[stack_size++] = 0;
 
-		while (!node_stack.empty())
+		while (stack_size > 0)
 		{
-			assert(node_stack.size() < m_nodes.size());
-
 			//Get a the node index and pop
-			IndexType node_index = node_stack.back();
-			node_stack.pop_back();
+			const IndexType node_index = node_stack[--stack_size];
 
 			const Node& node = m_nodes[node_index];
 
@@ -291,14 +1526,12 @@ namespace helpers
 				else
 				{
 					//Push left and right
-					if (node_index == 0) node_index++; //Fake node for cache aligment in the root node
-
-					node_stack.push_back(node_index + 1);
-					node_stack.push_back(node.right_node);
+					assert(stack_size + 2 <= kMaxStackSize);
+					node_stack[stack_size++] = LeftNode(node_index);
+					node_stack[stack_size++] = node.right_node;
 				}
 			}
 		}
-
 	}
 }
 #endif //BVH_H_
\ No newline at end of file
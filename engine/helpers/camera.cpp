@@ -10,25 +10,8 @@
 #include <ext/glm/gtx/rotate_vector.hpp>
 #include <ext/glm/gtx/euler_angles.hpp>
 
-//https://gist.github.com/podgorskiy/e698d18879588ada9014768e3e82a644
-
 namespace helpers
 {
-	template<FlyCamera::Planes i, FlyCamera::Planes j>
-	struct ij2k
-	{
-		enum { k = i * (9 - i) / 2 + j - 1 };
-	};
-
-	template<FlyCamera::Planes a, FlyCamera::Planes b, FlyCamera::Planes c>
-	inline glm::vec3 intersection(const glm::vec4* planes, const glm::vec3* crosses)
-	{
-		float D = glm::dot(glm::vec3(planes[a]), crosses[ij2k<b, c>::k]);
-		glm::vec3 res = glm::mat3(crosses[ij2k<b, c>::k], -crosses[ij2k<a, c>::k], crosses[ij2k<a, b>::k]) *
-			glm::vec3(planes[a].w, planes[b].w, planes[c].w);
-		return res * (-1.0f / D);
-	}
-
 	//Process input and update the position
 	void FlyCamera::Update(platform::Game* game, float elapsed_time)
 	{
@@ -113,9 +96,11 @@ namespace helpers
 		switch (m_type)
 		{
 		case Type::Rotation:
+		{
 			glm::mat3x3 rot = glm::rotate(m_rotation.GetInterpolated().y, glm::vec3(1.f, 0.f, 0.f)) * glm::rotate(m_rotation.GetInterpolated().x, glm::vec3(0.f, 0.f, 1.f));
 			world_to_view_matrix =glm::lookAt(m_position.GetInterpolated(), m_position.GetInterpolated() + glm::vec3(0.f, 1.f, 0.f) * rot, m_up_vector);
 			break;
+		}
 		case Type::Target:
 			world_to_view_matrix = glm::lookAt(m_position.GetInterpolated(), m_target.GetInterpolated(), m_up_vector);
 			break;
@@ -155,45 +140,4 @@ namespace helpers
 	{
 		return m_view_projection_matrix;
 	}
-	
-	void Frustum::Init(const glm::mat4x4& view_projection_matrix)
-	{
-		//Calculate frustum planes
-		glm::mat4x4 frustum_matrix = glm::transpose(view_projection_matrix);
-
-		planes[Planes::Left] = frustum_matrix[3] + frustum_matrix[0];
-		planes[Planes::Right] = frustum_matrix[3] - frustum_matrix[0];
-		planes[Planes::Bottom] = frustum_matrix[3] + frustum_matrix[1];
-		planes[Planes::Top] = frustum_matrix[3] - frustum_matrix[1];
-		planes[Planes::Near] = frustum_matrix[3] + frustum_matrix[2];
-		planes[Planes::Far] = frustum_matrix[3] - frustum_matrix[2];
-
-		//Calculate points
-		glm::vec3 crosses[Combinations] = {
-			glm::cross(glm::vec3(planes[Left]),   glm::vec3(planes[Right])),
-			glm::cross(glm::vec3(planes[Left]),   glm::vec3(planes[Bottom])),
-			glm::cross(glm::vec3(planes[Left]),   glm::vec3(planes[Top])),
-			glm::cross(glm::vec3(planes[Left]),   glm::vec3(planes[Near])),
-			glm::cross(glm::vec3(planes[Left]),   glm::vec3(planes[Far])),
-			glm::cross(glm::vec3(planes[Right]),  glm::vec3(planes[Bottom])),
-			glm::cross(glm::vec3(planes[Right]),  glm::vec3(planes[Top])),
-			glm::cross(glm::vec3(planes[Right]),  glm::vec3(planes[Near])),
-			glm::cross(glm::vec3(planes[Right]),  glm::vec3(planes[Far])),
-			glm::cross(glm::vec3(planes[Bottom]), glm::vec3(planes[Top])),
-			glm::cross(glm::vec3(planes[Bottom]), glm::vec3(planes[Near])),
-			glm::cross(glm::vec3(planes[Bottom]), glm::vec3(planes[Far])),
-			glm::cross(glm::vec3(planes[Top]),    glm::vec3(planes[Near])),
-			glm::cross(glm::vec3(planes[Top]),    glm::vec3(planes[Far])),
-			glm::cross(glm::vec3(planes[Near]),   glm::vec3(planes[Far]))
-		};
-
-		points[0] = intersection<Left, Bottom, Near>(planes, crosses);
-		points[1] = intersection<Left, Top, Near>(planes, crosses);
-		points[2] = intersection<Right, Bottom, Near>(planes, crosses);
-		points[3] = intersection<Right, Top, Near>(planes, crosses);
-		points[4] = intersection<Left, Bottom, Far>(planes, crosses);
-		points[5] = intersection<Left, Top, Far>(planes, crosses);
-		points[6] = intersection<Right, Bottom, Far>(planes, crosses);
-		points[7] = intersection<Right, Top, Far>(planes, crosses);
-	}
 }
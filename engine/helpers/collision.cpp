@@ -1,7 +1,141 @@
 #include "collision.h"
+#include <immintrin.h>
+#include <cmath>
 
 //#pragma optimize("", off)
 
+namespace
+{
+	//Vector of floats used by the batched culling, 8 lanes with AVX and 4 lanes with SSE
+#ifdef __AVX__
+	using SimdFloat = __m256;
+	constexpr uint32_t kSimdWidth = 8;
+	inline SimdFloat SimdSet(float value) { return _mm256_set1_ps(value); }
+	inline SimdFloat SimdLoad(const float* source) { return _mm256_loadu_ps(source); }
+	inline SimdFloat SimdAdd(SimdFloat a, SimdFloat b) { return _mm256_add_ps(a, b); }
+	inline SimdFloat SimdSub(SimdFloat a, SimdFloat b) { return _mm256_sub_ps(a, b); }
+	inline SimdFloat SimdMul(SimdFloat a, SimdFloat b) { return _mm256_mul_ps(a, b); }
+	inline SimdFloat SimdAnd(SimdFloat a, SimdFloat b) { return _mm256_and_ps(a, b); }
+	inline SimdFloat SimdAbs(SimdFloat a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a); }
+	inline SimdFloat SimdGreaterEqual(SimdFloat a, SimdFloat b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+	inline SimdFloat SimdLessEqual(SimdFloat a, SimdFloat b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+	inline uint32_t SimdMask(SimdFloat a) { return static_cast<uint32_t>(_mm256_movemask_ps(a)); }
+#else
+	using SimdFloat = __m128;
+	constexpr uint32_t kSimdWidth = 4;
+	inline SimdFloat SimdSet(float value) { return _mm_set1_ps(value); }
+	inline SimdFloat SimdLoad(const float* source) { return _mm_loadu_ps(source); }
+	inline SimdFloat SimdAdd(SimdFloat a, SimdFloat b) { return _mm_add_ps(a, b); }
+	inline SimdFloat SimdSub(SimdFloat a, SimdFloat b) { return _mm_sub_ps(a, b); }
+	inline SimdFloat SimdMul(SimdFloat a, SimdFloat b) { return _mm_mul_ps(a, b); }
+	inline SimdFloat SimdAnd(SimdFloat a, SimdFloat b) { return _mm_and_ps(a, b); }
+	inline SimdFloat SimdAbs(SimdFloat a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a); }
+	inline SimdFloat SimdGreaterEqual(SimdFloat a, SimdFloat b) { return _mm_cmpge_ps(a, b); }
+	inline SimdFloat SimdLessEqual(SimdFloat a, SimdFloat b) { return _mm_cmple_ps(a, b); }
+	inline uint32_t SimdMask(SimdFloat a) { return static_cast<uint32_t>(_mm_movemask_ps(a)); }
+#endif
+
+	//Frustum broadcasted to all the lanes
+	struct SimdFrustum
+	{
+		SimdFloat planes[helpers::Frustum::Count][4];
+		SimdFloat abs_planes[helpers::Frustum::Count][3];
+		SimdFloat points_min[3];
+		SimdFloat points_max[3];
+
+		SimdFrustum(const helpers::Frustum& frustum)
+		{
+			for (uint32_t i = 0; i < helpers::Frustum::Count; ++i)
+			{
+				for (glm::length_t j = 0; j < 4; ++j)
+				{
+					planes[i][j] = SimdSet(frustum.planes[i][j]);
+				}
+				for (glm::length_t j = 0; j < 3; ++j)
+				{
+					abs_planes[i][j] = SimdSet(glm::abs(frustum.planes[i][j]));
+				}
+			}
+
+			//Bounds of the frustum points, a box is outside if all the points are outside one of the sides of the box
+			glm::vec3 min = frustum.points[0];
+			glm::vec3 max = frustum.points[0];
+			bool valid = true;
+			for (uint32_t i = 0; i < 8; ++i)
+			{
+				min = glm::min(min, frustum.points[i]);
+				max = glm::max(max, frustum.points[i]);
+				valid = valid && std::isfinite(frustum.points[i].x) && std::isfinite(frustum.points[i].y) && std::isfinite(frustum.points[i].z);
+			}
+			//Frustums without far plane don't have valid points, skip the test like CollisionFrustumVsAABB
+			for (glm::length_t j = 0; j < 3; ++j)
+			{
+				points_min[j] = SimdSet(valid ? min[j] : -FLT_MAX);
+				points_max[j] = SimdSet(valid ? max[j] : FLT_MAX);
+			}
+		}
+	};
+
+	//Loads the lanes of a block, the lanes after the count are filled with zeros
+	struct SimdBlockLoader
+	{
+		uint32_t begin;
+		uint32_t num_lanes;
+
+		SimdFloat Load(const float* source) const
+		{
+			if (num_lanes == kSimdWidth)
+			{
+				return SimdLoad(source + begin);
+			}
+			else
+			{
+				float lanes[kSimdWidth] = {};
+				for (uint32_t i = 0; i < num_lanes; ++i) lanes[i] = source[begin + i];
+				return SimdLoad(lanes);
+			}
+		}
+	};
+
+	//Visible if the box is not completely behind any of the planes and it overlaps the bounds of the frustum points
+	//plane_extents returns the projection of the extents in the normal of the plane
+	template<typename PLANE_EXTENTS>
+	inline SimdFloat CalculateVisibility(const SimdFrustum& frustum, const SimdFloat center[3], const SimdFloat bounds_extents[3], PLANE_EXTENTS&& plane_extents)
+	{
+		const SimdFloat zero = SimdSet(0.f);
+		SimdFloat visible = SimdGreaterEqual(zero, zero);
+		for (uint32_t i = 0; i < helpers::Frustum::Count; ++i)
+		{
+			//Distance of the center plus the distance of the p-vertex to the center
+			const SimdFloat distance = SimdAdd(SimdAdd(SimdMul(frustum.planes[i][0], center[0]), SimdMul(frustum.planes[i][1], center[1])),
+				SimdAdd(SimdMul(frustum.planes[i][2], center[2]), frustum.planes[i][3]));
+			visible = SimdAnd(visible, SimdGreaterEqual(SimdAdd(distance, plane_extents(i)), zero));
+		}
+		for (uint32_t j = 0; j < 3; ++j)
+		{
+			visible = SimdAnd(visible, SimdLessEqual(frustum.points_min[j], SimdAdd(center[j], bounds_extents[j])));
+			visible = SimdAnd(visible, SimdGreaterEqual(frustum.points_max[j], SimdSub(center[j], bounds_extents[j])));
+		}
+		return visible;
+	}
+
+	//Calls the block function for each block of lanes and writes the returned lanes in the mask
+	template<typename BLOCK_FUNCTION>
+	inline void CalculateBlockMask(uint32_t count, uint32_t* mask, BLOCK_FUNCTION&& block_function)
+	{
+		static_assert(32 % kSimdWidth == 0, "The blocks can not cross the words of the mask");
+		for (uint32_t begin = 0; begin < count; begin += kSimdWidth)
+		{
+			const SimdBlockLoader loader{ begin, std::min(kSimdWidth, count - begin) };
+			const uint32_t lanes_mask = (1u << loader.num_lanes) - 1u;
+			const uint32_t block_mask = (SimdMask(block_function(loader)) & lanes_mask) << (begin % 32);
+
+			uint32_t& word = mask[begin / 32];
+			word = (begin % 32 == 0) ? block_mask : (word | block_mask);
+		}
+	}
+}
+
 namespace helpers
 {
 	bool CollisionFrustumVsAABB(const Frustum& frustum, const AABB& bounding_box)
@@ -35,6 +169,67 @@ namespace helpers
 
 		return true;
 	}
+	void CollisionFrustumVsAABBs(const Frustum& frustum, const AABBSoA& boxes, uint32_t count, uint32_t* visibility_mask)
+	{
+		const SimdFrustum simd_frustum(frustum);
+
+		CalculateBlockMask(count, visibility_mask, [&](const SimdBlockLoader& loader)
+			{
+				SimdFloat center[3];
+				SimdFloat extents[3];
+				for (uint32_t j = 0; j < 3; ++j)
+				{
+					center[j] = loader.Load(boxes.center[j]);
+					extents[j] = loader.Load(boxes.extents[j]);
+				}
+
+				return CalculateVisibility(simd_frustum, center, extents, [&](uint32_t plane)
+					{
+						const SimdFloat* abs_normal = simd_frustum.abs_planes[plane];
+						return SimdAdd(SimdAdd(SimdMul(abs_normal[0], extents[0]), SimdMul(abs_normal[1], extents[1])), SimdMul(abs_normal[2], extents[2]));
+					});
+			});
+	}
+
+	void CollisionFrustumVsOBBs(const Frustum& frustum, const OBBSoA& boxes, uint32_t count, uint32_t* visibility_mask)
+	{
+		const SimdFrustum simd_frustum(frustum);
+
+		CalculateBlockMask(count, visibility_mask, [&](const SimdBlockLoader& loader)
+			{
+				//Axis of the box scaled by the extents
+				SimdFloat center[3];
+				SimdFloat axis[3][3];
+				for (uint32_t j = 0; j < 3; ++j)
+				{
+					center[j] = loader.Load(boxes.center[j]);
+					const SimdFloat extents = loader.Load(boxes.extents[j]);
+					for (uint32_t k = 0; k < 3; ++k)
+					{
+						axis[j][k] = SimdMul(loader.Load(boxes.rotation[j][k]), extents);
+					}
+				}
+
+				//Extents of the axis aligned box that contains the OBB
+				SimdFloat bounds_extents[3];
+				for (uint32_t k = 0; k < 3; ++k)
+				{
+					bounds_extents[k] = SimdAdd(SimdAdd(SimdAbs(axis[0][k]), SimdAbs(axis[1][k])), SimdAbs(axis[2][k]));
+				}
+
+				return CalculateVisibility(simd_frustum, center, bounds_extents, [&](uint32_t plane)
+					{
+						const SimdFloat* normal = simd_frustum.planes[plane];
+						SimdFloat plane_extents = SimdSet(0.f);
+						for (uint32_t j = 0; j < 3; ++j)
+						{
+							plane_extents = SimdAdd(plane_extents, SimdAbs(SimdAdd(SimdAdd(SimdMul(normal[0], axis[j][0]), SimdMul(normal[1], axis[j][1])), SimdMul(normal[2], axis[j][2]))));
+						}
+						return plane_extents;
+					});
+			});
+	}
+
 	bool CollisionOBBVsOBB(const OBB& a, const OBB& b)
 	{
 		float ra, rb;
@@ -108,6 +303,94 @@ namespace helpers
 		return true;
 	}
 
+	void CollisionOBBVsOBBs(const OBB& a, const OBBSoA& boxes, uint32_t count, uint32_t* collision_mask)
+	{
+		//Axis of a and the epsilon of CollisionOBBVsOBB for parallel edges
+		SimdFloat a_axis[3][3];
+		SimdFloat a_extents[3];
+		SimdFloat a_position[3];
+		for (glm::length_t i = 0; i < 3; ++i)
+		{
+			for (glm::length_t j = 0; j < 3; ++j)
+			{
+				a_axis[i][j] = SimdSet(glm::row(a.rotation, i)[j]);
+			}
+			a_extents[i] = SimdSet(a.extents[i]);
+			a_position[i] = SimdSet(a.position[i]);
+		}
+		const SimdFloat epsilon = SimdSet(0.00001f);
+
+		CalculateBlockMask(count, collision_mask, [&](const SimdBlockLoader& loader)
+			{
+				//Translation in the frame of a, the face axis of a are the cheapest test and they reject most of the boxes
+				SimdFloat t_world[3];
+				SimdFloat b_extents[3];
+				for (uint32_t i = 0; i < 3; ++i)
+				{
+					t_world[i] = SimdSub(loader.Load(boxes.center[i]), a_position[i]);
+					b_extents[i] = loader.Load(boxes.extents[i]);
+				}
+				SimdFloat t[3];
+				for (uint32_t i = 0; i < 3; ++i)
+				{
+					t[i] = SimdAdd(SimdAdd(SimdMul(a_axis[i][0], t_world[0]), SimdMul(a_axis[i][1], t_world[1])), SimdMul(a_axis[i][2], t_world[2]));
+				}
+
+				//Rotation of b in the frame of a
+				SimdFloat R[3][3];
+				SimdFloat AbsR[3][3];
+				for (uint32_t j = 0; j < 3; ++j)
+				{
+					const SimdFloat b_axis[3] = { loader.Load(boxes.rotation[j][0]), loader.Load(boxes.rotation[j][1]), loader.Load(boxes.rotation[j][2]) };
+					for (uint32_t i = 0; i < 3; ++i)
+					{
+						R[i][j] = SimdAdd(SimdAdd(SimdMul(a_axis[i][0], b_axis[0]), SimdMul(a_axis[i][1], b_axis[1])), SimdMul(a_axis[i][2], b_axis[2]));
+						AbsR[i][j] = SimdAdd(SimdAbs(R[i][j]), epsilon);
+					}
+				}
+
+				auto dot3 = [](const SimdFloat a0, const SimdFloat b0, const SimdFloat a1, const SimdFloat b1, const SimdFloat a2, const SimdFloat b2)
+				{
+					return SimdAdd(SimdAdd(SimdMul(a0, b0), SimdMul(a1, b1)), SimdMul(a2, b2));
+				};
+
+				//Test axes L = A0, L = A1, L = A2
+				SimdFloat colliding = SimdGreaterEqual(epsilon, epsilon);
+				for (uint32_t i = 0; i < 3; ++i)
+				{
+					const SimdFloat rb = dot3(b_extents[0], AbsR[i][0], b_extents[1], AbsR[i][1], b_extents[2], AbsR[i][2]);
+					colliding = SimdAnd(colliding, SimdLessEqual(SimdAbs(t[i]), SimdAdd(a_extents[i], rb)));
+				}
+				if (SimdMask(colliding) == 0) return colliding;
+
+				//Test axes L = B0, L = B1, L = B2
+				for (uint32_t i = 0; i < 3; ++i)
+				{
+					const SimdFloat ra = dot3(a_extents[0], AbsR[0][i], a_extents[1], AbsR[1][i], a_extents[2], AbsR[2][i]);
+					const SimdFloat distance = dot3(t[0], R[0][i], t[1], R[1][i], t[2], R[2][i]);
+					colliding = SimdAnd(colliding, SimdLessEqual(SimdAbs(distance), SimdAdd(ra, b_extents[i])));
+				}
+				if (SimdMask(colliding) == 0) return colliding;
+
+				//Test axes L = Ai x Bj
+				for (uint32_t i = 0; i < 3; ++i)
+				{
+					const uint32_t i1 = (i + 1) % 3;
+					const uint32_t i2 = (i + 2) % 3;
+					for (uint32_t j = 0; j < 3; ++j)
+					{
+						const uint32_t j1 = (j + 1) % 3;
+						const uint32_t j2 = (j + 2) % 3;
+						const SimdFloat ra = SimdAdd(SimdMul(a_extents[i1], AbsR[i2][j]), SimdMul(a_extents[i2], AbsR[i1][j]));
+						const SimdFloat rb = SimdAdd(SimdMul(b_extents[j1], AbsR[i][j2]), SimdMul(b_extents[j2], AbsR[i][j1]));
+						const SimdFloat distance = SimdSub(SimdMul(t[i2], R[i1][j]), SimdMul(t[i1], R[i2][j]));
+						colliding = SimdAnd(colliding, SimdLessEqual(SimdAbs(distance), SimdAdd(ra, rb)));
+					}
+				}
+				return colliding;
+			});
+	}
+
 	//https://github.com/gszauer/GamePhysicsCookbook/blob/master/Code/Geometry3D.cpp
 	struct Interval
 	{
@@ -273,8 +556,8 @@ namespace helpers
 
 		std::array<Plane, 6> planes = GetPlanes(obb);
 
-		for (int i = 0; i < planes.size(); ++i) {
-			for (int j = 0; j < edges.size(); ++j) {
+		for (size_t i = 0; i < planes.size(); ++i) {
+			for (size_t j = 0; j < edges.size(); ++j) {
 				if (ClipToPlane(planes[i], edges[j], &intersection)) {
 					if (PointInOBB(intersection, obb)) {
 						result.push_back(intersection);
@@ -826,9 +1109,9 @@ namespace helpers
 				glm::vec3 pointInWorld;
 				for (i = 0; i < 3; i++)
 					pointInWorld[i] = (pa[i] + pb[i]) * float(0.5);
-				collision_return.contacts.emplace_back(pointInWorld, -normal, -*depth);
+				collision_return.AddContact(pointInWorld, -normal, -*depth);
 #else
-				collision_return.contacts.emplace_back(pb , -normal, -*depth);
+				collision_return.AddContact(pb , -normal, -*depth);
 
 #endif  //
 				collision_return.code = code;
@@ -1029,7 +1312,7 @@ namespace helpers
 					glm::vec3 pointInWorld;
 					for (i = 0; i < 3; i++)
 						pointInWorld[i] = point[j * 3 + i] + pa[i];
-					collision_return.contacts.emplace_back(pointInWorld, -normal, -dep[j]);
+					collision_return.AddContact(pointInWorld, -normal, -dep[j]);
 				}
 			}
 			else
@@ -1041,7 +1324,7 @@ namespace helpers
 					for (i = 0; i < 3; i++)
 						pointInWorld[i] = point[j * 3 + i] + pa[i] - normal[i] * dep[j];
 					//pointInWorld[i] = point[j*3+i] + pa[i];
-					collision_return.contacts.emplace_back(pointInWorld, -normal, -dep[j]);
+					collision_return.AddContact(pointInWorld, -normal, -dep[j]);
 				}
 			}
 		}
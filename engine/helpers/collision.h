@@ -5,6 +5,7 @@
 #include <ext/glm/ext.hpp>
 #include <ext/glm/gtx/norm.hpp>
 #include <utility>
+#include <cassert>
 #include "camera.h"
 
 namespace helpers
@@ -60,10 +61,56 @@ namespace helpers
 		glm::vec3 extents;
 	};
 
+	//Points in the ray are origin + direction * t, with t in [0, max_t]
+	//A segment is a ray with direction end - begin and max_t 1
+	struct Ray
+	{
+		glm::vec3 origin;
+		glm::vec3 direction;
+		float max_t = FLT_MAX;
+
+		Ray() = default;
+		Ray(const glm::vec3& _origin, const glm::vec3& _direction, const float _max_t = FLT_MAX) :
+			origin(_origin), direction(_direction), max_t(_max_t)
+		{
+		}
+	};
+
+	inline Ray CalculateRayFromSegment(const glm::vec3& segment_begin, const glm::vec3& segment_end)
+	{
+		return Ray(segment_begin, segment_end - segment_begin, 1.f);
+	}
+
 	bool CollisionFrustumVsAABB(const Frustum& frustum, const AABB& bounding_box);
 
+	//Boxes in structure of arrays for the batched culling, one array for each component
+	struct AABBSoA
+	{
+		const float* center[3];
+		const float* extents[3];
+	};
+
+	//The rows of the rotation are the axis of the boxes, rotation[row][column]
+	struct OBBSoA
+	{
+		const float* center[3];
+		const float* extents[3];
+		const float* rotation[3][3];
+	};
+
+	//Batched frustum culling, p-vertex test against each plane and the frustum points against the bounds of the box
+	//Processes 8 boxes at the same time with AVX and 4 with SSE
+	//Bit i of the visibility mask is set if the box i is visible, the mask needs (count + 31) / 32 words
+	void CollisionFrustumVsAABBs(const Frustum& frustum, const AABBSoA& boxes, uint32_t count, uint32_t* visibility_mask);
+	void CollisionFrustumVsOBBs(const Frustum& frustum, const OBBSoA& boxes, uint32_t count, uint32_t* visibility_mask);
+
 	bool CollisionOBBVsOBB(const OBB& a, const OBB& b);
 
+	//Separating axis test of one OBB against a batch of OBBs, same axis and epsilon than CollisionOBBVsOBB
+	//Stops testing axis when all the boxes of the block are separated
+	//Bit i of the collision mask is set if the box i collides, the mask needs (count + 31) / 32 words
+	void CollisionOBBVsOBBs(const OBB& a, const OBBSoA& boxes, uint32_t count, uint32_t* collision_mask);
+
 	inline bool CollisionAABBVsAABB(const AABB& a, const AABB& b)
 	{
 		// Exit with no intersection if separated along an axis
@@ -83,6 +130,45 @@ namespace helpers
 		output.max = source.position + half_distance;
 	}
 
+	//Slab test, returns the entry t of the ray in the box (0 if the origin is inside)
+	inline bool CollisionRayVsAABB(const Ray& ray, const AABB& box, float& t)
+	{
+		float t_min = 0.f;
+		float t_max = ray.max_t;
+		for (glm::length_t i = 0; i < 3; ++i)
+		{
+			if (ray.direction[i] == 0.f)
+			{
+				//Parallel to the slab
+				if (ray.origin[i] < box.min[i] || ray.origin[i] > box.max[i]) return false;
+			}
+			else
+			{
+				const float inv_direction = 1.f / ray.direction[i];
+				float t_near = (box.min[i] - ray.origin[i]) * inv_direction;
+				float t_far = (box.max[i] - ray.origin[i]) * inv_direction;
+				if (t_near > t_far) std::swap(t_near, t_far);
+
+				t_min = glm::max(t_min, t_near);
+				t_max = glm::min(t_max, t_far);
+				if (t_min > t_max) return false;
+			}
+		}
+		t = t_min;
+		return true;
+	}
+
+	//Slab test in the space of the OBB, returns the entry t of the ray in the box
+	inline bool CollisionRayVsOBB(const Ray& ray, const OBB& box, float& t)
+	{
+		//The rows of the rotation are the axis of the box
+		const Ray local_ray(box.rotation * (ray.origin - box.position), box.rotation * ray.direction, ray.max_t);
+		AABB local_box;
+		local_box.min = -box.extents;
+		local_box.max = box.extents;
+		return CollisionRayVsAABB(local_ray, local_box, t);
+	}
+
 	inline glm::vec3 CalculateClosestPointToSegment(const glm::vec3& point,
 		const glm::vec3& segment_begin, const glm::vec3& segment_end)
 	{
@@ -141,6 +227,7 @@ namespace helpers
 		glm::vec3 normal;
 		float depth = FLT_MAX;
 
+		CollisionContact() = default;
 		CollisionContact(const glm::vec3 _position, const glm::vec3 _normal, const float _depth):
 			position(_position), normal(_normal), depth(_depth)
 		{
@@ -148,10 +235,20 @@ namespace helpers
 	};
 	struct CollisionReturn
 	{
+		//Two boxes generate up to 8 contacts (the intersection of two faces)
+		constexpr static uint32_t kMaxContacts = 8;
+
 		uint32_t code;
 		glm::vec3 normal;
 		float depth = FLT_MAX;
-		std::vector<CollisionContact> contacts = {};
+		uint32_t num_contacts = 0;
+		CollisionContact contacts[kMaxContacts];
+
+		void AddContact(const glm::vec3& position, const glm::vec3& contact_normal, const float contact_depth)
+		{
+			assert(num_contacts < kMaxContacts);
+			contacts[num_contacts++] = CollisionContact(position, contact_normal, contact_depth);
+		}
 	};
 	bool CollisionFeaturesOBBvsOBB(const OBB& obb1, const OBB& obb2, CollisionReturn& collision_return);
 
@@ -0,0 +1,67 @@
+#include "camera.h"
+#include <ext/glm/vec3.hpp>
+#include <ext/glm/vec4.hpp>
+#include <ext/glm/mat3x3.hpp>
+#include <ext/glm/geometric.hpp>
+#include <ext/glm/matrix.hpp>
+
+//https://gist.github.com/podgorskiy/e698d18879588ada9014768e3e82a644
+
+namespace helpers
+{
+	template<Frustum::Planes i, Frustum::Planes j>
+	struct ij2k
+	{
+		enum { k = i * (9 - i) / 2 + j - 1 };
+	};
+
+	template<Frustum::Planes a, Frustum::Planes b, Frustum::Planes c>
+	inline glm::vec3 intersection(const glm::vec4* planes, const glm::vec3* crosses)
+	{
+		float D = glm::dot(glm::vec3(planes[a]), crosses[ij2k<b, c>::k]);
+		glm::vec3 res = glm::mat3(crosses[ij2k<b, c>::k], -crosses[ij2k<a, c>::k], crosses[ij2k<a, b>::k]) *
+			glm::vec3(planes[a].w, planes[b].w, planes[c].w);
+		return res * (-1.0f / D);
+	}
+
+	void Frustum::Init(const glm::mat4x4& view_projection_matrix)
+	{
+		//Calculate frustum planes
+		glm::mat4x4 frustum_matrix = glm::transpose(view_projection_matrix);
+
+		planes[Planes::Left] = frustum_matrix[3] + frustum_matrix[0];
+		planes[Planes::Right] = frustum_matrix[3] - frustum_matrix[0];
+		planes[Planes::Bottom] = frustum_matrix[3] + frustum_matrix[1];
+		planes[Planes::Top] = frustum_matrix[3] - frustum_matrix[1];
+		planes[Planes::Near] = frustum_matrix[3] + frustum_matrix[2];
+		planes[Planes::Far] = frustum_matrix[3] - frustum_matrix[2];
+
+		//Calculate points
+		glm::vec3 crosses[Combinations] = {
+			glm::cross(glm::vec3(planes[Left]),   glm::vec3(planes[Right])),
+			glm::cross(glm::vec3(planes[Left]),   glm::vec3(planes[Bottom])),
+			glm::cross(glm::vec3(planes[Left]),   glm::vec3(planes[Top])),
+			glm::cross(glm::vec3(planes[Left]),   glm::vec3(planes[Near])),
+			glm::cross(glm::vec3(planes[Left]),   glm::vec3(planes[Far])),
+			glm::cross(glm::vec3(planes[Right]),  glm::vec3(planes[Bottom])),
+			glm::cross(glm::vec3(planes[Right]),  glm::vec3(planes[Top])),
+			glm::cross(glm::vec3(planes[Right]),  glm::vec3(planes[Near])),
+			glm::cross(glm::vec3(planes[Right]),  glm::vec3(planes[Far])),
+			glm::cross(glm::vec3(planes[Bottom]), glm::vec3(planes[Top])),
+			glm::cross(glm::vec3(planes[Bottom]), glm::vec3(planes[Near])),
+			glm::cross(glm::vec3(planes[Bottom]), glm::vec3(planes[Far])),
+			glm::cross(glm::vec3(planes[Top]),    glm::vec3(planes[Near])),
+			glm::cross(glm::vec3(planes[Top]),    glm::vec3(planes[Far])),
+			glm::cross(glm::vec3(planes[Near]),   glm::vec3(planes[Far]))
+		};
+
+		points[0] = intersection<Left, Bottom, Near>(planes, crosses);
+		points[1] = intersection<Left, Top, Near>(planes, crosses);
+		points[2] = intersection<Right, Bottom, Near>(planes, crosses);
+		points[3] = intersection<Right, Top, Near>(planes, crosses);
+		points[4] = intersection<Left, Bottom, Far>(planes, crosses);
+		points[5] = intersection<Left, Top, Far>(planes, crosses);
+		points[6] = intersection<Right, Bottom, Far>(planes, crosses);
+		points[7] = intersection<Right, Top, Far>(planes, crosses);
+	}
+}
@@ -2,6 +2,11 @@
 #define GRID3D_H_
 
 #include <array>
+#include <algorithm>
+#include <vector>
+#include <memory>
+#include <cassert>
+#include <cstdint>
 
 namespace helpers
 {
@@ -40,6 +45,369 @@ namespace helpers
 
 		std::array<T, DIM_X * DIM_Y * DIM_Z> m_data;
 	};
+
+	//Position of a brick in a sparse grid, in bricks
+	struct BrickPosition
+	{
+		int32_t x;
+		int32_t y;
+		int32_t z;
+
+		bool operator==(const BrickPosition& b) const
+		{
+			return x == b.x && y == b.y && z == b.z;
+		}
+
+		bool Inside(const BrickPosition& min, const BrickPosition& max) const
+		{
+			return x >= min.x && y >= min.y && z >= min.z && x <= max.x && y <= max.y && z <= max.z;
+		}
+	};
+
+	//A sparse 3d grid without limits, only the bricks of TILE_SIZE^3 cells that are used are allocated
+	//The bricks are found with a hash of the brick position, the cells inside each brick are in morton order
+	//The bricks are allocated in pages, so the cells don't move when other bricks are allocated or freed
+	template<typename T, uint32_t TILE_SIZE = 8, uint32_t BRICKS_PER_PAGE = 64>
+	class SparseGrid3D
+	{
+		static_assert(TILE_SIZE >= 2 && TILE_SIZE <= 16 && (TILE_SIZE & (TILE_SIZE - 1)) == 0, "TILE_SIZE needs to be a power of two");
+	public:
+		constexpr static uint32_t kBrickNumCells = TILE_SIZE * TILE_SIZE * TILE_SIZE;
+
+		SparseGrid3D(const T& default_value = T()) : m_default_value(default_value)
+		{
+		}
+
+		//Cell if the brick is allocated, nullptr if not
+		const T* Find(int32_t x, int32_t y, int32_t z) const
+		{
+			const uint32_t brick_index = FindBrick(CalculateBrickPosition(x, y, z));
+			return (brick_index == kInvalidIndex) ? nullptr : &GetBrickCells(m_bricks[brick_index].slot)[CalculateCellOffset(x, y, z)];
+		}
+		T* Find(int32_t x, int32_t y, int32_t z)
+		{
+			return const_cast<T*>(static_cast<const SparseGrid3D*>(this)->Find(x, y, z));
+		}
+
+		//Cell, the brick is allocated with the default value if it is not
+		T& Get(int32_t x, int32_t y, int32_t z)
+		{
+			return AllocBrick(CalculateBrickPosition(x, y, z))[CalculateCellOffset(x, y, z)];
+		}
+
+		//Brick that contains the cell
+		static BrickPosition CalculateBrickPosition(int32_t x, int32_t y, int32_t z)
+		{
+			//Arithmetic shift, rounds to minus infinite for the negative positions
+			return BrickPosition{ x >> kTileShift, y >> kTileShift, z >> kTileShift };
+		}
+
+		//Cells of the brick in morton order, nullptr if it is not allocated
+		T* FindBrickCells(const BrickPosition& brick_position)
+		{
+			const uint32_t brick_index = FindBrick(brick_position);
+			return (brick_index == kInvalidIndex) ? nullptr : GetBrickCells(m_bricks[brick_index].slot);
+		}
+
+		//Cells of the brick, allocated and filled with the default value if it was not allocated
+		T* AllocBrick(const BrickPosition& brick_position)
+		{
+			bool created;
+			return AllocBrick(brick_position, created);
+		}
+		T* AllocBrick(const BrickPosition& brick_position, bool& created);
+
+		//Free the brick if it is allocated
+		void FreeBrick(const BrickPosition& brick_position);
+
+		//Streaming, keeps allocated only the bricks inside the range, like the box city tiles around the camera
+		//Unload is called with each allocated brick outside of the new range before it is freed
+		//Load is called with each brick that enters in the range, it returns false if the brick is empty and doesn't need to be allocated
+		template<typename UNLOAD, typename LOAD>
+		void Stream(const BrickPosition& min_brick, const BrickPosition& max_brick, UNLOAD&& unload, LOAD&& load);
+
+		//Call the visitor with the position and the cells of each allocated brick
+		template<typename VISITOR>
+		void VisitBricks(VISITOR&& visitor);
+
+		//Call the visitor with the position and the value of each cell of the allocated bricks
+		template<typename VISITOR>
+		void VisitCells(VISITOR&& visitor);
+
+		uint32_t GetNumBricks() const
+		{
+			return static_cast<uint32_t>(m_bricks.size());
+		}
+
+		void Clear()
+		{
+			m_bricks.clear();
+			m_hash.clear();
+			m_free_slots.clear();
+			m_pages.clear();
+			m_streaming = false;
+		}
+
+	private:
+		constexpr static uint32_t kInvalidIndex = static_cast<uint32_t>(-1);
+
+		constexpr static uint32_t CalculateTileShift()
+		{
+			uint32_t shift = 0;
+			while ((1u << shift) < TILE_SIZE) ++shift;
+			return shift;
+		}
+		constexpr static uint32_t kTileShift = CalculateTileShift();
+
+		//Spreads the bits of a local coordinate, so three of them can be interleaved in a morton code
+		constexpr static uint32_t SpreadBits(uint32_t value)
+		{
+			uint32_t result = 0;
+			for (uint32_t bit = 0; bit < kTileShift; ++bit)
+			{
+				result |= ((value >> bit) & 1u) << (bit * 3);
+			}
+			return result;
+		}
+
+		struct MortonTable
+		{
+			std::array<uint32_t, TILE_SIZE> spread;
+			std::array<std::array<uint8_t, 3>, kBrickNumCells> local_position;
+
+			constexpr MortonTable() : spread(), local_position()
+			{
+				for (uint32_t i = 0; i < TILE_SIZE; ++i)
+				{
+					spread[i] = SpreadBits(i);
+				}
+				for (uint32_t z = 0; z < TILE_SIZE; ++z)
+					for (uint32_t y = 0; y < TILE_SIZE; ++y)
+						for (uint32_t x = 0; x < TILE_SIZE; ++x)
+						{
+							local_position[spread[x] | (spread[y] << 1) | (spread[z] << 2)] = { static_cast<uint8_t>(x), static_cast<uint8_t>(y), static_cast<uint8_t>(z) };
+						}
+			}
+		};
+		constexpr static MortonTable kMortonTable = MortonTable();
+
+		static uint32_t CalculateCellOffset(int32_t x, int32_t y, int32_t z)
+		{
+			constexpr uint32_t mask = TILE_SIZE - 1;
+			return kMortonTable.spread[static_cast<uint32_t>(x) & mask] | (kMortonTable.spread[static_cast<uint32_t>(y) & mask] << 1) | (kMortonTable.spread[static_cast<uint32_t>(z) & mask] << 2);
+		}
+
+		static uint32_t CalculateHash(const BrickPosition& brick_position)
+		{
+			return (static_cast<uint32_t>(brick_position.x) * 73856093u) ^ (static_cast<uint32_t>(brick_position.y) * 19349663u) ^ (static_cast<uint32_t>(brick_position.z) * 83492791u);
+		}
+
+		T* GetBrickCells(uint32_t slot) const
+		{
+			return m_pages[slot / BRICKS_PER_PAGE].get() + (slot % BRICKS_PER_PAGE) * kBrickNumCells;
+		}
+
+		//Index in m_bricks or kInvalidIndex
+		uint32_t FindBrick(const BrickPosition& brick_position) const;
+
+		//Hash slot with the brick or the empty slot where it needs to be added
+		uint32_t FindHashSlot(const BrickPosition& brick_position) const;
+
+		void GrowHash();
+
+		struct Brick
+		{
+			BrickPosition position;
+			uint32_t slot;
+		};
+
+		//Allocated bricks, dense for the bulk iteration
+		std::vector<Brick> m_bricks;
+
+		//Open addressing with linear probing, index in m_bricks or kInvalidIndex, size is a power of two
+		std::vector<uint32_t> m_hash;
+
+		//Slots of the pages that are not used
+		std::vector<uint32_t> m_free_slots;
+
+		//Cells of the bricks, BRICKS_PER_PAGE bricks in each page
+		std::vector<std::unique_ptr<T[]>> m_pages;
+
+		T m_default_value;
+
+		//Last streaming range
+		bool m_streaming = false;
+		BrickPosition m_stream_min;
+		BrickPosition m_stream_max;
+	};
+
+	template<typename T, uint32_t TILE_SIZE, uint32_t BRICKS_PER_PAGE>
+	inline uint32_t SparseGrid3D<T, TILE_SIZE, BRICKS_PER_PAGE>::FindHashSlot(const BrickPosition& brick_position) const
+	{
+		assert(!m_hash.empty());
+		const uint32_t mask = static_cast<uint32_t>(m_hash.size()) - 1;
+		uint32_t hash_slot = CalculateHash(brick_position) & mask;
+		while (m_hash[hash_slot] != kInvalidIndex && !(m_bricks[m_hash[hash_slot]].position == brick_position))
+		{
+			hash_slot = (hash_slot + 1) & mask;
+		}
+		return hash_slot;
+	}
+
+	template<typename T, uint32_t TILE_SIZE, uint32_t BRICKS_PER_PAGE>
+	inline uint32_t SparseGrid3D<T, TILE_SIZE, BRICKS_PER_PAGE>::FindBrick(const BrickPosition& brick_position) const
+	{
+		if (m_hash.empty()) return kInvalidIndex;
+		return m_hash[FindHashSlot(brick_position)];
+	}
+
+	template<typename T, uint32_t TILE_SIZE, uint32_t BRICKS_PER_PAGE>
+	inline void SparseGrid3D<T, TILE_SIZE, BRICKS_PER_PAGE>::GrowHash()
+	{
+		//Keep the load under a half
+		size_t hash_size = std::max<size_t>(m_hash.size(), 16);
+		while (hash_size < (m_bricks.size() + 1) * 2) hash_size *= 2;
+		if (hash_size == m_hash.size()) return;
+
+		m_hash.assign(hash_size, kInvalidIndex);
+		for (uint32_t i = 0; i < static_cast<uint32_t>(m_bricks.size()); ++i)
+		{
+			m_hash[FindHashSlot(m_bricks[i].position)] = i;
+		}
+	}
+
+	template<typename T, uint32_t TILE_SIZE, uint32_t BRICKS_PER_PAGE>
+	inline T* SparseGrid3D<T, TILE_SIZE, BRICKS_PER_PAGE>::AllocBrick(const BrickPosition& brick_position, bool& created)
+	{
+		const uint32_t brick_index = FindBrick(brick_position);
+		if (brick_index != kInvalidIndex)
+		{
+			created = false;
+			return GetBrickCells(m_bricks[brick_index].slot);
+		}
+
+		GrowHash();
+
+		//Slot from the free list or from a new page
+		if (m_free_slots.empty())
+		{
+			const uint32_t first_slot = static_cast<uint32_t>(m_pages.size()) * BRICKS_PER_PAGE;
+			m_pages.emplace_back(std::make_unique<T[]>(BRICKS_PER_PAGE * kBrickNumCells));
+			for (uint32_t i = BRICKS_PER_PAGE; i > 0; --i)
+			{
+				m_free_slots.push_back(first_slot + i - 1);
+			}
+		}
+		const uint32_t slot = m_free_slots.back();
+		m_free_slots.pop_back();
+
+		m_hash[FindHashSlot(brick_position)] = static_cast<uint32_t>(m_bricks.size());
+		m_bricks.push_back(Brick{ brick_position, slot });
+
+		T* cells = GetBrickCells(slot);
+		std::fill(cells, cells + kBrickNumCells, m_default_value);
+		created = true;
+		return cells;
+	}
+
+	template<typename T, uint32_t TILE_SIZE, uint32_t BRICKS_PER_PAGE>
+	inline void SparseGrid3D<T, TILE_SIZE, BRICKS_PER_PAGE>::FreeBrick(const BrickPosition& brick_position)
+	{
+		if (m_hash.empty()) return;
+
+		uint32_t hash_slot = FindHashSlot(brick_position);
+		const uint32_t brick_index = m_hash[hash_slot];
+		if (brick_index == kInvalidIndex) return;
+
+		m_free_slots.push_back(m_bricks[brick_index].slot);
+
+		//Remove from the hash, shifting back the next entries of the probe sequence so there are no holes
+		const uint32_t mask = static_cast<uint32_t>(m_hash.size()) - 1;
+		m_hash[hash_slot] = kInvalidIndex;
+		for (uint32_t next_slot = (hash_slot + 1) & mask; m_hash[next_slot] != kInvalidIndex; next_slot = (next_slot + 1) & mask)
+		{
+			const uint32_t ideal_slot = CalculateHash(m_bricks[m_hash[next_slot]].position) & mask;
+			//Move it if the empty slot is between its ideal slot and its current slot
+			if (((next_slot - ideal_slot) & mask) >= ((next_slot - hash_slot) & mask))
+			{
+				m_hash[hash_slot] = m_hash[next_slot];
+				m_hash[next_slot] = kInvalidIndex;
+				hash_slot = next_slot;
+			}
+		}
+
+		//Remove from the dense array, the last brick is moved to its place
+		const uint32_t last_index = static_cast<uint32_t>(m_bricks.size()) - 1;
+		if (brick_index != last_index)
+		{
+			m_bricks[brick_index] = m_bricks[last_index];
+			m_hash[FindHashSlot(m_bricks[brick_index].position)] = brick_index;
+		}
+		m_bricks.pop_back();
+	}
+
+	template<typename T, uint32_t TILE_SIZE, uint32_t BRICKS_PER_PAGE>
+	template<typename UNLOAD, typename LOAD>
+	inline void SparseGrid3D<T, TILE_SIZE, BRICKS_PER_PAGE>::Stream(const BrickPosition& min_brick, const BrickPosition& max_brick, UNLOAD&& unload, LOAD&& load)
+	{
+		//Unload the bricks outside of the range, backwards as the free moves the last brick
+		for (uint32_t i = static_cast<uint32_t>(m_bricks.size()); i > 0; --i)
+		{
+			const Brick brick = m_bricks[i - 1];
+			if (!brick.position.Inside(min_brick, max_brick))
+			{
+				unload(brick.position, GetBrickCells(brick.slot));
+				FreeBrick(brick.position);
+			}
+		}
+
+		//Load the bricks that were not inside the last range
+		for (int32_t z = min_brick.z; z <= max_brick.z; ++z)
+			for (int32_t y = min_brick.y; y <= max_brick.y; ++y)
+				for (int32_t x = min_brick.x; x <= max_brick.x; ++x)
+				{
+					const BrickPosition brick_position{ x, y, z };
+					if (m_streaming && brick_position.Inside(m_stream_min, m_stream_max)) continue;
+
+					bool created;
+					T* cells = AllocBrick(brick_position, created);
+					if (!load(brick_position, cells) && created)
+					{
+						FreeBrick(brick_position);
+					}
+				}
+
+		m_streaming = true;
+		m_stream_min = min_brick;
+		m_stream_max = max_brick;
+	}
+
+	template<typename T, uint32_t TILE_SIZE, uint32_t BRICKS_PER_PAGE>
+	template<typename VISITOR>
+	inline void SparseGrid3D<T, TILE_SIZE, BRICKS_PER_PAGE>::VisitBricks(VISITOR&& visitor)
+	{
+		for (auto& brick : m_bricks)
+		{
+			visitor(brick.position, GetBrickCells(brick.slot));
+		}
+	}
+
+	template<typename T, uint32_t TILE_SIZE, uint32_t BRICKS_PER_PAGE>
+	template<typename VISITOR>
+	inline void SparseGrid3D<T, TILE_SIZE, BRICKS_PER_PAGE>::VisitCells(VISITOR&& visitor)
+	{
+		for (auto& brick : m_bricks)
+		{
+			T* cells = GetBrickCells(brick.slot);
+			for (uint32_t i = 0; i < kBrickNumCells; ++i)
+			{
+				const auto& local_position = kMortonTable.local_position[i];
+				visitor(brick.position.x * static_cast<int32_t>(TILE_SIZE) + local_position[0],
+					brick.position.y * static_cast<int32_t>(TILE_SIZE) + local_position[1],
+					brick.position.z * static_cast<int32_t>(TILE_SIZE) + local_position[2], cells[i]);
+			}
+		}
+	}
 }
 
 #endif //GRID3D_H_
\ No newline at end of file
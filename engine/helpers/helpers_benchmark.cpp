@@ -0,0 +1,387 @@
+//////////////////////////////////////////////////////////////////////////
+// Cute engine - Benchmark and validation of the spatial helpers
+//////////////////////////////////////////////////////////////////////////
+
+#include <benchmark/benchmark.h>
+#include <helpers/bvh.h>
+#include <helpers/spatial_hash_grid.h>
+#include <helpers/grid3D.h>
+#include <core/log.h>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <tuple>
+
+namespace
+{
+	//The results are compared with a brute force version only up to this number of instances
+	constexpr uint32_t kMaxBruteForceInstances = 4096;
+
+	struct BVHBenchmarkSettings
+	{
+		using IndexType = uint32_t;
+
+		const std::vector<helpers::AABB>* instances_bounds;
+		std::vector<uint32_t> leaf_indices;
+
+		helpers::AABB GetAABB(const uint32_t& instance) const
+		{
+			return (*instances_bounds)[instance];
+		}
+
+		void SetLeafIndex(const uint32_t& instance, uint32_t leaf_index)
+		{
+			leaf_indices[instance] = leaf_index;
+		}
+	};
+
+	//Random boxes in a flat volume, as the buildings and cars of a city
+	std::vector<helpers::AABB> CreateRandomBoxes(std::mt19937& random, uint32_t num_boxes, float size, float max_extent)
+	{
+		std::uniform_real_distribution<float> position(-size, size);
+		std::uniform_real_distribution<float> extent(max_extent * 0.1f, max_extent);
+
+		std::vector<helpers::AABB> boxes(num_boxes);
+		for (auto& box : boxes)
+		{
+			const glm::vec3 center(position(random), position(random), position(random) * 0.1f);
+			const glm::vec3 box_extent(extent(random), extent(random), extent(random));
+			box.min = center - box_extent;
+			box.max = center + box_extent;
+		}
+		return boxes;
+	}
+
+	template<typename VISIT_FUNCTION>
+	std::vector<uint32_t> CollectSorted(VISIT_FUNCTION&& visit_function)
+	{
+		std::vector<uint32_t> instances;
+		visit_function([&](const uint32_t& instance)
+			{
+				instances.push_back(instance);
+			});
+		std::sort(instances.begin(), instances.end());
+		return instances;
+	}
+
+	std::vector<uint32_t> BruteForceVisit(const std::vector<helpers::AABB>& boxes, const helpers::AABB& bounds)
+	{
+		std::vector<uint32_t> instances;
+		for (uint32_t i = 0; i < static_cast<uint32_t>(boxes.size()); ++i)
+		{
+			if (helpers::CollisionAABBVsAABB(boxes[i], bounds)) instances.push_back(i);
+		}
+		return instances;
+	}
+
+	void ValidateBVH(const helpers::LinearBVH<uint32_t, BVHBenchmarkSettings>& bvh, const std::vector<helpers::AABB>& boxes, const std::vector<helpers::AABB>& queries, const std::vector<helpers::Ray>& rays)
+	{
+		for (auto& query : queries)
+		{
+			const std::vector<uint32_t> expected = BruteForceVisit(boxes, query);
+			if (CollectSorted([&](auto&& visitor) { bvh.Visit(query, visitor); }) != expected ||
+				CollectSorted([&](auto&& visitor) { bvh.VisitBinary(query, visitor); }) != expected)
+			{
+				core::LogError("BVH benchmark, the query doesn't match the brute force query with <%zu> instances", boxes.size());
+			}
+		}
+
+		for (auto& ray : rays)
+		{
+			float expected_t = FLT_MAX;
+			for (auto& box : boxes)
+			{
+				float t;
+				if (helpers::CollisionRayVsAABB(ray, box, t)) expected_t = std::min(expected_t, t);
+			}
+
+			uint32_t closest_instance;
+			float closest_t;
+			const bool hit = bvh.ClosestHit(ray, [&](const uint32_t& instance, float& t)
+				{
+					return helpers::CollisionRayVsAABB(ray, boxes[instance], t);
+				}, closest_instance, closest_t);
+
+			if (hit != (expected_t != FLT_MAX) || (hit && closest_t != expected_t))
+			{
+				core::LogError("BVH benchmark, the closest hit doesn't match the brute force closest hit with <%zu> instances", boxes.size());
+			}
+		}
+	}
+
+	void BenchmarkBVH(const benchmark::Context& context, helpers::BVHBuilder builder, const char* builder_name)
+	{
+		constexpr float kWorldSize = 1000.f;
+		const helpers::AABB world_bounds{ glm::vec3(-kWorldSize * 1.1f), glm::vec3(kWorldSize * 1.1f) };
+
+		std::mt19937 random(1);
+		for (uint32_t num_instances : { 1u, 17u, 2049u, 100000u })
+		{
+			if (context.quick && num_instances > kMaxBruteForceInstances) continue;
+
+			std::vector<helpers::AABB> boxes = CreateRandomBoxes(random, num_instances, kWorldSize, 20.f);
+			std::vector<uint32_t> instances(num_instances);
+			std::iota(instances.begin(), instances.end(), 0);
+
+			BVHBenchmarkSettings settings{ &boxes, std::vector<uint32_t>(num_instances) };
+			helpers::LinearBVH<uint32_t, BVHBenchmarkSettings> bvh;
+
+			const uint32_t num_build_iterations = context.quick ? 1 : 10;
+			const double build_single_thread = benchmark::Measure(num_build_iterations, [&]()
+				{
+					bvh.Build(&settings, instances.data(), num_instances, world_bounds, nullptr, builder);
+				});
+			const double build_jobs = benchmark::Measure(num_build_iterations, [&]()
+				{
+					bvh.Build(&settings, instances.data(), num_instances, world_bounds, context.job_system, builder);
+				});
+
+			std::vector<helpers::AABB> queries = CreateRandomBoxes(random, context.quick ? 64 : 1000, kWorldSize, 40.f);
+			std::vector<helpers::Ray> rays(queries.size());
+			std::uniform_real_distribution<float> direction(-1.f, 1.f);
+			for (size_t i = 0; i < rays.size(); ++i)
+			{
+				//Some rays parallel to an axis and some segments
+				glm::vec3 ray_direction(direction(random), direction(random), (i % 7 == 0) ? 0.f : direction(random));
+				rays[i] = helpers::Ray((queries[i].min + queries[i].max) / 2.f, ray_direction * kWorldSize, (i % 2) ? 0.5f : FLT_MAX);
+			}
+
+			size_t num_visited = 0;
+			const double query_time = benchmark::Measure(static_cast<uint32_t>(queries.size()), [&, query_index = size_t(0)]() mutable
+				{
+					bvh.Visit(queries[query_index++], [&](const uint32_t&) { ++num_visited; });
+				});
+
+			//Move some instances and refit
+			std::uniform_real_distribution<float> offset(-10.f, 10.f);
+			const uint32_t num_moved = num_instances / 10 + 1;
+			for (uint32_t i = 0; i < num_moved; ++i)
+			{
+				const uint32_t instance = random() % num_instances;
+				const glm::vec3 instance_offset(offset(random), offset(random), offset(random));
+				boxes[instance].min += instance_offset;
+				boxes[instance].max += instance_offset;
+				bvh.UpdateLeaf(settings.leaf_indices[instance], boxes[instance]);
+			}
+			const double refit_time = benchmark::Measure(1, [&]()
+				{
+					bvh.Refit(context.job_system);
+				});
+
+			if (num_instances <= kMaxBruteForceInstances)
+			{
+				ValidateBVH(bvh, boxes, queries, rays);
+			}
+
+			core::LogInfo("BVH %s <%u> instances: build %.1fus, build with jobs %.1fus, query %.2fus (%zu visited), refit %.1fus",
+				builder_name, num_instances, build_single_thread, build_jobs, query_time, num_visited, refit_time);
+		}
+	}
+
+	void BenchmarkSpatialHashGrid(const benchmark::Context& context)
+	{
+		using Grid = helpers::SpatialHashGrid<uint32_t>;
+
+		std::mt19937 random(2);
+		for (uint32_t num_instances : { 0u, 1u, 1000u, 50000u })
+		{
+			if (context.quick && num_instances > kMaxBruteForceInstances) continue;
+
+			//Similar density of cars for all the sizes
+			const float world_size = 10.f * std::sqrt(static_cast<float>(num_instances) + 1.f);
+			const std::vector<helpers::AABB> boxes = CreateRandomBoxes(random, num_instances, world_size, 4.f);
+			std::vector<uint32_t> instances(num_instances);
+			std::iota(instances.begin(), instances.end(), 0);
+
+			Grid grid;
+			std::vector<Grid::Pair> pairs;
+			const uint32_t num_iterations = context.quick ? 1 : 10;
+			const double build_time = benchmark::Measure(num_iterations, [&]()
+				{
+					grid.Build(instances.data(), boxes.data(), num_instances, 16.f, context.job_system);
+				});
+			const double pairs_time = benchmark::Measure(num_iterations, [&]()
+				{
+					grid.CalculatePairs(pairs, context.job_system);
+				});
+
+			size_t num_visited_pairs = 0;
+			grid.VisitPairs([&](uint32_t, uint32_t) { ++num_visited_pairs; });
+			if (grid.GetNumInstances() != num_instances || num_visited_pairs != pairs.size())
+			{
+				core::LogError("Spatial hash grid benchmark, VisitPairs and CalculatePairs don't match with <%u> instances", num_instances);
+			}
+
+			if (num_instances <= kMaxBruteForceInstances)
+			{
+				std::vector<std::pair<uint32_t, uint32_t>> expected_pairs;
+				for (uint32_t i = 0; i < num_instances; ++i)
+				{
+					for (uint32_t j = i + 1; j < num_instances; ++j)
+					{
+						if (helpers::CollisionAABBVsAABB(boxes[i], boxes[j])) expected_pairs.emplace_back(i, j);
+					}
+				}
+				std::vector<std::pair<uint32_t, uint32_t>> grid_pairs;
+				for (auto& pair : pairs)
+				{
+					grid_pairs.emplace_back(std::min(pair.a, pair.b), std::max(pair.a, pair.b));
+				}
+				std::sort(grid_pairs.begin(), grid_pairs.end());
+
+				const std::vector<helpers::AABB> queries = CreateRandomBoxes(random, 64, world_size, world_size * 0.1f);
+				bool queries_valid = true;
+				for (auto& query : queries)
+				{
+					queries_valid = queries_valid && CollectSorted([&](auto&& visitor) { grid.Visit(query, visitor); }) == BruteForceVisit(boxes, query);
+				}
+
+				if (grid_pairs != expected_pairs || !queries_valid)
+				{
+					core::LogError("Spatial hash grid benchmark, the results don't match the brute force results with <%u> instances", num_instances);
+				}
+			}
+
+			core::LogInfo("Spatial hash grid <%u> instances: build %.1fus, pairs %.1fus (%zu pairs)", num_instances, build_time, pairs_time, pairs.size());
+		}
+	}
+
+	void BenchmarkGrid3D(const benchmark::Context& context)
+	{
+		constexpr uint32_t kDim = 64;
+		using Grid = helpers::Grid3D<uint32_t, kDim, kDim, kDim>;
+		auto grid = std::make_unique<Grid>();
+
+		auto cell_value = [](uint32_t x, uint32_t y, uint32_t z)
+		{
+			return x + y * kDim + z * kDim * kDim;
+		};
+
+		const double fill_time = benchmark::Measure(context.quick ? 1 : 10, [&]()
+			{
+				for (uint32_t z = 0; z < kDim; ++z)
+					for (uint32_t y = 0; y < kDim; ++y)
+						for (uint32_t x = 0; x < kDim; ++x)
+						{
+							grid->Get(x, y, z) = cell_value(x, y, z);
+						}
+			});
+
+		//Each cell has its own position, so the tiling doesn't alias cells
+		for (uint32_t z = 0; z < kDim; ++z)
+			for (uint32_t y = 0; y < kDim; ++y)
+				for (uint32_t x = 0; x < kDim; ++x)
+				{
+					if (static_cast<const Grid&>(*grid).Get(x, y, z) != cell_value(x, y, z))
+					{
+						core::LogError("Grid3D benchmark, cell <%u,%u,%u> has a wrong value", x, y, z);
+					}
+				}
+
+		core::LogInfo("Grid3D <%u^3> cells: fill %.1fus", kDim, fill_time);
+	}
+
+	void BenchmarkSparseGrid3D(const benchmark::Context& context)
+	{
+		using Grid = helpers::SparseGrid3D<uint32_t, 8, 16>;
+		using Position = std::tuple<int32_t, int32_t, int32_t>;
+
+		Grid grid(0xFFFFFFFF);
+		std::map<Position, uint32_t> expected;
+		std::mt19937 random(3);
+		std::uniform_int_distribution<int32_t> coordinate(-200, 200);
+
+		const uint32_t num_writes = context.quick ? 10000 : 200000;
+		std::vector<Position> positions(num_writes);
+		for (auto& position : positions)
+		{
+			position = Position(coordinate(random), coordinate(random), coordinate(random) / 8);
+		}
+		const double write_time = benchmark::Measure(num_writes, [&, value = 0u]() mutable
+			{
+				const Position& position = positions[value];
+				grid.Get(std::get<0>(position), std::get<1>(position), std::get<2>(position)) = value;
+				++value;
+			});
+		for (uint32_t i = 0; i < num_writes; ++i)
+		{
+			expected[positions[i]] = i;
+		}
+
+		//Free some bricks, their cells need to go back to the default value
+		for (int32_t brick = -5; brick < 5; ++brick)
+		{
+			const helpers::BrickPosition brick_position{ brick, brick, 0 };
+			grid.FreeBrick(brick_position);
+			for (auto it = expected.begin(); it != expected.end();)
+			{
+				const Position& position = it->first;
+				it = (Grid::CalculateBrickPosition(std::get<0>(position), std::get<1>(position), std::get<2>(position)) == brick_position) ? expected.erase(it) : std::next(it);
+			}
+		}
+
+		size_t num_written_cells = 0;
+		grid.VisitCells([&](int32_t x, int32_t y, int32_t z, uint32_t value)
+			{
+				auto it = expected.find(Position(x, y, z));
+				if (it == expected.end() ? value != 0xFFFFFFFF : value != it->second)
+				{
+					core::LogError("SparseGrid3D benchmark, cell <%i,%i,%i> has a wrong value", x, y, z);
+				}
+				num_written_cells += (it != expected.end());
+			});
+		for (auto& [position, value] : expected)
+		{
+			const uint32_t* cell = grid.Find(std::get<0>(position), std::get<1>(position), std::get<2>(position));
+			if (cell == nullptr || *cell != value)
+			{
+				core::LogError("SparseGrid3D benchmark, a written cell was not found");
+			}
+		}
+		if (num_written_cells != expected.size())
+		{
+			core::LogError("SparseGrid3D benchmark, VisitCells visited <%zu> written cells, expected <%zu>", num_written_cells, expected.size());
+		}
+
+		//Streaming a moving range, only the bricks inside the range are kept and the odd bricks are empty
+		grid.Clear();
+		uint32_t num_loaded = 0;
+		uint32_t num_unloaded = 0;
+		for (int32_t step = 0; step < 8; ++step)
+		{
+			const helpers::BrickPosition min_brick{ step, -2, -1 };
+			const helpers::BrickPosition max_brick{ step + 4, 2, 1 };
+			grid.Stream(min_brick, max_brick,
+				[&](const helpers::BrickPosition&, uint32_t*) { ++num_unloaded; },
+				[&](const helpers::BrickPosition& brick_position, uint32_t*)
+				{
+					++num_loaded;
+					return (brick_position.x & 1) == 0;
+				});
+
+			grid.VisitBricks([&](const helpers::BrickPosition& brick_position, uint32_t*)
+				{
+					if (!brick_position.Inside(min_brick, max_brick) || (brick_position.x & 1) != 0)
+					{
+						core::LogError("SparseGrid3D benchmark, brick <%i,%i,%i> is outside of the streaming range", brick_position.x, brick_position.y, brick_position.z);
+					}
+				});
+		}
+
+		core::LogInfo("SparseGrid3D <%u> writes: %.3fus per write, streaming loaded <%u> and unloaded <%u> bricks", num_writes, write_time, num_loaded, num_unloaded);
+	}
+}
+
+namespace benchmark
+{
+	void BenchmarkHelpers(const Context& context)
+	{
+		BenchmarkBVH(context, helpers::BVHBuilder::Linear, "linear");
+		BenchmarkBVH(context, helpers::BVHBuilder::BinnedSAH, "binned SAH");
+		BenchmarkSpatialHashGrid(context);
+		BenchmarkGrid3D(context);
+		BenchmarkSparseGrid3D(context);
+	}
+}
@@ -0,0 +1,293 @@
+#ifndef SPATIAL_HASH_GRID_H_
+#define SPATIAL_HASH_GRID_H_
+
+#include <ext/glm/vec3.hpp>
+#include "collision.h"
+#include <algorithm>
+#include <vector>
+#include <cassert>
+#include <cmath>
+#include <job/job_helper.h>
+
+namespace helpers
+{
+	//Loose uniform grid for dynamic objects, rebuilt each frame
+	//Each instance is placed only in the cell of the center of its bounds, the queries are expanded with the largest extents
+	//The cells are hashed in buckets, so the grid doesn't have limits and only uses memory for the instances
+	//The instances are sorted by bucket (counting sort), each bucket is a contiguous range
+	template<typename INSTANCE>
+	class SpatialHashGrid
+	{
+	public:
+		struct Pair
+		{
+			INSTANCE a;
+			INSTANCE b;
+		};
+
+		//Build the grid from an instances array and their bounds
+		//If a job system is provided, the cells of the instances are calculated in jobs
+		void Build(const INSTANCE* instances, const AABB* instances_bounds, uint32_t num_instances, float cell_size, job::System* job_system = nullptr);
+
+		//Call the visitor with each instance that overlaps the bounds
+		template<typename VISITOR>
+		void Visit(const AABB& bounds, VISITOR&& visitor) const;
+
+		//Call the visitor with each pair of instances with overlapping bounds, each pair is visited once
+		template<typename VISITOR>
+		void VisitPairs(VISITOR&& visitor) const;
+
+		//Collect all the pairs of instances with overlapping bounds
+		//If a job system is provided, the instances are split in jobs and the pairs are appended in the order of the instances
+		void CalculatePairs(std::vector<Pair>& pairs, job::System* job_system = nullptr) const;
+
+		bool IsValid() const
+		{
+			return !m_entries.empty();
+		}
+
+		uint32_t GetNumInstances() const
+		{
+			return static_cast<uint32_t>(m_entries.size());
+		}
+
+		void Clear()
+		{
+			m_entries.clear();
+			m_bucket_offsets.clear();
+			m_instance_cells.clear();
+			m_instance_buckets.clear();
+		}
+
+	private:
+		//Number of instances processed by each job
+		constexpr static uint32_t kJobSize = 1024;
+
+		struct Cell
+		{
+			int32_t x;
+			int32_t y;
+			int32_t z;
+
+			bool operator==(const Cell& b) const
+			{
+				return x == b.x && y == b.y && z == b.z;
+			}
+		};
+
+		struct Entry
+		{
+			AABB bounds;
+			Cell cell;
+			INSTANCE instance;
+		};
+
+		Cell CalculateCell(const glm::vec3& position) const
+		{
+			//Clamped, so far positions don't overflow the cell coordinates
+			auto coordinate = [&](const float value)
+			{
+				return static_cast<int32_t>(std::floor(glm::clamp(value * m_inv_cell_size, -1.0e9f, 1.0e9f)));
+			};
+			return Cell{ coordinate(position.x), coordinate(position.y), coordinate(position.z) };
+		}
+
+		uint32_t CalculateBucket(const Cell& cell) const
+		{
+			return ((static_cast<uint32_t>(cell.x) * 73856093u) ^ (static_cast<uint32_t>(cell.y) * 19349663u) ^ (static_cast<uint32_t>(cell.z) * 83492791u)) & m_bucket_mask;
+		}
+
+		//Call the visitor with the index of each entry that overlaps the bounds
+		template<typename VISITOR>
+		void VisitEntries(const AABB& bounds, VISITOR&& visitor) const;
+
+		//Instances sorted by bucket
+		std::vector<Entry> m_entries;
+
+		//Offset of the first entry of each bucket, num buckets + 1
+		std::vector<uint32_t> m_bucket_offsets;
+
+		//Build scratch, cell and bucket of each instance
+		std::vector<Cell> m_instance_cells;
+		std::vector<uint32_t> m_instance_buckets;
+
+		float m_inv_cell_size = 1.f;
+		uint32_t m_bucket_mask = 0;
+
+		//Largest extents of the instances, the queries are expanded with it
+		glm::vec3 m_max_extents = glm::vec3(0.f, 0.f, 0.f);
+	};
+
+	template<typename INSTANCE>
+	inline void SpatialHashGrid<INSTANCE>::Build(const INSTANCE* instances, const AABB* instances_bounds, uint32_t num_instances, float cell_size, job::System* job_system)
+	{
+		assert(cell_size > 0.f);
+
+		m_inv_cell_size = 1.f / cell_size;
+
+		//At least two buckets for each instance, power of two so the hash is masked
+		uint32_t num_buckets = 1;
+		while (num_buckets < num_instances * 2) num_buckets *= 2;
+		m_bucket_mask = num_buckets - 1;
+
+		//Cell, bucket and largest extents of each instance
+		m_instance_cells.resize(num_instances);
+		m_instance_buckets.resize(num_instances);
+
+		const uint32_t num_jobs = (num_instances + kJobSize - 1) / kJobSize;
+		std::vector<glm::vec3> jobs_max_extents(num_jobs, glm::vec3(0.f, 0.f, 0.f));
+		job::RunJobs(job_system, num_jobs, [&](uint32_t job_index)
+			{
+				const uint32_t begin = job_index * kJobSize;
+				const uint32_t end = std::min(begin + kJobSize, num_instances);
+				glm::vec3 max_extents(0.f, 0.f, 0.f);
+				for (uint32_t i = begin; i < end; ++i)
+				{
+					const AABB& bounds = instances_bounds[i];
+					m_instance_cells[i] = CalculateCell((bounds.min + bounds.max) * 0.5f);
+					m_instance_buckets[i] = CalculateBucket(m_instance_cells[i]);
+					max_extents = glm::max(max_extents, (bounds.max - bounds.min) * 0.5f);
+				}
+				jobs_max_extents[job_index] = max_extents;
+			});
+
+		m_max_extents = glm::vec3(0.f, 0.f, 0.f);
+		for (auto& max_extents : jobs_max_extents)
+		{
+			m_max_extents = glm::max(m_max_extents, max_extents);
+		}
+
+		//Counting sort by bucket, the instances keep their order inside each bucket
+		m_bucket_offsets.assign(num_buckets + 1, 0);
+		for (uint32_t i = 0; i < num_instances; ++i)
+		{
+			m_bucket_offsets[m_instance_buckets[i] + 1]++;
+		}
+		for (uint32_t i = 0; i < num_buckets; ++i)
+		{
+			m_bucket_offsets[i + 1] += m_bucket_offsets[i];
+		}
+
+		//The bucket offsets are used as cursors and restored after
+		m_entries.resize(num_instances);
+		for (uint32_t i = 0; i < num_instances; ++i)
+		{
+			m_entries[m_bucket_offsets[m_instance_buckets[i]]++] = Entry{ instances_bounds[i], m_instance_cells[i], instances[i] };
+		}
+		for (uint32_t i = num_buckets; i > 0; --i)
+		{
+			m_bucket_offsets[i] = m_bucket_offsets[i - 1];
+		}
+		m_bucket_offsets[0] = 0;
+	}
+
+	template<typename INSTANCE>
+	template<typename VISITOR>
+	inline void SpatialHashGrid<INSTANCE>::VisitEntries(const AABB& bounds, VISITOR&& visitor) const
+	{
+		if (m_entries.empty()) return;
+
+		//Any instance that overlaps the bounds has the center inside the bounds expanded by the largest extents
+		const Cell min_cell = CalculateCell(bounds.min - m_max_extents);
+		const Cell max_cell = CalculateCell(bounds.max + m_max_extents);
+
+		auto cell_range = [](const int32_t min, const int32_t max)
+		{
+			return static_cast<uint64_t>(static_cast<int64_t>(max) - static_cast<int64_t>(min) + 1);
+		};
+		const uint64_t num_cells_xy = cell_range(min_cell.x, max_cell.x) * cell_range(min_cell.y, max_cell.y);
+		if (num_cells_xy > m_entries.size() || num_cells_xy * cell_range(min_cell.z, max_cell.z) > m_entries.size())
+		{
+			//Bigger than the grid, cheaper to test all the instances
+			for (uint32_t i = 0; i < static_cast<uint32_t>(m_entries.size()); ++i)
+			{
+				if (CollisionAABBVsAABB(m_entries[i].bounds, bounds))
+				{
+					visitor(i);
+				}
+			}
+			return;
+		}
+
+		for (int32_t z = min_cell.z; z <= max_cell.z; ++z)
+		{
+			for (int32_t y = min_cell.y; y <= max_cell.y; ++y)
+			{
+				for (int32_t x = min_cell.x; x <= max_cell.x; ++x)
+				{
+					const Cell cell{ x, y, z };
+					const uint32_t bucket = CalculateBucket(cell);
+					const uint32_t end = m_bucket_offsets[bucket + 1];
+					for (uint32_t i = m_bucket_offsets[bucket]; i < end; ++i)
+					{
+						//Other cells can share the bucket, each instance is only visited from its own cell
+						const Entry& entry = m_entries[i];
+						if (entry.cell == cell && CollisionAABBVsAABB(entry.bounds, bounds))
+						{
+							visitor(i);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	template<typename INSTANCE>
+	template<typename VISITOR>
+	inline void SpatialHashGrid<INSTANCE>::Visit(const AABB& bounds, VISITOR&& visitor) const
+	{
+		VisitEntries(bounds, [&](uint32_t entry_index)
+			{
+				visitor(m_entries[entry_index].instance);
+			});
+	}
+
+	template<typename INSTANCE>
+	template<typename VISITOR>
+	inline void SpatialHashGrid<INSTANCE>::VisitPairs(VISITOR&& visitor) const
+	{
+		for (uint32_t i = 0; i < static_cast<uint32_t>(m_entries.size()); ++i)
+		{
+			VisitEntries(m_entries[i].bounds, [&](uint32_t entry_index)
+				{
+					//Only the pairs with the other entry after, so each pair is visited once
+					if (entry_index > i)
+					{
+						visitor(m_entries[i].instance, m_entries[entry_index].instance);
+					}
+				});
+		}
+	}
+
+	template<typename INSTANCE>
+	inline void SpatialHashGrid<INSTANCE>::CalculatePairs(std::vector<Pair>& pairs, job::System* job_system) const
+	{
+		pairs.clear();
+
+		const uint32_t num_entries = static_cast<uint32_t>(m_entries.size());
+		const uint32_t num_jobs = (num_entries + kJobSize - 1) / kJobSize;
+		std::vector<std::vector<Pair>> jobs_pairs(num_jobs);
+		job::RunJobs(job_system, num_jobs, [&](uint32_t job_index)
+			{
+				const uint32_t begin = job_index * kJobSize;
+				const uint32_t end = std::min(begin + kJobSize, num_entries);
+				for (uint32_t i = begin; i < end; ++i)
+				{
+					VisitEntries(m_entries[i].bounds, [&](uint32_t entry_index)
+						{
+							if (entry_index > i)
+							{
+								jobs_pairs[job_index].push_back(Pair{ m_entries[i].instance, m_entries[entry_index].instance });
+							}
+						});
+				}
+			});
+
+		for (auto& job_pairs : jobs_pairs)
+		{
+			pairs.insert(pairs.end(), job_pairs.begin(), job_pairs.end());
+		}
+	}
+}
+
+#endif //SPATIAL_HASH_GRID_H_
@@ -1,9 +1,19 @@
 #include "job.h"
 #include <vector>
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include "job_queue.h"
 #include <cstdlib>
+#include <chrono>
+#include <fstream>
+#include <cstdio>
+#include <cwchar>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
 #include <core/log.h>
 #include <core/profile.h>
 #include <core/sync.h>
@@ -38,12 +48,107 @@ namespace job
 		return g_num_workers;
 	}
 
+	//Max number of jobs in the queue of each worker
+	constexpr size_t kJobQueueSize = 4096;
+
 	//Job data
 	struct Job
 	{
 		JobFunction function;
 		void* data;
 		Fence* fence;
+		//Order of the job in the schedule (only used during record or replay)
+		uint32_t schedule_id;
+	};
+
+	//Events captured by the trace recorder
+	enum class TraceEventType : uint8_t
+	{
+		JobBegin,
+		JobEnd,
+		Steal,
+		WaitBegin,
+		WaitEnd,
+		IdleBegin,
+		IdleEnd
+	};
+
+	struct TraceEvent
+	{
+		//TSC timestamp
+		uint64_t timestamp;
+		//Job function, fence or stolen worker, depending of the type
+		uint64_t data;
+		TraceEventType type;
+	};
+
+	//Begin event type for an end event type
+	inline TraceEventType GetTraceBeginEventType(TraceEventType type)
+	{
+		switch (type)
+		{
+		case TraceEventType::JobEnd: return TraceEventType::JobBegin;
+		case TraceEventType::WaitEnd: return TraceEventType::WaitBegin;
+		case TraceEventType::IdleEnd: return TraceEventType::IdleBegin;
+		default: return type;
+		}
+	}
+
+	//Name of the span of a begin or end event in the dumped trace
+	inline const char* GetTraceEventName(TraceEventType type)
+	{
+		switch (type)
+		{
+		case TraceEventType::JobBegin: case TraceEventType::JobEnd: return "Job";
+		case TraceEventType::WaitBegin: case TraceEventType::WaitEnd: return "Wait";
+		case TraceEventType::IdleBegin: case TraceEventType::IdleEnd: return "Idle";
+		default: return "Steal";
+		}
+	}
+
+	//Ring buffer of trace events, only the owner worker writes into it
+	//When it is full the oldest events get overwritten
+	class TraceRecorder
+	{
+	public:
+		void Init(size_t capacity)
+		{
+			m_events = std::make_unique<TraceEvent[]>(capacity);
+			m_capacity = capacity;
+			m_count = 0;
+		}
+
+		void Reset()
+		{
+			m_count = 0;
+		}
+
+		void Record(TraceEventType type, uint64_t data)
+		{
+			TraceEvent& event = m_events[m_count % m_capacity];
+			event.timestamp = __rdtsc();
+			event.data = data;
+			event.type = type;
+
+			m_count++;
+		}
+
+		//Visit the events from the oldest to the newest
+		template<typename VISITOR>
+		void Visit(VISITOR&& visitor) const
+		{
+			const size_t begin = (m_count > m_capacity) ? (m_count - m_capacity) : 0;
+			for (size_t i = begin; i < m_count; ++i)
+			{
+				visitor(m_events[i % m_capacity]);
+			}
+		}
+
+	private:
+		std::unique_ptr<TraceEvent[]> m_events;
+		size_t m_capacity = 0;
+		//Number of events recorded since the last reset
+		size_t m_count = 0;
 	};
 
 	//Worker
@@ -67,7 +172,7 @@ namespace job
 			m_running = true;
 
 			wchar_t name_buffer[256];
-			swprintf_s(name_buffer, L"Worker Thread %zd", m_worker_index);
+			swprintf(name_buffer, 256, L"Worker Thread %zd", m_worker_index);
 
 			//Create a thread associated to this worker
 			m_thread = std::make_unique<core::Thread>(name_buffer, core::ThreadPriority::Normal, &Worker::ThreadRun, this);
@@ -106,6 +211,42 @@ namespace job
 
 		bool GetJob(Job& job);
 
+		//Mark that the worker is reading the schedule state, fails if SetScheduleMode is changing it
+		bool BeginScheduleAccess();
+		void EndScheduleAccess()
+		{
+			m_schedule_access.store(false, std::memory_order_release);
+		}
+
+		bool IsAccessingSchedule() const
+		{
+			return m_schedule_access.load(std::memory_order_acquire);
+		}
+
+		//Execute the job and release the fence
+		void ExecuteJob(const Job& job);
+
+		//Record a trace event if the trace recorder is running, returns if it was recorded
+		bool Trace(TraceEventType type, uint64_t data = 0);
+
+		//Close the idle period, if any
+		void EndIdle();
+
+		TraceRecorder& GetTraceRecorder()
+		{
+			return m_trace_recorder;
+		}
+
+		std::vector<uint32_t>& GetSchedule()
+		{
+			return m_schedule;
+		}
+
+		void ResetScheduleCursor()
+		{
+			m_schedule_cursor = 0;
+		}
+
 	private:
 		//Thread if it needed
 		std::unique_ptr<core::Thread> m_thread;
@@ -116,9 +257,24 @@ namespace job
 		//System
 		System* m_system;
 		//Queue
-		Queue<Job, 4096> m_job_queue;
+		Queue<Job, kJobQueueSize> m_job_queue;
 		//Count for yield, count of failed job search before to yield
 		size_t m_count_for_yield = 0;
+		//Worker didn't find any job the last time it tried
+		bool m_idle = false;
+		//The begin of the idle period was recorded, so the end needs to be recorded as well
+		bool m_idle_traced = false;
+		//Trace events of this worker
+		TraceRecorder m_trace_recorder;
+		//Schedule ids executed by this worker, in order
+		std::vector<uint32_t> m_schedule;
+		//Next schedule entry to run during replay
+		size_t m_schedule_cursor = 0;
+		//Set while the worker reads the schedule state
+		std::atomic_bool m_schedule_access = false;
+
+		//Pop, steal or get the next replay job, needs the schedule access
+		bool FindJob(Job& job);
 
 		//Code running in the worker thread
 		void ThreadRun();
@@ -149,10 +305,82 @@ namespace job
 		std::atomic<size_t> m_jobs_added = 0;
 		std::atomic<size_t> m_jobs_stolen = 0;
 
-		bool StealJob(size_t current_worker_id, Job& job)
+		//Trace recorder
+		size_t m_trace_events_per_worker = 0;
+		std::atomic_bool m_trace_running = false;
+		uint64_t m_trace_begin_timestamp = 0;
+		uint64_t m_trace_end_timestamp = 0;
+		std::chrono::high_resolution_clock::time_point m_trace_begin_time;
+		std::chrono::high_resolution_clock::time_point m_trace_end_time;
+
+		//Schedule record/replay
+		//The mode and the replay slots are only read with the schedule access of the worker,
+		//SetScheduleMode sets m_schedule_switching and waits until no worker has access before changing them
+		std::atomic<ScheduleMode> m_schedule_mode = ScheduleMode::Normal;
+		std::atomic<uint32_t> m_schedule_job_count = 0;
+		std::atomic_bool m_schedule_switching = false;
+
+		//Jobs added during replay, indexed by schedule id
+		enum class ReplaySlotState : uint32_t
+		{
+			Empty,
+			Ready,
+			Taken
+		};
+		struct ReplaySlot
+		{
+			Job job;
+			std::atomic<ReplaySlotState> state = ReplaySlotState::Empty;
+		};
+		std::unique_ptr<ReplaySlot[]> m_replay_slots;
+		size_t m_num_replay_slots = 0;
+
+		//The jobs added don't match the recorded schedule, the replay slots are not used anymore
+		std::atomic_bool m_replay_diverged = false;
+
+		//Time without progress in a wait during replay before it is considered diverged
+		constexpr static std::chrono::milliseconds kReplayStallTime = std::chrono::milliseconds(250);
+
+		//Get the job with the schedule id if it was already added and nobody took it
+		bool ClaimReplayJob(uint32_t schedule_id, Job& job)
+		{
+			ReplaySlot& slot = m_replay_slots[schedule_id];
+			ReplaySlotState expected = ReplaySlotState::Ready;
+			if (slot.state.load(std::memory_order_acquire) == ReplaySlotState::Ready &&
+				slot.state.compare_exchange_strong(expected, ReplaySlotState::Taken, std::memory_order_acq_rel))
+			{
+				job = slot.job;
+				return true;
+			}
+			return false;
+		}
+
+		//Stop replaying, the jobs waiting in the replay slots are moved to the queue of the worker
+		//Needs the schedule access of the worker
+		void DivergeReplay(Worker& worker)
+		{
+			bool expected = false;
+			if (!m_replay_diverged.compare_exchange_strong(expected, true))
+			{
+				return;
+			}
+
+			core::LogWarning("Job system replay doesn't match the recorded schedule, the jobs are scheduled normally");
+
+			Job job;
+			for (size_t i = 0; i < m_num_replay_slots; ++i)
+			{
+				if (ClaimReplayJob(static_cast<uint32_t>(i), job))
+				{
+					worker.AddJob(job);
+				}
+			}
+		}
+
+		bool StealJob(size_t current_worker_id, Job& job, size_t& worker_to_steal)
 		{
 			//Get random value
-			size_t worker_to_steal = std::rand() % m_workers.size();
+			worker_to_steal = std::rand() % m_workers.size();
 
 			if (worker_to_steal != current_worker_id)
 			{
@@ -182,6 +410,30 @@ namespace job
 		{
 			return (fence.value == 0);
 		}
+
+		//Jobs left in the fence
+		size_t GetFenceValue(Fence& fence) const
+		{
+			return fence.value;
+		}
+
+		//Wait until no worker is reading the schedule state, they keep looking for jobs between frames
+		void BeginScheduleSwitch()
+		{
+			m_schedule_switching.store(true);
+			for (auto& worker : m_workers)
+			{
+				while (worker->IsAccessingSchedule())
+				{
+					std::this_thread::yield();
+				}
+			}
+		}
+
+		void EndScheduleSwitch()
+		{
+			m_schedule_switching.store(false, std::memory_order_release);
+		}
 	};
 
 	System * CreateSystem(const SystemDesc & system_desc)
@@ -230,6 +482,16 @@ namespace job
 
 		system->m_count_for_yield = system_desc.count_for_yield;
 
+		//Init trace recorders
+		system->m_trace_events_per_worker = system_desc.trace_events_per_worker;
+		if (system->m_trace_events_per_worker > 0)
+		{
+			for (auto& worker : system->m_workers)
+			{
+				worker->GetTraceRecorder().Init(system->m_trace_events_per_worker);
+			}
+		}
+
 		system->m_state = System::State::Started;
 
 		return system;
@@ -265,6 +527,26 @@ namespace job
 			ImGui::Text("Num jobs added (%zu)", system->m_jobs_added.load());
 			ImGui::Text("Num jobs stolen (%zu)", system->m_jobs_stolen.load());
 			ImGui::Separator();
+			if (system->m_trace_events_per_worker > 0)
+			{
+				bool trace_running = IsTraceRunning(system);
+				if (ImGui::Checkbox("Trace recording", &trace_running))
+				{
+					(trace_running) ? StartTrace(system) : StopTrace(system);
+				}
+				if (ImGui::Button("Dump trace"))
+				{
+					DumpTrace(system, "job_trace.json");
+				}
+				ImGui::Separator();
+			}
+			int schedule_mode = static_cast<int>(job::GetScheduleMode(system));
+			if (ImGui::Combo("Schedule mode", &schedule_mode, "Normal\0Record\0Replay\0"))
+			{
+				job::SetScheduleMode(system, static_cast<ScheduleMode>(schedule_mode));
+			}
+			ImGui::Text("Num jobs scheduled (%u)", system->m_schedule_job_count.load());
+			ImGui::Separator();
 			bool single_frame_mode = job::GetSingleThreadMode(system);
 			if (ImGui::Checkbox("Single thread mode", &single_frame_mode))
 			{
@@ -288,6 +570,328 @@ namespace job
 		return system->m_single_thread_mode;
 	}
 
+	void StartTrace(System* system)
+	{
+		if (system->m_trace_events_per_worker == 0 || system->m_trace_running)
+		{
+			return;
+		}
+
+		for (auto& worker : system->m_workers)
+		{
+			worker->GetTraceRecorder().Reset();
+		}
+
+		system->m_trace_begin_time = std::chrono::high_resolution_clock::now();
+		system->m_trace_begin_timestamp = __rdtsc();
+
+		system->m_trace_running.store(true, std::memory_order_release);
+	}
+
+	void StopTrace(System* system)
+	{
+		if (!system->m_trace_running)
+		{
+			return;
+		}
+
+		system->m_trace_running.store(false, std::memory_order_release);
+
+		system->m_trace_end_timestamp = __rdtsc();
+		system->m_trace_end_time = std::chrono::high_resolution_clock::now();
+	}
+
+	bool IsTraceRunning(System* system)
+	{
+		return system->m_trace_running;
+	}
+
+	bool DumpTrace(System* system, const char* filename)
+	{
+		if (system->m_trace_events_per_worker == 0)
+		{
+			core::LogWarning("Job trace recorder is disabled, trace_events_per_worker needs to be set during the job system creation");
+			return false;
+		}
+
+		StopTrace(system);
+
+		std::ofstream file(filename);
+		if (!file.is_open())
+		{
+			core::LogWarning("Job trace file <%s> can not be created", filename);
+			return false;
+		}
+
+		//Calculate the TSC frequency using the time elapsed during the capture
+		const double elapsed_us = std::chrono::duration<double, std::micro>(system->m_trace_end_time - system->m_trace_begin_time).count();
+		const double elapsed_ticks = static_cast<double>(system->m_trace_end_timestamp - system->m_trace_begin_timestamp);
+		const double ticks_per_us = (elapsed_us > 0.0 && elapsed_ticks > 0.0) ? (elapsed_ticks / elapsed_us) : 1.0;
+
+		file << "{\"traceEvents\":[\n";
+
+		bool first_event = true;
+		auto begin_event = [&](const char* name, const char* phase, size_t worker_index)
+		{
+			file << ((first_event) ? "" : ",\n") << "{\"name\":\"" << name << "\",\"cat\":\"job\",\"ph\":\"" << phase << "\",\"pid\":0,\"tid\":" << worker_index;
+			first_event = false;
+		};
+
+		char buffer[64];
+		auto write_timestamp = [&](uint64_t timestamp)
+		{
+			const double timestamp_us = static_cast<double>(timestamp - system->m_trace_begin_timestamp) / ticks_per_us;
+			snprintf(buffer, sizeof(buffer), "%.3f", timestamp_us);
+			file << ",\"ts\":" << buffer << "}";
+		};
+
+		std::vector<TraceEventType> open_events;
+		for (size_t worker_index = 0; worker_index < system->m_workers.size(); ++worker_index)
+		{
+			//Thread name
+			begin_event("thread_name", "M", worker_index);
+			file << ",\"args\":{\"name\":\"Worker Thread " << worker_index << "\"}}";
+
+			//Begin events without end, the ring buffer only loses the oldest events,
+			//so an end event is unmatched if its begin was overwritten and there is not other begin open
+			open_events.clear();
+
+			system->m_workers[worker_index]->GetTraceRecorder().Visit([&](const TraceEvent& event)
+				{
+					//Events from a previous capture are skipped
+					if (event.timestamp < system->m_trace_begin_timestamp)
+					{
+						return;
+					}
+
+					switch (event.type)
+					{
+					case TraceEventType::JobBegin:
+					case TraceEventType::WaitBegin:
+					case TraceEventType::IdleBegin:
+						open_events.push_back(event.type);
+						break;
+					case TraceEventType::JobEnd:
+					case TraceEventType::WaitEnd:
+					case TraceEventType::IdleEnd:
+						if (open_events.empty() || open_events.back() != GetTraceBeginEventType(event.type))
+						{
+							//The begin was overwritten, the viewer would match it with a different begin
+							return;
+						}
+						open_events.pop_back();
+						break;
+					default:
+						break;
+					}
+
+					switch (event.type)
+					{
+					case TraceEventType::JobBegin:
+						begin_event("Job", "B", worker_index);
+						snprintf(buffer, sizeof(buffer), "0x%llx", static_cast<unsigned long long>(event.data));
+						file << ",\"args\":{\"function\":\"" << buffer << "\"}";
+						break;
+					case TraceEventType::JobEnd:
+						begin_event("Job", "E", worker_index);
+						break;
+					case TraceEventType::Steal:
+						begin_event("Steal", "i", worker_index);
+						file << ",\"s\":\"t\",\"args\":{\"from_worker\":" << event.data << "}";
+						break;
+					case TraceEventType::WaitBegin:
+						begin_event("Wait", "B", worker_index);
+						snprintf(buffer, sizeof(buffer), "0x%llx", static_cast<unsigned long long>(event.data));
+						file << ",\"args\":{\"fence\":\"" << buffer << "\"}";
+						break;
+					case TraceEventType::WaitEnd:
+						begin_event("Wait", "E", worker_index);
+						break;
+					case TraceEventType::IdleBegin:
+						begin_event("Idle", "B", worker_index);
+						break;
+					case TraceEventType::IdleEnd:
+						begin_event("Idle", "E", worker_index);
+						break;
+					}
+
+					write_timestamp(event.timestamp);
+				});
+
+			//Close the events still open at the end of the capture
+			while (!open_events.empty())
+			{
+				begin_event(GetTraceEventName(open_events.back()), "E", worker_index);
+				write_timestamp(system->m_trace_end_timestamp);
+				open_events.pop_back();
+			}
+		}
+
+		file << "\n],\"displayTimeUnit\":\"ns\"}\n";
+
+		core::LogInfo("Job trace dumped to <%s>", filename);
+
+		return true;
+	}
+
+	void SetScheduleMode(System* system, ScheduleMode schedule_mode)
+	{
+		system->BeginScheduleSwitch();
+
+		if (system->m_schedule_mode == ScheduleMode::Replay)
+		{
+			//Jobs still waiting in the replay slots are moved to the current worker, so they are not lost
+			Job job;
+			for (size_t i = 0; i < system->m_num_replay_slots; ++i)
+			{
+				if (system->ClaimReplayJob(static_cast<uint32_t>(i), job))
+				{
+					system->m_workers[g_worker_id]->AddJob(job);
+				}
+			}
+			system->m_replay_slots.reset();
+			system->m_num_replay_slots = 0;
+		}
+
+		system->m_schedule_job_count = 0;
+		system->m_replay_diverged = false;
+
+		if (schedule_mode == ScheduleMode::Record)
+		{
+			for (auto& worker : system->m_workers)
+			{
+				worker->GetSchedule().clear();
+			}
+		}
+		else if (schedule_mode == ScheduleMode::Replay)
+		{
+			//Jobs that got a schedule id but didn't run before the switch leave gaps in the ids
+			size_t num_replay_slots = 0;
+			for (auto& worker : system->m_workers)
+			{
+				worker->ResetScheduleCursor();
+				for (const uint32_t schedule_id : worker->GetSchedule())
+				{
+					num_replay_slots = std::max<size_t>(num_replay_slots, static_cast<size_t>(schedule_id) + 1);
+				}
+			}
+
+			if (num_replay_slots == 0)
+			{
+				core::LogWarning("Job system replay mode enabled without a recorded schedule");
+			}
+
+			system->m_replay_slots = std::make_unique<System::ReplaySlot[]>(num_replay_slots);
+			system->m_num_replay_slots = num_replay_slots;
+		}
+
+		system->m_schedule_mode.store(schedule_mode, std::memory_order_relaxed);
+		system->EndScheduleSwitch();
+	}
+
+	ScheduleMode GetScheduleMode(System* system)
+	{
+		return system->m_schedule_mode.load(std::memory_order_relaxed);
+	}
+
+	bool SaveSchedule(System* system, const char* filename)
+	{
+		std::ofstream file(filename, std::ios::binary);
+		if (!file.is_open())
+		{
+			core::LogWarning("Job schedule file <%s> can not be created", filename);
+			return false;
+		}
+
+		const uint64_t num_workers = system->m_workers.size();
+		file.write(reinterpret_cast<const char*>(&num_workers), sizeof(num_workers));
+
+		//The workers add entries to their schedule during recording
+		system->BeginScheduleSwitch();
+		for (auto& worker : system->m_workers)
+		{
+			const auto& schedule = worker->GetSchedule();
+			const uint64_t num_entries = schedule.size();
+			file.write(reinterpret_cast<const char*>(&num_entries), sizeof(num_entries));
+			file.write(reinterpret_cast<const char*>(schedule.data()), num_entries * sizeof(uint32_t));
+		}
+		system->EndScheduleSwitch();
+
+		return true;
+	}
+
+	bool LoadSchedule(System* system, const char* filename)
+	{
+		std::ifstream file(filename, std::ios::binary | std::ios::ate);
+		if (!file.is_open())
+		{
+			core::LogWarning("Job schedule file <%s> can not be opened", filename);
+			return false;
+		}
+		const uint64_t file_size = static_cast<uint64_t>(file.tellg());
+		file.seekg(0);
+
+		uint64_t num_workers = 0;
+		file.read(reinterpret_cast<char*>(&num_workers), sizeof(num_workers));
+		if (num_workers != system->m_workers.size())
+		{
+			core::LogWarning("Job schedule file <%s> was recorded with %zu workers, the job system has %zu workers", filename, static_cast<size_t>(num_workers), system->m_workers.size());
+			return false;
+		}
+
+		if (system->m_schedule_mode == ScheduleMode::Replay)
+		{
+			core::LogWarning("Job schedule file <%s> can not be loaded during a replay", filename);
+			return false;
+		}
+
+		//Read all the schedules before replacing the ones in the workers, so a corrupted file doesn't leave a partial schedule
+		std::vector<std::vector<uint32_t>> schedules(num_workers);
+		uint64_t read_size = sizeof(num_workers);
+		uint64_t num_total_entries = 0;
+		for (auto& schedule : schedules)
+		{
+			uint64_t num_entries = 0;
+			file.read(reinterpret_cast<char*>(&num_entries), sizeof(num_entries));
+			read_size += sizeof(num_entries);
+			if (!file || num_entries > (file_size - read_size) / sizeof(uint32_t))
+			{
+				core::LogWarning("Job schedule file <%s> is corrupted", filename);
+				return false;
+			}
+			schedule.resize(num_entries);
+			file.read(reinterpret_cast<char*>(schedule.data()), num_entries * sizeof(uint32_t));
+			read_size += num_entries * sizeof(uint32_t);
+			num_total_entries += num_entries;
+		}
+
+		//The ids have gaps only for the jobs that were still in the queues when the recording stopped
+		const uint64_t max_schedule_id = num_total_entries + kJobQueueSize * num_workers;
+		bool valid_ids = static_cast<bool>(file);
+		for (const auto& schedule : schedules)
+		{
+			for (const uint32_t schedule_id : schedule)
+			{
+				valid_ids &= (schedule_id < max_schedule_id);
+			}
+		}
+		if (!valid_ids)
+		{
+			core::LogWarning("Job schedule file <%s> is corrupted", filename);
+			return false;
+		}
+
+		//The workers add entries to their schedule during recording
+		system->BeginScheduleSwitch();
+		for (size_t i = 0; i < system->m_workers.size(); ++i)
+		{
+			system->m_workers[i]->GetSchedule() = std::move(schedules[i]);
+		}
+		system->EndScheduleSwitch();
+
+		return true;
+	}
+
 	void RegisterExtraWorker(System* system, size_t extra_worker_index)
 	{
 		g_worker_id = system->m_begin_extra_workers + extra_worker_index;
@@ -300,21 +904,67 @@ namespace job
 		if (system->m_single_thread_mode)
 		{
 			//Just run the job
+			auto& worker = *system->m_workers[g_worker_id].get();
+			worker.Trace(TraceEventType::JobBegin, reinterpret_cast<uint64_t>(job));
 			job(data);
+			worker.Trace(TraceEventType::JobEnd);
 		}
 		else
 		{
 			//Increment the fence
 			system->IncrementFence(fence);
 
+			Job new_job{ job, data, &fence, 0 };
+			auto& worker = *system->m_workers[g_worker_id].get();
+
+			//Wait if the schedule mode is changing
+			while (!worker.BeginScheduleAccess())
+			{
+				std::this_thread::yield();
+			}
+
+			const ScheduleMode schedule_mode = system->m_schedule_mode.load(std::memory_order_relaxed);
+			if (schedule_mode != ScheduleMode::Normal)
+			{
+				new_job.schedule_id = system->m_schedule_job_count.fetch_add(1);
+
+				if (schedule_mode == ScheduleMode::Replay && !system->m_replay_diverged && new_job.schedule_id < system->m_num_replay_slots)
+				{
+					//The worker that recorded this job will pick it
+					System::ReplaySlot& slot = system->m_replay_slots[new_job.schedule_id];
+					slot.job = new_job;
+					slot.state.store(System::ReplaySlotState::Ready);
+
+					//If the replay diverged in the meantime, nobody is going to look at the slot
+					Job orphan_job;
+					if (system->m_replay_diverged && system->ClaimReplayJob(new_job.schedule_id, orphan_job))
+					{
+						worker.AddJob(orphan_job);
+					}
+
+					worker.EndScheduleAccess();
+					return;
+				}
+			}
+
+			worker.EndScheduleAccess();
+
 			//Add job to current worker
-			system->m_workers[g_worker_id]->AddJob(Job{ job, data, &fence });
+			worker.AddJob(new_job);
 		}
 	}
 
 	void Wait(System * system, Fence& fence)
 	{
 		auto& worker = *system->m_workers[g_worker_id].get();
+
+		worker.Trace(TraceEventType::WaitBegin, reinterpret_cast<uint64_t>(&fence));
+
+		//Last time this wait made progress, used for detecting a replay that doesn't match the jobs added
+		auto last_progress_time = std::chrono::steady_clock::now();
+		size_t last_fence_value = system->GetFenceValue(fence);
+		size_t num_failed_jobs = 0;
+
 		while (!system->IsFenceFinished(fence))
 		{
 			//Work for a job during waiting
@@ -322,29 +972,111 @@ namespace job
 
 			if (worker.GetJob(job))
 			{
-				//Execute
-				job.function(job.data);
-
-				//Decrement the fence
-				system->DecrementFence(*job.fence);
+				worker.ExecuteJob(job);
+				num_failed_jobs = 0;
+				last_progress_time = std::chrono::steady_clock::now();
+			}
+			else if (++num_failed_jobs % 1024 == 0 && system->m_schedule_mode.load(std::memory_order_relaxed) == ScheduleMode::Replay)
+			{
+				const auto now = std::chrono::steady_clock::now();
+				const size_t fence_value = system->GetFenceValue(fence);
+				if (fence_value != last_fence_value)
+				{
+					last_fence_value = fence_value;
+					last_progress_time = now;
+				}
+				else if (now - last_progress_time > System::kReplayStallTime && worker.BeginScheduleAccess())
+				{
+					//The jobs this wait needs are not coming in the recorded order
+					if (system->m_schedule_mode.load(std::memory_order_relaxed) == ScheduleMode::Replay)
+					{
+						system->DivergeReplay(worker);
+					}
+					worker.EndScheduleAccess();
+				}
 			}
 		}
+
+		worker.EndIdle();
+
+		worker.Trace(TraceEventType::WaitEnd);
 	}
 	
 	//Worker inline functions
-	inline bool Worker::GetJob(Job & job)
+	inline bool Worker::BeginScheduleAccess()
 	{
+		//Sequentially consistent, SetScheduleMode sets the switching flag and then checks the access flags
+		m_schedule_access.store(true);
+		if (m_system->m_schedule_switching.load())
+		{
+			m_schedule_access.store(false, std::memory_order_release);
+			return false;
+		}
+		return true;
+	}
+
+	inline bool Worker::FindJob(Job& job)
+	{
+		const ScheduleMode schedule_mode = m_system->m_schedule_mode.load(std::memory_order_relaxed);
+		if (schedule_mode == ScheduleMode::Replay && !m_system->m_replay_diverged && m_schedule_cursor < m_schedule.size())
+		{
+			const uint32_t schedule_id = m_schedule[m_schedule_cursor];
+			if (schedule_id >= m_system->m_num_replay_slots)
+			{
+				//The recorded schedule can not be replayed
+				m_system->DivergeReplay(*this);
+			}
+			else
+			{
+				//Replaying, only the next recorded job can run in this worker
+				if (m_system->ClaimReplayJob(schedule_id, job))
+				{
+					m_schedule_cursor++;
+					return true;
+				}
+				return false;
+			}
+		}
+
 		//Try to pop from the worker job queue
-		if (m_job_queue.Pop(job))
+		bool found = m_job_queue.Pop(job);
+		if (!found)
 		{
-			return true;
+			//Try to steal from a random queue
+			size_t stolen_worker_index;
+			found = m_system->StealJob(m_worker_index, job, stolen_worker_index);
+			if (found)
+			{
+				m_system->m_jobs_stolen++;
+				Trace(TraceEventType::Steal, stolen_worker_index);
+			}
 		}
 
-		//Try to steal from a random queue
-		if (m_system->StealJob(m_worker_index, job))
+		if (found && schedule_mode == ScheduleMode::Record)
 		{
-			m_system->m_jobs_stolen++;
-			return true;
+			m_schedule.push_back(job.schedule_id);
+		}
+		return found;
+	}
+
+	inline bool Worker::GetJob(Job & job)
+	{
+		if (BeginScheduleAccess())
+		{
+			const bool found = FindJob(job);
+			EndScheduleAccess();
+
+			if (found)
+			{
+				EndIdle();
+				return true;
+			}
+		}
+
+		if (!m_idle)
+		{
+			m_idle = true;
+			m_idle_traced = Trace(TraceEventType::IdleBegin);
 		}
 
 		//Increase the count for yield of this worker
@@ -360,13 +1092,49 @@ namespace job
 		return false;
 	}
 
+	inline void Worker::ExecuteJob(const Job& job)
+	{
+		Trace(TraceEventType::JobBegin, reinterpret_cast<uint64_t>(job.function));
+
+		//Execute
+		job.function(job.data);
+
+		Trace(TraceEventType::JobEnd);
+
+		//Decrement the fence
+		m_system->DecrementFence(*job.fence);
+	}
+
+	inline bool Worker::Trace(TraceEventType type, uint64_t data)
+	{
+		if (m_system->m_trace_running.load(std::memory_order_relaxed))
+		{
+			m_trace_recorder.Record(type, data);
+			return true;
+		}
+		return false;
+	}
+
+	inline void Worker::EndIdle()
+	{
+		if (m_idle)
+		{
+			m_idle = false;
+			if (m_idle_traced)
+			{
+				m_idle_traced = false;
+				Trace(TraceEventType::IdleEnd);
+			}
+		}
+	}
+
 	//Code running in the worker thread
 
 	inline void Worker::ThreadRun()
 	{
 		//Set name to the profiler
 		char name_buffer[256];
-		sprintf_s(name_buffer, "Worker Thread %zd", m_worker_index);
+		snprintf(name_buffer, 256, "Worker Thread %zd", m_worker_index);
 		core::OnThreadCreate(name_buffer);
 
 		//Set local thread storage for fast access
@@ -379,11 +1147,7 @@ namespace job
 
 			if (GetJob(job))
 			{
-				//Execute
-				job.function(job.data);
-
-				//Decrement the fence
-				m_system->DecrementFence(*job.fence);
+				ExecuteJob(job);
 			}
 
 		}
@@ -6,6 +6,7 @@
 
 #include <atomic>
 #include <thread>
+#include <new>
 
 namespace job
 {
@@ -27,6 +28,8 @@ namespace job
 		size_t num_workers = static_cast<size_t>(-1);
 		size_t count_for_yield = 128;
 		size_t extra_workers = 0;
+		//Number of trace events kept in the ring buffer of each worker, 0 disables the trace recorder
+		size_t trace_events_per_worker = 0;
 	};
 
 	System* CreateSystem(const SystemDesc& system_desc);
@@ -38,6 +41,38 @@ namespace job
 	void SetSingleThreadMode(System* system, bool single_thread_mode);
 	bool GetSingleThreadMode(System* system);
 
+	//Trace recorder, captures job begin/end, steal, wait and idle events for each worker
+	//Only available if the system was created with trace_events_per_worker
+	void StartTrace(System* system);
+	void StopTrace(System* system);
+	bool IsTraceRunning(System* system);
+
+	//Dump the recorded events in chrome trace json format (chrome://tracing)
+	//Needs to be called from the main thread when the workers are not running jobs
+	bool DumpTrace(System* system, const char* filename);
+
+	//Schedule mode
+	//Record logs which worker runs each job and in which order
+	//Replay forces the recorded schedule, jobs are identified by the order they are added,
+	//so the game needs to add the jobs in the same order (usually from the main thread)
+	enum class ScheduleMode
+	{
+		Normal,
+		Record,
+		Replay
+	};
+
+	//The schedule mode can be changed at any time, it waits until no worker is reading the schedule state
+	//Switching during a frame breaks the replay of that frame, so it is better to do it between frames
+	//If the jobs added during a replay don't match the recording and a wait stops making progress,
+	//the replay is abandoned and the jobs are scheduled normally
+	void SetScheduleMode(System* system, ScheduleMode schedule_mode);
+	ScheduleMode GetScheduleMode(System* system);
+
+	//Save/Load the recorded schedule, so it can be replayed in another run
+	bool SaveSchedule(System* system, const char* filename);
+	bool LoadSchedule(System* system, const char* filename);
+
 	//Register extra worker
 	void RegisterExtraWorker(System* system, size_t extra_worker_index);
 
@@ -61,7 +96,7 @@ namespace job
 	void AddLambdaJob(System* system, const FUNCTION& job, JOB_ALLOCATOR& job_allocator, Fence& fence)
 	{
 		//Capture function in the job allocator
-		FUNCTION* captured_function = new (job_allocator->Alloc<FUNCTION>()) FUNCTION(job);
+		FUNCTION* captured_function = new (job_allocator->template Alloc<FUNCTION>()) FUNCTION(job);
 		//Create a job with a specialized function that knows how to run that lambda
 		AddJob(system, Helper<FUNCTION>::Job, captured_function, fence);
 	}
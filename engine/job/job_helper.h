@@ -6,7 +6,10 @@
 
 #include <vector>
 #include <thread>
+#include <new>
+#include <type_traits>
 #include <core/virtual_buffer.h>
+#include <job/job.h>
 
 namespace job
 {
@@ -122,8 +125,44 @@ namespace job
 		}
 	};
 
+	//Run num_jobs calls of function(job_index) in the job system and wait for all of them
+	//Runs inline if there is not job system or only one job
+	template<typename FUNCTION>
+	void RunJobs(System* job_system, const uint32_t num_jobs, FUNCTION&& function)
+	{
+		if (job_system == nullptr || num_jobs <= 1)
+		{
+			for (uint32_t i = 0; i < num_jobs; ++i)
+			{
+				function(i);
+			}
+			return;
+		}
+
+		//FUNCTION is a reference type when the caller passes an lvalue
+		using FunctionType = std::remove_reference_t<FUNCTION>;
+		struct JobData
+		{
+			FunctionType* function;
+			uint32_t job_index;
 
+			static void Job(void* data)
+			{
+				JobData* job_data = reinterpret_cast<JobData*>(data);
+				(*job_data->function)(job_data->job_index);
+			}
+		};
 
+		//The job data is owned by this vector, it stays alive until the fence is finished
+		std::vector<JobData> jobs_data(num_jobs);
+		Fence fence;
+		for (uint32_t i = 0; i < num_jobs; ++i)
+		{
+			jobs_data[i] = JobData{ &function, i };
+			AddJob(job_system, JobData::Job, &jobs_data[i], fence);
+		}
+		Wait(job_system, fence);
+	}
 }
 
 #endif
\ No newline at end of file
@@ -6,11 +6,13 @@
 #include <render/render_resource.h>
 #include <core/profile.h>
 #include "render_pass.h"
+#include "render_item_sort.h"
 
 #include <cassert>
 #include <stdarg.h>
 #include <utility>
 #include <numeric>
+#include <algorithm>
 
 #pragma optimize("", off)
 
@@ -52,6 +54,37 @@ namespace
 	{
 		return core::HashConst<uint32_t>(name.GetHash() ^ pass_name.GetHash() ^ pass_id, "");
 	}
+
+	//Calculate begin/end for each render priority, the items need to be sorted
+	template<typename GET_PRIORITY>
+	void BuildPriorityTable(std::vector<std::pair<size_t, size_t>>& priority_table, size_t num_priorities, size_t num_sorted_render_items, GET_PRIORITY&& get_priority)
+	{
+		priority_table.resize(num_priorities);
+		size_t render_item_index = 0;
+
+		for (size_t priority = 0; priority < num_priorities; ++priority)
+		{
+			if (render_item_index < num_sorted_render_items && get_priority(render_item_index) == priority)
+			{
+				//First item found
+				priority_table[priority].first = render_item_index;
+
+				//Look for the last one or the last 
+				while (render_item_index < num_sorted_render_items && get_priority(render_item_index) == priority)
+				{
+					render_item_index++;
+				}
+
+				//Last item found
+				priority_table[priority].second = (render_item_index - 1);
+			}
+			else
+			{
+				//We don't have any item of priority in the sort items
+				priority_table[priority].first = priority_table[priority].second = -1;
+			}
+		}
+	}
 }
 
 namespace render
@@ -807,6 +840,122 @@ namespace render
 		return render_context;
 	}
 
+	void System::SortRenderItems(PointOfView& point_of_view)
+	{
+		PROFILE_SCOPE("Render", kRenderProfileColour, "SortRenderItems");
+
+		auto& render_items = point_of_view.m_render_items;
+		auto& sorted_render_items = point_of_view.m_sorted_render_items;
+
+		//Clear sort render items
+		sorted_render_items.m_sorted_render_items.clear();
+
+		//Get number of render items
+		size_t num_render_items = 0;
+		render_items.Visit([&](auto& data)
+			{
+				num_render_items += data.size();
+			});
+
+		if (!m_job_system || !m_parallel_sort_render_items || (num_render_items < m_parallel_sort_render_item_min_count))
+		{
+			//Sort in the render job, not a lot 
+
+			//Copy render items from the point of view for each worker to the render context
+			render_items.Visit([&](auto& data)
+				{
+					sorted_render_items.m_sorted_render_items.insert(sorted_render_items.m_sorted_render_items.end(), data.begin(), data.end());
+				});
+
+			//Sort render items
+			std::sort(sorted_render_items.m_sorted_render_items.begin(), sorted_render_items.m_sorted_render_items.end(),
+				[](const Item& a, const Item& b)
+				{
+					return a.full_32bit_sort_key < b.full_32bit_sort_key;
+				});
+		}
+		else
+		{
+			if (m_radix_sort_render_items)
+			{
+				RadixSortRenderItems(m_job_system, m_job_allocator, render_items, num_render_items, sorted_render_items.m_sorted_render_items, point_of_view.m_temp_render_items);
+			}
+			else
+			{
+				MergeSortRenderItems(m_job_system, m_job_allocator, render_items, num_render_items, sorted_render_items.m_sorted_render_items);
+			}
+		}
+
+		//Calculate begin/end for each render priority
+		BuildPriorityTable(sorted_render_items.m_priority_table, m_render_priorities.size(), sorted_render_items.m_sorted_render_items.size(),
+			[&](size_t index)
+			{
+				return sorted_render_items.m_sorted_render_items[index].priority;
+			});
+
+		//Apply the changes in the persistent render items
+		UpdatePersistentRenderItems(point_of_view);
+	}
+
+	void System::UpdatePersistentRenderItems(PointOfView& point_of_view)
+	{
+		if (point_of_view.m_persistent_render_items == nullptr)
+			return;
+
+		PROFILE_SCOPE("Render", kRenderProfileColour, "UpdatePersistentRenderItems");
+
+		auto& persistent_render_items = *point_of_view.m_persistent_render_items;
+		auto& sorted_render_items = persistent_render_items.m_sorted_render_items;
+
+		//Gather the deltas of all the workers in worker index order and apply them sorted by handle and push order,
+		//so the result doesn't depend on the worker that ran each job or the order the workers finished
+		auto& deltas = persistent_render_items.m_deltas;
+		deltas.clear();
+		point_of_view.m_persistent_render_item_deltas.Visit([&](auto& worker_deltas)
+			{
+				deltas.insert(deltas.end(), worker_deltas.begin(), worker_deltas.end());
+			});
+		std::sort(deltas.begin(), deltas.end(),
+			[](const PersistentRenderItemDelta& a, const PersistentRenderItemDelta& b)
+			{
+				return (a.handle_index != b.handle_index) ? (a.handle_index < b.handle_index) : (a.sequence < b.sequence);
+			});
+
+		//The commands are compiled as the point of view command buffer is reset each frame
+		const bool changed = ApplyPersistentRenderItemDeltas(persistent_render_items, deltas, point_of_view.m_name.GetValue(), persistent_render_items.m_num_removed_commands,
+			[&](Item& item)
+			{
+				auto& source_command_buffer = point_of_view.m_command_buffer.AccessThreadData(item.command_worker);
+				item.command_offset = persistent_render_items.m_command_buffer.Compile(source_command_buffer, item.command_offset);
+				item.command_worker = PersistentRenderItems::kCommandWorker;
+			});
+
+		const bool priority_table_valid = persistent_render_items.m_priority_table.size() == m_render_priorities.size();
+		if (!changed && priority_table_valid)
+			return;
+
+		//Compact the command buffer when most of the commands are not used anymore
+		constexpr size_t kMinRemovedCommandsForCompaction = 1024;
+		if (persistent_render_items.m_num_removed_commands > std::max(kMinRemovedCommandsForCompaction, sorted_render_items.size()))
+		{
+			PROFILE_SCOPE("Render", kRenderProfileColour, "CompactPersistentCommandBuffer");
+
+			CompiledCommandBuffer command_buffer;
+			for (auto& sorted_render_item : sorted_render_items)
+			{
+				sorted_render_item.item.command_offset = command_buffer.CopyCommands(persistent_render_items.m_command_buffer, sorted_render_item.item.command_offset);
+			}
+			persistent_render_items.m_command_buffer = std::move(command_buffer);
+			persistent_render_items.m_num_removed_commands = 0;
+		}
+
+		BuildPriorityTable(persistent_render_items.m_priority_table, m_render_priorities.size(), sorted_render_items.size(),
+			[&](size_t index)
+			{
+				return sorted_render_items[index].item.priority;
+			});
+	}
+
 	void System::SubmitRender()
 	{
 		PROFILE_SCOPE("Render", kRenderProfileColour, "Submit");
@@ -851,147 +1000,51 @@ namespace render
 			command_list_to_execute.push_back(m_render_command_list);
 		}
 
-		//Sort all render items for each point of view, it can run in parallel
-		for (auto& point_of_view : render_frame.m_point_of_views)
+		//Release the persistent render items of the point of views that removed all their items, nothing from the previous frame uses them
+		for (auto it = m_persistent_render_items.begin(); it != m_persistent_render_items.end();)
 		{
-			PROFILE_SCOPE("Render", kRenderProfileColour, "SortRenderItems");
-
-			auto& render_items = point_of_view.m_render_items;
-			auto& sorted_render_items = point_of_view.m_sorted_render_items;
-
-			//Clear sort render items
-			sorted_render_items.m_sorted_render_items.clear();
-
-			//Get number of render items
-			size_t num_render_items = 0;
-			render_items.Visit([&](auto& data)
-				{
-					num_render_items += data.size();
-				});
-
-			if (!m_job_system || !m_parallel_sort_render_items || (num_render_items < m_parallel_sort_render_item_min_count))
+			if (it->second->m_sorted_render_items.empty())
 			{
-				//Sort in the render job, not a lot 
-
-				//Copy render items from the point of view for each worker to the render context
-				render_items.Visit([&](auto& data)
-					{
-						sorted_render_items.m_sorted_render_items.insert(sorted_render_items.m_sorted_render_items.end(), data.begin(), data.end());
-					});
-
-				//Sort render items
-				std::sort(sorted_render_items.m_sorted_render_items.begin(), sorted_render_items.m_sorted_render_items.end(),
-					[](const Item& a, const Item& b)
-					{
-						return a.full_32bit_sort_key < b.full_32bit_sort_key;
-					});
+				it = m_persistent_render_items.erase(it);
 			}
 			else
 			{
-				job::Fence sorting_fence;
-				//Sort each thread data array in a task and merge sort the result
-				render_items.Visit([&](auto& data)
-					{
-						job::AddLambdaJob(m_job_system, [&data]()
-							{
-								PROFILE_SCOPE("Render", kRenderProfileColour, "SortRenderItemsJob");
-								std::sort(data.begin(), data.end(),
-									[](const Item& a, const Item& b)
-									{
-										return a.full_32bit_sort_key < b.full_32bit_sort_key;
-									});
-							}, m_job_allocator, sorting_fence);
-					});
-
-				//Merge sort the result
-				sorted_render_items.m_sorted_render_items.resize(num_render_items);
-
-				job::Wait(m_job_system, sorting_fence);
+				++it;
+			}
+		}
 
-				struct SourceData
-				{
-					std::vector<render::Item>& data;
-					size_t next_index;
-					size_t size;
-					SourceData(std::vector<render::Item>& _data) : data(_data)
-					{
-						next_index = 0;
-						size = data.size();
-					}
-				};
-					
-				//Indicate the next position to merge for each sorted source data
-				std::vector<SourceData> sorted_source_data;
-				sorted_source_data.reserve(8);
-				render_items.Visit([&](auto& data)
+		//Sort all render items for each point of view, each point of view is sorted in its own job
+		//Passes associated to a point of view only wait for the sort of its point of view
+		for (auto& point_of_view : render_frame.m_point_of_views)
+		{
+			//Associate the persistent render items, they are only created if the point of view has pushed any of them
+			const uint64_t persistent_key = (static_cast<uint64_t>(point_of_view.m_name.GetHash()) << 32) | point_of_view.m_id;
+			auto persistent_it = m_persistent_render_items.find(persistent_key);
+			if (persistent_it == m_persistent_render_items.end())
+			{
+				bool has_persistent_deltas = false;
+				point_of_view.m_persistent_render_item_deltas.Visit([&](auto& data)
 					{
-						sorted_source_data.emplace_back(data);
+						has_persistent_deltas |= !data.empty();
 					});
 
-				const size_t num_sorted_source_data = sorted_source_data.size();
-				bool all_empty = false;
-				size_t sorted_render_items_index = 0;
+				if (has_persistent_deltas)
 				{
-					PROFILE_SCOPE("Render", kRenderProfileColour, "MergedSortRenderItems");
-					while (!all_empty)
-					{
-						render::Item next_render_item(0xFF, 0xFFFFFF, 0); //Worst case
-						size_t next_item_sorted_data_index = static_cast<size_t>(-1);
-						for (size_t i = 0; i < num_sorted_source_data; ++i)
-						{
-							auto& sorted_source = sorted_source_data[i];
-							if (sorted_source.next_index < sorted_source.size)
-							{
-								if (sorted_source.data[sorted_source.next_index].full_32bit_sort_key < next_render_item.full_32bit_sort_key)
-								{
-									next_item_sorted_data_index = i;
-									next_render_item = sorted_source.data[sorted_source.next_index];
-								}
-							}
-						}
-
-						if (next_item_sorted_data_index != static_cast<size_t>(-1))
-						{
-							//Found, add into the dest buffer
-							sorted_render_items.m_sorted_render_items[sorted_render_items_index++] = next_render_item;
-							//Increase the index for that sorted data
-							sorted_source_data[next_item_sorted_data_index].next_index++;
-						}
-						else
-						{
-							//Done, if we didn't found any, means that all is done
-							all_empty = true;
-						}
-					}
+					persistent_it = m_persistent_render_items.emplace(persistent_key, std::make_unique<PersistentRenderItems>()).first;
 				}
 			}
+			point_of_view.m_persistent_render_items = (persistent_it != m_persistent_render_items.end()) ? persistent_it->second.get() : nullptr;
 
-			//Calculate begin/end for each render priority	
-			sorted_render_items.m_priority_table.resize(m_render_priorities.size());
-			size_t render_item_index = 0;
-			const size_t num_sorted_render_items = sorted_render_items.m_sorted_render_items.size();
-
-			for (size_t priority = 0; priority < m_render_priorities.size(); ++priority)
+			if (m_job_system && m_parallel_sort_point_of_views)
 			{
-				if (num_sorted_render_items > 0 && sorted_render_items.m_sorted_render_items[render_item_index].priority == priority)
-				{
-					//First item found
-					sorted_render_items.m_priority_table[priority].first = render_item_index;
-
-					//Look for the last one or the last 
-					while (render_item_index < num_sorted_render_items && sorted_render_items.m_sorted_render_items[render_item_index].priority == priority)
+				job::AddLambdaJob(m_job_system, [this, &point_of_view]()
 					{
-						render_item_index++;
-					}
-
-					//Last item found
-					sorted_render_items.m_priority_table[priority].second = (render_item_index - 1);
-				}
-				else
-				{
-					//We don't have any item of priority in the sort items
-					sorted_render_items.m_priority_table[priority].first = sorted_render_items.m_priority_table[priority].second = -1;
-				}
+						SortRenderItems(point_of_view);
+					}, m_job_allocator, point_of_view.m_sorted_render_items_fence);
+			}
+			else
+			{
+				SortRenderItems(point_of_view);
 			}
 		}
 
@@ -1137,6 +1190,12 @@ namespace render
 						if (point_of_view.m_name == render_pass.associated_point_of_view_name &&
 							point_of_view.m_id == render_pass.associated_point_of_view_id)
 						{
+							//The render items of the point of view needs to be sorted
+							if (m_job_system)
+							{
+								job::Wait(m_job_system, point_of_view.m_sorted_render_items_fence);
+							}
+
 							//Set point to view to the context
 							render_context->m_point_of_view = &point_of_view;
 							break;
@@ -1273,6 +1332,15 @@ namespace render
 
 		display::EndFrame(m_device);
 
+		//Points of view without passes could be still sorting
+		if (m_job_system)
+		{
+			for (auto& point_of_view : render_frame.m_point_of_views)
+			{
+				job::Wait(m_job_system, point_of_view.m_sorted_render_items_fence);
+			}
+		}
+
 		render_frame.Reset();
 
 		UpdatePoolResources();
@@ -1359,6 +1427,32 @@ namespace render
 		return system->m_frame_data[system->m_game_frame_index % 2];
 	}
 
+	PersistentRenderItemHandle AllocPersistentRenderItemHandle(System* system)
+	{
+		core::MutexGuard guard(system->m_persistent_render_item_handles_mutex);
+
+		PersistentRenderItemHandle handle;
+		if (system->m_free_persistent_render_item_handles.empty())
+		{
+			handle.index = system->m_num_persistent_render_item_handles++;
+		}
+		else
+		{
+			handle.index = system->m_free_persistent_render_item_handles.back();
+			system->m_free_persistent_render_item_handles.pop_back();
+		}
+		return handle;
+	}
+
+	void FreePersistentRenderItemHandle(System* system, PersistentRenderItemHandle& handle)
+	{
+		assert(handle.IsValid());
+		core::MutexGuard guard(system->m_persistent_render_item_handles_mutex);
+
+		system->m_free_persistent_render_item_handles.push_back(handle.index);
+		handle.index = PersistentRenderItemHandle::kInvalid;
+	}
+
 	Priority GetRenderItemPriority(System * system, const PriorityName priority_name)
 	{
 		const size_t priorities_size = system->m_render_priorities.size();
@@ -1395,10 +1489,17 @@ namespace render
 			ImGui::Separator();
 			ImGui::Checkbox("Parallel sort render items", &system->m_parallel_sort_render_items);
 			ImGui::DragScalar("Parallel sort render items min count", ImGuiDataType_U32, &system->m_parallel_sort_render_item_min_count, 1.f);
+			ImGui::Checkbox("Radix sort render items", &system->m_radix_sort_render_items);
+			ImGui::Checkbox("Parallel sort point of views", &system->m_parallel_sort_point_of_views);
 			ImGui::Separator();
 			for (auto& point_of_view : points_of_view)
 			{
 				ImGui::Text("Point of View (%s): Num of render items (%zu)", point_of_view.m_name.GetValue(), point_of_view.GetSortedRenderItems().m_sorted_render_items.size());
+				if (point_of_view.m_persistent_render_items)
+				{
+					ImGui::Text("   Num of persistent render items (%zu), compiled commands (%zu), removed commands (%zu)", point_of_view.m_persistent_render_items->m_sorted_render_items.size(),
+						point_of_view.m_persistent_render_items->m_command_buffer.GetNumCommands(), point_of_view.m_persistent_render_items->m_num_removed_commands);
+				}
 			}
 			ImGui::Separator();
 			for (const auto& module : system->m_modules)
@@ -1,4 +1,17 @@
 #include <render/render_command_buffer.h>
+#include <core/counters.h>
+#include <core/control_variables.h>
+
+namespace
+{
+	template<class... Ts> struct overloaded : Ts... { using Ts::operator()...; };
+	template<class... Ts> overloaded(Ts...) -> overloaded<Ts...>;
+}
+
+CONTROL_VARIABLE_BOOL_RENDER(c_filter_redundant_binds, true, "Render", "Filter redundant binds");
+
+COUNTER_RENDER(c_Binds_Issued, "Render", "Binds issued", true);
+COUNTER_RENDER(c_Binds_Skipped, "Render", "Redundant binds skipped", true);
 
 namespace render
 {
@@ -19,6 +32,108 @@ namespace render
 		Custom
 	};
 
+	void StateCache::Invalidate()
+	{
+		m_pipeline_state = display::WeakPipelineStateHandle();
+		InvalidateResourceBinds();
+	}
+
+	void StateCache::InvalidateResourceBinds()
+	{
+		m_index_buffer = display::WeakBufferHandle();
+		for (auto& pipe_root_parameters : m_root_parameters)
+		{
+			for (auto& root_parameter : pipe_root_parameters)
+			{
+				root_parameter.type = RootParameter::Type::None;
+			}
+		}
+	}
+
+	bool StateCache::Issue(bool redundant)
+	{
+		if (redundant && c_filter_redundant_binds)
+		{
+			m_num_skipped_binds++;
+			return false;
+		}
+		else
+		{
+			m_num_issued_binds++;
+			return true;
+		}
+	}
+
+	bool StateCache::SetPipelineState(const display::WeakPipelineStateHandle& pipeline_state)
+	{
+		if (!Issue(m_pipeline_state.IsValid() && m_pipeline_state == pipeline_state))
+			return false;
+
+		//The root signature can change with the pipeline state, the root parameters are not valid anymore
+		m_pipeline_state = pipeline_state;
+		InvalidateResourceBinds();
+		return true;
+	}
+
+	bool StateCache::SetIndexBuffer(const display::WeakBufferHandle& index_buffer)
+	{
+		if (!Issue(m_index_buffer.IsValid() && m_index_buffer == index_buffer))
+			return false;
+
+		m_index_buffer = index_buffer;
+		return true;
+	}
+
+	bool StateCache::SetConstantBuffer(const display::Pipe& pipe, uint8_t root_parameter_index, const display::WeakBufferHandle& constant_buffer)
+	{
+		if (root_parameter_index >= kMaxRootParameters)
+			return Issue(false);
+
+		auto& root_parameter = m_root_parameters[static_cast<size_t>(pipe)][root_parameter_index];
+		if (!Issue(root_parameter.type == RootParameter::Type::ConstantBuffer && root_parameter.constant_buffer == constant_buffer))
+			return false;
+
+		root_parameter.type = RootParameter::Type::ConstantBuffer;
+		root_parameter.constant_buffer = constant_buffer;
+		return true;
+	}
+
+	bool StateCache::SetDescriptorTable(const display::Pipe& pipe, uint8_t root_parameter_index, const display::WeakDescriptorTableHandle& descriptor_table)
+	{
+		if (root_parameter_index >= kMaxRootParameters)
+			return Issue(false);
+
+		auto& root_parameter = m_root_parameters[static_cast<size_t>(pipe)][root_parameter_index];
+		if (!Issue(root_parameter.type == RootParameter::Type::DescriptorTable && root_parameter.descriptor_table == descriptor_table))
+			return false;
+
+		root_parameter.type = RootParameter::Type::DescriptorTable;
+		root_parameter.descriptor_table = descriptor_table;
+		return true;
+	}
+
+	bool StateCache::SetDescriptorTable(const display::Pipe& pipe, uint8_t root_parameter_index, const display::WeakSamplerDescriptorTableHandle& sampler_descriptor_table)
+	{
+		if (root_parameter_index >= kMaxRootParameters)
+			return Issue(false);
+
+		auto& root_parameter = m_root_parameters[static_cast<size_t>(pipe)][root_parameter_index];
+		if (!Issue(root_parameter.type == RootParameter::Type::SamplerDescriptorTable && root_parameter.sampler_descriptor_table == sampler_descriptor_table))
+			return false;
+
+		root_parameter.type = RootParameter::Type::SamplerDescriptorTable;
+		root_parameter.sampler_descriptor_table = sampler_descriptor_table;
+		return true;
+	}
+
+	void StateCache::FlushStats()
+	{
+		COUNTER_INC_VALUE(c_Binds_Issued, m_num_issued_binds);
+		COUNTER_INC_VALUE(c_Binds_Skipped, m_num_skipped_binds);
+		m_num_issued_binds = 0;
+		m_num_skipped_binds = 0;
+	}
+
 	//Starts a capture of a command buffer
 	CommandBuffer::CommandOffset CommandBuffer::Open()
 	{
@@ -41,7 +156,7 @@ namespace render
 		PushCommand(static_cast<uint8_t>(Commands::Close));
 	}
 
-	CommandBuffer::CommandOffset CommandBuffer::Execute(display::Context & context, CommandOffset command_offset)
+	CommandBuffer::CommandOffset CommandBuffer::Execute(display::Context & context, CommandOffset command_offset, StateCache* state_cache)
 	{
 		if (command_offset >= GetCurrentCommandPosition())
 		{
@@ -56,6 +171,10 @@ namespace render
 		data_offset |= GetCommand(offset) << 16;
 		data_offset |= GetCommand(offset) << 24;
 
+		//Without a state cache from the caller the redundant binds are only filtered inside this execution
+		StateCache local_state_cache;
+		StateCache& current_state_cache = (state_cache) ? *state_cache : local_state_cache;
+
 		//Go for all commands until the close commands and execute the correct render context calls
 		Commands command = static_cast<Commands>(GetCommand(offset));
 
@@ -64,7 +183,11 @@ namespace render
 			switch (command)
 			{
 			case Commands::SetPipelineState:
-				context.SetPipelineState(GetData<display::WeakPipelineStateHandle>(data_offset));
+			{
+				const auto& pipeline_state = GetData<display::WeakPipelineStateHandle>(data_offset);
+				if (current_state_cache.SetPipelineState(pipeline_state))
+					context.SetPipelineState(pipeline_state);
+			}
 				break;
 			case Commands::SetVertexBuffers:
 			{
@@ -79,16 +202,38 @@ namespace render
 			}
 				break;
 			case Commands::SetIndexBuffer:
-				context.SetIndexBuffer(GetData<display::WeakBufferHandle>(data_offset));
+			{
+				const auto& index_buffer = GetData<display::WeakBufferHandle>(data_offset);
+				if (current_state_cache.SetIndexBuffer(index_buffer))
+					context.SetIndexBuffer(index_buffer);
+			}
 				break;
 			case Commands::SetConstantBuffer:
-				context.SetConstantBuffer(GetData<display::Pipe>(data_offset), GetData<uint8_t>(data_offset), GetData<display::WeakBufferHandle>(data_offset));
+			{
+				const display::Pipe pipe = GetData<display::Pipe>(data_offset);
+				const uint8_t root_parameter = GetData<uint8_t>(data_offset);
+				const auto& constant_buffer = GetData<display::WeakBufferHandle>(data_offset);
+				if (current_state_cache.SetConstantBuffer(pipe, root_parameter, constant_buffer))
+					context.SetConstantBuffer(pipe, root_parameter, constant_buffer);
+			}
 				break;
 			case Commands::SetDescriptorTable:
-				context.SetDescriptorTable(GetData<display::Pipe>(data_offset), GetData<uint8_t>(data_offset), GetData<display::WeakDescriptorTableHandle>(data_offset));
+			{
+				const display::Pipe pipe = GetData<display::Pipe>(data_offset);
+				const uint8_t root_parameter = GetData<uint8_t>(data_offset);
+				const auto& descriptor_table = GetData<display::WeakDescriptorTableHandle>(data_offset);
+				if (current_state_cache.SetDescriptorTable(pipe, root_parameter, descriptor_table))
+					context.SetDescriptorTable(pipe, root_parameter, descriptor_table);
+			}
 				break;
 			case Commands::SetSamplerDescriptorTable:
-				context.SetDescriptorTable(GetData<display::Pipe>(data_offset), GetData<uint8_t>(data_offset), GetData<display::WeakSamplerDescriptorTableHandle>(data_offset));
+			{
+				const display::Pipe pipe = GetData<display::Pipe>(data_offset);
+				const uint8_t root_parameter = GetData<uint8_t>(data_offset);
+				const auto& sampler_descriptor_table = GetData<display::WeakSamplerDescriptorTableHandle>(data_offset);
+				if (current_state_cache.SetDescriptorTable(pipe, root_parameter, sampler_descriptor_table))
+					context.SetDescriptorTable(pipe, root_parameter, sampler_descriptor_table);
+			}
 				break;
 			case Commands::Draw:
 				context.Draw(GetData<display::DrawDesc>(data_offset));
@@ -101,6 +246,8 @@ namespace render
 				break;
 			case Commands::ExecuteCompute:
 				context.ExecuteCompute(GetData<display::ExecuteComputeDesc>(data_offset));
+				//Execute compute sets its own state
+				current_state_cache.Invalidate();
 				break;
 			case Commands::UploadResourceBuffer:
 			{
@@ -108,6 +255,8 @@ namespace render
 				const std::byte* buffer = GetBuffer(data_offset, size);
 				
 				display::UpdateResourceBuffer(context.GetDevice(), GetData<display::UpdatableResourceHandle>(data_offset), buffer, size);
+				//Updated resources can change location, the binds need to be issued again
+				current_state_cache.InvalidateResourceBinds();
 			}
 			break;
 			default:
@@ -120,6 +269,8 @@ namespace render
 			command = static_cast<Commands>(GetCommand(offset));
 		}
 
+		local_state_cache.FlushStats();
+
 		if (offset == GetCurrentCommandPosition())
 		{
 			return CommandOffset();
@@ -208,4 +359,202 @@ namespace render
 		return data_buffer_inside_command_buffer;
 	}
 
+
+	CommandBuffer::CommandOffset CompiledCommandBuffer::Compile(CommandBuffer& source, CommandOffset command_offset)
+	{
+		const CommandOffset compiled_offset = static_cast<uint32_t>(m_commands.size());
+
+		size_t offset = command_offset;
+
+		//Data offset is coded in the first 4 commands
+		size_t data_offset = source.GetCommand(offset);
+		data_offset |= source.GetCommand(offset) << 8;
+		data_offset |= source.GetCommand(offset) << 16;
+		data_offset |= source.GetCommand(offset) << 24;
+
+		//Go for all commands until the close command, decoding them the same way as Execute
+		Commands command = static_cast<Commands>(source.GetCommand(offset));
+
+		while (command != Commands::Close)
+		{
+			switch (command)
+			{
+			case Commands::SetPipelineState:
+				m_commands.emplace_back(SetPipelineState{ source.GetData<display::WeakPipelineStateHandle>(data_offset) });
+				break;
+			case Commands::SetVertexBuffers:
+			{
+				SetVertexBuffers set_vertex_buffers;
+				set_vertex_buffers.start_slot_index = source.GetData<uint8_t>(data_offset);
+				set_vertex_buffers.num_vertex_buffers = source.GetData<uint8_t>(data_offset);
+				set_vertex_buffers.vertex_buffers_offset = static_cast<uint32_t>(m_vertex_buffers.size());
+				for (size_t i = 0; i < set_vertex_buffers.num_vertex_buffers; ++i)
+				{
+					m_vertex_buffers.push_back(source.GetData<display::WeakBufferHandle>(data_offset));
+				}
+				m_commands.emplace_back(set_vertex_buffers);
+			}
+				break;
+			case Commands::SetIndexBuffer:
+				m_commands.emplace_back(SetIndexBuffer{ source.GetData<display::WeakBufferHandle>(data_offset) });
+				break;
+			case Commands::SetConstantBuffer:
+			{
+				SetConstantBuffer set_constant_buffer;
+				set_constant_buffer.pipe = source.GetData<display::Pipe>(data_offset);
+				set_constant_buffer.root_parameter = source.GetData<uint8_t>(data_offset);
+				set_constant_buffer.constant_buffer = source.GetData<display::WeakBufferHandle>(data_offset);
+				m_commands.emplace_back(set_constant_buffer);
+			}
+				break;
+			case Commands::SetDescriptorTable:
+			{
+				SetDescriptorTable set_descriptor_table;
+				set_descriptor_table.pipe = source.GetData<display::Pipe>(data_offset);
+				set_descriptor_table.root_parameter = source.GetData<uint8_t>(data_offset);
+				set_descriptor_table.descriptor_table = source.GetData<display::WeakDescriptorTableHandle>(data_offset);
+				m_commands.emplace_back(set_descriptor_table);
+			}
+				break;
+			case Commands::SetSamplerDescriptorTable:
+			{
+				SetSamplerDescriptorTable set_sampler_descriptor_table;
+				set_sampler_descriptor_table.pipe = source.GetData<display::Pipe>(data_offset);
+				set_sampler_descriptor_table.root_parameter = source.GetData<uint8_t>(data_offset);
+				set_sampler_descriptor_table.sampler_descriptor_table = source.GetData<display::WeakSamplerDescriptorTableHandle>(data_offset);
+				m_commands.emplace_back(set_sampler_descriptor_table);
+			}
+				break;
+			case Commands::Draw:
+				m_commands.emplace_back(source.GetData<display::DrawDesc>(data_offset));
+				break;
+			case Commands::DrawIndexed:
+				m_commands.emplace_back(source.GetData<display::DrawIndexedDesc>(data_offset));
+				break;
+			case Commands::DrawIndexedInstanced:
+				m_commands.emplace_back(source.GetData<display::DrawIndexedInstancedDesc>(data_offset));
+				break;
+			case Commands::ExecuteCompute:
+				m_commands.emplace_back(source.GetData<display::ExecuteComputeDesc>(data_offset));
+				break;
+			case Commands::UploadResourceBuffer:
+			{
+				UploadResourceBuffer upload_resource_buffer;
+				const size_t size = source.GetData<size_t>(data_offset);
+				const std::byte* buffer = source.GetBuffer(data_offset, size);
+				upload_resource_buffer.data_offset = static_cast<uint32_t>(m_upload_data.size());
+				upload_resource_buffer.size = static_cast<uint32_t>(size);
+				m_upload_data.insert(m_upload_data.end(), buffer, buffer + size);
+				upload_resource_buffer.handle = source.GetData<display::UpdatableResourceHandle>(data_offset);
+				m_commands.emplace_back(upload_resource_buffer);
+			}
+			break;
+			default:
+				//Command non know
+				throw std::runtime_error("Command in the command buffer is not known");
+				break;
+			}
+
+			//Next command
+			command = static_cast<Commands>(source.GetCommand(offset));
+		}
+
+		m_commands.emplace_back(Close());
+
+		return compiled_offset;
+	}
+
+	CommandBuffer::CommandOffset CompiledCommandBuffer::CopyCommands(const CompiledCommandBuffer& source, CommandOffset command_offset)
+	{
+		const CommandOffset compiled_offset = static_cast<uint32_t>(m_commands.size());
+
+		for (size_t offset = command_offset; !std::holds_alternative<Close>(source.m_commands[offset]); ++offset)
+		{
+			Command command = source.m_commands[offset];
+
+			//Vertex buffers and upload data are stored outside of the command
+			if (auto set_vertex_buffers = std::get_if<SetVertexBuffers>(&command))
+			{
+				auto begin = source.m_vertex_buffers.begin() + set_vertex_buffers->vertex_buffers_offset;
+				set_vertex_buffers->vertex_buffers_offset = static_cast<uint32_t>(m_vertex_buffers.size());
+				m_vertex_buffers.insert(m_vertex_buffers.end(), begin, begin + set_vertex_buffers->num_vertex_buffers);
+			}
+			else if (auto upload_resource_buffer = std::get_if<UploadResourceBuffer>(&command))
+			{
+				auto begin = source.m_upload_data.begin() + upload_resource_buffer->data_offset;
+				upload_resource_buffer->data_offset = static_cast<uint32_t>(m_upload_data.size());
+				m_upload_data.insert(m_upload_data.end(), begin, begin + upload_resource_buffer->size);
+			}
+
+			m_commands.push_back(command);
+		}
+
+		m_commands.emplace_back(Close());
+
+		return compiled_offset;
+	}
+
+	void CompiledCommandBuffer::Execute(display::Context& context, CommandOffset command_offset, StateCache* state_cache) const
+	{
+		//Without a state cache from the caller the redundant binds are only filtered inside this execution
+		StateCache local_state_cache;
+		StateCache& current_state_cache = (state_cache) ? *state_cache : local_state_cache;
+
+		for (size_t offset = command_offset; !std::holds_alternative<Close>(m_commands[offset]); ++offset)
+		{
+			std::visit(
+				overloaded
+				{
+					[&](const Close&) {},
+					[&](const SetPipelineState& command)
+					{
+						if (current_state_cache.SetPipelineState(command.pipeline_state))
+							context.SetPipelineState(command.pipeline_state);
+					},
+					[&](const SetVertexBuffers& command) { context.SetVertexBuffers(command.start_slot_index, command.num_vertex_buffers, const_cast<display::WeakBufferHandle*>(&m_vertex_buffers[command.vertex_buffers_offset])); },
+					[&](const SetIndexBuffer& command)
+					{
+						if (current_state_cache.SetIndexBuffer(command.index_buffer))
+							context.SetIndexBuffer(command.index_buffer);
+					},
+					[&](const SetConstantBuffer& command)
+					{
+						if (current_state_cache.SetConstantBuffer(command.pipe, command.root_parameter, command.constant_buffer))
+							context.SetConstantBuffer(command.pipe, command.root_parameter, command.constant_buffer);
+					},
+					[&](const SetDescriptorTable& command)
+					{
+						if (current_state_cache.SetDescriptorTable(command.pipe, command.root_parameter, command.descriptor_table))
+							context.SetDescriptorTable(command.pipe, command.root_parameter, command.descriptor_table);
+					},
+					[&](const SetSamplerDescriptorTable& command)
+					{
+						if (current_state_cache.SetDescriptorTable(command.pipe, command.root_parameter, command.sampler_descriptor_table))
+							context.SetDescriptorTable(command.pipe, command.root_parameter, command.sampler_descriptor_table);
+					},
+					[&](const display::DrawDesc& command) { context.Draw(command); },
+					[&](const display::DrawIndexedDesc& command) { context.DrawIndexed(command); },
+					[&](const display::DrawIndexedInstancedDesc& command) { context.DrawIndexedInstanced(command); },
+					[&](const display::ExecuteComputeDesc& command)
+					{
+						context.ExecuteCompute(command);
+						current_state_cache.Invalidate();
+					},
+					[&](const UploadResourceBuffer& command)
+					{
+						display::UpdateResourceBuffer(context.GetDevice(), command.handle, m_upload_data.data() + command.data_offset, command.size);
+						current_state_cache.InvalidateResourceBinds();
+					}
+				}, m_commands[offset]);
+		}
+
+		local_state_cache.FlushStats();
+	}
+
+	void CompiledCommandBuffer::Reset()
+	{
+		m_commands.clear();
+		m_vertex_buffers.clear();
+		m_upload_data.clear();
+	}
 }
\ No newline at end of file
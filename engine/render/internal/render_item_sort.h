@@ -0,0 +1,408 @@
+//////////////////////////////////////////////////////////////////////////
+// Cute engine - Sort of the render items of a point of view
+//////////////////////////////////////////////////////////////////////////
+#ifndef RENDER_ITEM_SORT_H_
+#define RENDER_ITEM_SORT_H_
+
+#include <render/render_frame.h>
+#include <core/profile.h>
+#include <core/log.h>
+#include <job/job.h>
+#include <job/job_helper.h>
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <vector>
+
+namespace render
+{
+	using RenderItemsThreadData = job::ThreadData<std::vector<render::Item>>;
+
+	//Sort each worker render items in a job and merge sort the results
+	template<typename JOB_ALLOCATOR>
+	void MergeSortRenderItems(job::System* job_system, JOB_ALLOCATOR& job_allocator, RenderItemsThreadData& render_items, size_t num_render_items, std::vector<render::Item>& sorted_render_items)
+	{
+		job::Fence sorting_fence;
+		//Sort each thread data array in a task and merge sort the result
+		render_items.Visit([&](auto& data)
+			{
+				job::AddLambdaJob(job_system, [&data]()
+					{
+						PROFILE_SCOPE("Render", render::kRenderProfileColour, "SortRenderItemsJob");
+						std::sort(data.begin(), data.end(),
+							[](const render::Item& a, const render::Item& b)
+							{
+								return a.full_32bit_sort_key < b.full_32bit_sort_key;
+							});
+					}, job_allocator, sorting_fence);
+			});
+
+		//Merge sort the result
+		sorted_render_items.resize(num_render_items);
+
+		job::Wait(job_system, sorting_fence);
+
+		struct SourceData
+		{
+			std::vector<render::Item>& data;
+			size_t next_index;
+			size_t size;
+			SourceData(std::vector<render::Item>& _data) : data(_data)
+			{
+				next_index = 0;
+				size = data.size();
+			}
+		};
+
+		//Indicate the next position to merge for each sorted source data
+		std::vector<SourceData> sorted_source_data;
+		sorted_source_data.reserve(8);
+		render_items.Visit([&](auto& data)
+			{
+				sorted_source_data.emplace_back(data);
+			});
+
+		const size_t num_sorted_source_data = sorted_source_data.size();
+		bool all_empty = false;
+		size_t sorted_render_items_index = 0;
+		{
+			PROFILE_SCOPE("Render", render::kRenderProfileColour, "MergedSortRenderItems");
+			while (!all_empty)
+			{
+				render::Item next_render_item(0xFF, 0xFFFFFF, 0); //Worst case
+				size_t next_item_sorted_data_index = static_cast<size_t>(-1);
+				for (size_t i = 0; i < num_sorted_source_data; ++i)
+				{
+					auto& sorted_source = sorted_source_data[i];
+					if (sorted_source.next_index < sorted_source.size)
+					{
+						if (sorted_source.data[sorted_source.next_index].full_32bit_sort_key < next_render_item.full_32bit_sort_key)
+						{
+							next_item_sorted_data_index = i;
+							next_render_item = sorted_source.data[sorted_source.next_index];
+						}
+					}
+				}
+
+				if (next_item_sorted_data_index != static_cast<size_t>(-1))
+				{
+					//Found, add into the dest buffer
+					sorted_render_items[sorted_render_items_index++] = next_render_item;
+					//Increase the index for that sorted data
+					sorted_source_data[next_item_sorted_data_index].next_index++;
+				}
+				else
+				{
+					//Done, if we didn't found any, means that all is done
+					all_empty = true;
+				}
+			}
+		}
+	}
+
+	//Range of render items processed by one radix sort job
+	struct RenderItemSpan
+	{
+		const render::Item* data;
+		size_t size;
+	};
+
+	constexpr size_t kRadixSortNumPasses = 4;
+	constexpr size_t kRadixSortNumBuckets = 256;
+	constexpr size_t kRadixSortMinItemsPerJob = 4096;
+	using RadixSortHistogram = std::array<uint32_t, kRadixSortNumBuckets>;
+
+	inline uint32_t GetRadixSortDigit(const render::Item& item, size_t pass)
+	{
+		return (item.full_32bit_sort_key >> (pass * 8)) & 0xFF;
+	}
+
+	//Parallel LSD radix sort of the render items using the 32bit sort key, 8 bits each pass
+	//Each pass calculates a histogram for each span in a job, builds the scatter offsets
+	//and each job scatters its span into the output, keeping the order between spans so it is stable
+	//First pass reads directly from each worker render items, so no merge is needed
+	template<typename JOB_ALLOCATOR>
+	void RadixSortRenderItems(job::System* job_system, JOB_ALLOCATOR& job_allocator, RenderItemsThreadData& render_items, size_t num_render_items, std::vector<render::Item>& sorted_render_items, std::vector<render::Item>& temp_render_items)
+	{
+		PROFILE_SCOPE("Render", render::kRenderProfileColour, "RadixSortRenderItems");
+
+		sorted_render_items.resize(num_render_items);
+		temp_render_items.resize(num_render_items);
+
+		if (num_render_items == 0)
+		{
+			return;
+		}
+
+		//Spans for the first pass, one for each worker
+		std::vector<RenderItemSpan> spans;
+		spans.reserve(job::GetNumWorkers());
+		render_items.Visit([&](auto& data)
+			{
+				if (data.size() > 0)
+				{
+					spans.push_back(RenderItemSpan{ data.data(), data.size() });
+				}
+			});
+
+		const size_t num_jobs = std::max<size_t>(1, std::min(job::GetNumWorkers(), num_render_items / kRadixSortMinItemsPerJob));
+		std::vector<RadixSortHistogram> histograms;
+
+		render::Item* output = temp_render_items.data();
+		for (size_t pass = 0; pass < kRadixSortNumPasses; ++pass)
+		{
+			const size_t num_spans = spans.size();
+			histograms.assign(num_spans, RadixSortHistogram{});
+
+			job::Fence histogram_fence;
+			for (size_t span_index = 0; span_index < num_spans; ++span_index)
+			{
+				job::AddLambdaJob(job_system, [span = spans[span_index], histogram = &histograms[span_index], pass]()
+					{
+						PROFILE_SCOPE("Render", render::kRenderProfileColour, "RadixSortHistogramJob");
+						for (size_t i = 0; i < span.size; ++i)
+						{
+							(*histogram)[GetRadixSortDigit(span.data[i], pass)]++;
+						}
+					}, job_allocator, histogram_fence);
+			}
+			job::Wait(job_system, histogram_fence);
+
+			//Convert the histograms in the scatter offset of each span
+			uint32_t offset = 0;
+			bool all_in_one_bucket = false;
+			for (size_t bucket = 0; bucket < kRadixSortNumBuckets; ++bucket)
+			{
+				uint32_t bucket_count = 0;
+				for (size_t span_index = 0; span_index < num_spans; ++span_index)
+				{
+					const uint32_t count = histograms[span_index][bucket];
+					histograms[span_index][bucket] = offset;
+					offset += count;
+					bucket_count += count;
+				}
+				all_in_one_bucket |= (bucket_count == num_render_items);
+			}
+
+			//All the items have the same digit, the pass will not change the order
+			//The first pass always needs to run, it gathers all the worker render items
+			if (all_in_one_bucket && pass > 0)
+			{
+				continue;
+			}
+
+			job::Fence scatter_fence;
+			for (size_t span_index = 0; span_index < num_spans; ++span_index)
+			{
+				job::AddLambdaJob(job_system, [span = spans[span_index], offsets = &histograms[span_index], output, pass]()
+					{
+						PROFILE_SCOPE("Render", render::kRenderProfileColour, "RadixSortScatterJob");
+						for (size_t i = 0; i < span.size; ++i)
+						{
+							const render::Item& item = span.data[i];
+							output[(*offsets)[GetRadixSortDigit(item, pass)]++] = item;
+						}
+					}, job_allocator, scatter_fence);
+			}
+			job::Wait(job_system, scatter_fence);
+
+			//Next pass reads from the output, split in spans for each job
+			spans.clear();
+			const size_t items_per_job = (num_render_items + num_jobs - 1) / num_jobs;
+			for (size_t begin = 0; begin < num_render_items; begin += items_per_job)
+			{
+				spans.push_back(RenderItemSpan{ output + begin, std::min(items_per_job, num_render_items - begin) });
+			}
+
+			output = (output == temp_render_items.data()) ? sorted_render_items.data() : temp_render_items.data();
+		}
+
+		//Last pass could have written into the temp buffer
+		if (spans[0].data == temp_render_items.data())
+		{
+			std::swap(sorted_render_items, temp_render_items);
+		}
+	}
+
+	//Persistent render item inside the sorted list of a point of view
+	struct PersistentSortedRenderItem
+	{
+		Item item;
+		uint32_t handle_index;
+
+		//Sorted by the item key, the handle index makes each item unique
+		uint64_t GetKey() const
+		{
+			return (static_cast<uint64_t>(item.full_32bit_sort_key) << 32) | handle_index;
+		}
+	};
+
+	//Persistent render items kept sorted by (sort key, handle) between frames
+	struct PersistentSortedRenderItems
+	{
+		struct HandleState
+		{
+			//Sort key of the item in the sorted list
+			uint32_t full_32bit_sort_key = 0;
+			//Index in the added items during the delta update or -1
+			uint32_t added_index = static_cast<uint32_t>(-1);
+			//Is it inside the sorted list
+			bool in_sorted_list = false;
+		};
+
+		//Sorted items
+		std::vector<PersistentSortedRenderItem> m_sorted_render_items;
+		//State for each handle index used in this point of view
+		std::vector<HandleState> m_handle_states;
+
+		//Temporal buffers used during the delta update
+		std::vector<PersistentSortedRenderItem> m_added_render_items;
+		std::vector<uint64_t> m_removed_render_items;
+	};
+
+	//Apply the deltas to the sorted persistent render items without sorting all of them again
+	//Removed items are compacted in one pass and the added items are sorted and merged with the sorted list
+	//The deltas need to be sorted by handle and sequence, compile_item is called for each added or updated item before it is merged
+	//Returns false if the sorted list didn't change, num_removed_items counts the items removed or replaced
+	template<typename COMPILE_ITEM>
+	bool ApplyPersistentRenderItemDeltas(PersistentSortedRenderItems& persistent_render_items, const std::vector<PersistentRenderItemDelta>& deltas, const char* name, size_t& num_removed_items, COMPILE_ITEM&& compile_item)
+	{
+		auto& sorted_render_items = persistent_render_items.m_sorted_render_items;
+		auto& added_render_items = persistent_render_items.m_added_render_items;
+		auto& removed_render_items = persistent_render_items.m_removed_render_items;
+		constexpr uint32_t kInvalidIndex = static_cast<uint32_t>(-1);
+
+		added_render_items.clear();
+		removed_render_items.clear();
+
+		//Collect the net changes, an item added and removed in the same frame never reaches the sorted list
+		for (auto& delta : deltas)
+		{
+			if (delta.handle_index >= persistent_render_items.m_handle_states.size())
+			{
+				persistent_render_items.m_handle_states.resize(delta.handle_index + 1);
+			}
+			auto& handle_state = persistent_render_items.m_handle_states[delta.handle_index];
+			const bool present = handle_state.in_sorted_list || handle_state.added_index != kInvalidIndex;
+
+			if (delta.type == PersistentRenderItemDelta::Type::Add && present)
+			{
+				core::LogWarning("Persistent render item <%u> added twice to <%s>, it will be updated", delta.handle_index, name);
+			}
+			else if (delta.type != PersistentRenderItemDelta::Type::Add && !present)
+			{
+				core::LogWarning("Persistent render item <%u> changed in <%s> but it was never added", delta.handle_index, name);
+			}
+
+			//Remove the previous version of the item
+			if (handle_state.added_index != kInvalidIndex)
+			{
+				added_render_items[handle_state.added_index].handle_index = kInvalidIndex;
+				handle_state.added_index = kInvalidIndex;
+				num_removed_items++;
+			}
+			else if (handle_state.in_sorted_list)
+			{
+				removed_render_items.push_back((static_cast<uint64_t>(handle_state.full_32bit_sort_key) << 32) | delta.handle_index);
+				handle_state.in_sorted_list = false;
+				num_removed_items++;
+			}
+
+			//Add the new version
+			if (delta.type != PersistentRenderItemDelta::Type::Remove)
+			{
+				Item item = delta.item;
+				compile_item(item);
+
+				handle_state.added_index = static_cast<uint32_t>(added_render_items.size());
+				added_render_items.push_back({ item, delta.handle_index });
+			}
+		}
+
+		if (removed_render_items.empty() && added_render_items.empty())
+			return false;
+
+		//Compact the sorted list, starting from the first removed item
+		if (!removed_render_items.empty())
+		{
+			std::sort(removed_render_items.begin(), removed_render_items.end());
+
+			auto write_it = std::lower_bound(sorted_render_items.begin(), sorted_render_items.end(), removed_render_items.front(),
+				[](const PersistentSortedRenderItem& a, uint64_t key)
+				{
+					return a.GetKey() < key;
+				});
+			auto removed_it = removed_render_items.begin();
+			for (auto read_it = write_it; read_it != sorted_render_items.end(); ++read_it)
+			{
+				if (removed_it != removed_render_items.end() && read_it->GetKey() == *removed_it)
+				{
+					++removed_it;
+				}
+				else
+				{
+					*write_it++ = *read_it;
+				}
+			}
+			assert(removed_it == removed_render_items.end());
+			sorted_render_items.erase(write_it, sorted_render_items.end());
+		}
+
+		//Sort the added items and merge them with the sorted list
+		if (!added_render_items.empty())
+		{
+			added_render_items.erase(std::remove_if(added_render_items.begin(), added_render_items.end(),
+				[&](const PersistentSortedRenderItem& sorted_item)
+				{
+					return sorted_item.handle_index == kInvalidIndex;
+				}), added_render_items.end());
+
+			for (auto& added_render_item : added_render_items)
+			{
+				auto& handle_state = persistent_render_items.m_handle_states[added_render_item.handle_index];
+				handle_state.full_32bit_sort_key = added_render_item.item.full_32bit_sort_key;
+				handle_state.added_index = kInvalidIndex;
+				handle_state.in_sorted_list = true;
+			}
+
+			std::sort(added_render_items.begin(), added_render_items.end(),
+				[](const PersistentSortedRenderItem& a, const PersistentSortedRenderItem& b)
+				{
+					return a.GetKey() < b.GetKey();
+				});
+
+			const size_t num_sorted_render_items = sorted_render_items.size();
+			sorted_render_items.insert(sorted_render_items.end(), added_render_items.begin(), added_render_items.end());
+			std::inplace_merge(sorted_render_items.begin(), sorted_render_items.begin() + num_sorted_render_items, sorted_render_items.end(),
+				[](const PersistentSortedRenderItem& a, const PersistentSortedRenderItem& b)
+				{
+					return a.GetKey() < b.GetKey();
+				});
+		}
+
+		return true;
+	}
+
+	//Visit the frame render items and the persistent render items of a range merged by sort key
+	//With the same sort key the frame render items go first
+	template<typename VISIT_RENDER_ITEM, typename VISIT_PERSISTENT_RENDER_ITEM>
+	void VisitMergedRenderItems(const std::vector<Item>& render_items, size_t render_item_index, size_t end_render_item,
+		const std::vector<PersistentSortedRenderItem>& persistent_render_items, size_t persistent_render_item_index, size_t end_persistent_render_item,
+		VISIT_RENDER_ITEM&& visit_render_item, VISIT_PERSISTENT_RENDER_ITEM&& visit_persistent_render_item)
+	{
+		while (render_item_index < end_render_item || persistent_render_item_index < end_persistent_render_item)
+		{
+			if (persistent_render_item_index == end_persistent_render_item ||
+				(render_item_index < end_render_item && render_items[render_item_index].full_32bit_sort_key <= persistent_render_items[persistent_render_item_index].item.full_32bit_sort_key))
+			{
+				visit_render_item(render_items[render_item_index++]);
+			}
+			else
+			{
+				visit_persistent_render_item(persistent_render_items[persistent_render_item_index++].item);
+			}
+		}
+	}
+}
+
+#endif //RENDER_ITEM_SORT_H_
@@ -750,22 +750,41 @@ namespace render
 		assert(render_context_internal.m_point_of_view);
 
 		auto& context = render_context_internal.m_display_context;
-		auto& render_items = render_context_internal.m_point_of_view->m_sorted_render_items;
-		const size_t begin_render_item = render_context_internal.m_point_of_view->m_sorted_render_items.m_priority_table[m_priority].first;
-		const size_t end_render_item = render_context_internal.m_point_of_view->m_sorted_render_items.m_priority_table[m_priority].second;
-		if (begin_render_item != -1)
+		auto& point_of_view = *render_context_internal.m_point_of_view;
+		auto& render_items = point_of_view.m_sorted_render_items;
+		size_t render_item_index = render_items.m_priority_table[m_priority].first;
+		const size_t end_render_item = (render_item_index != -1) ? render_items.m_priority_table[m_priority].second + 1 : 0;
+		if (render_item_index == -1) render_item_index = 0;
+
+		//Persistent render items are merged with the frame render items by sort key
+		size_t persistent_render_item_index = 0;
+		size_t end_persistent_render_item = 0;
+		if (point_of_view.m_persistent_render_items && point_of_view.m_persistent_render_items->m_priority_table[m_priority].first != -1)
 		{
-			//It has something to render
-			for (size_t render_item_index = begin_render_item; render_item_index <= end_render_item; ++render_item_index)
-			{
-				auto& render_item = render_items.m_sorted_render_items[render_item_index];
+			persistent_render_item_index = point_of_view.m_persistent_render_items->m_priority_table[m_priority].first;
+			end_persistent_render_item = point_of_view.m_persistent_render_items->m_priority_table[m_priority].second + 1;
+		}
+
+		//State is tracked between render items, so binds shared with the previous item are skipped
+		StateCache state_cache;
 
-				auto& command_buffer = render_context_internal.m_point_of_view->m_command_buffer.AccessThreadData(render_item.command_worker);
+		//It has something to render
+		static const std::vector<PersistentSortedRenderItem> kEmptyPersistentRenderItems;
+		VisitMergedRenderItems(render_items.m_sorted_render_items, render_item_index, end_render_item,
+			point_of_view.m_persistent_render_items ? point_of_view.m_persistent_render_items->m_sorted_render_items : kEmptyPersistentRenderItems, persistent_render_item_index, end_persistent_render_item,
+			[&](const Item& render_item)
+			{
+				auto& command_buffer = point_of_view.m_command_buffer.AccessThreadData(render_item.command_worker);
 
 				//Execute commands for this render item
-				command_buffer.Execute(*context, render_item.command_offset);
-			}
-		}
+				command_buffer.Execute(*context, render_item.command_offset, &state_cache);
+			},
+			[&](const Item& render_item)
+			{
+				//Execute commands for this persistent render item
+				point_of_view.m_persistent_render_items->m_command_buffer.Execute(*context, render_item.command_offset, &state_cache);
+			});
 
+		state_cache.FlushStats();
 	}
 }
\ No newline at end of file
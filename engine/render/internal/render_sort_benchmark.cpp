@@ -0,0 +1,255 @@
+//////////////////////////////////////////////////////////////////////////
+// Cute engine - Benchmark of the sort of the render items
+//////////////////////////////////////////////////////////////////////////
+
+#include <benchmark/benchmark.h>
+#include <core/log.h>
+#include <memory>
+#include "render_item_sort.h"
+
+namespace
+{
+	bool IsSorted(const std::vector<render::Item>& render_items)
+	{
+		return std::is_sorted(render_items.begin(), render_items.end(), [](const render::Item& a, const render::Item& b)
+			{
+				return a.full_32bit_sort_key < b.full_32bit_sort_key;
+			});
+	}
+
+	uint32_t NextRandom(uint32_t& random)
+	{
+		random ^= random << 13;
+		random ^= random >> 17;
+		random ^= random << 5;
+		return random;
+	}
+}
+
+namespace benchmark
+{
+	//Compare the merge sort and the radix sort of the render items with random render items
+	void BenchmarkSortRenderItems(const Context& context)
+	{
+		const uint32_t num_iterations = context.quick ? 1 : 8;
+
+		auto job_allocator = std::make_unique<job::JobAllocator<1024 * 1024>>();
+		render::RenderItemsThreadData source_render_items;
+		render::RenderItemsThreadData render_items;
+		std::vector<render::Item> sorted_render_items;
+		std::vector<render::Item> temp_render_items;
+
+		const size_t num_workers = job::GetNumWorkers();
+
+		for (const size_t num_render_items : { 10000, 100000, 1000000 })
+		{
+			if (context.quick && num_render_items > 10000) continue;
+
+			//Distribute random render items between the workers
+			uint32_t random = 0x9E3779B9;
+			for (size_t worker_index = 0; worker_index < num_workers; ++worker_index)
+			{
+				auto& data = source_render_items.AccessThreadData(worker_index);
+				data.clear();
+
+				const size_t num_worker_render_items = num_render_items / num_workers + ((worker_index < (num_render_items % num_workers)) ? 1 : 0);
+				for (size_t i = 0; i < num_worker_render_items; ++i)
+				{
+					random ^= random << 13;
+					random ^= random >> 17;
+					random ^= random << 5;
+					data.emplace_back(static_cast<render::Priority>(random % 8), (random >> 8) & 0xFFFFFF, static_cast<uint32_t>(i));
+				}
+			}
+
+			//Merge sort works in place, so the source needs to be copied each iteration
+			const double merge_sort_time = Measure(num_iterations, [&]()
+				{
+					for (size_t worker_index = 0; worker_index < num_workers; ++worker_index)
+					{
+						render_items.AccessThreadData(worker_index) = source_render_items.AccessThreadData(worker_index);
+					}
+
+					job_allocator->Clear();
+					render::MergeSortRenderItems(context.job_system, job_allocator, render_items, num_render_items, sorted_render_items);
+				});
+			if (sorted_render_items.size() != num_render_items || !IsSorted(sorted_render_items))
+			{
+				core::LogError("Merge sort of <%zu> render items is not sorted", num_render_items);
+			}
+
+			const double radix_sort_time = Measure(num_iterations, [&]()
+				{
+					job_allocator->Clear();
+					render::RadixSortRenderItems(context.job_system, job_allocator, source_render_items, num_render_items, sorted_render_items, temp_render_items);
+				});
+			//Radix sort is stable, it needs to match a stable sort of the worker render items in worker order
+			std::vector<render::Item> expected_render_items;
+			source_render_items.Visit([&](auto& data)
+				{
+					expected_render_items.insert(expected_render_items.end(), data.begin(), data.end());
+				});
+			std::stable_sort(expected_render_items.begin(), expected_render_items.end(), [](const render::Item& a, const render::Item& b)
+				{
+					return a.full_32bit_sort_key < b.full_32bit_sort_key;
+				});
+			if (sorted_render_items.size() != num_render_items || !std::equal(sorted_render_items.begin(), sorted_render_items.end(), expected_render_items.begin(),
+				[](const render::Item& a, const render::Item& b)
+				{
+					return a.full_32bit_sort_key == b.full_32bit_sort_key && a.data == b.data;
+				}))
+			{
+				core::LogError("Radix sort of <%zu> render items doesn't match the stable sort", num_render_items);
+			}
+
+			core::LogInfo("Sort render items benchmark <%zu> items: merge sort %.3fms (including the copy), radix sort %.3fms", num_render_items, merge_sort_time / 1000.0, radix_sort_time / 1000.0);
+		}
+	}
+
+	//Apply random deltas to the persistent render items each frame, as the game would do with static objects
+	//The result needs to match a full sort of the live items, and the merge with the frame render items a full sort of both
+	void BenchmarkPersistentRenderItems(const Context& context)
+	{
+		const uint32_t num_frames = context.quick ? 4 : 16;
+		std::vector<render::PersistentRenderItemDelta> deltas;
+		std::vector<render::PersistentSortedRenderItem> expected_render_items;
+
+		for (const size_t num_render_items : { 10000, 100000, 1000000 })
+		{
+			if (context.quick && num_render_items > 10000) continue;
+
+			render::PersistentSortedRenderItems persistent_render_items;
+			//Live items by handle index, used to build the expected result
+			std::vector<std::pair<bool, render::Item>> live_render_items(num_render_items, { false, render::Item() });
+			size_t num_removed_items = 0;
+			uint32_t random = 0x9E3779B9;
+			double apply_deltas_time = 0.0;
+			double full_sort_time = 0.0;
+
+			for (uint32_t frame = 0; frame < num_frames; ++frame)
+			{
+				//All the items are added the first frame, after that 1% of them changes each frame
+				//The same handle can change several times in one frame
+				deltas.clear();
+				const size_t num_deltas = (frame == 0) ? num_render_items : num_render_items / 100;
+				for (size_t i = 0; i < num_deltas; ++i)
+				{
+					const uint32_t handle_index = (frame == 0) ? static_cast<uint32_t>(i) : NextRandom(random) % static_cast<uint32_t>(num_render_items);
+					auto& live_render_item = live_render_items[handle_index];
+
+					render::PersistentRenderItemDelta delta;
+					delta.handle_index = handle_index;
+					delta.sequence = static_cast<uint32_t>(i);
+					delta.item = render::Item(static_cast<render::Priority>(NextRandom(random) % 8), (random >> 8) & 0xFFFF, handle_index);
+					if (!live_render_item.first)
+					{
+						delta.type = render::PersistentRenderItemDelta::Type::Add;
+						live_render_item = { true, delta.item };
+					}
+					else if (random % 4 == 0)
+					{
+						delta.type = render::PersistentRenderItemDelta::Type::Remove;
+						live_render_item.first = false;
+					}
+					else
+					{
+						delta.type = render::PersistentRenderItemDelta::Type::Update;
+						live_render_item.second = delta.item;
+					}
+					deltas.push_back(delta);
+				}
+				std::sort(deltas.begin(), deltas.end(),
+					[](const render::PersistentRenderItemDelta& a, const render::PersistentRenderItemDelta& b)
+					{
+						return (a.handle_index != b.handle_index) ? (a.handle_index < b.handle_index) : (a.sequence < b.sequence);
+					});
+
+				apply_deltas_time += Measure(1, [&]()
+					{
+						render::ApplyPersistentRenderItemDeltas(persistent_render_items, deltas, "PersistentRenderItemsBenchmark", num_removed_items,
+							[](render::Item& item)
+							{
+								//The render system moves the commands to the persistent command buffer
+								item.command_worker = 0xFF;
+							});
+					});
+
+				//Full sort of the live items, as if all of them were pushed each frame
+				expected_render_items.clear();
+				for (size_t handle_index = 0; handle_index < num_render_items; ++handle_index)
+				{
+					if (live_render_items[handle_index].first)
+					{
+						render::Item item = live_render_items[handle_index].second;
+						item.command_worker = 0xFF;
+						expected_render_items.push_back({ item, static_cast<uint32_t>(handle_index) });
+					}
+				}
+				full_sort_time += Measure(1, [&]()
+					{
+						std::sort(expected_render_items.begin(), expected_render_items.end(),
+							[](const render::PersistentSortedRenderItem& a, const render::PersistentSortedRenderItem& b)
+							{
+								return a.GetKey() < b.GetKey();
+							});
+					});
+
+				if (!std::equal(persistent_render_items.m_sorted_render_items.begin(), persistent_render_items.m_sorted_render_items.end(), expected_render_items.begin(), expected_render_items.end(),
+					[](const render::PersistentSortedRenderItem& a, const render::PersistentSortedRenderItem& b)
+					{
+						return a.GetKey() == b.GetKey() && a.item.data == b.item.data;
+					}))
+				{
+					core::LogError("Persistent render items with <%zu> items don't match the full sort in the frame <%u>", num_render_items, frame);
+				}
+			}
+
+			//Merge with the frame render items, the frame items go first with the same sort key
+			std::vector<render::Item> render_items;
+			for (size_t i = 0; i < num_render_items / 10; ++i)
+			{
+				render_items.emplace_back(static_cast<render::Priority>(NextRandom(random) % 8), (random >> 8) & 0xFFFF, static_cast<uint32_t>(i));
+			}
+			std::stable_sort(render_items.begin(), render_items.end(), [](const render::Item& a, const render::Item& b)
+				{
+					return a.full_32bit_sort_key < b.full_32bit_sort_key;
+				});
+
+			//Source of the item in the high bit of the data, the frame item data is small
+			constexpr uint32_t kPersistentBit = 0x80000000;
+			std::vector<render::Item> expected_merged_render_items = render_items;
+			for (auto& sorted_render_item : persistent_render_items.m_sorted_render_items)
+			{
+				render::Item item = sorted_render_item.item;
+				item.data |= kPersistentBit;
+				expected_merged_render_items.push_back(item);
+			}
+			std::stable_sort(expected_merged_render_items.begin(), expected_merged_render_items.end(), [](const render::Item& a, const render::Item& b)
+				{
+					return a.full_32bit_sort_key < b.full_32bit_sort_key;
+				});
+
+			std::vector<render::Item> merged_render_items;
+			render::VisitMergedRenderItems(render_items, 0, render_items.size(), persistent_render_items.m_sorted_render_items, 0, persistent_render_items.m_sorted_render_items.size(),
+				[&](const render::Item& item)
+				{
+					merged_render_items.push_back(item);
+				},
+				[&](const render::Item& item)
+				{
+					merged_render_items.push_back(item);
+					merged_render_items.back().data |= kPersistentBit;
+				});
+			if (!std::equal(merged_render_items.begin(), merged_render_items.end(), expected_merged_render_items.begin(), expected_merged_render_items.end(),
+				[](const render::Item& a, const render::Item& b)
+				{
+					return a.full_32bit_sort_key == b.full_32bit_sort_key && a.data == b.data;
+				}))
+			{
+				core::LogError("Merge of the frame and persistent render items with <%zu> items doesn't match the full sort", num_render_items);
+			}
+
+			core::LogInfo("Persistent render items benchmark <%zu> items, <%u> frames: apply deltas %.3fms, full sort %.3fms", num_render_items, num_frames, apply_deltas_time / 1000.0, full_sort_time / 1000.0);
+		}
+	}
+}
@@ -11,6 +11,9 @@
 #include <job/job.h>
 #include <core/platform.h>
 #include <core/fast_map.h>
+#include <core/simd_fast_map.h>
+#include <core/sync.h>
+#include "render_item_sort.h"
 
 namespace render
 {
@@ -33,6 +36,24 @@ namespace render
 		Buffer
 	};
 
+	//Persistent render items of a point of view, kept sorted between frames
+	//Only the deltas pushed by the game are applied each frame
+	struct PersistentRenderItems : PersistentSortedRenderItems
+	{
+		//Command worker used in the items that execute commands from the persistent command buffer
+		static constexpr uint32_t kCommandWorker = 0xFF;
+
+		//Index access to the sorted render items by priority (begin item and end item)
+		std::vector<std::pair<size_t, size_t>> m_priority_table;
+		//Commands of the persistent items, they are compiled when added and replayed each frame without decoding
+		CompiledCommandBuffer m_command_buffer;
+		//Number of items removed since the last compaction of the command buffer
+		size_t m_num_removed_commands = 0;
+
+		//Temporal buffer used during the delta update
+		std::vector<PersistentRenderItemDelta> m_deltas;
+	};
+
 	class RenderContextInternal : public RenderContext
 	{
 	public:
@@ -163,8 +184,8 @@ namespace render
 			}
 		};
 
-		using ResourceMap = core::FastMap<ResourceName, std::unique_ptr<ResourceInfo>>;
-		using PassMap = core::FastMap<PassName, std::unique_ptr<Pass>>;
+		using ResourceMap = core::SIMDFastMap<ResourceName, std::unique_ptr<ResourceInfo>>;
+		using PassMap = core::SIMDFastMap<PassName, std::unique_ptr<Pass>>;
 		using GroupPassMap = core::FastMap<GroupPassName, std::vector<PassName>>;
 
 		//Gobal resources
@@ -177,7 +198,7 @@ namespace render
 		GroupPassMap m_group_passes_map;
 
 		//List of modules
-		core::FastMap<ModuleName, std::unique_ptr<Module>> m_modules;
+		core::SIMDFastMap<ModuleName, std::unique_ptr<Module>> m_modules;
 
 		//Buffer of all the render frame data
 		//Two buffers, one in the render and other in the game, that allows to render and prepare the next frame at the same time
@@ -225,6 +246,16 @@ namespace render
 
 		bool m_parallel_sort_render_items = true;
 		uint32_t m_parallel_sort_render_item_min_count = 1000;
+		bool m_radix_sort_render_items = true;
+		bool m_parallel_sort_point_of_views = true;
+
+		//Persistent render items for each point of view, key is point of view name and id
+		std::unordered_map<uint64_t, std::unique_ptr<PersistentRenderItems>> m_persistent_render_items;
+
+		//Free list of persistent render item handles
+		std::vector<uint32_t> m_free_persistent_render_item_handles;
+		uint32_t m_num_persistent_render_item_handles = 0;
+		core::Mutex m_persistent_render_item_handles_mutex;
 
 		//Create render context
 		RenderContextInternal * CreateRenderContext(display::Device * device, const PassName& pass, const uint16_t pass_id, const PassInfo& pass_info, std::vector<std::string>& errors);
@@ -259,6 +290,12 @@ namespace render
 		//Get Between frames cached render context
 		RenderContextInternal* GetCachedRenderContext(const PassName& pass_name, uint16_t id, const PassInfo& pass_info);
 
+		//Sort the render items of a point of view and build the priority table
+		void SortRenderItems(PointOfView& point_of_view);
+
+		//Apply the persistent render item changes pushed during the frame
+		void UpdatePersistentRenderItems(PointOfView& point_of_view);
+
 		//Submit render
 		void SubmitRender();
 	};
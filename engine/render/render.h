@@ -182,6 +182,12 @@ namespace render
 	//Only can be called from the game thread, between begin and end prepare frame
 	Frame& GetGameRenderFrame(System* system);
 
+	//Alloc a handle for a persistent render item, it can be used in any point of view
+	PersistentRenderItemHandle AllocPersistentRenderItemHandle(System* system);
+
+	//Free a persistent render item handle, the item needs to be removed from the point of view first
+	void FreePersistentRenderItemHandle(System* system, PersistentRenderItemHandle& handle);
+
 	//Get the index of the priority for a priority name
 	Priority GetRenderItemPriority(System* system, const PriorityName priority_name);
 
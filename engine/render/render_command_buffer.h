@@ -6,9 +6,63 @@
 
 #include <display/display.h>
 #include <core/command_buffer.h>
+#include <variant>
+#include <vector>
 
 namespace render
 {
+	//Tracks the state set in the display context during the execution of commands
+	//Binds that are already set in the display context are skipped, it can be shared between the execution of several render items
+	class StateCache
+	{
+	public:
+		//The state of the display context is unknown, all the binds need to be issued again
+		void Invalidate();
+
+		//Resources got updated, constant buffers, descriptor tables and index buffer need to be issued again
+		void InvalidateResourceBinds();
+
+		//Each function returns true if the bind needs to be issued to the display context
+		bool SetPipelineState(const display::WeakPipelineStateHandle& pipeline_state);
+		bool SetIndexBuffer(const display::WeakBufferHandle& index_buffer);
+		bool SetConstantBuffer(const display::Pipe& pipe, uint8_t root_parameter, const display::WeakBufferHandle& constant_buffer);
+		bool SetDescriptorTable(const display::Pipe& pipe, uint8_t root_parameter, const display::WeakDescriptorTableHandle& descriptor_table);
+		bool SetDescriptorTable(const display::Pipe& pipe, uint8_t root_parameter, const display::WeakSamplerDescriptorTableHandle& sampler_descriptor_table);
+
+		//Add the number of issued and skipped binds to the render counters and reset them
+		void FlushStats();
+
+	private:
+		//Root parameters over this index are not tracked, always issued
+		static constexpr size_t kMaxRootParameters = 16;
+
+		struct RootParameter
+		{
+			enum class Type : uint8_t
+			{
+				None,
+				ConstantBuffer,
+				DescriptorTable,
+				SamplerDescriptorTable
+			};
+			Type type = Type::None;
+			display::WeakBufferHandle constant_buffer;
+			display::WeakDescriptorTableHandle descriptor_table;
+			display::WeakSamplerDescriptorTableHandle sampler_descriptor_table;
+		};
+
+		//Returns true if the bind needs to be issued, updates the stats
+		bool Issue(bool redundant);
+
+		display::WeakPipelineStateHandle m_pipeline_state;
+		display::WeakBufferHandle m_index_buffer;
+		RootParameter m_root_parameters[2][kMaxRootParameters];
+
+		//Stats, they are added to the counters during the flush
+		uint32_t m_num_issued_binds = 0;
+		uint32_t m_num_skipped_binds = 0;
+	};
+
 	class CommandBuffer : public core::CommandBuffer<uint8_t>
 	{
 	public:
@@ -54,7 +108,8 @@ namespace render
 
 		//Execute commands in this offset
 		//Returns the offset of the next command in the render command, InvalidCommandOffset if it is the last
-		CommandOffset Execute(display::Context& context, CommandOffset command_offset = 0);
+		//Redundant binds are filtered with the state cache, without state cache only inside this execution
+		CommandOffset Execute(display::Context& context, CommandOffset command_offset = 0, StateCache* state_cache = nullptr);
 
 		//Set pipeline state
 		void SetPipelineState(const display::WeakPipelineStateHandle& pipeline_state);
@@ -90,6 +145,88 @@ namespace render
 		//If data is null, returns an internal buffer where the memory can get copied
 		void* UploadResourceBuffer(const display::UpdatableResourceHandle& handle, const void* data, size_t size);
 	};
+
+	//Commands of a static range of a command buffer, decoded only once
+	//Executing them doesn't need to decode the command buffer again, each command is already a resolved display call
+	class CompiledCommandBuffer
+	{
+	public:
+		using CommandOffset = CommandBuffer::CommandOffset;
+
+		//Decode the commands captured in the offset of the source command buffer
+		//Returns the offset of the compiled commands
+		CommandOffset Compile(CommandBuffer& source, CommandOffset command_offset);
+
+		//Copy the compiled commands in the offset of the source compiled command buffer
+		//Returns the offset of the copied commands
+		CommandOffset CopyCommands(const CompiledCommandBuffer& source, CommandOffset command_offset);
+
+		//Execute compiled commands in this offset
+		//Redundant binds are filtered with the state cache, without state cache only inside this execution
+		void Execute(display::Context& context, CommandOffset command_offset, StateCache* state_cache = nullptr) const;
+
+		//Clear all the compiled commands
+		void Reset();
+
+		//Number of compiled commands
+		size_t GetNumCommands() const
+		{
+			return m_commands.size();
+		}
+
+	private:
+		struct Close
+		{
+		};
+		struct SetPipelineState
+		{
+			display::WeakPipelineStateHandle pipeline_state;
+		};
+		struct SetVertexBuffers
+		{
+			uint8_t start_slot_index;
+			uint8_t num_vertex_buffers;
+			uint32_t vertex_buffers_offset;
+		};
+		struct SetIndexBuffer
+		{
+			display::WeakBufferHandle index_buffer;
+		};
+		struct SetConstantBuffer
+		{
+			display::Pipe pipe;
+			uint8_t root_parameter;
+			display::WeakBufferHandle constant_buffer;
+		};
+		struct SetDescriptorTable
+		{
+			display::Pipe pipe;
+			uint8_t root_parameter;
+			display::WeakDescriptorTableHandle descriptor_table;
+		};
+		struct SetSamplerDescriptorTable
+		{
+			display::Pipe pipe;
+			uint8_t root_parameter;
+			display::WeakSamplerDescriptorTableHandle sampler_descriptor_table;
+		};
+		struct UploadResourceBuffer
+		{
+			display::UpdatableResourceHandle handle;
+			uint32_t data_offset;
+			uint32_t size;
+		};
+
+		using Command = std::variant<Close, SetPipelineState, SetVertexBuffers, SetIndexBuffer, SetConstantBuffer, SetDescriptorTable, SetSamplerDescriptorTable,
+			display::DrawDesc, display::DrawIndexedDesc, display::DrawIndexedInstancedDesc, display::ExecuteComputeDesc, UploadResourceBuffer>;
+
+		//Compiled commands, each range ends with a close command
+		std::vector<Command> m_commands;
+		//Vertex buffers used by the SetVertexBuffers commands
+		std::vector<display::WeakBufferHandle> m_vertex_buffers;
+		//Data used by the UploadResourceBuffer commands
+		std::vector<std::byte> m_upload_data;
+	};
 }
 
 #endif //RENDER_COMMAND_BUFFER_h
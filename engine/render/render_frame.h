@@ -7,6 +7,8 @@
 #include <render/render_common.h>
 #include <render/render_command_buffer.h>
 #include <list>
+#include <atomic>
+#include <job/job.h>
 #include <job/job_helper.h>
 
 namespace render
@@ -61,6 +63,39 @@ namespace render
 		}
 	};
 
+	//Handle of a persistent render item, allocated from the render system
+	struct PersistentRenderItemHandle
+	{
+		static constexpr uint32_t kInvalid = static_cast<uint32_t>(-1);
+
+		uint32_t index = kInvalid;
+
+		bool IsValid() const
+		{
+			return index != kInvalid;
+		}
+	};
+
+	//Change in a persistent render item, pushed from the game and applied by the render system
+	struct PersistentRenderItemDelta
+	{
+		enum class Type : uint8_t
+		{
+			Add,
+			Update,
+			Remove
+		};
+
+		Item item;
+		uint32_t handle_index;
+		//Order in which the game pushed the delta, it doesn't depend on the worker that pushed it
+		uint32_t sequence;
+		Type type;
+	};
+
+	//Persistent render items of a point of view, owned by the render system
+	struct PersistentRenderItems;
+
 	//Sorted render items
 	struct SortedRenderItems
 	{
@@ -97,6 +132,28 @@ namespace render
 			return m_command_buffer.Get();
 		}
 
+		//Persistent render items are kept sorted by the render system between frames, only the changes needs to be pushed
+		//The commands are captured in the point of view command buffer, the render system keeps a copy of them
+		void AddPersistentRenderItem(const PersistentRenderItemHandle& handle, Priority priority, SortKey sort_key, const CommandBuffer::CommandOffset& command_offset)
+		{
+			assert(handle.IsValid());
+			assert(sort_key < (1 << 24));
+			m_persistent_render_item_deltas.Get().push_back({ Item(priority, sort_key, command_offset), handle.index, NextPersistentRenderItemSequence(), PersistentRenderItemDelta::Type::Add });
+		}
+
+		void UpdatePersistentRenderItem(const PersistentRenderItemHandle& handle, Priority priority, SortKey sort_key, const CommandBuffer::CommandOffset& command_offset)
+		{
+			assert(handle.IsValid());
+			assert(sort_key < (1 << 24));
+			m_persistent_render_item_deltas.Get().push_back({ Item(priority, sort_key, command_offset), handle.index, NextPersistentRenderItemSequence(), PersistentRenderItemDelta::Type::Update });
+		}
+
+		void RemovePersistentRenderItem(const PersistentRenderItemHandle& handle)
+		{
+			assert(handle.IsValid());
+			m_persistent_render_item_deltas.Get().push_back({ Item(), handle.index, NextPersistentRenderItemSequence(), PersistentRenderItemDelta::Type::Remove });
+		}
+
 		//Reset memory for next frame
 		void Reset();
 
@@ -114,6 +171,10 @@ namespace render
 		};
 
 	private:
+		uint32_t NextPersistentRenderItemSequence()
+		{
+			return m_persistent_render_item_sequence.fetch_add(1, std::memory_order_relaxed);
+		}
 		
 		//Point of view name, used for identification
 		PointOfViewName m_name;
@@ -130,6 +191,19 @@ namespace render
 		//Sorted render items associated (updated by the render system)
 		SortedRenderItems m_sorted_render_items;
 
+		//Temporal buffer used during the sorting of the render items
+		std::vector<Item> m_temp_render_items;
+
+		//Fence for the sort job of the render items
+		job::Fence m_sorted_render_items_fence;
+
+		//Changes in the persistent render items during this frame
+		job::ThreadData<std::vector<PersistentRenderItemDelta>> m_persistent_render_item_deltas;
+		std::atomic<uint32_t> m_persistent_render_item_sequence = 0;
+
+		//Persistent render items associated (updated by the render system)
+		PersistentRenderItems* m_persistent_render_items = nullptr;
+
 		//Custom data associated to this point of view
 		std::unique_ptr<std::byte[]> m_data;
 
@@ -221,6 +295,12 @@ namespace render
 		{
 			data.Reset();
 		});
+		m_persistent_render_item_deltas.Visit([](auto& data)
+		{
+			data.clear();
+		});
+		m_persistent_render_item_sequence = 0;
+		m_persistent_render_items = nullptr;
 		
 		m_allocated = false;
 	}
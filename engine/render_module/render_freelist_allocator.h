@@ -8,6 +8,7 @@
 #include <core/log.h>
 #include <job/job_helper.h>
 #include <core/sync.h>
+#include <core/concurrent_handle_pool.h>
 #include <vector>
 #include <utility>
 
@@ -101,7 +102,7 @@ namespace render
 		size_t m_resource_size;
 
 		//Handle pool of allocated blocks
-		core::HandlePool<AllocHandle> m_handle_pool;
+		core::ConcurrentHandlePool<AllocHandle> m_handle_pool;
 
 		static constexpr uint32_t kInvalidFreeBlock = static_cast<uint32_t>(-1);
 		struct FreeListFreeAllocation